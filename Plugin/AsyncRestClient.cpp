@@ -0,0 +1,467 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "AsyncRestClient.h"
+
+#include "JsonWriter.h"
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <algorithm>
+
+
+bool AsyncRestClient::Future::Wait(const boost::posix_time::ptime& deadline) const
+{
+  if (state_.get() == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+  }
+
+  boost::mutex::scoped_lock lock(state_->mutex_);
+
+  while (state_->status_ == Status_Pending ||
+         state_->status_ == Status_Running)
+  {
+    if (!state_->done_.timed_wait(lock, deadline) &&
+        (state_->status_ == Status_Pending ||
+         state_->status_ == Status_Running))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+AsyncRestClient::Status AsyncRestClient::Future::GetStatus() const
+{
+  if (state_.get() == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+  }
+
+  boost::mutex::scoped_lock lock(state_->mutex_);
+  return state_->status_;
+}
+
+
+void AsyncRestClient::Future::Cancel()
+{
+  if (state_.get() == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+  }
+
+  {
+    boost::mutex::scoped_lock lock(state_->mutex_);
+
+    if (state_->status_ != Status_Pending)
+    {
+      return;
+    }
+
+    state_->status_ = Status_Cancelled;
+  }
+
+  state_->done_.notify_all();
+}
+
+
+bool AsyncRestClient::Future::IsFound() const
+{
+  GetAnswer();  // checks the status
+  return state_->found_;
+}
+
+
+const Json::Value& AsyncRestClient::Future::GetAnswer() const
+{
+  if (state_.get() == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+  }
+
+  boost::mutex::scoped_lock lock(state_->mutex_);
+
+  switch (state_->status_)
+  {
+    case Status_Success:
+      return state_->answer_;  // not modified anymore once the call is complete
+
+    case Status_Failure:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Internal REST call has failed: " + state_->uri_ + " (" + state_->error_ + ")");
+
+    case Status_Cancelled:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Timeout, "Internal REST call has been cancelled: " + state_->uri_);
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "Internal REST call is not complete: " + state_->uri_);
+  }
+}
+
+
+AsyncRestClient::AsyncRestClient() :
+  threadsCount_(4),
+  defaultTimeout_(boost::posix_time::seconds(30)),
+  stopped_(true)
+{
+}
+
+
+AsyncRestClient::~AsyncRestClient()
+{
+  if (!stopped_)
+  {
+    LOG(ERROR) << "AsyncRestClient::Stop() should have been called";
+  }
+}
+
+
+void AsyncRestClient::Configure(const Json::Value& configuration)
+{
+  if (configuration.isObject())
+  {
+    threadsCount_ = std::max(1u, configuration["ThreadsCount"].asUInt());
+    defaultTimeout_ = boost::posix_time::milliseconds(configuration["Timeout"].asUInt());
+  }
+}
+
+
+void AsyncRestClient::Start()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (!stopped_)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+  }
+
+  stopped_ = false;
+
+  for (unsigned int i = 0; i < threadsCount_; i++)
+  {
+    threads_.push_back(new boost::thread(&AsyncRestClient::Worker, this));
+  }
+}
+
+
+void AsyncRestClient::Stop()
+{
+  std::deque<boost::shared_ptr<State> > pending;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (stopped_)
+    {
+      return;
+    }
+
+    stopped_ = true;
+    pending.swap(queue_);
+  }
+
+  requestAvailable_.notify_all();
+
+  for (size_t i = 0; i < pending.size(); i++)
+  {
+    Future(pending[i]).Cancel();
+  }
+
+  for (size_t i = 0; i < threads_.size(); i++)
+  {
+    if (threads_[i]->joinable())
+    {
+      threads_[i]->join();
+    }
+
+    delete threads_[i];
+  }
+
+  threads_.clear();
+}
+
+
+boost::posix_time::ptime AsyncRestClient::GetDefaultDeadline() const
+{
+  return boost::posix_time::microsec_clock::universal_time() + defaultTimeout_;
+}
+
+
+void AsyncRestClient::Execute(State& state)
+{
+  bool found = false;
+  Json::Value answer;
+  std::string error;
+  bool success = false;
+
+  try
+  {
+    if (state.method_ == OrthancPluginHttpMethod_Post)
+    {
+      found = OrthancPlugins::RestApiPost(answer, state.uri_, state.body_.c_str(), state.body_.size(), state.applyPlugins_);
+    }
+    else if (state.method_ != OrthancPluginHttpMethod_Get)
+    {
+      found = CallWithHeaders(answer, state.method_, state.uri_, state.body_, state.headers_, state.applyPlugins_);
+    }
+    else if (state.headers_.empty())
+    {
+      found = OrthancPlugins::RestApiGet(answer, state.uri_, state.applyPlugins_);
+    }
+    else
+    {
+      found = OrthancPlugins::RestApiGet(answer, state.uri_, state.headers_, state.applyPlugins_);
+    }
+
+    success = true;
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    error = e.What();
+  }
+  catch (std::exception& e)
+  {
+    error = e.what();
+  }
+
+  {
+    boost::mutex::scoped_lock lock(state.mutex_);
+    state.status_ = (success ? Status_Success : Status_Failure);
+    state.found_ = found;
+    state.answer_.swap(answer);
+    state.error_ = error;
+  }
+
+  state.done_.notify_all();
+}
+
+
+void AsyncRestClient::Worker()
+{
+  for (;;)
+  {
+    boost::shared_ptr<State> state;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      while (!stopped_ && queue_.empty())
+      {
+        requestAvailable_.wait(lock);
+      }
+
+      if (stopped_)
+      {
+        return;
+      }
+
+      state = queue_.front();
+      queue_.pop_front();
+    }
+
+    {
+      boost::mutex::scoped_lock lock(state->mutex_);
+
+      if (state->status_ != Status_Pending)
+      {
+        continue;  // cancelled
+      }
+
+      if (boost::posix_time::microsec_clock::universal_time() > state->deadline_)
+      {
+        // nobody is waiting for the result anymore
+        state->status_ = Status_Cancelled;
+        lock.unlock();
+        state->done_.notify_all();
+        continue;
+      }
+
+      state->status_ = Status_Running;
+    }
+
+    Execute(*state);
+  }
+}
+
+
+AsyncRestClient::Future AsyncRestClient::Submit(const boost::shared_ptr<State>& state)
+{
+  state->deadline_ = GetDefaultDeadline();
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (stopped_)
+    {
+      // e.g. while Orthanc is stopping: the call is performed synchronously
+      lock.unlock();
+      state->status_ = Status_Running;
+      Execute(*state);
+      return Future(state);
+    }
+
+    queue_.push_back(state);
+  }
+
+  requestAvailable_.notify_one();
+  return Future(state);
+}
+
+
+AsyncRestClient::Future AsyncRestClient::Get(const std::string& uri,
+                                             const std::map<std::string, std::string>& headers,
+                                             bool applyPlugins)
+{
+  boost::shared_ptr<State> state(new State);
+  state->uri_ = uri;
+  state->headers_ = headers;
+  state->applyPlugins_ = applyPlugins;
+  return Submit(state);
+}
+
+
+AsyncRestClient::Future AsyncRestClient::Get(const std::string& uri,
+                                             bool applyPlugins)
+{
+  return Get(uri, std::map<std::string, std::string>(), applyPlugins);
+}
+
+
+AsyncRestClient::Future AsyncRestClient::Post(const std::string& uri,
+                                              const Json::Value& body,
+                                              bool applyPlugins)
+{
+  boost::shared_ptr<State> state(new State);
+  state->method_ = OrthancPluginHttpMethod_Post;
+  state->uri_ = uri;
+  state->applyPlugins_ = applyPlugins;
+
+  JsonWriter writer(state->body_);
+  writer.WriteValue(body);
+
+  return Submit(state);
+}
+
+
+AsyncRestClient::Future AsyncRestClient::Put(const std::string& uri,
+                                             const std::string& body,
+                                             const std::map<std::string, std::string>& headers,
+                                             bool applyPlugins)
+{
+  boost::shared_ptr<State> state(new State);
+  state->method_ = OrthancPluginHttpMethod_Put;
+  state->uri_ = uri;
+  state->body_ = body;
+  state->headers_ = headers;
+  state->applyPlugins_ = applyPlugins;
+  return Submit(state);
+}
+
+
+AsyncRestClient::Future AsyncRestClient::Delete(const std::string& uri,
+                                                const std::map<std::string, std::string>& headers,
+                                                bool applyPlugins)
+{
+  boost::shared_ptr<State> state(new State);
+  state->method_ = OrthancPluginHttpMethod_Delete;
+  state->uri_ = uri;
+  state->headers_ = headers;
+  state->applyPlugins_ = applyPlugins;
+  return Submit(state);
+}
+
+
+bool AsyncRestClient::CallWithHeaders(Json::Value& answer,
+                                      OrthancPluginHttpMethod method,
+                                      const std::string& uri,
+                                      const std::string& body,
+                                      const std::map<std::string, std::string>& headers,
+                                      bool applyPlugins)
+{
+  std::vector<const char*> headersKeys;
+  std::vector<const char*> headersValues;
+
+  for (std::map<std::string, std::string>::const_iterator it = headers.begin(); it != headers.end(); ++it)
+  {
+    headersKeys.push_back(it->first.c_str());
+    headersValues.push_back(it->second.c_str());
+  }
+
+  OrthancPlugins::MemoryBuffer answerBody;
+  OrthancPlugins::MemoryBuffer answerHeaders;
+  uint16_t httpStatus = 0;
+
+  OrthancPluginErrorCode code = OrthancPluginCallRestApi(OrthancPlugins::GetGlobalContext(),
+                                                         *answerBody, *answerHeaders, &httpStatus, method, uri.c_str(),
+                                                         static_cast<uint32_t>(headersKeys.size()),
+                                                         headersKeys.empty() ? NULL : &headersKeys[0],
+                                                         headersValues.empty() ? NULL : &headersValues[0],
+                                                         body.empty() ? NULL : body.c_str(), body.size(),
+                                                         applyPlugins ? 1 : 0);
+
+  if (code != OrthancPluginErrorCode_Success)
+  {
+    // the buffers are not filled on failure
+    (*answerBody)->data = NULL;
+    (*answerBody)->size = 0;
+    (*answerHeaders)->data = NULL;
+    (*answerHeaders)->size = 0;
+    return false;
+  }
+
+  // e.g. 403 from the authorization plugin
+  if (httpStatus < 200 || httpStatus >= 300)
+  {
+    return false;
+  }
+
+  answer = Json::nullValue;
+
+  if (!answerBody.IsEmpty())
+  {
+    answerBody.ToJson(answer);
+  }
+
+  return true;
+}
+
+
+bool AsyncRestClient::WaitAll(std::vector<Future>& futures,
+                              const boost::posix_time::ptime& deadline)
+{
+  bool complete = true;
+
+  for (size_t i = 0; i < futures.size(); i++)
+  {
+    if (!futures[i].Wait(deadline))
+    {
+      futures[i].Cancel();
+      complete = false;
+    }
+  }
+
+  return complete;
+}
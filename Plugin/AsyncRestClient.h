@@ -0,0 +1,175 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <json/value.h>
+#include <orthanc/OrthancCPlugin.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+
+// Asynchronous facade over the synchronous calls to the Orthanc REST API (OrthancPlugins::RestApiGet/Post), so that
+// a route can issue its internal sub-requests concurrently and only wait for the slowest one.  The calls are executed
+// by a bounded pool of threads that is distinct from the TaskExecutor, so that a background task can wait for
+// futures without starving its own pool.
+class AsyncRestClient : public boost::noncopyable
+{
+public:
+  enum Status
+  {
+    Status_Pending,
+    Status_Running,
+    Status_Success,    // the call has been performed (see Future::IsFound())
+    Status_Failure,    // the call has thrown an exception
+    Status_Cancelled   // cancelled or timed out before it has started
+  };
+
+private:
+  struct State : public boost::noncopyable
+  {
+    boost::mutex                        mutex_;
+    boost::condition_variable           done_;
+    Status                              status_;
+    OrthancPluginHttpMethod             method_;
+    std::string                         uri_;
+    std::string                         body_;
+    std::map<std::string, std::string>  headers_;
+    bool                                applyPlugins_;
+    boost::posix_time::ptime            deadline_;
+    bool                                found_;
+    Json::Value                         answer_;
+    std::string                         error_;
+
+    State() :
+      status_(Status_Pending),
+      method_(OrthancPluginHttpMethod_Get),
+      applyPlugins_(false),
+      found_(false)
+    {
+    }
+  };
+
+public:
+  class Future
+  {
+  private:
+    boost::shared_ptr<State>  state_;
+
+  public:
+    Future()
+    {
+    }
+
+    explicit Future(const boost::shared_ptr<State>& state) :
+      state_(state)
+    {
+    }
+
+    // returns false if the call is not complete once the deadline is reached
+    bool Wait(const boost::posix_time::ptime& deadline) const;
+
+    Status GetStatus() const;
+
+    // the call has not started yet -> it will never be executed.  A running call can not be interrupted.
+    void Cancel();
+
+    // throws if the call has failed, has been cancelled or is not complete
+    bool IsFound() const;
+
+    // throws if the call has failed, has been cancelled or is not complete
+    const Json::Value& GetAnswer() const;
+  };
+
+private:
+  unsigned int                              threadsCount_;
+  boost::posix_time::time_duration          defaultTimeout_;
+  boost::mutex                              mutex_;
+  boost::condition_variable                 requestAvailable_;
+  std::deque<boost::shared_ptr<State> >     queue_;
+  std::vector<boost::thread*>               threads_;
+  bool                                      stopped_;
+
+  Future Submit(const boost::shared_ptr<State>& state);
+
+  static void Execute(State& state);
+
+  void Worker();
+
+public:
+  AsyncRestClient();
+
+  ~AsyncRestClient();
+
+  // to call before Start()
+  void Configure(const Json::Value& configuration);
+
+  void Start();
+
+  // the pending calls are cancelled and the running calls are awaited
+  void Stop();
+
+  boost::posix_time::ptime GetDefaultDeadline() const;
+
+  Future Get(const std::string& uri,
+             const std::map<std::string, std::string>& headers,
+             bool applyPlugins);
+
+  Future Get(const std::string& uri,
+             bool applyPlugins);
+
+  Future Post(const std::string& uri,
+              const Json::Value& body,
+              bool applyPlugins);
+
+  // the future is "found" if the call has been accepted (2xx status)
+  Future Put(const std::string& uri,
+             const std::string& body,
+             const std::map<std::string, std::string>& headers,
+             bool applyPlugins);
+
+  Future Delete(const std::string& uri,
+                const std::map<std::string, std::string>& headers,
+                bool applyPlugins);
+
+  // Synchronous call with the given headers, e.g. to let the authorization plugin check them (the C++ wrapper only
+  // forwards the headers in GET and POST).  Returns false if the call has been rejected (status other than 2xx).
+  static bool CallWithHeaders(Json::Value& answer,
+                              OrthancPluginHttpMethod method,
+                              const std::string& uri,
+                              const std::string& body,
+                              const std::map<std::string, std::string>& headers,
+                              bool applyPlugins);
+
+  // waits for all the futures ("when_all"), the calls that are not complete at the deadline are cancelled.
+  // Returns false if some calls have not completed.
+  static bool WaitAll(std::vector<Future>& futures,
+                      const boost::posix_time::ptime& deadline);
+};
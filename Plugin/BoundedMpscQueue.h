@@ -0,0 +1,113 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+
+#include <atomic>
+#include <stdint.h>
+
+
+// Bounded lock-free queue with multiple producers and a single consumer (D. Vyukov's algorithm).
+// Each slot carries a sequence number that tells whether it is ready to be written or read.
+template <typename T>
+class BoundedMpscQueue : public boost::noncopyable
+{
+private:
+  struct Slot
+  {
+    std::atomic<size_t>  sequence_;
+    T                    value_;
+  };
+
+  boost::scoped_array<Slot>  slots_;
+  size_t                     mask_;
+  std::atomic<size_t>        enqueuePosition_;
+  size_t                     dequeuePosition_;  // only accessed by the consumer
+
+public:
+  // 'capacity' must be a power of 2
+  explicit BoundedMpscQueue(size_t capacity) :
+    slots_(new Slot[capacity]),
+    mask_(capacity - 1),
+    enqueuePosition_(0),
+    dequeuePosition_(0)
+  {
+    for (size_t i = 0; i < capacity; i++)
+    {
+      slots_[i].sequence_.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // returns false if the queue is full, never blocks
+  bool TryEnqueue(const T& value)
+  {
+    Slot* slot = NULL;
+    size_t position = enqueuePosition_.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+      slot = &slots_[position & mask_];
+      size_t sequence = slot->sequence_.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+      if (diff == 0)
+      {
+        if (enqueuePosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+        {
+          break;
+        }
+      }
+      else if (diff < 0)
+      {
+        return false;  // full
+      }
+      else
+      {
+        position = enqueuePosition_.load(std::memory_order_relaxed);  // another producer has taken this slot
+      }
+    }
+
+    slot->value_ = value;
+    slot->sequence_.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  // must only be called from the consumer thread
+  bool TryDequeue(T& value)
+  {
+    Slot& slot = slots_[dequeuePosition_ & mask_];
+    size_t sequence = slot.sequence_.load(std::memory_order_acquire);
+
+    if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(dequeuePosition_ + 1) < 0)
+    {
+      return false;  // empty
+    }
+
+    value = slot.value_;
+    slot.sequence_.store(dequeuePosition_ + mask_ + 1, std::memory_order_release);
+    dequeuePosition_++;
+    return true;
+  }
+};
@@ -0,0 +1,309 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "CborWriter.h"
+
+#include <OrthancException.h>
+
+#include <string.h>
+
+
+void CborWriter::WriteHead(uint8_t majorType,
+                           uint64_t value)
+{
+  const uint8_t type = static_cast<uint8_t>(majorType << 5);
+
+  if (value < 24)
+  {
+    target_.push_back(static_cast<char>(type | value));
+  }
+  else if (value <= 0xffu)
+  {
+    target_.push_back(static_cast<char>(type | 24));
+    target_.push_back(static_cast<char>(value));
+  }
+  else if (value <= 0xffffu)
+  {
+    target_.push_back(static_cast<char>(type | 25));
+    target_.push_back(static_cast<char>(value >> 8));
+    target_.push_back(static_cast<char>(value));
+  }
+  else if (value <= 0xffffffffu)
+  {
+    target_.push_back(static_cast<char>(type | 26));
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+      target_.push_back(static_cast<char>(value >> shift));
+    }
+  }
+  else
+  {
+    target_.push_back(static_cast<char>(type | 27));
+    for (int shift = 56; shift >= 0; shift -= 8)
+    {
+      target_.push_back(static_cast<char>(value >> shift));
+    }
+  }
+}
+
+
+void CborWriter::WriteUnsigned(uint64_t value)
+{
+  WriteHead(0, value);
+}
+
+
+void CborWriter::WriteInteger(int64_t value)
+{
+  if (value >= 0)
+  {
+    WriteHead(0, static_cast<uint64_t>(value));
+  }
+  else
+  {
+    // major type 1 encodes "-1 - n"
+    WriteHead(1, static_cast<uint64_t>(-(value + 1)));
+  }
+}
+
+
+void CborWriter::WriteDouble(double value)
+{
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  target_.push_back(static_cast<char>(0xfb));
+  for (int shift = 56; shift >= 0; shift -= 8)
+  {
+    target_.push_back(static_cast<char>(bits >> shift));
+  }
+}
+
+
+void CborWriter::WriteString(const std::string& value)
+{
+  WriteHead(3, value.size());
+  target_.append(value);
+}
+
+
+void CborWriter::WriteBoolean(bool value)
+{
+  target_.push_back(static_cast<char>(value ? 0xf5 : 0xf4));
+}
+
+
+void CborWriter::WriteNull()
+{
+  target_.push_back(static_cast<char>(0xf6));
+}
+
+
+void CborWriter::WriteUndefined()
+{
+  target_.push_back(static_cast<char>(0xf7));
+}
+
+
+void CborWriter::StartArray(uint64_t size)
+{
+  WriteHead(4, size);
+}
+
+
+void CborWriter::StartMap(uint64_t size)
+{
+  WriteHead(5, size);
+}
+
+
+void CborWriter::WriteTag(uint64_t tag)
+{
+  WriteHead(6, tag);
+}
+
+
+uint64_t CompactJsonEncoder::GetKeyIndex(const std::string& key)
+{
+  KeysDictionary::const_iterator found = keys_.find(key);
+
+  if (found != keys_.end())
+  {
+    return found->second;
+  }
+  else
+  {
+    uint64_t index = orderedKeys_.size();
+    keys_[key] = index;
+    orderedKeys_.push_back(key);
+    return index;
+  }
+}
+
+
+static bool IsArrayOfObjects(const Json::Value& value)
+{
+  if (!value.isArray() || value.size() < 2)
+  {
+    return false;  // a columnar layout is useless for a single row
+  }
+
+  for (Json::Value::ArrayIndex i = 0; i < value.size(); i++)
+  {
+    if (!value[i].isObject())
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+void CompactJsonEncoder::EncodeColumnar(const Json::Value& rows)
+{
+  // the columns are the union of the keys of all the rows, in their order of appearance
+  std::vector<std::string> columns;
+  std::map<std::string, size_t> columnsIndex;
+
+  for (Json::Value::ArrayIndex i = 0; i < rows.size(); i++)
+  {
+    for (Json::Value::const_iterator it = rows[i].begin(); it != rows[i].end(); ++it)
+    {
+      const std::string key = it.name();
+      if (columnsIndex.find(key) == columnsIndex.end())
+      {
+        columnsIndex[key] = columns.size();
+        columns.push_back(key);
+      }
+    }
+  }
+
+  writer_.WriteTag(COLUMNAR_TAG);
+  writer_.StartArray(rows.size() + 1);
+
+  writer_.StartArray(columns.size());
+  for (size_t i = 0; i < columns.size(); i++)
+  {
+    writer_.WriteUnsigned(GetKeyIndex(columns[i]));
+  }
+
+  for (Json::Value::ArrayIndex i = 0; i < rows.size(); i++)
+  {
+    writer_.StartArray(columns.size());
+
+    for (size_t j = 0; j < columns.size(); j++)
+    {
+      if (rows[i].isMember(columns[j]))
+      {
+        EncodeValue(rows[i][columns[j]]);
+      }
+      else
+      {
+        writer_.WriteUndefined();
+      }
+    }
+  }
+}
+
+
+void CompactJsonEncoder::EncodeValue(const Json::Value& value)
+{
+  switch (value.type())
+  {
+    case Json::nullValue:
+      writer_.WriteNull();
+      break;
+
+    case Json::intValue:
+      writer_.WriteInteger(value.asInt64());
+      break;
+
+    case Json::uintValue:
+      writer_.WriteUnsigned(value.asUInt64());
+      break;
+
+    case Json::realValue:
+      writer_.WriteDouble(value.asDouble());
+      break;
+
+    case Json::stringValue:
+      writer_.WriteString(value.asString());
+      break;
+
+    case Json::booleanValue:
+      writer_.WriteBoolean(value.asBool());
+      break;
+
+    case Json::arrayValue:
+      if (IsArrayOfObjects(value))
+      {
+        EncodeColumnar(value);
+      }
+      else
+      {
+        writer_.StartArray(value.size());
+        for (Json::Value::ArrayIndex i = 0; i < value.size(); i++)
+        {
+          EncodeValue(value[i]);
+        }
+      }
+      break;
+
+    case Json::objectValue:
+      writer_.StartMap(value.size());
+      for (Json::Value::const_iterator it = value.begin(); it != value.end(); ++it)
+      {
+        writer_.WriteUnsigned(GetKeyIndex(it.name()));
+        EncodeValue(*it);
+      }
+      break;
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+}
+
+
+void CompactJsonEncoder::Encode(const Json::Value& value)
+{
+  writer_.StartMap(2);
+
+  writer_.WriteString("d");
+  EncodeValue(value);
+
+  writer_.WriteString("k");
+  writer_.StartArray(orderedKeys_.size());
+  for (size_t i = 0; i < orderedKeys_.size(); i++)
+  {
+    writer_.WriteString(orderedKeys_[i]);
+  }
+}
+
+
+bool CompactJsonEncoder::IsAccepted(const std::map<std::string, std::string>& httpHeaders)
+{
+  std::map<std::string, std::string>::const_iterator accept = httpHeaders.find("accept");
+
+  return (accept != httpHeaders.end() &&
+          accept->second.find(GetMimeType()) != std::string::npos);
+}
@@ -0,0 +1,109 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <json/value.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+// Streaming encoder for CBOR (RFC 8949).  Only the definite length items are supported.
+class CborWriter : public boost::noncopyable
+{
+private:
+  std::string&  target_;
+
+  void WriteHead(uint8_t majorType,
+                 uint64_t value);
+
+public:
+  explicit CborWriter(std::string& target) :
+    target_(target)
+  {
+  }
+
+  void WriteUnsigned(uint64_t value);
+
+  void WriteInteger(int64_t value);
+
+  void WriteDouble(double value);
+
+  void WriteString(const std::string& value);
+
+  void WriteBoolean(bool value);
+
+  void WriteNull();
+
+  void WriteUndefined();
+
+  void StartArray(uint64_t size);
+
+  void StartMap(uint64_t size);
+
+  void WriteTag(uint64_t tag);
+};
+
+
+// Encodes a JSON value into a compact CBOR document:
+//   { "d": <data>, "k": [ <key dictionary> ] }
+// In <data>, the keys of the objects are replaced by their index in the key dictionary, and
+// the arrays of objects (e.g. the expanded study lists) are stored in a columnar layout:
+//   tag(COLUMNAR_TAG) [ [ <key indices of the columns> ], [ <values of row 1> ], [ <values of row 2> ], ... ]
+// where the missing values are encoded as 'undefined'.  The dictionary is written last to allow streaming the data.
+class CompactJsonEncoder : public boost::noncopyable
+{
+private:
+  typedef std::map<std::string, uint64_t>  KeysDictionary;
+
+  CborWriter      writer_;
+  KeysDictionary  keys_;
+  std::vector<std::string>  orderedKeys_;
+
+  uint64_t GetKeyIndex(const std::string& key);
+
+  void EncodeValue(const Json::Value& value);
+
+  void EncodeColumnar(const Json::Value& rows);
+
+public:
+  static const uint64_t COLUMNAR_TAG = 65000;  // in the "first come first served" range of the IANA registry
+
+  explicit CompactJsonEncoder(std::string& target) :
+    writer_(target)
+  {
+  }
+
+  void Encode(const Json::Value& value);
+
+  static bool IsAccepted(const std::map<std::string, std::string>& httpHeaders);
+
+  static const char* GetMimeType()
+  {
+    return "application/cbor";
+  }
+};
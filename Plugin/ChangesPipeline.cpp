@@ -0,0 +1,485 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "ChangesPipeline.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+
+
+static const size_t QUEUE_CAPACITY = 16384;  // must be a power of 2
+static const size_t MAX_BATCH_SIZE = 1000;
+static const unsigned int CHANGES_PAGE_SIZE = 1000;
+static const unsigned int IDLE_WAKE_UP_PERIOD_MS = 1000;  // to read '/changes' even if the wake-up notification has been missed
+static const int32_t CURSOR_GLOBAL_PROPERTY = 5470;        // the plugins global properties must be >= 1024
+static const unsigned int CURSOR_SAVE_PERIOD_S = 10;       // don't write in the DB after each batch
+static const unsigned int MAX_DISPATCH_ATTEMPTS = 3;
+
+
+ChangesPipeline::ChangesPipeline() :
+  queue_(QUEUE_CAPACITY),
+  stopped_(true),
+  hasPendingChanges_(true),  // catch up on the changes that occurred while the plugin was not running
+  hasDroppedEvents_(false),
+  lastProcessedSequence_(-1),
+  lastSavedSequence_(-1),
+  isOrthancStarted_(false),
+  failedAttempts_(0)
+{
+}
+
+
+ChangesPipeline::~ChangesPipeline()
+{
+  Stop();
+}
+
+
+void ChangesPipeline::Register(IConsumer& consumer)
+{
+  if (worker_.get() != NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+  }
+
+  consumers_.push_back(&consumer);
+}
+
+
+void ChangesPipeline::Start()
+{
+  if (worker_.get() == NULL)
+  {
+    stopped_ = false;
+    worker_.reset(new boost::thread(&ChangesPipeline::Worker, this));
+  }
+}
+
+
+void ChangesPipeline::Stop()
+{
+  if (worker_.get() != NULL)
+  {
+    stopped_ = true;
+    wakeUp_.notify_one();
+
+    if (worker_->joinable())
+    {
+      worker_->join();
+    }
+
+    worker_.reset();
+  }
+}
+
+
+bool ChangesPipeline::IsRecordedInChanges(OrthancPluginChangeType changeType)
+{
+  switch (changeType)
+  {
+    case OrthancPluginChangeType_CompletedSeries:
+    case OrthancPluginChangeType_NewChildInstance:
+    case OrthancPluginChangeType_NewInstance:
+    case OrthancPluginChangeType_NewPatient:
+    case OrthancPluginChangeType_NewSeries:
+    case OrthancPluginChangeType_NewStudy:
+    case OrthancPluginChangeType_StablePatient:
+    case OrthancPluginChangeType_StableSeries:
+    case OrthancPluginChangeType_StableStudy:
+    case OrthancPluginChangeType_UpdatedAttachment:
+    case OrthancPluginChangeType_UpdatedMetadata:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+
+void ChangesPipeline::Enqueue(OrthancPluginChangeType changeType,
+                              OrthancPluginResourceType resourceType,
+                              const char* resourceId)
+{
+  if (IsRecordedInChanges(changeType))
+  {
+    // no need to copy the event, the worker will read it from '/changes'
+    hasPendingChanges_ = true;
+  }
+  else
+  {
+    Change change;
+    change.sequence_ = -1;
+    change.changeType_ = changeType;
+    change.resourceType_ = resourceType;
+    change.resourceId_ = (resourceId != NULL ? resourceId : "");
+
+    if (!queue_.TryEnqueue(change))
+    {
+      hasDroppedEvents_ = true;
+    }
+  }
+
+  // notifying without holding the mutex is allowed; if the notification is missed, the worker wakes up periodically
+  wakeUp_.notify_one();
+}
+
+
+bool ChangesPipeline::Dispatch(const std::vector<Change>& batch)
+{
+  bool success = true;
+
+  if (batch.empty())
+  {
+    return success;
+  }
+
+  for (size_t i = 0; i < consumers_.size(); i++)
+  {
+    try
+    {
+      consumers_[i]->HandleChanges(batch);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Orthanc Explorer 2: error while processing the changes: " << e.What();
+      success = false;
+    }
+    catch (std::exception& e)
+    {
+      LOG(ERROR) << "Orthanc Explorer 2: error while processing the changes: " << e.what();
+      success = false;
+    }
+  }
+
+  return success;
+}
+
+
+bool ChangesPipeline::DispatchWithRetries(const std::vector<Change>& batch)
+{
+  if (Dispatch(batch))
+  {
+    failedAttempts_ = 0;
+    return true;
+  }
+
+  failedAttempts_++;
+
+  if (failedAttempts_ >= MAX_DISPATCH_ATTEMPTS)
+  {
+    LOG(ERROR) << "Orthanc Explorer 2: " << batch.size() << " changes are skipped after " << failedAttempts_ << " failed attempts";
+    failedAttempts_ = 0;
+    return true;
+  }
+
+  return false;
+}
+
+
+void ChangesPipeline::LoadCursor()
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  char* value = OrthancPluginGetGlobalProperty(context, CURSOR_GLOBAL_PROPERTY, "");
+  std::string s;
+
+  if (value != NULL)
+  {
+    s = value;
+    OrthancPluginFreeString(context, value);
+  }
+
+  Json::Value changes;
+  if (!OrthancPlugins::RestApiGet(changes, "/changes?last", false))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+
+  const int64_t last = changes["Last"].asInt64();
+
+  try
+  {
+    lastProcessedSequence_ = (s.empty() ? last : boost::lexical_cast<int64_t>(s));
+  }
+  catch (boost::bad_lexical_cast&)
+  {
+    lastProcessedSequence_ = last;
+  }
+
+  for (size_t i = 0; i < consumers_.size(); i++)
+  {
+    // e.g. an index that has been loaded from an older snapshot
+    int64_t sequence = consumers_[i]->GetLastProcessedSequence();
+    if (sequence >= 0 && sequence < lastProcessedSequence_)
+    {
+      lastProcessedSequence_ = sequence;
+    }
+  }
+
+  if (lastProcessedSequence_ > last)
+  {
+    LOG(WARNING) << "Orthanc Explorer 2: the Orthanc DB has been reset, the changes are processed from the current one";
+    lastProcessedSequence_ = last;
+  }
+  else if (lastProcessedSequence_ < last)
+  {
+    LOG(WARNING) << "Orthanc Explorer 2: catching up with " << (last - lastProcessedSequence_) << " changes";
+  }
+}
+
+
+void ChangesPipeline::SaveCursor()
+{
+  if (lastProcessedSequence_ == lastSavedSequence_)
+  {
+    return;
+  }
+
+  lastSavedSequence_ = lastProcessedSequence_;
+  lastSaveTime_ = boost::posix_time::microsec_clock::universal_time();
+
+  std::string value = boost::lexical_cast<std::string>(lastProcessedSequence_);
+  OrthancPluginSetGlobalProperty(OrthancPlugins::GetGlobalContext(), CURSOR_GLOBAL_PROPERTY, value.c_str());
+}
+
+
+bool ChangesPipeline::ReadRecordedChanges()
+{
+  // the flag is reset before reading to make sure that a change recorded while reading is not missed
+  hasPendingChanges_ = false;
+
+  bool done = false;
+
+  while (!done && !stopped_)
+  {
+    Json::Value changes;
+    if (!OrthancPlugins::RestApiGet(changes, "/changes?since=" + boost::lexical_cast<std::string>(lastProcessedSequence_) +
+                                    "&limit=" + boost::lexical_cast<std::string>(CHANGES_PAGE_SIZE), false))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    std::vector<Change> batch;
+    batch.reserve(changes["Changes"].size());
+
+    for (Json::Value::ArrayIndex i = 0; i < changes["Changes"].size(); i++)
+    {
+      const Json::Value& c = changes["Changes"][i];
+      Change change;
+
+      if (StringToChangeType(change.changeType_, c["ChangeType"].asString()))
+      {
+        change.sequence_ = c["Seq"].asInt64();
+        change.resourceType_ = StringToResourceType(c["ResourceType"].asString());
+        change.resourceId_ = c["ID"].asString();
+        batch.push_back(change);
+      }
+    }
+
+    if (!DispatchWithRetries(batch))
+    {
+      hasPendingChanges_ = true;  // the cursor is not moved, the same changes will be read again
+      return false;
+    }
+
+    int64_t newLast = changes["Last"].asInt64();
+    done = changes["Done"].asBool() || newLast <= lastProcessedSequence_;
+    lastProcessedSequence_ = std::max(lastProcessedSequence_, newLast);
+  }
+
+  if (boost::posix_time::microsec_clock::universal_time() - lastSaveTime_ > boost::posix_time::seconds(CURSOR_SAVE_PERIOD_S))
+  {
+    SaveCursor();
+  }
+
+  return true;
+}
+
+
+void ChangesPipeline::Worker()
+{
+  std::vector<Change> batch;  // the queued events are kept until they have been dispatched
+
+  while (!stopped_)
+  {
+    Change change;
+
+    while (batch.size() < MAX_BATCH_SIZE && queue_.TryDequeue(change))
+    {
+      if (change.changeType_ == OrthancPluginChangeType_OrthancStarted)
+      {
+        isOrthancStarted_ = true;
+      }
+
+      batch.push_back(change);
+    }
+
+    if (hasDroppedEvents_.exchange(false))
+    {
+      LOG(WARNING) << "Orthanc Explorer 2: the changes queue has been full, some events have been dropped";
+
+      for (size_t i = 0; i < consumers_.size(); i++)
+      {
+        consumers_[i]->HandleDroppedEvents();
+      }
+    }
+
+    const bool isFull = (batch.size() >= MAX_BATCH_SIZE);
+    bool retry = false;
+
+    try
+    {
+      bool dispatchFirst = !isOrthancStarted_;  // the REST API can not be used before
+
+      if (isOrthancStarted_ &&
+          lastProcessedSequence_ < 0)
+      {
+        LoadCursor();
+        lastSavedSequence_ = lastProcessedSequence_;
+        lastSaveTime_ = boost::posix_time::microsec_clock::universal_time();
+
+        // "OrthancStarted" is received before catching up with the changes that occurred while the plugin was not running
+        dispatchFirst = true;
+      }
+
+      if (dispatchFirst)
+      {
+        retry = !DispatchWithRetries(batch);
+        if (!retry)
+        {
+          batch.clear();
+        }
+      }
+
+      // the recorded changes that precede the queued events must be dispatched first
+      if (!retry &&
+          isOrthancStarted_ &&
+          (hasPendingChanges_ || !batch.empty()))
+      {
+        retry = !ReadRecordedChanges();
+      }
+
+      if (!retry)
+      {
+        retry = !DispatchWithRetries(batch);
+      }
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Orthanc Explorer 2: error while reading the changes: " << e.What();
+      hasPendingChanges_ = true;
+      retry = true;
+    }
+    catch (std::exception& e)
+    {
+      LOG(ERROR) << "Orthanc Explorer 2: error while reading the changes: " << e.what();
+      hasPendingChanges_ = true;
+      retry = true;
+    }
+
+    if (!retry)
+    {
+      batch.clear();
+    }
+
+    // after a failure, wait before retrying
+    if (retry ||
+        (!isFull && (!hasPendingChanges_ || !isOrthancStarted_)))
+    {
+      boost::mutex::scoped_lock lock(wakeUpMutex_);
+      wakeUp_.timed_wait(lock, boost::posix_time::milliseconds(IDLE_WAKE_UP_PERIOD_MS));
+    }
+  }
+
+  if (lastProcessedSequence_ >= 0)
+  {
+    SaveCursor();
+  }
+}
+
+
+bool ChangesPipeline::StringToChangeType(OrthancPluginChangeType& target,
+                                         const std::string& value)
+{
+  // the values used by '/changes'
+  static const struct
+  {
+    const char*              name_;
+    OrthancPluginChangeType  type_;
+  } CHANGE_TYPES[] = {
+    { "CompletedSeries",   OrthancPluginChangeType_CompletedSeries },
+    { "Deleted",           OrthancPluginChangeType_Deleted },
+    { "NewChildInstance",  OrthancPluginChangeType_NewChildInstance },
+    { "NewInstance",       OrthancPluginChangeType_NewInstance },
+    { "NewPatient",        OrthancPluginChangeType_NewPatient },
+    { "NewSeries",         OrthancPluginChangeType_NewSeries },
+    { "NewStudy",          OrthancPluginChangeType_NewStudy },
+    { "StablePatient",     OrthancPluginChangeType_StablePatient },
+    { "StableSeries",      OrthancPluginChangeType_StableSeries },
+    { "StableStudy",       OrthancPluginChangeType_StableStudy },
+    { "UpdatedAttachment", OrthancPluginChangeType_UpdatedAttachment },
+    { "UpdatedMetadata",   OrthancPluginChangeType_UpdatedMetadata },
+    { NULL,                OrthancPluginChangeType_Deleted }
+  };
+
+  for (size_t i = 0; CHANGE_TYPES[i].name_ != NULL; i++)
+  {
+    if (value == CHANGE_TYPES[i].name_)
+    {
+      target = CHANGE_TYPES[i].type_;
+      return true;
+    }
+  }
+
+  return false;  // a change type that is unknown to this version of the plugin
+}
+
+
+OrthancPluginResourceType ChangesPipeline::StringToResourceType(const std::string& value)
+{
+  if (value == "Patient")
+  {
+    return OrthancPluginResourceType_Patient;
+  }
+  else if (value == "Study")
+  {
+    return OrthancPluginResourceType_Study;
+  }
+  else if (value == "Series")
+  {
+    return OrthancPluginResourceType_Series;
+  }
+  else if (value == "Instance")
+  {
+    return OrthancPluginResourceType_Instance;
+  }
+  else
+  {
+    return OrthancPluginResourceType_None;
+  }
+}
@@ -0,0 +1,137 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "BoundedMpscQueue.h"
+
+#include <orthanc/OrthancCPlugin.h>
+
+#include <boost/thread.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// Decouples the processing of the Orthanc changes from the Orthanc change thread.  The change callback only
+// pushes the events in a lock-free queue.  A worker thread dispatches them by batches to the registered consumers.
+//
+// The changes that are recorded in the Orthanc DB (new resources, stable resources, ...) are read from '/changes'
+// and the sequence of the last processed change is persisted in a global property.  After a restart, the consumers
+// receive the changes that have occurred while the plugin was not running.  The queued events are only used to wake
+// up the worker for these changes, so that nothing is lost if the queue overflows.
+// The other events (Deleted, OrthancStarted, jobs, ...) are not recorded in the DB and are dispatched from the queue,
+// after the recorded changes that precede them.  A recorded change that occurs while such an event is waiting in
+// the queue (a few milliseconds) may still be dispatched before it.
+//
+// If a consumer throws, the batch is dispatched again to all the consumers at the next wake up and the cursor is not
+// moved.  The batch is skipped after a few failed attempts so that a single bad change can not block the pipeline.
+class ChangesPipeline : public boost::noncopyable
+{
+public:
+  struct Change
+  {
+    int64_t                    sequence_;  // -1 for the events that are not recorded in '/changes'
+    OrthancPluginChangeType    changeType_;
+    OrthancPluginResourceType  resourceType_;
+    std::string                resourceId_;
+  };
+
+  class IConsumer : public boost::noncopyable
+  {
+  public:
+    virtual ~IConsumer()
+    {
+    }
+
+    // called from the worker thread.  A batch may be dispatched again if another consumer has failed.
+    virtual void HandleChanges(const std::vector<Change>& changes) = 0;
+
+    // called from the worker thread when events that are not recorded in '/changes' have been lost
+    virtual void HandleDroppedEvents()
+    {
+    }
+
+    // The sequence of the last change that has been taken into account by a consumer whose state is persisted
+    // on its own (-1 if not applicable).  At startup, the changes are replayed from the oldest of these sequences,
+    // so the consumers may receive changes that they have already processed and must ignore them.
+    virtual int64_t GetLastProcessedSequence()
+    {
+      return -1;
+    }
+  };
+
+private:
+  BoundedMpscQueue<Change>   queue_;
+  std::vector<IConsumer*>    consumers_;
+  std::unique_ptr<boost::thread>  worker_;
+  boost::mutex               wakeUpMutex_;
+  boost::condition_variable  wakeUp_;
+  std::atomic<bool>          stopped_;
+  std::atomic<bool>          hasPendingChanges_;
+  std::atomic<bool>          hasDroppedEvents_;
+  int64_t                    lastProcessedSequence_;  // only accessed by the worker thread
+  int64_t                    lastSavedSequence_;
+  boost::posix_time::ptime   lastSaveTime_;
+  bool                       isOrthancStarted_;       // only accessed by the worker thread
+  unsigned int               failedAttempts_;         // only accessed by the worker thread
+
+  static bool IsRecordedInChanges(OrthancPluginChangeType changeType);
+
+  // returns false if a consumer has failed
+  bool Dispatch(const std::vector<Change>& batch);
+
+  // returns false if the batch must be dispatched again
+  bool DispatchWithRetries(const std::vector<Change>& batch);
+
+  void LoadCursor();
+
+  void SaveCursor();
+
+  // returns false if the changes must be read again
+  bool ReadRecordedChanges();
+
+  void Worker();
+
+public:
+  ChangesPipeline();
+
+  ~ChangesPipeline();
+
+  // consumers must be registered before Start() and must outlive the pipeline
+  void Register(IConsumer& consumer);
+
+  void Start();
+
+  void Stop();
+
+  // called from the Orthanc change callback: never blocks
+  void Enqueue(OrthancPluginChangeType changeType,
+               OrthancPluginResourceType resourceType,
+               const char* resourceId);
+
+  static bool StringToChangeType(OrthancPluginChangeType& target,
+                                 const std::string& value);
+
+  static OrthancPluginResourceType StringToResourceType(const std::string& value);
+};
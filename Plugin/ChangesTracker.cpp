@@ -0,0 +1,264 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "ChangesTracker.h"
+
+#include "JsonScanner.h"
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+
+
+namespace ChangesTracker
+{
+  static const unsigned int CHANGES_PAGE_SIZE = 1000;
+
+
+  static bool LookupParent(std::string& parent,
+                           std::map<std::string, std::string>& cache,
+                           const std::string& uri,
+                           const std::string& parentField)
+  {
+    std::map<std::string, std::string>::const_iterator found = cache.find(uri);
+    if (found != cache.end())
+    {
+      parent = found->second;
+      return true;
+    }
+
+    Json::Value resource;
+    if (OrthancPlugins::RestApiGet(resource, uri, false) &&
+        resource.isMember(parentField))
+    {
+      parent = resource[parentField].asString();
+      cache[uri] = parent;
+      return true;
+    }
+
+    return false;  // the resource has already been deleted
+  }
+
+
+  // same as LookupParent() for a series, that also caches the parent of all its instances, so that the changes of
+  // the instances of a series only require one lookup
+  static bool LookupSeriesParent(std::string& studyId,
+                                 std::map<std::string, std::string>& cache,
+                                 const std::string& seriesId)
+  {
+    const std::string uri = "/series/" + seriesId;
+
+    std::map<std::string, std::string>::const_iterator found = cache.find(uri);
+    if (found != cache.end())
+    {
+      studyId = found->second;
+      return true;
+    }
+
+    Json::Value series;
+    if (OrthancPlugins::RestApiGet(series, uri, false) &&
+        series.isMember("ParentStudy"))
+    {
+      studyId = series["ParentStudy"].asString();
+      cache[uri] = studyId;
+
+      const Json::Value& instances = series["Instances"];
+      for (Json::Value::ArrayIndex i = 0; i < instances.size(); i++)
+      {
+        cache["/instances/" + instances[i].asString()] = seriesId;
+      }
+
+      return true;
+    }
+
+    return false;  // the series has already been deleted
+  }
+
+
+  bool CollectTouchedResources(TouchedResources& target,
+                               int64_t& last,
+                               int64_t since,
+                               unsigned int maxChanges,
+                               bool includeInstances)
+  {
+    std::map<std::string, std::string> parents;
+    unsigned int changesCount = 0;
+    bool done = false;
+
+    last = since;
+
+    while (!done)
+    {
+      Json::Value changes;
+      if (!OrthancPlugins::RestApiGet(changes, "/changes?since=" + boost::lexical_cast<std::string>(last) +
+                                      "&limit=" + boost::lexical_cast<std::string>(CHANGES_PAGE_SIZE), false))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+
+      const Json::Value& changesList = changes["Changes"];
+      for (Json::Value::ArrayIndex i = 0; i < changesList.size(); i++)
+      {
+        const std::string& resourceType = changesList[i]["ResourceType"].asString();
+        const std::string& resourceId = changesList[i]["ID"].asString();
+
+        if (resourceType == "Study")
+        {
+          target.studies_.insert(resourceId);
+        }
+        else if (resourceType == "Series" ||
+                 (resourceType == "Instance" && includeInstances))
+        {
+          std::string seriesId = resourceId;
+          std::string studyId;
+
+          if (resourceType == "Instance" &&
+              !LookupParent(seriesId, parents, "/instances/" + resourceId, "ParentSeries"))
+          {
+            continue;
+          }
+
+          target.series_.insert(seriesId);
+
+          if (LookupSeriesParent(studyId, parents, seriesId))
+          {
+            target.studies_.insert(studyId);
+          }
+        }
+      }
+
+      int64_t newLast = changes["Last"].asInt64();
+      done = changes["Done"].asBool() || newLast <= last;
+      changesCount += changesList.size();
+
+      if (newLast < since)  // the Orthanc DB has been reset
+      {
+        return false;
+      }
+
+      last = std::max(last, newLast);
+
+      if (changesCount > maxChanges)
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+
+  int64_t GetLastChange()
+  {
+    JsonScanner::Document changes;
+    JsonScanner::Value last;
+
+    if (!changes.RestApiGet("/changes?last", false) ||
+        !changes.GetRoot().LookupMember(last, "Last"))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    return last.GetInteger();
+  }
+
+
+  DeletedResourcesJournal::DeletedResourcesJournal(size_t capacity) :
+    first_(0),
+    capacity_(capacity),
+    journalId_(Orthanc::Toolbox::GenerateUuid())
+  {
+  }
+
+
+  void DeletedResourcesJournal::Add(const std::string& resourceId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    ids_.push_back(resourceId);
+
+    while (ids_.size() > capacity_)
+    {
+      ids_.pop_front();
+      first_++;
+    }
+  }
+
+
+  std::string DeletedResourcesJournal::GetJournalId()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return journalId_;
+  }
+
+
+  void DeletedResourcesJournal::HandleChanges(const std::vector<ChangesPipeline::Change>& changes)
+  {
+    for (size_t i = 0; i < changes.size(); i++)
+    {
+      if (changes[i].changeType_ == OrthancPluginChangeType_Deleted)
+      {
+        Add(changes[i].resourceId_);
+      }
+    }
+  }
+
+
+  void DeletedResourcesJournal::HandleDroppedEvents()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    journalId_ = Orthanc::Toolbox::GenerateUuid();
+  }
+
+
+  uint64_t DeletedResourcesJournal::GetLast()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return first_ + ids_.size();
+  }
+
+
+  bool DeletedResourcesJournal::GetSince(std::vector<std::string>& target,
+                                         uint64_t& last,
+                                         uint64_t since)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    last = first_ + ids_.size();
+
+    if (since < first_ || since > last)
+    {
+      return false;
+    }
+
+    for (size_t i = static_cast<size_t>(since - first_); i < ids_.size(); i++)
+    {
+      target.push_back(ids_[i]);
+    }
+
+    return true;
+  }
+}
@@ -0,0 +1,89 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "ChangesPipeline.h"
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <deque>
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+namespace ChangesTracker
+{
+  // The resources that have been touched by a range of the Orthanc '/changes'
+  struct TouchedResources
+  {
+    std::set<std::string>  studies_;
+    std::set<std::string>  series_;
+  };
+
+  // Pages through '/changes' starting after 'since'.  The studies and series that have been
+  // created or modified are collected, series and instances are also reported through their parent study.
+  // Returns false if there are more than 'maxChanges' changes or if the Orthanc DB has been reset.
+  bool CollectTouchedResources(TouchedResources& target,
+                               int64_t& last,
+                               int64_t since,
+                               unsigned int maxChanges,
+                               bool includeInstances);
+
+  int64_t GetLastChange();
+
+
+  // The '/changes' route does not report the deleted resources, they are only available
+  // in the change callback of the plugin.  This journal keeps the last ones in memory.
+  class DeletedResourcesJournal : public ChangesPipeline::IConsumer
+  {
+  private:
+    boost::mutex             mutex_;
+    std::deque<std::string>  ids_;      // ids_[i] has the sequence 'first_ + i + 1'
+    uint64_t                 first_;
+    size_t                   capacity_;
+    std::string              journalId_;  // changes each time Orthanc restarts since the journal is not persisted
+
+  public:
+    explicit DeletedResourcesJournal(size_t capacity);
+
+    std::string GetJournalId();
+
+    void Add(const std::string& resourceId);
+
+    virtual void HandleChanges(const std::vector<ChangesPipeline::Change>& changes);
+
+    // some deletions may be missing -> the clients must reset their caches
+    virtual void HandleDroppedEvents();
+
+    uint64_t GetLast();
+
+    // returns false if some of the deletions after 'since' are not in the journal anymore
+    bool GetSince(std::vector<std::string>& target,
+                  uint64_t& last,
+                  uint64_t since);
+  };
+}
@@ -0,0 +1,248 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "DistDirectory.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+
+
+static const char* const INDEX_FILE = "index.html";
+
+
+DistDirectory::File::File(const std::string& path) :
+  mimeType_(Orthanc::EnumerationToString(Orthanc::SystemToolbox::AutodetectMimeType(path)))
+{
+  // NB: the files are not mapped in memory: the truncation of a mapped file that is updated in place would crash
+  // Orthanc (SIGBUS), and OrthancPluginAnswerBuffer() copies the answer anyway
+  Orthanc::SystemToolbox::ReadFile(content_, path);
+
+  OrthancPlugins::OrthancString md5;
+  md5.Assign(OrthancPluginComputeMd5(OrthancPlugins::GetGlobalContext(), GetData(), content_.size()));
+  etag_ = "\"" + std::string(md5.GetContent()) + "\"";
+}
+
+
+DistDirectory::Version::Version(const std::string& root,
+                                const std::string& signature) :
+  signature_(signature)
+{
+  try
+  {
+    const boost::filesystem::path rootPath(root);
+
+    for (boost::filesystem::recursive_directory_iterator it(rootPath);
+         it != boost::filesystem::recursive_directory_iterator(); ++it)
+    {
+      if (boost::filesystem::is_regular_file(it->status()))
+      {
+        const std::string path = it->path().string();
+        const std::string relativePath = boost::filesystem::path(path.substr(rootPath.string().size())).generic_string();
+
+        // the relative path starts with a '/'
+        files_[relativePath.substr(relativePath.find_first_not_of('/'))] = new File(path);
+      }
+    }
+  }
+  catch (...)
+  {
+    for (std::map<std::string, File*>::iterator it = files_.begin(); it != files_.end(); ++it)
+    {
+      delete it->second;
+    }
+
+    throw;
+  }
+
+  if (files_.find(INDEX_FILE) == files_.end())
+  {
+    for (std::map<std::string, File*>::iterator it = files_.begin(); it != files_.end(); ++it)
+    {
+      delete it->second;
+    }
+
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile, "The web application directory has no index.html: " + root);
+  }
+}
+
+
+DistDirectory::Version::~Version()
+{
+  for (std::map<std::string, File*>::iterator it = files_.begin(); it != files_.end(); ++it)
+  {
+    delete it->second;
+  }
+}
+
+
+const DistDirectory::File* DistDirectory::Version::Lookup(const std::string& path) const
+{
+  std::map<std::string, File*>::const_iterator found = files_.find(path);
+  return found == files_.end() ? NULL : found->second;
+}
+
+
+std::string DistDirectory::ComputeSignature(const std::string& root)
+{
+  std::string signature;
+
+  for (boost::filesystem::recursive_directory_iterator it((boost::filesystem::path(root)));
+       it != boost::filesystem::recursive_directory_iterator(); ++it)
+  {
+    if (boost::filesystem::is_regular_file(it->status()))
+    {
+      signature += it->path().string() + ":" +
+        boost::lexical_cast<std::string>(boost::filesystem::file_size(it->path())) + ":" +
+        boost::lexical_cast<std::string>(boost::filesystem::last_write_time(it->path())) + "\n";
+    }
+  }
+
+  return signature;
+}
+
+
+DistDirectory::DistDirectory(const std::string& root,
+                             unsigned int pollingInterval) :
+  root_(root),
+  pollingInterval_(std::max(1u, pollingInterval)),
+  stopped_(true)
+{
+  current_.reset(new Version(root_, ComputeSignature(root_)));
+  LOG(WARNING) << "Orthanc Explorer 2: serving the web application from " << root_;
+}
+
+
+DistDirectory::~DistDirectory()
+{
+  if (!stopped_)
+  {
+    LOG(ERROR) << "DistDirectory::Stop() should have been called";
+  }
+}
+
+
+DistDirectory::VersionPtr DistDirectory::GetCurrentVersion()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return current_;
+}
+
+
+void DistDirectory::Watch()
+{
+  std::string previousSignature;
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  while (!stopped_)
+  {
+    stopRequested_.timed_wait(lock, boost::posix_time::seconds(pollingInterval_));
+
+    if (stopped_)
+    {
+      break;
+    }
+
+    const std::string currentSignature = current_->GetSignature();
+
+    // the files are read without holding the lock to not delay the requests
+    lock.unlock();
+
+    try
+    {
+      const std::string signature = ComputeSignature(root_);
+
+      // the directory is only indexed once it has not changed during a polling interval, so that
+      // a new version that is being copied is not served partially
+      if (signature != currentSignature &&
+          signature == previousSignature)
+      {
+        VersionPtr version(new Version(root_, signature));
+
+        {
+          boost::mutex::scoped_lock swapLock(mutex_);
+          current_ = version;
+        }
+
+        LOG(WARNING) << "Orthanc Explorer 2: a new version of the web application has been loaded from " << root_
+                     << " (" << version->GetFilesCount() << " files)";
+      }
+
+      previousSignature = signature;
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      // e.g. the index.html has not been copied yet, the current version is kept
+      previousSignature.clear();
+      LOG(INFO) << "Orthanc Explorer 2: the web application directory is not ready: " << e.What();
+    }
+    catch (boost::filesystem::filesystem_error& e)
+    {
+      previousSignature.clear();
+      LOG(INFO) << "Orthanc Explorer 2: the web application directory is not ready: " << e.what();
+    }
+
+    lock.lock();
+  }
+}
+
+
+void DistDirectory::Start()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (stopped_)
+  {
+    stopped_ = false;
+    watcher_ = boost::thread(&DistDirectory::Watch, this);
+  }
+}
+
+
+void DistDirectory::Stop()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (stopped_)
+    {
+      return;
+    }
+
+    stopped_ = true;
+  }
+
+  stopRequested_.notify_all();
+
+  if (watcher_.joinable())
+  {
+    watcher_.join();
+  }
+}
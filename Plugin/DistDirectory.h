@@ -0,0 +1,133 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <map>
+#include <stdint.h>
+#include <string>
+
+
+// Serves the web application from an external 'dist' directory (the output of 'npm run build') instead of the
+// resources embedded in the plugin.  The files are read in memory once and indexed with their ETag.  The directory
+// is watched: when a new version of the web application is dropped in, it is indexed again and atomically swapped
+// with the current one, the requests that are in progress keep on using the previous version.  Since the files are
+// copies, the directory can be updated in place (the served content always matches its ETag).
+class DistDirectory : public boost::noncopyable
+{
+public:
+  class File : public boost::noncopyable
+  {
+  private:
+    std::string  content_;
+    std::string  etag_;
+    std::string  mimeType_;
+
+  public:
+    explicit File(const std::string& path);
+
+    const void* GetData() const
+    {
+      return content_.empty() ? NULL : content_.c_str();
+    }
+
+    size_t GetSize() const
+    {
+      return content_.size();
+    }
+
+    const std::string& GetETag() const
+    {
+      return etag_;
+    }
+
+    const std::string& GetMimeType() const
+    {
+      return mimeType_;
+    }
+  };
+
+
+  class Version : public boost::noncopyable
+  {
+  private:
+    std::map<std::string, File*>  files_;  // by path relative to the dist directory, with '/' separators
+    std::string                   signature_;
+
+  public:
+    Version(const std::string& root,
+            const std::string& signature);
+
+    ~Version();
+
+    const std::string& GetSignature() const
+    {
+      return signature_;
+    }
+
+    // returns NULL if the file does not exist
+    const File* Lookup(const std::string& path) const;
+
+    size_t GetFilesCount() const
+    {
+      return files_.size();
+    }
+  };
+
+  typedef boost::shared_ptr<const Version>  VersionPtr;
+
+private:
+  std::string                root_;
+  unsigned int               pollingInterval_;  // in seconds
+  boost::mutex               mutex_;
+  VersionPtr                 current_;
+  bool                       stopped_;
+  boost::condition_variable  stopRequested_;
+  boost::thread              watcher_;
+
+  // the paths, sizes and modification times of all the files of the directory
+  static std::string ComputeSignature(const std::string& root);
+
+  void Watch();
+
+public:
+  // indexes the directory immediately, throws if it does not contain a web application
+  DistDirectory(const std::string& root,
+                unsigned int pollingInterval);
+
+  ~DistDirectory();
+
+  const std::string& GetRoot() const
+  {
+    return root_;
+  }
+
+  VersionPtr GetCurrentVersion();
+
+  void Start();
+
+  void Stop();
+};
@@ -0,0 +1,318 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "HttpClientPool.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <memory>
+
+
+static Orthanc::HttpMethod ConvertMethod(OrthancPluginHttpMethod method)
+{
+  switch (method)
+  {
+    case OrthancPluginHttpMethod_Get:
+      return Orthanc::HttpMethod_Get;
+
+    case OrthancPluginHttpMethod_Post:
+      return Orthanc::HttpMethod_Post;
+
+    case OrthancPluginHttpMethod_Put:
+      return Orthanc::HttpMethod_Put;
+
+    case OrthancPluginHttpMethod_Delete:
+      return Orthanc::HttpMethod_Delete;
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+HttpClientPool::HttpClientPool() :
+  maxIdlePerHost_(4),
+  idleTimeout_(boost::posix_time::seconds(60)),
+  defaultTimeout_(60)
+{
+}
+
+
+HttpClientPool::~HttpClientPool()
+{
+  Clear();
+}
+
+
+void HttpClientPool::Configure(const Json::Value& configuration)
+{
+  if (configuration.isObject())
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxIdlePerHost_ = configuration["MaxIdleConnectionsPerHost"].asUInt();
+    idleTimeout_ = boost::posix_time::seconds(configuration["IdleTimeout"].asUInt());
+  }
+}
+
+
+void HttpClientPool::SetOrthancOptions(const std::string& proxy,
+                                       uint32_t defaultTimeout)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  proxy_ = proxy;
+  defaultTimeout_ = defaultTimeout;
+}
+
+
+void HttpClientPool::Clear()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  for (IdleClients::iterator it = idleClients_.begin(); it != idleClients_.end(); ++it)
+  {
+    for (std::list<IdleClient>::iterator client = it->second.begin(); client != it->second.end(); ++client)
+    {
+      delete client->client_;
+    }
+  }
+
+  idleClients_.clear();
+}
+
+
+std::string HttpClientPool::GetPoolKey(const std::string& url,
+                                       const std::string& username,
+                                       const std::string& password)
+{
+  // the origin of the URL: "scheme://host:port"
+  size_t start = url.find("://");
+  start = (start == std::string::npos ? 0 : start + 3);
+
+  const size_t end = url.find('/', start);
+  const std::string origin = (end == std::string::npos ? url : url.substr(0, end));
+
+  // the credentials are set once for all when a client is created.  The password is hashed, so that the keys
+  // are not ambiguous and do not hold it in clear.
+  std::string passwordHash;
+  Orthanc::Toolbox::ComputeSHA1(passwordHash, password);
+
+  return username + ":" + passwordHash + "@" + origin;
+}
+
+
+void HttpClientPool::EvictIdleClients(const boost::posix_time::ptime& now)
+{
+  for (IdleClients::iterator it = idleClients_.begin(); it != idleClients_.end(); )
+  {
+    std::list<IdleClient>& clients = it->second;
+
+    // the most recently used clients are at the front
+    while (!clients.empty() &&
+           clients.back().lastUse_ + idleTimeout_ < now)
+    {
+      delete clients.back().client_;
+      clients.pop_back();
+    }
+
+    if (clients.empty())
+    {
+      idleClients_.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+
+Orthanc::HttpClient* HttpClientPool::Acquire(const std::string& key,
+                                             const std::string& username,
+                                             const std::string& password)
+{
+  std::string proxy;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    proxy = proxy_;
+
+    EvictIdleClients(boost::posix_time::microsec_clock::universal_time());
+
+    IdleClients::iterator found = idleClients_.find(key);
+    if (found != idleClients_.end())
+    {
+      Orthanc::HttpClient* client = found->second.front().client_;
+      found->second.pop_front();
+
+      if (found->second.empty())
+      {
+        idleClients_.erase(found);
+      }
+
+      return client;
+    }
+  }
+
+  std::unique_ptr<Orthanc::HttpClient> client(new Orthanc::HttpClient);
+
+  if (!proxy.empty())
+  {
+    client->SetProxy(proxy);
+  }
+
+  if (!username.empty())
+  {
+    client->SetCredentials(username.c_str(), password.c_str());
+  }
+
+  return client.release();
+}
+
+
+void HttpClientPool::Release(const std::string& key,
+                             Orthanc::HttpClient* client)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  std::list<IdleClient>& clients = idleClients_[key];
+
+  if (clients.size() >= maxIdlePerHost_)
+  {
+    delete client;
+
+    if (clients.empty())
+    {
+      idleClients_.erase(key);
+    }
+  }
+  else
+  {
+    IdleClient idle;
+    idle.client_ = client;
+    idle.lastUse_ = boost::posix_time::microsec_clock::universal_time();
+    clients.push_front(idle);
+  }
+}
+
+
+bool HttpClientPool::Execute(uint16_t& httpStatus,
+                             Orthanc::HttpClient::HttpHeaders& answerHeaders,
+                             std::string& answerBody,
+                             OrthancPluginHttpMethod method,
+                             const std::string& url,
+                             const std::map<std::string, std::string>& headers,
+                             const std::string& body,
+                             const std::string& username,
+                             const std::string& password,
+                             uint32_t timeout)
+{
+  const std::string key = GetPoolKey(url, username, password);
+
+  if (timeout == 0)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    timeout = defaultTimeout_;
+  }
+
+  std::unique_ptr<Orthanc::HttpClient> client(Acquire(key, username, password));
+
+  client->SetUrl(url);
+  client->SetMethod(ConvertMethod(method));
+  client->SetTimeout(timeout);
+  client->SetBody(body);
+  client->ClearHeaders();
+
+  for (std::map<std::string, std::string>::const_iterator it = headers.begin(); it != headers.end(); ++it)
+  {
+    client->AddHeader(it->first, it->second);
+  }
+
+  bool success;
+
+  try
+  {
+    success = client->Apply(answerBody, answerHeaders);
+  }
+  catch (Orthanc::OrthancException&)
+  {
+    // e.g. the server is not reachable: the connection is not kept
+    httpStatus = 0;
+    return false;
+  }
+
+  httpStatus = static_cast<uint16_t>(client->GetLastStatus());
+
+  // the connection is kept alive for the next requests to the same server
+  Release(key, client.release());
+
+  return success;
+}
+
+
+HttpClientPool& HttpClientPool::GetInstance()
+{
+  static HttpClientPool instance;
+  return instance;
+}
+
+
+PooledHttpClient::PooledHttpClient() :
+  httpStatus_(0),
+  method_(OrthancPluginHttpMethod_Get),
+  timeout_(0)
+{
+}
+
+
+void PooledHttpClient::Execute(std::map<std::string, std::string>& answerHeaders,
+                               std::string& answerBody)
+{
+  const bool success = HttpClientPool::GetInstance().Execute(httpStatus_, answerHeaders, answerBody, method_, url_, headers_,
+                                                             body_, username_, password_, timeout_);
+
+  if (httpStatus_ == 0)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "Unable to reach " + url_);
+  }
+  else if (!success)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "HTTP status " + boost::lexical_cast<std::string>(httpStatus_) + " from " + url_);
+  }
+}
+
+
+void PooledHttpClient::Execute(std::map<std::string, std::string>& answerHeaders,
+                               Json::Value& answerBody)
+{
+  std::string body;
+  Execute(answerHeaders, body);
+
+  if (!OrthancPlugins::ReadJson(answerBody, body))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The answer of " + url_ + " is not a JSON document");
+  }
+}
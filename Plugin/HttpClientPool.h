@@ -0,0 +1,183 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#if !defined(ORTHANC_OE2_ENABLE_HTTP_CLIENT_POOL)
+#  error The macro ORTHANC_OE2_ENABLE_HTTP_CLIENT_POOL must be defined
+#endif
+
+#if ORTHANC_OE2_ENABLE_HTTP_CLIENT_POOL == 1
+
+#include <HttpClient.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <list>
+#include <map>
+#include <string>
+
+
+// The HTTP clients of the Orthanc SDK (OrthancPlugins::HttpClient) open a new connection for each request.  This pool
+// keeps the clients of the Orthanc framework (and their curl handles) alive between the requests so that the calls
+// to the same server reuse the TCP/TLS connections (HTTP keep-alive).  The idle clients are evicted after a delay.
+// Note that curl does not support HTTP/1.1 pipelining anymore: a connection serves one request at a time and the
+// concurrent requests to the same server use distinct connections.
+class HttpClientPool : public boost::noncopyable
+{
+private:
+  struct IdleClient
+  {
+    Orthanc::HttpClient*      client_;
+    boost::posix_time::ptime  lastUse_;
+  };
+
+  typedef std::map<std::string, std::list<IdleClient> >  IdleClients;  // by origin and credentials
+
+  boost::mutex                      mutex_;
+  IdleClients                       idleClients_;
+  size_t                            maxIdlePerHost_;
+  boost::posix_time::time_duration  idleTimeout_;
+  std::string                       proxy_;
+  uint32_t                          defaultTimeout_;
+
+  static std::string GetPoolKey(const std::string& url,
+                                const std::string& username,
+                                const std::string& password);
+
+  // to call with the mutex locked
+  void EvictIdleClients(const boost::posix_time::ptime& now);
+
+  Orthanc::HttpClient* Acquire(const std::string& key,
+                               const std::string& username,
+                               const std::string& password);
+
+  void Release(const std::string& key,
+               Orthanc::HttpClient* client);
+
+public:
+  HttpClientPool();
+
+  ~HttpClientPool();
+
+  void Configure(const Json::Value& configuration);
+
+  // the "HttpProxy" and "HttpTimeout" options of Orthanc, that are not applied to the clients of the plugins
+  void SetOrthancOptions(const std::string& proxy,
+                         uint32_t defaultTimeout);
+
+  // closes all the idle connections
+  void Clear();
+
+  // returns false if the server could not be reached, 'httpStatus' is 0 in this case
+  bool Execute(uint16_t& httpStatus,
+               Orthanc::HttpClient::HttpHeaders& answerHeaders,
+               std::string& answerBody,
+               OrthancPluginHttpMethod method,
+               const std::string& url,
+               const std::map<std::string, std::string>& headers,
+               const std::string& body,
+               const std::string& username,
+               const std::string& password,
+               uint32_t timeout);
+
+  static HttpClientPool& GetInstance();
+};
+
+
+// Same interface as OrthancPlugins::HttpClient for the plain (not chunked) requests, through the pool
+class PooledHttpClient : public boost::noncopyable
+{
+private:
+  uint16_t                            httpStatus_;
+  OrthancPluginHttpMethod             method_;
+  std::string                         url_;
+  std::map<std::string, std::string>  headers_;
+  std::string                         username_;
+  std::string                         password_;
+  uint32_t                            timeout_;
+  std::string                         body_;
+
+public:
+  PooledHttpClient();
+
+  uint16_t GetHttpStatus() const
+  {
+    return httpStatus_;
+  }
+
+  void SetMethod(OrthancPluginHttpMethod method)
+  {
+    method_ = method;
+  }
+
+  const std::string& GetUrl() const
+  {
+    return url_;
+  }
+
+  void SetUrl(const std::string& url)
+  {
+    url_ = url;
+  }
+
+  void AddHeader(const std::string& key,
+                 const std::string& value)
+  {
+    headers_[key] = value;
+  }
+
+  void SetCredentials(const std::string& username,
+                      const std::string& password)
+  {
+    username_ = username;
+    password_ = password;
+  }
+
+  // in seconds, 0 = the default of Orthanc
+  void SetTimeout(uint32_t timeout)
+  {
+    timeout_ = timeout;
+  }
+
+  void SetBody(const std::string& body)
+  {
+    body_ = body;
+  }
+
+  // throws if the server could not be reached or if the answer is not 2xx
+  void Execute(std::map<std::string, std::string>& answerHeaders,
+               std::string& answerBody);
+
+  void Execute(std::map<std::string, std::string>& answerHeaders,
+               Json::Value& answerBody);
+};
+
+#else
+
+// Built without the HTTP client of the Orthanc framework: one connection per request
+typedef OrthancPlugins::HttpClient  PooledHttpClient;
+
+#endif
@@ -0,0 +1,500 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "IndexSnapshot.h"
+
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+
+#include <boost/filesystem.hpp>
+
+#include <cassert>
+#include <stdio.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+
+namespace IndexSnapshot
+{
+  static const char MAGIC[8] = { 'O', 'E', '2', 'S', 'N', 'A', 'P', '\0' };
+  static const uint32_t FORMAT_VERSION = 1;
+  static const uint32_t ENDIANNESS_MARKER = 0x01020304;  // the snapshots are not portable between architectures
+  static const size_t MAX_INDEX_NAME_SIZE = 32;
+  static const size_t ALIGNMENT = 8;
+
+  struct FileHeader
+  {
+    char      magic_[8];
+    uint32_t  formatVersion_;
+    uint32_t  endiannessMarker_;
+    uint32_t  indexVersion_;
+    uint32_t  sectionsCount_;
+    int64_t   changeSequence_;
+    uint64_t  fileSize_;
+    char      indexName_[MAX_INDEX_NAME_SIZE];
+  };
+
+
+  struct SectionInfo
+  {
+    uint32_t  id_;
+    uint32_t  kind_;
+    uint64_t  offset_;  // from the beginning of the file
+    uint64_t  size_;    // in bytes
+    uint64_t  count_;   // number of items (strings, values, lists or bits)
+  };
+
+
+  static void Pad(std::string& target)
+  {
+    while (target.size() % ALIGNMENT != 0)
+    {
+      target.push_back('\0');
+    }
+  }
+
+
+  template <typename T>
+  static void Append(std::string& target,
+                     const T& value)
+  {
+    target.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+
+  Writer::Writer(const std::string& indexName,
+                 uint32_t indexVersion,
+                 int64_t changeSequence) :
+    indexName_(indexName),
+    indexVersion_(indexVersion),
+    changeSequence_(changeSequence)
+  {
+    if (indexName.size() >= MAX_INDEX_NAME_SIZE)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Index name too long: " + indexName);
+    }
+  }
+
+
+  Writer::Section& Writer::AddSection(uint32_t id,
+                                      SectionKind kind,
+                                      uint64_t count)
+  {
+    for (size_t i = 0; i < sections_.size(); i++)
+    {
+      if (sections_[i].id_ == id)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Duplicate snapshot section");
+      }
+    }
+
+    sections_.push_back(Section());
+    sections_.back().id_ = id;
+    sections_.back().kind_ = kind;
+    sections_.back().count_ = count;
+    return sections_.back();
+  }
+
+
+  void Writer::AddStrings(uint32_t id,
+                          const std::vector<std::string>& values)
+  {
+    Section& section = AddSection(id, SectionKind_Strings, values.size());
+
+    uint64_t offset = 0;
+    Append(section.data_, offset);
+    for (size_t i = 0; i < values.size(); i++)
+    {
+      offset += values[i].size();
+      Append(section.data_, offset);
+    }
+
+    for (size_t i = 0; i < values.size(); i++)
+    {
+      section.data_.append(values[i]);
+    }
+  }
+
+
+  void Writer::AddUInt32Array(uint32_t id,
+                              const std::vector<uint32_t>& values)
+  {
+    Section& section = AddSection(id, SectionKind_UInt32Array, values.size());
+
+    if (!values.empty())
+    {
+      section.data_.assign(reinterpret_cast<const char*>(&values[0]), values.size() * sizeof(uint32_t));
+    }
+  }
+
+
+  void Writer::AddPostingLists(uint32_t id,
+                               const std::vector<std::vector<uint32_t> >& lists)
+  {
+    Section& section = AddSection(id, SectionKind_PostingLists, lists.size());
+
+    uint64_t offset = 0;
+    Append(section.data_, offset);
+    for (size_t i = 0; i < lists.size(); i++)
+    {
+      offset += lists[i].size();
+      Append(section.data_, offset);
+    }
+
+    for (size_t i = 0; i < lists.size(); i++)
+    {
+      if (!lists[i].empty())
+      {
+        section.data_.append(reinterpret_cast<const char*>(&lists[i][0]), lists[i].size() * sizeof(uint32_t));
+      }
+    }
+  }
+
+
+  void Writer::AddBitmap(uint32_t id,
+                         const std::vector<bool>& bits)
+  {
+    Section& section = AddSection(id, SectionKind_Bitmap, bits.size());
+
+    std::vector<uint64_t> words((bits.size() + 63) / 64, 0);
+    for (size_t i = 0; i < bits.size(); i++)
+    {
+      if (bits[i])
+      {
+        words[i / 64] |= (static_cast<uint64_t>(1) << (i % 64));
+      }
+    }
+
+    if (!words.empty())
+    {
+      section.data_.assign(reinterpret_cast<const char*>(&words[0]), words.size() * sizeof(uint64_t));
+    }
+  }
+
+
+  void Writer::WriteAtomically(const std::string& path) const
+  {
+    std::string content;
+
+    // the header and the section table are written first, with the final offsets
+    uint64_t offset = sizeof(FileHeader) + sections_.size() * sizeof(SectionInfo);
+    uint64_t fileSize = offset;
+
+    for (size_t i = 0; i < sections_.size(); i++)
+    {
+      fileSize += sections_[i].data_.size();
+      fileSize += (ALIGNMENT - sections_[i].data_.size() % ALIGNMENT) % ALIGNMENT;
+    }
+
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic_, MAGIC, sizeof(MAGIC));
+    header.formatVersion_ = FORMAT_VERSION;
+    header.endiannessMarker_ = ENDIANNESS_MARKER;
+    header.indexVersion_ = indexVersion_;
+    header.sectionsCount_ = static_cast<uint32_t>(sections_.size());
+    header.changeSequence_ = changeSequence_;
+    header.fileSize_ = fileSize;
+    memcpy(header.indexName_, indexName_.c_str(), indexName_.size());
+
+    content.reserve(fileSize);
+    Append(content, header);
+
+    for (size_t i = 0; i < sections_.size(); i++)
+    {
+      SectionInfo info;
+      info.id_ = sections_[i].id_;
+      info.kind_ = sections_[i].kind_;
+      info.offset_ = offset;
+      info.size_ = sections_[i].data_.size();
+      info.count_ = sections_[i].count_;
+      Append(content, info);
+
+      offset += sections_[i].data_.size();
+      offset += (ALIGNMENT - sections_[i].data_.size() % ALIGNMENT) % ALIGNMENT;
+    }
+
+    for (size_t i = 0; i < sections_.size(); i++)
+    {
+      content.append(sections_[i].data_);
+      Pad(content);
+    }
+
+    assert(content.size() == fileSize);
+
+    const std::string temporaryPath = path + ".tmp";
+
+    FILE* fp = fopen(temporaryPath.c_str(), "wb");
+    if (fp == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile, "Unable to write the index snapshot: " + temporaryPath);
+    }
+
+    bool success = (fwrite(content.c_str(), 1, content.size(), fp) == content.size() &&
+                    fflush(fp) == 0);
+
+#if !defined(_WIN32)
+    success = success && (fsync(fileno(fp)) == 0);  // the rename must not be persisted before the content
+#endif
+
+    success = (fclose(fp) == 0) && success;
+
+    if (!success)
+    {
+      boost::filesystem::remove(temporaryPath);
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile, "Unable to write the index snapshot: " + temporaryPath);
+    }
+
+    boost::filesystem::rename(temporaryPath, path);
+  }
+
+
+  Reader::Reader(const std::string& path) :
+    data_(NULL),
+    size_(0),
+    indexVersion_(0),
+    changeSequence_(0)
+  {
+    Map(path);
+
+    try
+    {
+      if (size_ < sizeof(FileHeader))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Index snapshot too small: " + path);
+      }
+
+      const FileHeader* header = reinterpret_cast<const FileHeader*>(data_);
+
+      if (memcmp(header->magic_, MAGIC, sizeof(MAGIC)) != 0 ||
+          header->formatVersion_ != FORMAT_VERSION ||
+          header->endiannessMarker_ != ENDIANNESS_MARKER ||
+          header->fileSize_ != size_ ||
+          header->indexName_[MAX_INDEX_NAME_SIZE - 1] != '\0')
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Invalid or incompatible index snapshot: " + path);
+      }
+
+      indexName_ = header->indexName_;
+      indexVersion_ = header->indexVersion_;
+      changeSequence_ = header->changeSequence_;
+
+      const uint64_t tableEnd = sizeof(FileHeader) + static_cast<uint64_t>(header->sectionsCount_) * sizeof(SectionInfo);
+      if (tableEnd > size_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Invalid index snapshot: " + path);
+      }
+
+      for (uint32_t i = 0; i < header->sectionsCount_; i++)
+      {
+        const SectionInfo* section = reinterpret_cast<const SectionInfo*>(data_ + sizeof(FileHeader)) + i;
+
+        if (section->offset_ < tableEnd ||
+            section->offset_ % ALIGNMENT != 0 ||
+            section->size_ > size_ ||
+            section->offset_ > size_ - section->size_)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Invalid section in index snapshot: " + path);
+        }
+
+        sections_.push_back(section);
+      }
+    }
+    catch (Orthanc::OrthancException&)
+    {
+#if !defined(_WIN32)
+      munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+      throw;
+    }
+  }
+
+
+  Reader::~Reader()
+  {
+#if !defined(_WIN32)
+    if (data_ != NULL && size_ > 0)
+    {
+      munmap(const_cast<uint8_t*>(data_), size_);
+    }
+#endif
+  }
+
+
+  void Reader::Map(const std::string& path)
+  {
+#if defined(_WIN32)
+    Orthanc::SystemToolbox::ReadFile(fallbackContent_, path);
+    data_ = reinterpret_cast<const uint8_t*>(fallbackContent_.c_str());
+    size_ = fallbackContent_.size();
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile, "Unable to open the index snapshot: " + path);
+    }
+
+    struct stat s;
+    if (fstat(fd, &s) != 0 || s.st_size == 0)
+    {
+      close(fd);
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Unable to read the index snapshot: " + path);
+    }
+
+    void* mapped = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  // the mapping remains valid
+
+    if (mapped == MAP_FAILED)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Unable to map the index snapshot: " + path);
+    }
+
+    data_ = reinterpret_cast<const uint8_t*>(mapped);
+    size_ = static_cast<uint64_t>(s.st_size);
+#endif
+  }
+
+
+  bool Reader::HasSection(uint32_t id) const
+  {
+    for (size_t i = 0; i < sections_.size(); i++)
+    {
+      if (sections_[i]->id_ == id)
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  const SectionInfo& Reader::GetSection(uint32_t id,
+                                                SectionKind kind) const
+  {
+    for (size_t i = 0; i < sections_.size(); i++)
+    {
+      if (sections_[i]->id_ == id)
+      {
+        if (sections_[i]->kind_ != static_cast<uint32_t>(kind))
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Unexpected kind of snapshot section");
+        }
+
+        if (sections_[i]->count_ / 8 > size_)  // prevents overflows when computing the sizes from a corrupted count
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Invalid snapshot section");
+        }
+
+        return *sections_[i];
+      }
+    }
+
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem, "Missing snapshot section");
+  }
+
+
+  const uint8_t* Reader::GetSectionData(const SectionInfo& section,
+                                        uint64_t minimalSize) const
+  {
+    if (section.size_ < minimalSize)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Truncated snapshot section");
+    }
+
+    return data_ + section.offset_;
+  }
+
+
+  // The offsets of the strings and of the posting lists must start at 0, never decrease and stay in the section.
+  // Otherwise, a corrupted snapshot would read outside of the mapped file.
+  static void CheckOffsets(const uint64_t* offsets,
+                           uint64_t count,
+                           uint64_t limit)
+  {
+    if (offsets[0] != 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Invalid offsets in snapshot section");
+    }
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+      if (offsets[i + 1] < offsets[i])
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Invalid offsets in snapshot section");
+      }
+    }
+
+    if (offsets[count] > limit)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Truncated snapshot section");
+    }
+  }
+
+
+  StringsView Reader::GetStrings(uint32_t id) const
+  {
+    const SectionInfo& section = GetSection(id, SectionKind_Strings);
+    const uint64_t offsetsSize = (section.count_ + 1) * sizeof(uint64_t);
+    const uint8_t* data = GetSectionData(section, offsetsSize);
+    const uint64_t* offsets = reinterpret_cast<const uint64_t*>(data);
+
+    CheckOffsets(offsets, section.count_, section.size_ - offsetsSize);
+
+    return StringsView(offsets, reinterpret_cast<const char*>(data + offsetsSize), section.count_);
+  }
+
+
+  UInt32ArrayView Reader::GetUInt32Array(uint32_t id) const
+  {
+    const SectionInfo& section = GetSection(id, SectionKind_UInt32Array);
+    const uint8_t* data = GetSectionData(section, section.count_ * sizeof(uint32_t));
+    return UInt32ArrayView(reinterpret_cast<const uint32_t*>(data), section.count_);
+  }
+
+
+  PostingListsView Reader::GetPostingLists(uint32_t id) const
+  {
+    const SectionInfo& section = GetSection(id, SectionKind_PostingLists);
+    const uint64_t offsetsSize = (section.count_ + 1) * sizeof(uint64_t);
+    const uint8_t* data = GetSectionData(section, offsetsSize);
+    const uint64_t* offsets = reinterpret_cast<const uint64_t*>(data);
+
+    CheckOffsets(offsets, section.count_, (section.size_ - offsetsSize) / sizeof(uint32_t));
+
+    return PostingListsView(offsets, reinterpret_cast<const uint32_t*>(data + offsetsSize), section.count_);
+  }
+
+
+  BitmapView Reader::GetBitmap(uint32_t id) const
+  {
+    const SectionInfo& section = GetSection(id, SectionKind_Bitmap);
+    const uint8_t* data = GetSectionData(section, (section.count_ + 63) / 64 * sizeof(uint64_t));
+    return BitmapView(reinterpret_cast<const uint64_t*>(data), section.count_);
+  }
+}
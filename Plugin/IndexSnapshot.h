@@ -0,0 +1,269 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+// A versioned on-disk snapshot of a plugin index.  The file is opened with mmap at startup and the sections are
+// stored in their in-memory layout: an index copies them in its own structures without parsing them.
+// Layout (native endianness, 8 bytes aligned):
+//
+//   FileHeader | SectionHeader[sectionsCount] | section data ...
+//
+// Section kinds:
+//  - Strings:      uint64 offsets[count + 1] | bytes                  (a string arena)
+//  - UInt32Array:  uint32 values[count]
+//  - PostingLists: uint64 offsets[count + 1] | uint32 values[...]     (list i = values[offsets[i] .. offsets[i+1]])
+//  - Bitmap:       uint64 words[(count + 63) / 64]                     (count = number of bits)
+namespace IndexSnapshot
+{
+  struct SectionInfo;
+
+  enum SectionKind
+  {
+    SectionKind_Strings = 1,
+    SectionKind_UInt32Array = 2,
+    SectionKind_PostingLists = 3,
+    SectionKind_Bitmap = 4
+  };
+
+
+  class Writer : public boost::noncopyable
+  {
+  private:
+    struct Section
+    {
+      uint32_t     id_;
+      SectionKind  kind_;
+      uint64_t     count_;
+      std::string  data_;
+    };
+
+    std::string           indexName_;
+    uint32_t              indexVersion_;
+    int64_t               changeSequence_;
+    std::vector<Section>  sections_;
+
+    Section& AddSection(uint32_t id,
+                        SectionKind kind,
+                        uint64_t count);
+
+  public:
+    // 'changeSequence' is the last Orthanc change reflected in the index content
+    Writer(const std::string& indexName,
+           uint32_t indexVersion,
+           int64_t changeSequence);
+
+    void AddStrings(uint32_t id,
+                    const std::vector<std::string>& values);
+
+    void AddUInt32Array(uint32_t id,
+                        const std::vector<uint32_t>& values);
+
+    void AddPostingLists(uint32_t id,
+                         const std::vector<std::vector<uint32_t> >& lists);
+
+    void AddBitmap(uint32_t id,
+                   const std::vector<bool>& bits);
+
+    // writes a temporary file and renames it: a crash never leaves a partial snapshot
+    void WriteAtomically(const std::string& path) const;
+  };
+
+
+  class StringsView
+  {
+  private:
+    const uint64_t*  offsets_;
+    const char*      bytes_;
+    uint64_t         count_;
+
+  public:
+    StringsView() : offsets_(NULL), bytes_(NULL), count_(0)
+    {
+    }
+
+    StringsView(const uint64_t* offsets, const char* bytes, uint64_t count) :
+      offsets_(offsets), bytes_(bytes), count_(count)
+    {
+    }
+
+    uint64_t GetCount() const
+    {
+      return count_;
+    }
+
+    std::string GetString(uint64_t index) const
+    {
+      return std::string(bytes_ + offsets_[index], bytes_ + offsets_[index + 1]);
+    }
+  };
+
+
+  class UInt32ArrayView
+  {
+  private:
+    const uint32_t*  values_;
+    uint64_t         count_;
+
+  public:
+    UInt32ArrayView() : values_(NULL), count_(0)
+    {
+    }
+
+    UInt32ArrayView(const uint32_t* values, uint64_t count) :
+      values_(values), count_(count)
+    {
+    }
+
+    uint64_t GetCount() const
+    {
+      return count_;
+    }
+
+    uint32_t operator[] (uint64_t index) const
+    {
+      return values_[index];
+    }
+
+    const uint32_t* GetData() const
+    {
+      return values_;
+    }
+  };
+
+
+  class PostingListsView
+  {
+  private:
+    const uint64_t*  offsets_;
+    const uint32_t*  values_;
+    uint64_t         count_;
+
+  public:
+    PostingListsView() : offsets_(NULL), values_(NULL), count_(0)
+    {
+    }
+
+    PostingListsView(const uint64_t* offsets, const uint32_t* values, uint64_t count) :
+      offsets_(offsets), values_(values), count_(count)
+    {
+    }
+
+    uint64_t GetCount() const
+    {
+      return count_;
+    }
+
+    UInt32ArrayView GetList(uint64_t index) const
+    {
+      return UInt32ArrayView(values_ + offsets_[index], offsets_[index + 1] - offsets_[index]);
+    }
+  };
+
+
+  class BitmapView
+  {
+  private:
+    const uint64_t*  words_;
+    uint64_t         count_;
+
+  public:
+    BitmapView() : words_(NULL), count_(0)
+    {
+    }
+
+    BitmapView(const uint64_t* words, uint64_t count) :
+      words_(words), count_(count)
+    {
+    }
+
+    uint64_t GetCount() const
+    {
+      return count_;
+    }
+
+    bool IsSet(uint64_t index) const
+    {
+      return (words_[index / 64] >> (index % 64)) & 1;
+    }
+  };
+
+
+  // The views returned by the reader are only valid as long as the reader exists
+  class Reader : public boost::noncopyable
+  {
+  private:
+    const uint8_t*  data_;
+    uint64_t        size_;
+    std::string     fallbackContent_;  // when mmap is not available
+    std::string     indexName_;
+    uint32_t        indexVersion_;
+    int64_t         changeSequence_;
+    std::vector<const SectionInfo*>  sections_;
+
+    void Map(const std::string& path);
+
+    const SectionInfo& GetSection(uint32_t id,
+                                  SectionKind kind) const;
+
+    const uint8_t* GetSectionData(const SectionInfo& section,
+                                  uint64_t minimalSize) const;
+
+  public:
+    // throws if the file is not a valid snapshot
+    explicit Reader(const std::string& path);
+
+    ~Reader();
+
+    const std::string& GetIndexName() const
+    {
+      return indexName_;
+    }
+
+    uint32_t GetIndexVersion() const
+    {
+      return indexVersion_;
+    }
+
+    int64_t GetChangeSequence() const
+    {
+      return changeSequence_;
+    }
+
+    bool HasSection(uint32_t id) const;
+
+    StringsView GetStrings(uint32_t id) const;
+
+    UInt32ArrayView GetUInt32Array(uint32_t id) const;
+
+    PostingListsView GetPostingLists(uint32_t id) const;
+
+    BitmapView GetBitmap(uint32_t id) const;
+  };
+}
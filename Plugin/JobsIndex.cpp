@@ -0,0 +1,395 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "JobsIndex.h"
+
+#include "StringDictionary.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <algorithm>
+
+
+static const unsigned int ACTIVE_JOBS_REFRESH_INTERVAL = 1000;  // in ms, the panel may be polled by several admins
+static const char CURSOR_SEPARATOR = '/';
+
+
+JobsIndex::JobsIndex(AsyncRestClient& restClient) :
+  restClient_(restClient),
+  maxJobs_(10000)
+{
+}
+
+
+void JobsIndex::Configure(const Json::Value& configuration)
+{
+  if (configuration.isObject() &&
+      configuration.isMember("MaxJobs"))
+  {
+    maxJobs_ = std::max(1u, configuration["MaxJobs"].asUInt());
+  }
+}
+
+
+bool JobsIndex::IsCompleted(uint32_t state)
+{
+  static const uint32_t SUCCESS = StringDictionary::GetShared().Intern("Success");
+  static const uint32_t FAILURE = StringDictionary::GetShared().Intern("Failure");
+
+  return (state == SUCCESS ||
+          state == FAILURE);
+}
+
+
+static std::string GetStringMember(const Json::Value& value,
+                                   const char* member)
+{
+  if (value.isObject() &&
+      value.isMember(member) &&
+      value[member].isString())
+  {
+    return value[member].asString();
+  }
+  else
+  {
+    return "";
+  }
+}
+
+
+void JobsIndex::ParseJob(JobSummary& target,
+                         const Json::Value& job)
+{
+  StringDictionary& dictionary = StringDictionary::GetShared();
+
+  target.id_ = GetStringMember(job, "ID");
+  target.type_ = dictionary.Intern(GetStringMember(job, "Type"));
+  target.state_ = dictionary.Intern(GetStringMember(job, "State"));
+  target.progress_ = (job["Progress"].isNumeric() ? job["Progress"].asUInt() : 0);
+  target.creationTime_ = GetStringMember(job, "CreationTime");
+  target.completionTime_ = GetStringMember(job, "CompletionTime");
+  target.errorCode_ = (job["ErrorCode"].isNumeric() ? job["ErrorCode"].asInt() : 0);
+  target.errorDescription_ = GetStringMember(job, "ErrorDescription");
+
+  const Json::Value& content = job["Content"];
+
+  std::string creator = GetStringMember(job, "UserData");
+  if (creator.empty())
+  {
+    creator = GetStringMember(content, "UserData");
+  }
+
+  target.creator_ = dictionary.Intern(creator);
+
+  // C-MOVE: the destination is "TargetAet", C-STORE: "RemoteAet", peers: "Peer" (a list of URLs)
+  std::string destination = GetStringMember(content, "TargetAet");
+  if (destination.empty())
+  {
+    destination = GetStringMember(content, "RemoteAet");
+  }
+  if (destination.empty() &&
+      content.isObject() &&
+      content.isMember("Peer") &&
+      content["Peer"].isArray() &&
+      content["Peer"].size() > 0)
+  {
+    destination = content["Peer"][0].asString();
+  }
+
+  target.target_ = dictionary.Intern(destination);
+
+  target.description_ = GetStringMember(content, "Description");
+}
+
+
+void JobsIndex::Store(const JobSummary& job)
+{
+  std::map<std::string, JobSummary>::iterator found = jobs_.find(job.id_);
+
+  if (found != jobs_.end())
+  {
+    sorted_.erase(SortKey(found->second.creationTime_, found->first));
+    found->second = job;
+  }
+  else
+  {
+    jobs_[job.id_] = job;
+  }
+
+  sorted_.insert(SortKey(job.creationTime_, job.id_));
+
+  // forget the oldest jobs (the active jobs are normally the most recent ones)
+  while (jobs_.size() > maxJobs_)
+  {
+    Remove(sorted_.begin()->second);
+  }
+}
+
+
+void JobsIndex::Remove(const std::string& jobId)
+{
+  std::map<std::string, JobSummary>::iterator found = jobs_.find(jobId);
+
+  if (found != jobs_.end())
+  {
+    sorted_.erase(SortKey(found->second.creationTime_, found->first));
+    jobs_.erase(found);
+  }
+}
+
+
+void JobsIndex::FetchJobs(const std::set<std::string>& jobIds)
+{
+  if (jobIds.empty())
+  {
+    return;
+  }
+
+  std::vector<std::string> ids(jobIds.begin(), jobIds.end());
+  std::vector<AsyncRestClient::Future> answers;
+  answers.reserve(ids.size());
+
+  for (size_t i = 0; i < ids.size(); i++)
+  {
+    answers.push_back(restClient_.Get("/jobs/" + ids[i], false));
+  }
+
+  AsyncRestClient::WaitAll(answers, restClient_.GetDefaultDeadline());
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  for (size_t i = 0; i < ids.size(); i++)
+  {
+    if (answers[i].GetStatus() != AsyncRestClient::Status_Success)
+    {
+      continue;  // keep the previous summary, the job will be fetched again at the next refresh
+    }
+
+    if (answers[i].IsFound())
+    {
+      JobSummary job;
+      ParseJob(job, answers[i].GetAnswer());
+
+      if (!job.id_.empty())
+      {
+        Store(job);
+      }
+    }
+    else
+    {
+      // The completed jobs are kept after they have left the Orthanc history, but a job that has disappeared
+      // before completion (e.g. deleted or lost at a restart) would otherwise stay "Running" forever
+      std::map<std::string, JobSummary>::const_iterator found = jobs_.find(ids[i]);
+      if (found != jobs_.end() &&
+          !IsCompleted(found->second.state_))
+      {
+        Remove(ids[i]);
+      }
+    }
+  }
+}
+
+
+void JobsIndex::Refresh(const Json::Value& liveJobIds)
+{
+  std::set<std::string> toFetch;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (Json::Value::ArrayIndex i = 0; i < liveJobIds.size(); i++)
+    {
+      const std::string id = liveJobIds[i].asString();
+      if (jobs_.find(id) == jobs_.end())
+      {
+        toFetch.insert(id);
+      }
+    }
+
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    if (lastActiveRefresh_.is_not_a_date_time() ||
+        now - lastActiveRefresh_ > boost::posix_time::milliseconds(ACTIVE_JOBS_REFRESH_INTERVAL))
+    {
+      lastActiveRefresh_ = now;
+
+      for (std::map<std::string, JobSummary>::const_iterator it = jobs_.begin(); it != jobs_.end(); ++it)
+      {
+        if (!IsCompleted(it->second.state_))
+        {
+          toFetch.insert(it->first);
+        }
+      }
+    }
+  }
+
+  FetchJobs(toFetch);
+}
+
+
+std::string JobsIndex::FormatCursor(const SortKey& key)
+{
+  return key.first + CURSOR_SEPARATOR + key.second;
+}
+
+
+bool JobsIndex::ParseCursor(SortKey& target,
+                            const std::string& cursor)
+{
+  size_t separator = cursor.find(CURSOR_SEPARATOR);
+
+  if (separator == std::string::npos)
+  {
+    return false;
+  }
+  else
+  {
+    target.first = cursor.substr(0, separator);
+    target.second = cursor.substr(separator + 1);
+    return true;
+  }
+}
+
+
+void JobsIndex::Find(std::vector<JobSummary>& target,
+                     std::string& next,
+                     const Query& query)
+{
+  target.clear();
+  next.clear();
+
+  // the values that have never been interned can not match any job
+  StringDictionary& dictionary = StringDictionary::GetShared();
+
+  std::set<uint32_t> states;
+  for (std::set<std::string>::const_iterator it = query.states_.begin(); it != query.states_.end(); ++it)
+  {
+    uint32_t id;
+    if (dictionary.Lookup(id, *it))
+    {
+      states.insert(id);
+    }
+  }
+
+  std::set<uint32_t> types;
+  for (std::set<std::string>::const_iterator it = query.types_.begin(); it != query.types_.end(); ++it)
+  {
+    uint32_t id;
+    if (dictionary.Lookup(id, *it))
+    {
+      types.insert(id);
+    }
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  // keyset pagination: the next page starts right after the last job of the previous one, even if
+  // jobs have been added or removed in the meantime
+  std::set<SortKey>::const_reverse_iterator it = sorted_.rbegin();
+
+  if (!query.cursor_.empty())
+  {
+    SortKey cursor;
+    if (!ParseCursor(cursor, query.cursor_))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Invalid jobs cursor: " + query.cursor_);
+    }
+
+    it = std::set<SortKey>::const_reverse_iterator(sorted_.lower_bound(cursor));
+  }
+
+  for (; it != sorted_.rend(); ++it)
+  {
+    const JobSummary& job = jobs_.find(it->second)->second;
+
+    if ((!query.states_.empty() && states.find(job.state_) == states.end()) ||
+        (!query.types_.empty() && types.find(job.type_) == types.end()))
+    {
+      continue;
+    }
+
+    if (target.size() == query.limit_)
+    {
+      next = FormatCursor(SortKey(target.back().creationTime_, target.back().id_));
+      return;
+    }
+
+    target.push_back(job);
+  }
+}
+
+
+void JobsIndex::Format(Json::Value& target,
+                       const JobSummary& job)
+{
+  const StringDictionary& dictionary = StringDictionary::GetShared();
+
+  target = Json::objectValue;
+  target["ID"] = job.id_;
+  target["Type"] = dictionary.GetString(job.type_);
+  target["State"] = dictionary.GetString(job.state_);
+  target["Progress"] = job.progress_;
+  target["CreationTime"] = job.creationTime_;
+  target["CompletionTime"] = job.completionTime_;
+  target["ErrorCode"] = job.errorCode_;
+  target["ErrorDescription"] = job.errorDescription_;
+  target["Creator"] = dictionary.GetString(job.creator_);
+  target["Target"] = dictionary.GetString(job.target_);
+  target["Description"] = job.description_;
+}
+
+
+void JobsIndex::HandleChanges(const std::vector<ChangesPipeline::Change>& changes)
+{
+  std::set<std::string> toFetch;
+
+  for (size_t i = 0; i < changes.size(); i++)
+  {
+    switch (changes[i].changeType_)
+    {
+      case OrthancPluginChangeType_JobSubmitted:
+      case OrthancPluginChangeType_JobSuccess:
+      case OrthancPluginChangeType_JobFailure:
+        toFetch.insert(changes[i].resourceId_);
+        break;
+
+      case OrthancPluginChangeType_OrthancStarted:
+      {
+        // the jobs that have been reloaded from the Orthanc DB
+        Json::Value liveJobIds;
+        if (OrthancPlugins::RestApiGet(liveJobIds, "/jobs", false))
+        {
+          Refresh(liveJobIds);
+        }
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+
+  FetchJobs(toFetch);
+}
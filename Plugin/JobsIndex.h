@@ -0,0 +1,121 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "AsyncRestClient.h"
+#include "ChangesPipeline.h"
+
+#include <json/value.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+// A compact summary of the Orthanc jobs for the "all jobs" panel.  '/jobs?expand' returns the full content of every
+// job; this index only keeps the fields that are displayed and is paginated.  The jobs are fetched one by one when
+// they are submitted or completed (job events) and the summaries are kept after Orthanc has removed the jobs from
+// its history ("JobsHistorySize"), so that the panel can browse a longer history.
+// The jobs that are not completed yet (pending, running, paused, retry) have no event for their progress and state
+// changes: they are refreshed before each query.
+// The fields that take a few distinct values (type, state, creator, target) are interned in the shared
+// StringDictionary.
+class JobsIndex : public ChangesPipeline::IConsumer
+{
+public:
+  struct JobSummary
+  {
+    std::string   id_;
+    uint32_t      type_;            // id in the shared StringDictionary
+    uint32_t      state_;           // id in the shared StringDictionary
+    unsigned int  progress_;
+    std::string   creationTime_;    // ISO format from Orthanc, e.g. "20240216T103015.123456"
+    std::string   completionTime_;  // empty if not completed
+    int           errorCode_;
+    std::string   errorDescription_;
+    uint32_t      creator_;         // the "UserData" of the job if it is a string (id in the shared StringDictionary)
+    uint32_t      target_;          // the destination of the transfers: modality AET, peer, ... (id in the shared StringDictionary)
+    std::string   description_;
+  };
+
+  struct Query
+  {
+    std::set<std::string>  states_;  // empty = all
+    std::set<std::string>  types_;   // empty = all
+    std::string            cursor_;  // empty = the first page
+    unsigned int           limit_;
+  };
+
+private:
+  typedef std::pair<std::string, std::string>  SortKey;  // (creation time, id): the pages are sorted from the newest job
+
+  AsyncRestClient&                    restClient_;
+  size_t                              maxJobs_;
+  boost::mutex                        mutex_;
+  std::map<std::string, JobSummary>   jobs_;     // by job id
+  std::set<SortKey>                   sorted_;
+  boost::posix_time::ptime            lastActiveRefresh_;
+
+  static bool IsCompleted(uint32_t state);
+
+  static void ParseJob(JobSummary& target,
+                       const Json::Value& job);
+
+  // must be called with the mutex locked
+  void Store(const JobSummary& job);
+
+  // must be called with the mutex locked
+  void Remove(const std::string& jobId);
+
+  // fetches '/jobs/{id}' concurrently, the jobs that do not exist anymore are removed if they are not completed
+  void FetchJobs(const std::set<std::string>& jobIds);
+
+  static std::string FormatCursor(const SortKey& key);
+
+  static bool ParseCursor(SortKey& target,
+                          const std::string& cursor);
+
+public:
+  explicit JobsIndex(AsyncRestClient& restClient);
+
+  void Configure(const Json::Value& configuration);
+
+  // 'liveJobIds' is the answer of '/jobs': the jobs that are not in the index yet are fetched (e.g. some job events
+  // have been dropped) together with the jobs that are not completed
+  void Refresh(const Json::Value& liveJobIds);
+
+  // 'next' is empty on the last page
+  void Find(std::vector<JobSummary>& target,
+            std::string& next,
+            const Query& query);
+
+  static void Format(Json::Value& target,
+                     const JobSummary& job);
+
+  virtual void HandleChanges(const std::vector<ChangesPipeline::Change>& changes);
+};
@@ -0,0 +1,623 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "JsonScanner.h"
+
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <stdlib.h>
+#include <string.h>
+
+
+namespace JsonScanner
+{
+  static void ThrowInvalid()
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Invalid JSON document");
+  }
+
+
+  static const char* SkipWhitespaces(const char* p,
+                                     const char* end)
+  {
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+    {
+      p++;
+    }
+
+    return p;
+  }
+
+
+  // 'p' is on the opening quote, returns the position after the closing quote
+  static const char* SkipString(const char* p,
+                                const char* end)
+  {
+    p++;
+
+    for (;;)
+    {
+      const char* quote = reinterpret_cast<const char*>(memchr(p, '"', end - p));
+      if (quote == NULL)
+      {
+        ThrowInvalid();
+      }
+
+      // the quote is escaped if it is preceded by an odd number of backslashes
+      size_t backslashes = 0;
+      while (quote - backslashes > p && quote[-1 - static_cast<ptrdiff_t>(backslashes)] == '\\')
+      {
+        backslashes++;
+      }
+
+      if (backslashes % 2 == 0)
+      {
+        return quote + 1;
+      }
+
+      p = quote + 1;
+    }
+  }
+
+
+  static const char* SkipValue(const char* p,
+                               const char* end)
+  {
+    if (p >= end)
+    {
+      ThrowInvalid();
+    }
+
+    if (*p == '"')
+    {
+      return SkipString(p, end);
+    }
+    else if (*p == '{' || *p == '[')
+    {
+      // the nested values are not validated, only the brackets outside of the strings are counted
+      unsigned int depth = 0;
+
+      while (p < end)
+      {
+        switch (*p)
+        {
+          case '"':
+            p = SkipString(p, end);
+            continue;
+
+          case '{':
+          case '[':
+            depth++;
+            break;
+
+          case '}':
+          case ']':
+            depth--;
+            if (depth == 0)
+            {
+              return p + 1;
+            }
+            break;
+
+          default:
+            break;
+        }
+
+        p++;
+      }
+
+      ThrowInvalid();
+      return NULL;  // never reached
+    }
+    else
+    {
+      // literal or number
+      while (p < end && *p != ',' && *p != '}' && *p != ']' &&
+             *p != ' ' && *p != '\n' && *p != '\r' && *p != '\t')
+      {
+        p++;
+      }
+
+      return p;
+    }
+  }
+
+
+  static void AppendUtf8(std::string& target,
+                         uint32_t codepoint)
+  {
+    if (codepoint < 0x80)
+    {
+      target.push_back(static_cast<char>(codepoint));
+    }
+    else if (codepoint < 0x800)
+    {
+      target.push_back(static_cast<char>(0xc0 | (codepoint >> 6)));
+      target.push_back(static_cast<char>(0x80 | (codepoint & 0x3f)));
+    }
+    else if (codepoint < 0x10000)
+    {
+      target.push_back(static_cast<char>(0xe0 | (codepoint >> 12)));
+      target.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f)));
+      target.push_back(static_cast<char>(0x80 | (codepoint & 0x3f)));
+    }
+    else
+    {
+      target.push_back(static_cast<char>(0xf0 | (codepoint >> 18)));
+      target.push_back(static_cast<char>(0x80 | ((codepoint >> 12) & 0x3f)));
+      target.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3f)));
+      target.push_back(static_cast<char>(0x80 | (codepoint & 0x3f)));
+    }
+  }
+
+
+  static uint32_t ReadHex4(const char* p,
+                           const char* end)
+  {
+    if (end - p < 4)
+    {
+      ThrowInvalid();
+    }
+
+    uint32_t value = 0;
+    for (unsigned int i = 0; i < 4; i++)
+    {
+      const char c = p[i];
+      value <<= 4;
+
+      if (c >= '0' && c <= '9')
+      {
+        value |= c - '0';
+      }
+      else if (c >= 'a' && c <= 'f')
+      {
+        value |= c - 'a' + 10;
+      }
+      else if (c >= 'A' && c <= 'F')
+      {
+        value |= c - 'A' + 10;
+      }
+      else
+      {
+        ThrowInvalid();
+      }
+    }
+
+    return value;
+  }
+
+
+  Value::Value() :
+    begin_(NULL),
+    end_(NULL)
+  {
+  }
+
+
+  Value::Value(const char* begin,
+               const char* end) :
+    begin_(SkipWhitespaces(begin, end)),
+    end_(end)
+  {
+    if (begin_ >= end_)
+    {
+      ThrowInvalid();
+    }
+  }
+
+
+  const char* Value::Skip() const
+  {
+    return SkipValue(begin_, end_);
+  }
+
+
+  Type Value::GetType() const
+  {
+    switch (*begin_)
+    {
+      case 'n':
+        return Type_Null;
+
+      case 't':
+      case 'f':
+        return Type_Boolean;
+
+      case '"':
+        return Type_String;
+
+      case '[':
+        return Type_Array;
+
+      case '{':
+        return Type_Object;
+
+      default:
+        return Type_Number;
+    }
+  }
+
+
+  bool Value::GetBoolean() const
+  {
+    if (GetType() != Type_Boolean)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "JSON value is not a boolean");
+    }
+
+    return *begin_ == 't';
+  }
+
+
+  int64_t Value::GetInteger() const
+  {
+    if (GetType() != Type_Number)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "JSON value is not a number");
+    }
+
+    try
+    {
+      return boost::lexical_cast<int64_t>(std::string(begin_, Skip()));
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      // e.g. "1.0" or "1e3"
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "JSON value is not an integer");
+    }
+  }
+
+
+  uint64_t Value::GetUnsigned() const
+  {
+    if (GetType() != Type_Number)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "JSON value is not a number");
+    }
+
+    // boost::lexical_cast would accept a negative value and wrap it around
+    if (*begin_ == '-')
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "JSON value is not an unsigned integer");
+    }
+
+    try
+    {
+      return boost::lexical_cast<uint64_t>(std::string(begin_, Skip()));
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      // e.g. "1.0" or "1e3"
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "JSON value is not an unsigned integer");
+    }
+  }
+
+
+  double Value::GetDouble() const
+  {
+    if (GetType() != Type_Number)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "JSON value is not a number");
+    }
+
+    const std::string s(begin_, Skip());  // the document is not null-terminated
+    return strtod(s.c_str(), NULL);
+  }
+
+
+  std::string Value::GetString() const
+  {
+    if (GetType() != Type_String)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "JSON value is not a string");
+    }
+
+    const char* end = Skip() - 1;  // the closing quote
+    const char* p = begin_ + 1;
+
+    std::string result;
+    result.reserve(end - p);
+
+    while (p < end)
+    {
+      const char* backslash = reinterpret_cast<const char*>(memchr(p, '\\', end - p));
+      if (backslash == NULL)
+      {
+        result.append(p, end - p);
+        break;
+      }
+
+      result.append(p, backslash - p);
+      p = backslash + 1;
+
+      if (p >= end)
+      {
+        ThrowInvalid();
+      }
+
+      switch (*p)
+      {
+        case '"':  result.push_back('"');  break;
+        case '\\': result.push_back('\\'); break;
+        case '/':  result.push_back('/');  break;
+        case 'b':  result.push_back('\b'); break;
+        case 'f':  result.push_back('\f'); break;
+        case 'n':  result.push_back('\n'); break;
+        case 'r':  result.push_back('\r'); break;
+        case 't':  result.push_back('\t'); break;
+
+        case 'u':
+        {
+          uint32_t codepoint = ReadHex4(p + 1, end);
+          p += 4;
+
+          if (codepoint >= 0xd800 && codepoint < 0xdc00 &&  // surrogate pair
+              end - p >= 7 && p[1] == '\\' && p[2] == 'u')
+          {
+            const uint32_t low = ReadHex4(p + 3, end);
+            if (low >= 0xdc00 && low < 0xe000)
+            {
+              codepoint = 0x10000 + ((codepoint - 0xd800) << 10) + (low - 0xdc00);
+              p += 6;
+            }
+          }
+
+          AppendUtf8(result, codepoint);
+          break;
+        }
+
+        default:
+          ThrowInvalid();
+      }
+
+      p++;
+    }
+
+    return result;
+  }
+
+
+  bool Value::IsString(const std::string& value) const
+  {
+    if (GetType() != Type_String)
+    {
+      return false;
+    }
+
+    const char* end = Skip() - 1;
+    const char* content = begin_ + 1;
+    const size_t size = end - content;
+
+    if (memchr(content, '\\', size) == NULL)
+    {
+      return (size == value.size() &&
+              memcmp(content, value.c_str(), size) == 0);
+    }
+    else
+    {
+      return GetString() == value;
+    }
+  }
+
+
+  bool Value::LookupMember(Value& target,
+                           const std::string& key) const
+  {
+    if (GetType() != Type_Object)
+    {
+      return false;
+    }
+
+    ObjectReader reader(*this);
+
+    Value memberKey, memberValue;
+    while (reader.Next(memberKey, memberValue))
+    {
+      if (memberKey.IsString(key))
+      {
+        target = memberValue;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  std::string Value::GetStringMember(const std::string& key) const
+  {
+    Value member;
+    if (LookupMember(member, key) &&
+        member.GetType() == Type_String)
+    {
+      return member.GetString();
+    }
+    else
+    {
+      return "";
+    }
+  }
+
+
+  size_t Value::GetArraySize() const
+  {
+    ArrayReader reader(*this);
+
+    size_t count = 0;
+
+    Value item;
+    while (reader.Next(item))
+    {
+      count++;
+    }
+
+    return count;
+  }
+
+
+  void Value::ToJson(Json::Value& target) const
+  {
+    const char* end = Skip();
+    if (!OrthancPlugins::ReadJson(target, begin_, end - begin_))
+    {
+      ThrowInvalid();
+    }
+  }
+
+
+  ArrayReader::ArrayReader(const Value& array) :
+    isFirst_(true)
+  {
+    if (array.GetType() != Type_Array)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "JSON value is not an array");
+    }
+
+    current_ = array.begin_ + 1;
+    end_ = array.end_;
+  }
+
+
+  bool ArrayReader::Next(Value& item)
+  {
+    current_ = SkipWhitespaces(current_, end_);
+
+    if (current_ >= end_)
+    {
+      ThrowInvalid();
+    }
+    else if (*current_ == ']')
+    {
+      return false;
+    }
+
+    if (!isFirst_)
+    {
+      if (*current_ != ',')
+      {
+        ThrowInvalid();
+      }
+
+      current_++;
+    }
+
+    isFirst_ = false;
+    item = Value(current_, end_);
+    current_ = item.Skip();
+    return true;
+  }
+
+
+  ObjectReader::ObjectReader(const Value& object) :
+    isFirst_(true)
+  {
+    if (object.GetType() != Type_Object)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "JSON value is not an object");
+    }
+
+    current_ = object.begin_ + 1;
+    end_ = object.end_;
+  }
+
+
+  bool ObjectReader::Next(Value& key,
+                          Value& value)
+  {
+    current_ = SkipWhitespaces(current_, end_);
+
+    if (current_ >= end_)
+    {
+      ThrowInvalid();
+    }
+    else if (*current_ == '}')
+    {
+      return false;
+    }
+
+    if (!isFirst_)
+    {
+      if (*current_ != ',')
+      {
+        ThrowInvalid();
+      }
+
+      current_++;
+    }
+
+    isFirst_ = false;
+
+    key = Value(current_, end_);
+    if (key.GetType() != Type_String)
+    {
+      ThrowInvalid();
+    }
+
+    current_ = SkipWhitespaces(key.Skip(), end_);
+    if (current_ >= end_ ||
+        *current_ != ':')
+    {
+      ThrowInvalid();
+    }
+
+    value = Value(current_ + 1, end_);
+    current_ = value.Skip();
+    return true;
+  }
+
+
+  bool Document::RestApiGet(const std::string& uri,
+                            bool applyPlugins)
+  {
+    return buffer_.RestApiGet(uri, applyPlugins);
+  }
+
+
+  bool Document::RestApiGet(const std::string& uri,
+                            const std::map<std::string, std::string>& httpHeaders,
+                            bool applyPlugins)
+  {
+    return buffer_.RestApiGet(uri, httpHeaders, applyPlugins);
+  }
+
+
+  Value Document::GetRoot() const
+  {
+    return JsonScanner::GetRoot(buffer_.GetData(), buffer_.GetSize());
+  }
+
+
+  Value GetRoot(const void* data,
+                size_t size)
+  {
+    if (data == NULL ||
+        size == 0)
+    {
+      ThrowInvalid();
+    }
+
+    const char* begin = reinterpret_cast<const char*>(data);
+    return Value(begin, begin + size);
+  }
+}
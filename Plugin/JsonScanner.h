@@ -0,0 +1,155 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <json/value.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <map>
+#include <stdint.h>
+#include <string>
+
+
+// On-demand scanner for the JSON answers of the Orthanc REST API.  Instead of building a jsoncpp tree of the whole
+// answer (e.g. thousands of expanded series), the values are located in the raw bytes and only the fields that are
+// actually read are decoded.  The strings and the nested values are skipped with memchr() that is vectorized by the
+// C library.  The values are views on the document and are only valid as long as the document exists.
+namespace JsonScanner
+{
+  enum Type
+  {
+    Type_Null,
+    Type_Boolean,
+    Type_Number,
+    Type_String,
+    Type_Array,
+    Type_Object
+  };
+
+
+  class Value
+  {
+  private:
+    friend class ArrayReader;
+    friend class ObjectReader;
+
+    const char*  begin_;
+    const char*  end_;  // the end of the document
+
+  public:
+    Value();
+
+    Value(const char* begin,
+          const char* end);
+
+    // the position right after this value
+    const char* Skip() const;
+
+    Type GetType() const;
+
+    bool IsNull() const
+    {
+      return GetType() == Type_Null;
+    }
+
+    bool GetBoolean() const;
+
+    int64_t GetInteger() const;
+
+    uint64_t GetUnsigned() const;
+
+    double GetDouble() const;
+
+    std::string GetString() const;
+
+    // compares a string value without decoding it if it has no escape sequences
+    bool IsString(const std::string& value) const;
+
+    // returns false if the value is not an object or if it has no such member
+    bool LookupMember(Value& target,
+                      const std::string& key) const;
+
+    // shortcut for a string member of a nested object, returns an empty string if not found
+    std::string GetStringMember(const std::string& key) const;
+
+    size_t GetArraySize() const;
+
+    // builds the jsoncpp tree of this value only
+    void ToJson(Json::Value& target) const;
+  };
+
+
+  class ArrayReader : public boost::noncopyable
+  {
+  private:
+    const char*  current_;
+    const char*  end_;
+    bool         isFirst_;
+
+  public:
+    explicit ArrayReader(const Value& array);
+
+    bool Next(Value& item);
+  };
+
+
+  class ObjectReader : public boost::noncopyable
+  {
+  private:
+    const char*  current_;
+    const char*  end_;
+    bool         isFirst_;
+
+  public:
+    explicit ObjectReader(const Value& object);
+
+    // 'key' is a string value
+    bool Next(Value& key,
+              Value& value);
+  };
+
+
+  // Raw variant of OrthancPlugins::RestApiGet(Json::Value&, ...): the answer is kept as is
+  class Document : public boost::noncopyable
+  {
+  private:
+    OrthancPlugins::MemoryBuffer  buffer_;
+
+  public:
+    bool RestApiGet(const std::string& uri,
+                    bool applyPlugins);
+
+    bool RestApiGet(const std::string& uri,
+                    const std::map<std::string, std::string>& httpHeaders,
+                    bool applyPlugins);
+
+    Value GetRoot() const;
+  };
+
+
+  Value GetRoot(const void* data,
+                size_t size);
+}
@@ -0,0 +1,321 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "JsonWriter.h"
+
+#include <OrthancException.h>
+
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <stdio.h>
+#include <string.h>
+
+
+// a buffer that has grown beyond this capacity for a large answer is not kept for the next ones
+static const size_t MAX_KEPT_CAPACITY = 4 * 1024 * 1024;
+
+static boost::thread_specific_ptr<std::string> threadBuffer_;
+
+
+JsonWriter::JsonWriter(std::string& target) :
+  target_(target),
+  hasKey_(false)
+{
+}
+
+
+void JsonWriter::WriteSeparator()
+{
+  if (hasKey_)
+  {
+    hasKey_ = false;  // the value of a key
+  }
+  else if (!isFirst_.empty())
+  {
+    if (isFirst_.back())
+    {
+      isFirst_.back() = false;
+    }
+    else
+    {
+      target_.push_back(',');
+    }
+  }
+}
+
+
+void JsonWriter::WriteQuoted(const char* value,
+                             size_t size)
+{
+  static const char HEX[] = "0123456789abcdef";
+
+  target_.push_back('"');
+
+  size_t start = 0;  // the characters that don't need escaping are appended by blocks
+
+  for (size_t i = 0; i < size; i++)
+  {
+    const unsigned char c = static_cast<unsigned char>(value[i]);
+
+    if (c >= 0x20 && c != '"' && c != '\\')
+    {
+      continue;  // including the UTF-8 sequences that are kept as is
+    }
+
+    target_.append(value + start, i - start);
+    start = i + 1;
+
+    switch (c)
+    {
+      case '"':
+        target_.append("\\\"");
+        break;
+
+      case '\\':
+        target_.append("\\\\");
+        break;
+
+      case '\n':
+        target_.append("\\n");
+        break;
+
+      case '\r':
+        target_.append("\\r");
+        break;
+
+      case '\t':
+        target_.append("\\t");
+        break;
+
+      default:
+        target_.append("\\u00");
+        target_.push_back(HEX[c >> 4]);
+        target_.push_back(HEX[c & 0x0f]);
+        break;
+    }
+  }
+
+  target_.append(value + start, size - start);
+  target_.push_back('"');
+}
+
+
+void JsonWriter::StartObject()
+{
+  WriteSeparator();
+  target_.push_back('{');
+  isFirst_.push_back(true);
+}
+
+
+void JsonWriter::EndObject()
+{
+  if (isFirst_.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+  }
+
+  isFirst_.pop_back();
+  target_.push_back('}');
+}
+
+
+void JsonWriter::StartArray()
+{
+  WriteSeparator();
+  target_.push_back('[');
+  isFirst_.push_back(true);
+}
+
+
+void JsonWriter::EndArray()
+{
+  if (isFirst_.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+  }
+
+  isFirst_.pop_back();
+  target_.push_back(']');
+}
+
+
+void JsonWriter::WriteKey(const std::string& key)
+{
+  WriteKey(key.c_str(), key.size());
+}
+
+
+void JsonWriter::WriteKey(const char* key,
+                          size_t size)
+{
+  WriteSeparator();
+  WriteQuoted(key, size);
+  target_.push_back(':');
+  hasKey_ = true;
+}
+
+
+void JsonWriter::WriteString(const std::string& value)
+{
+  WriteSeparator();
+  WriteQuoted(value.c_str(), value.size());
+}
+
+
+void JsonWriter::WriteInteger(int64_t value)
+{
+  WriteSeparator();
+
+  char buffer[32];
+  int size = snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(value));
+  target_.append(buffer, size);
+}
+
+
+void JsonWriter::WriteUnsigned(uint64_t value)
+{
+  WriteSeparator();
+
+  char buffer[32];
+  int size = snprintf(buffer, sizeof(buffer), "%llu", static_cast<unsigned long long>(value));
+  target_.append(buffer, size);
+}
+
+
+void JsonWriter::WriteDouble(double value)
+{
+  WriteSeparator();
+
+  if (!boost::math::isfinite(value))
+  {
+    target_.append("null");  // not representable in JSON
+  }
+  else
+  {
+    char buffer[32];
+    int size = snprintf(buffer, sizeof(buffer), "%.17g", value);
+    target_.append(buffer, size);
+
+    if (strpbrk(buffer, ".e") == NULL)
+    {
+      target_.append(".0");  // like jsoncpp, so that the value is parsed back as a real
+    }
+  }
+}
+
+
+void JsonWriter::WriteBoolean(bool value)
+{
+  WriteSeparator();
+  target_.append(value ? "true" : "false");
+}
+
+
+void JsonWriter::WriteNull()
+{
+  WriteSeparator();
+  target_.append("null");
+}
+
+
+void JsonWriter::WriteValue(const Json::Value& value)
+{
+  switch (value.type())
+  {
+    case Json::nullValue:
+      WriteNull();
+      break;
+
+    case Json::intValue:
+      WriteInteger(value.asInt64());
+      break;
+
+    case Json::uintValue:
+      WriteUnsigned(value.asUInt64());
+      break;
+
+    case Json::realValue:
+      WriteDouble(value.asDouble());
+      break;
+
+    case Json::stringValue:
+    {
+      const char* begin = NULL;
+      const char* end = NULL;
+      value.getString(&begin, &end);  // no copy of the string
+
+      WriteSeparator();
+      WriteQuoted(begin, end - begin);
+      break;
+    }
+
+    case Json::booleanValue:
+      WriteBoolean(value.asBool());
+      break;
+
+    case Json::arrayValue:
+      StartArray();
+
+      for (Json::Value::ArrayIndex i = 0; i < value.size(); i++)
+      {
+        WriteValue(value[i]);
+      }
+
+      EndArray();
+      break;
+
+    case Json::objectValue:
+      StartObject();
+
+      for (Json::Value::const_iterator it = value.begin(); it != value.end(); ++it)
+      {
+        const char* end = NULL;
+        const char* name = it.memberName(&end);  // no copy of the key
+        WriteKey(name, end - name);
+        WriteValue(*it);
+      }
+
+      EndObject();
+      break;
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+}
+
+
+std::string& JsonWriter::GetThreadBuffer()
+{
+  std::string* buffer = threadBuffer_.get();
+
+  if (buffer == NULL ||
+      buffer->capacity() > MAX_KEPT_CAPACITY)
+  {
+    buffer = new std::string;
+    threadBuffer_.reset(buffer);  // deletes the previous buffer
+  }
+
+  buffer->clear();  // keeps the capacity
+  return *buffer;
+}
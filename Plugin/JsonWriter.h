@@ -0,0 +1,82 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <json/value.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+// Streaming serializer for compact JSON (without the indentation of 'toStyledString()').  The values are
+// appended to a target string that is typically the buffer of the current thread (see GetThreadBuffer()),
+// so that the successive answers of a thread reuse the same allocation.
+class JsonWriter : public boost::noncopyable
+{
+private:
+  std::string&       target_;
+  std::vector<bool>  isFirst_;  // one entry per open array/object
+  bool               hasKey_;
+
+  void WriteSeparator();
+
+  void WriteQuoted(const char* value,
+                   size_t size);
+
+public:
+  explicit JsonWriter(std::string& target);
+
+  void StartObject();
+
+  void EndObject();
+
+  void StartArray();
+
+  void EndArray();
+
+  // to call before each value of an object
+  void WriteKey(const std::string& key);
+
+  void WriteKey(const char* key,
+                size_t size);
+
+  void WriteString(const std::string& value);
+
+  void WriteInteger(int64_t value);
+
+  void WriteUnsigned(uint64_t value);
+
+  void WriteDouble(double value);
+
+  void WriteBoolean(bool value);
+
+  void WriteNull();
+
+  void WriteValue(const Json::Value& value);
+
+  // returns the cleared buffer of the calling thread, it remains valid until the next call in the same thread
+  static std::string& GetThreadBuffer();
+};
@@ -0,0 +1,786 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "JwtVerifier.h"
+
+#include "HttpClientPool.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+#include <Toolbox.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+// the RSA and EC_KEY structures are deprecated in OpenSSL 3 but they are the only ones that are also available in OpenSSL 1.1
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+#include <openssl/rsa.h>
+
+#include <ctime>
+
+
+static const unsigned int JWKS_TIMEOUT = 10;             // in seconds
+static const unsigned int JWKS_MIN_REFRESH_INTERVAL = 30;  // in seconds, a flood of tokens signed by an unknown key must not flood Keycloak
+static const unsigned int JWKS_MAX_AGE = 3600;           // in seconds, to eventually forget the revoked keys
+
+
+// the JWT are encoded in base64url without padding
+static bool DecodeBase64Url(std::string& target,
+                            const std::string& source)
+{
+  std::string base64 = source;
+
+  for (size_t i = 0; i < base64.size(); i++)
+  {
+    if (base64[i] == '-')
+    {
+      base64[i] = '+';
+    }
+    else if (base64[i] == '_')
+    {
+      base64[i] = '/';
+    }
+    else if (base64[i] == '+' || base64[i] == '/' || base64[i] == '=')
+    {
+      return false;
+    }
+  }
+
+  if (base64.size() % 4 == 1)
+  {
+    return false;
+  }
+
+  base64.append((4 - base64.size() % 4) % 4, '=');
+
+  try
+  {
+    Orthanc::Toolbox::DecodeBase64(target, base64);
+    return true;
+  }
+  catch (Orthanc::OrthancException&)
+  {
+    return false;
+  }
+}
+
+
+static BIGNUM* DecodeBigNum(const Json::Value& jwk,
+                            const char* member)
+{
+  std::string bytes;
+
+  if (!jwk.isMember(member) ||
+      !jwk[member].isString() ||
+      !DecodeBase64Url(bytes, jwk[member].asString()) ||
+      bytes.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Bad value for '" + std::string(member) + "' in a JWK");
+  }
+
+  return BN_bin2bn(reinterpret_cast<const unsigned char*>(bytes.c_str()), static_cast<int>(bytes.size()), NULL);
+}
+
+
+static EVP_PKEY* CreateRsaKey(const Json::Value& jwk)
+{
+  BIGNUM* n = DecodeBigNum(jwk, "n");
+  BIGNUM* e = NULL;
+
+  try
+  {
+    e = DecodeBigNum(jwk, "e");
+  }
+  catch (Orthanc::OrthancException&)
+  {
+    BN_free(n);
+    throw;
+  }
+
+  RSA* rsa = RSA_new();
+  if (rsa == NULL ||
+      RSA_set0_key(rsa, n, e, NULL) != 1)  // on success, 'rsa' takes the ownership of 'n' and 'e'
+  {
+    RSA_free(rsa);
+    BN_free(n);
+    BN_free(e);
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to create an RSA key");
+  }
+
+  EVP_PKEY* key = EVP_PKEY_new();
+  if (key == NULL ||
+      EVP_PKEY_assign_RSA(key, rsa) != 1)
+  {
+    EVP_PKEY_free(key);
+    RSA_free(rsa);
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to create an RSA key");
+  }
+
+  return key;
+}
+
+
+static EVP_PKEY* CreateEcKey(const Json::Value& jwk)
+{
+  if (!jwk.isMember("crv") ||
+      jwk["crv"].asString() != "P-256")
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented, "Only the P-256 curve is supported for the EC keys");
+  }
+
+  BIGNUM* x = DecodeBigNum(jwk, "x");
+  BIGNUM* y = NULL;
+
+  try
+  {
+    y = DecodeBigNum(jwk, "y");
+  }
+  catch (Orthanc::OrthancException&)
+  {
+    BN_free(x);
+    throw;
+  }
+
+  EC_KEY* ec = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+  const bool success = (ec != NULL &&
+                        EC_KEY_set_public_key_affine_coordinates(ec, x, y) == 1);  // also checks that the point is on the curve
+  BN_free(x);
+  BN_free(y);
+
+  if (!success)
+  {
+    EC_KEY_free(ec);
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Bad EC key in a JWK");
+  }
+
+  EVP_PKEY* key = EVP_PKEY_new();
+  if (key == NULL ||
+      EVP_PKEY_assign_EC_KEY(key, ec) != 1)
+  {
+    EVP_PKEY_free(key);
+    EC_KEY_free(ec);
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to create an EC key");
+  }
+
+  return key;
+}
+
+
+// JWS signs ES256 with the raw concatenation of R and S while OpenSSL expects a DER-encoded ECDSA-Sig-Value
+static bool ConvertEcdsaSignature(std::string& target,
+                                  const std::string& signature)
+{
+  if (signature.size() != 64)
+  {
+    return false;
+  }
+
+  const unsigned char* raw = reinterpret_cast<const unsigned char*>(signature.c_str());
+  BIGNUM* r = BN_bin2bn(raw, 32, NULL);
+  BIGNUM* s = BN_bin2bn(raw + 32, 32, NULL);
+
+  ECDSA_SIG* sig = ECDSA_SIG_new();
+  if (sig == NULL ||
+      r == NULL ||
+      s == NULL ||
+      ECDSA_SIG_set0(sig, r, s) != 1)  // on success, 'sig' takes the ownership of 'r' and 's'
+  {
+    ECDSA_SIG_free(sig);
+    BN_free(r);
+    BN_free(s);
+    return false;
+  }
+
+  const int size = i2d_ECDSA_SIG(sig, NULL);
+  if (size <= 0)
+  {
+    ECDSA_SIG_free(sig);
+    return false;
+  }
+
+  target.resize(size);
+  unsigned char* der = reinterpret_cast<unsigned char*>(&target[0]);
+  i2d_ECDSA_SIG(sig, &der);
+  ECDSA_SIG_free(sig);
+  return true;
+}
+
+
+static bool VerifySha256Signature(EVP_PKEY* key,
+                                  const std::string& signedData,
+                                  const std::string& signature)
+{
+  EVP_MD_CTX* context = EVP_MD_CTX_new();
+  if (context == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
+  }
+
+  const bool valid = (EVP_DigestVerifyInit(context, NULL, EVP_sha256(), NULL, key) == 1 &&
+                      EVP_DigestVerifyUpdate(context, signedData.c_str(), signedData.size()) == 1 &&
+                      EVP_DigestVerifyFinal(context, reinterpret_cast<const unsigned char*>(signature.c_str()), signature.size()) == 1);
+
+  EVP_MD_CTX_free(context);
+  return valid;
+}
+
+
+static bool ReadJsonSegment(Json::Value& target,
+                            const std::string& segment)
+{
+  std::string decoded;
+  return (DecodeBase64Url(decoded, segment) &&
+          OrthancPlugins::ReadJson(target, decoded) &&
+          target.type() == Json::objectValue);
+}
+
+
+// the "exp", "nbf" and "iat" claims are "NumericDate" (seconds since the epoch, possibly with a fraction)
+static bool GetNumericDate(int64_t& target,
+                           const Json::Value& claims,
+                           const char* member)
+{
+  if (claims.isMember(member) &&
+      claims[member].isNumeric())
+  {
+    target = static_cast<int64_t>(claims[member].asDouble());
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+
+// Keycloak sets the client that has requested the token in "azp", "aud" (a string or an array) lists the services
+// the token is intended for
+static bool IsIssuedTo(const Json::Value& claims,
+                       const std::string& audience)
+{
+  if (claims.isMember("azp") &&
+      claims["azp"].isString() &&
+      claims["azp"].asString() == audience)
+  {
+    return true;
+  }
+
+  if (claims.isMember("aud"))
+  {
+    const Json::Value& aud = claims["aud"];
+
+    if (aud.isString())
+    {
+      return aud.asString() == audience;
+    }
+    else if (aud.isArray())
+    {
+      for (Json::Value::ArrayIndex i = 0; i < aud.size(); i++)
+      {
+        if (aud[i].isString() &&
+            aud[i].asString() == audience)
+        {
+          return true;
+        }
+      }
+    }
+  }
+
+  return false;
+}
+
+
+class JwtVerifier::KeySet : public boost::noncopyable
+{
+private:
+  typedef std::map<std::string, EVP_PKEY*>  Keys;
+
+  Keys  keys_;  // by "kid"
+
+public:
+  ~KeySet()
+  {
+    for (Keys::iterator it = keys_.begin(); it != keys_.end(); ++it)
+    {
+      EVP_PKEY_free(it->second);
+    }
+  }
+
+  void Load(const Json::Value& jwks)
+  {
+    if (!jwks.isMember("keys") ||
+        jwks["keys"].type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "A JWKS must contain a 'keys' array");
+    }
+
+    const Json::Value& keys = jwks["keys"];
+
+    for (Json::Value::ArrayIndex i = 0; i < keys.size(); i++)
+    {
+      const Json::Value& jwk = keys[i];
+
+      if (jwk.type() != Json::objectValue ||
+          !jwk.isMember("kid") ||
+          !jwk.isMember("kty") ||
+          (jwk.isMember("use") && jwk["use"].asString() != "sig"))  // e.g. the encryption keys of Keycloak
+      {
+        continue;
+      }
+
+      const std::string keyId = jwk["kid"].asString();
+      const std::string keyType = jwk["kty"].asString();
+
+      try
+      {
+        EVP_PKEY* key;
+
+        if (keyType == "RSA")
+        {
+          key = CreateRsaKey(jwk);
+        }
+        else if (keyType == "EC")
+        {
+          key = CreateEcKey(jwk);
+        }
+        else
+        {
+          continue;
+        }
+
+        Keys::iterator found = keys_.find(keyId);
+        if (found != keys_.end())
+        {
+          EVP_PKEY_free(found->second);
+          found->second = key;
+        }
+        else
+        {
+          keys_[keyId] = key;
+        }
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(WARNING) << "Orthanc Explorer 2: Ignoring the JWK '" << keyId << "': " << e.What();
+      }
+    }
+  }
+
+  size_t GetSize() const
+  {
+    return keys_.size();
+  }
+
+  EVP_PKEY* Lookup(const std::string& keyId) const
+  {
+    Keys::const_iterator found = keys_.find(keyId);
+    return (found == keys_.end() ? NULL : found->second);
+  }
+};
+
+
+JwtVerifier::JwtVerifier() :
+  isEnabled_(false),
+  claimsCacheSize_(1000),
+  clockSkew_(30)
+{
+}
+
+
+void JwtVerifier::Configure(const Json::Value& configuration)
+{
+  isEnabled_ = (configuration["Enable"].asBool() &&
+                configuration.isMember("VerifyTokens") &&
+                configuration["VerifyTokens"].asBool());
+
+  if (!isEnabled_)
+  {
+    return;
+  }
+
+  std::string url = configuration["Url"].asString();
+  if (!url.empty() && url[url.size() - 1] != '/')
+  {
+    url += "/";
+  }
+
+  const std::string realmUrl = url + "realms/" + configuration["Realm"].asString();
+
+  jwksUrl_ = configuration["JwksUrl"].asString();
+  if (jwksUrl_.empty())
+  {
+    jwksUrl_ = realmUrl + "/protocol/openid-connect/certs";
+  }
+
+  issuer_ = configuration["Issuer"].asString();
+  if (issuer_.empty())
+  {
+    issuer_ = realmUrl;
+  }
+
+  audience_ = configuration["Audience"].asString();
+  if (audience_.empty())
+  {
+    audience_ = configuration["ClientId"].asString();
+  }
+
+  jwksPath_ = configuration["JwksPath"].asString();
+  claimsCacheSize_ = configuration["ClaimsCacheSize"].asUInt();
+  clockSkew_ = configuration["ClockSkew"].asUInt();
+
+  if (!jwksPath_.empty() &&
+      !Orthanc::SystemToolbox::IsExistingFile(jwksPath_))
+  {
+    LOG(ERROR) << "Unable to accesss the 'Keycloak.JwksPath': " << jwksPath_;
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile);
+  }
+
+  LOG(WARNING) << "Orthanc Explorer 2: The Keycloak tokens are verified by the plugin with the keys from "
+               << (jwksPath_.empty() ? jwksUrl_ : jwksPath_);
+}
+
+
+JwtVerifier::KeySetPtr JwtVerifier::LoadKeys() const
+{
+  Json::Value jwks;
+
+  if (!jwksPath_.empty())
+  {
+    std::string content;
+    Orthanc::SystemToolbox::ReadFile(content, jwksPath_);
+
+    if (!OrthancPlugins::ReadJson(jwks, content))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The JWKS file is not a JSON document: " + jwksPath_);
+    }
+  }
+  else
+  {
+    PooledHttpClient client;
+    client.SetMethod(OrthancPluginHttpMethod_Get);
+    client.SetUrl(jwksUrl_);
+    client.SetTimeout(JWKS_TIMEOUT);
+
+    std::map<std::string, std::string> answerHeaders;
+    client.Execute(answerHeaders, jwks);
+  }
+
+  boost::shared_ptr<KeySet> keys(new KeySet);
+  keys->Load(jwks);
+  return keys;
+}
+
+
+void JwtVerifier::RefreshKeys(const boost::posix_time::ptime& observed)
+{
+  boost::mutex::scoped_lock refreshLock(refreshMutex_);
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (lastRefresh_ != observed)
+    {
+      return;  // another thread has refreshed the keys while we were waiting
+    }
+  }
+
+  KeySetPtr keys;
+
+  try
+  {
+    keys = LoadKeys();
+    LOG(INFO) << "Orthanc Explorer 2: " << keys->GetSize() << " signing keys have been loaded for the Keycloak tokens";
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    // the previous keys are kept, the next attempt is delayed by JWKS_MIN_REFRESH_INTERVAL
+    LOG(ERROR) << "Orthanc Explorer 2: Unable to load the keys to verify the Keycloak tokens: " << e.What();
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (keys.get() != NULL)
+  {
+    keys_ = keys;
+  }
+
+  lastRefresh_ = boost::posix_time::microsec_clock::universal_time();
+}
+
+
+JwtVerifier::KeySetPtr JwtVerifier::LookupKeys(const std::string& keyId)
+{
+  KeySetPtr keys;
+  boost::posix_time::ptime lastRefresh;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    keys = keys_;
+    lastRefresh = lastRefresh_;
+  }
+
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  const bool mustRefresh = (lastRefresh.is_not_a_date_time() ||
+                            now - lastRefresh > boost::posix_time::seconds(JWKS_MAX_AGE) ||
+                            // a key that has not been seen yet -> the keys of the realm may have been rotated
+                            ((keys.get() == NULL || keys->Lookup(keyId) == NULL) &&
+                             now - lastRefresh > boost::posix_time::seconds(JWKS_MIN_REFRESH_INTERVAL)));
+
+  if (mustRefresh)
+  {
+    RefreshKeys(lastRefresh);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    keys = keys_;
+  }
+
+  return keys;
+}
+
+
+void JwtVerifier::StoreClaims(const std::string& token,
+                              const Json::Value& claims,
+                              int64_t expiration,
+                              int64_t now)
+{
+  if (claimsCacheSize_ == 0)
+  {
+    return;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (claimsCache_.size() >= claimsCacheSize_)
+  {
+    for (std::map<std::string, CachedClaims>::iterator it = claimsCache_.begin(); it != claimsCache_.end(); )
+    {
+      if (it->second.expiration_ + clockSkew_ < now)
+      {
+        claimsCache_.erase(it++);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+
+    if (claimsCache_.size() >= claimsCacheSize_)
+    {
+      claimsCache_.clear();  // the tokens are short-lived, the active users will fill the cache again
+    }
+  }
+
+  CachedClaims& cached = claimsCache_[token];
+  cached.claims_ = claims;
+  cached.expiration_ = expiration;
+}
+
+
+bool JwtVerifier::ExtractToken(std::string& token,
+                               const std::map<std::string, std::string>& headers)
+{
+  // the keys are lower case (see OrthancPlugins::GetHttpHeaders())
+  std::map<std::string, std::string>::const_iterator found = headers.find("authorization");
+  if (found != headers.end() &&
+      boost::algorithm::istarts_with(found->second, "bearer "))
+  {
+    token = Orthanc::Toolbox::StripSpaces(found->second.substr(7));
+    return !token.empty();
+  }
+
+  found = headers.find("token");
+  if (found == headers.end())
+  {
+    return false;
+  }
+
+  token = Orthanc::Toolbox::StripSpaces(found->second);
+
+  if (boost::algorithm::istarts_with(token, "bearer "))
+  {
+    token = Orthanc::Toolbox::StripSpaces(token.substr(7));
+  }
+
+  return !token.empty();
+}
+
+
+JwtVerifier::Status JwtVerifier::Verify(Json::Value& claims,
+                                        const std::string& token)
+{
+  const int64_t now = static_cast<int64_t>(time(NULL));
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    std::map<std::string, CachedClaims>::const_iterator found = claimsCache_.find(token);
+    if (found != claimsCache_.end())
+    {
+      if (found->second.expiration_ + clockSkew_ < now)
+      {
+        return Status_Expired;
+      }
+
+      claims = found->second.claims_;
+      return Status_Valid;
+    }
+  }
+
+  const size_t firstDot = token.find('.');
+  const size_t secondDot = (firstDot == std::string::npos ? std::string::npos : token.find('.', firstDot + 1));
+
+  if (secondDot == std::string::npos ||
+      token.find('.', secondDot + 1) != std::string::npos)
+  {
+    return Status_Malformed;
+  }
+
+  Json::Value header;
+  std::string signature;
+
+  if (!ReadJsonSegment(header, token.substr(0, firstDot)) ||
+      !ReadJsonSegment(claims, token.substr(firstDot + 1, secondDot - firstDot - 1)) ||
+      !DecodeBase64Url(signature, token.substr(secondDot + 1)) ||
+      !header.isMember("alg") ||
+      !header["alg"].isString())
+  {
+    return Status_Malformed;
+  }
+
+  const std::string algorithm = header["alg"].asString();
+  int expectedKeyType;
+
+  if (algorithm == "RS256")
+  {
+    expectedKeyType = EVP_PKEY_RSA;
+  }
+  else if (algorithm == "ES256")
+  {
+    expectedKeyType = EVP_PKEY_EC;
+
+    std::string der;
+    if (!ConvertEcdsaSignature(der, signature))
+    {
+      return Status_InvalidSignature;
+    }
+
+    signature.swap(der);
+  }
+  else
+  {
+    return Status_UnsupportedAlgorithm;
+  }
+
+  const std::string keyId = (header.isMember("kid") ? header["kid"].asString() : "");
+
+  KeySetPtr keys = LookupKeys(keyId);
+  EVP_PKEY* key = (keys.get() == NULL ? NULL : keys->Lookup(keyId));
+
+  if (key == NULL)
+  {
+    return Status_UnknownKey;
+  }
+
+  if (EVP_PKEY_base_id(key) != expectedKeyType ||  // e.g. an RSA key must not verify an ES256 token
+      !VerifySha256Signature(key, token.substr(0, secondDot), signature))
+  {
+    return Status_InvalidSignature;
+  }
+
+  int64_t expiration, notBefore;
+
+  if (!GetNumericDate(expiration, claims, "exp"))
+  {
+    return Status_Malformed;  // the access tokens of Keycloak always expire
+  }
+
+  if (expiration + clockSkew_ < now)
+  {
+    return Status_Expired;
+  }
+
+  if (GetNumericDate(notBefore, claims, "nbf") &&
+      notBefore - clockSkew_ > now)
+  {
+    return Status_NotYetValid;
+  }
+
+  if (!claims.isMember("iss") ||
+      claims["iss"].asString() != issuer_)
+  {
+    return Status_InvalidIssuer;
+  }
+
+  // a token of another client of the realm must not give access to OE2
+  if (!IsIssuedTo(claims, audience_))
+  {
+    return Status_InvalidAudience;
+  }
+
+  StoreClaims(token, claims, expiration, now);
+  return Status_Valid;
+}
+
+
+const char* JwtVerifier::EnumerationToString(Status status)
+{
+  switch (status)
+  {
+    case Status_Valid:
+      return "Valid";
+
+    case Status_MissingToken:
+      return "MissingToken";
+
+    case Status_Malformed:
+      return "Malformed";
+
+    case Status_UnsupportedAlgorithm:
+      return "UnsupportedAlgorithm";
+
+    case Status_UnknownKey:
+      return "UnknownKey";
+
+    case Status_InvalidSignature:
+      return "InvalidSignature";
+
+    case Status_Expired:
+      return "Expired";
+
+    case Status_NotYetValid:
+      return "NotYetValid";
+
+    case Status_InvalidIssuer:
+      return "InvalidIssuer";
+
+    case Status_InvalidAudience:
+      return "InvalidAudience";
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
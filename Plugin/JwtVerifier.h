@@ -0,0 +1,114 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <json/value.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <stdint.h>
+#include <string>
+
+
+// Verifies the Keycloak access tokens (JWT) in the plugin: the signatures (RS256 and ES256) are checked against
+// the public keys of the realm (JWKS) that are downloaded once and refreshed when a token is signed by an unknown
+// key (key rotation).  The claims of the verified tokens are cached until their expiration so that the next
+// requests with the same token are only a map lookup.
+class JwtVerifier : public boost::noncopyable
+{
+public:
+  enum Status
+  {
+    Status_Valid,
+    Status_MissingToken,
+    Status_Malformed,
+    Status_UnsupportedAlgorithm,   // only RS256 and ES256 are accepted (never "none" nor the HMAC algorithms)
+    Status_UnknownKey,
+    Status_InvalidSignature,
+    Status_Expired,
+    Status_NotYetValid,
+    Status_InvalidIssuer,
+    Status_InvalidAudience         // the token has not been issued to the OE2 client ("azp" or "aud")
+  };
+
+private:
+  class KeySet;
+
+  typedef boost::shared_ptr<const KeySet>  KeySetPtr;
+
+  struct CachedClaims
+  {
+    Json::Value  claims_;
+    int64_t      expiration_;
+  };
+
+  bool                      isEnabled_;
+  std::string               jwksUrl_;
+  std::string               jwksPath_;
+  std::string               issuer_;
+  std::string               audience_;
+  size_t                    claimsCacheSize_;
+  int64_t                   clockSkew_;
+
+  boost::mutex              refreshMutex_;  // a single download of the keys at a time
+  boost::mutex              mutex_;
+  KeySetPtr                 keys_;
+  boost::posix_time::ptime  lastRefresh_;
+  std::map<std::string, CachedClaims>  claimsCache_;  // by token
+
+  KeySetPtr LoadKeys() const;
+
+  // does nothing if the keys have been refreshed by another thread since 'observed'
+  void RefreshKeys(const boost::posix_time::ptime& observed);
+
+  KeySetPtr LookupKeys(const std::string& keyId);
+
+  void StoreClaims(const std::string& token,
+                   const Json::Value& claims,
+                   int64_t expiration,
+                   int64_t now);
+
+public:
+  JwtVerifier();
+
+  // 'configuration' is the "Keycloak" section
+  void Configure(const Json::Value& configuration);
+
+  bool IsEnabled() const
+  {
+    return isEnabled_;
+  }
+
+  // the token is read from the "Authorization: Bearer" header or from the "token" header set by the OE2 frontend
+  static bool ExtractToken(std::string& token,
+                           const std::map<std::string, std::string>& headers);
+
+  Status Verify(Json::Value& claims,
+                const std::string& token);
+
+  static const char* EnumerationToString(Status status);
+};
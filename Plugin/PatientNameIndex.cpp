@@ -0,0 +1,997 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "PatientNameIndex.h"
+
+#include "ChangesTracker.h"
+#include "StringDictionary.h"
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <ctype.h>
+#include <memory>
+#include <string.h>
+
+
+namespace
+{
+  enum SectionId
+  {
+    SectionId_OrthancIds = 1,
+    SectionId_PatientNames = 2,
+    SectionId_PatientIds = 3
+  };
+
+  static const unsigned int PATIENTS_PAGE_SIZE = 1000;
+  static const size_t MAX_PHONETIC_KEY_LENGTH = 4;
+
+  // the weights of the matches of a query component
+  static const double SCORE_FOLDED = 3.0;
+  static const double SCORE_PHONETIC_PRIMARY = 2.0;
+  static const double SCORE_PHONETIC_ALTERNATE = 1.0;
+
+  // the ASCII folding of the Latin-1 Supplement and Latin Extended-A letters
+  static const char* LATIN_FOLDING[0x180 - 0xc0] = {
+    "A", "A", "A", "A", "A", "A", "AE", "C", "E", "E", "E", "E", "I", "I", "I", "I",  // U+00C0
+    "D", "N", "O", "O", "O", "O", "O", "", "O", "U", "U", "U", "U", "Y", "TH", "SS",  // U+00D0
+    "A", "A", "A", "A", "A", "A", "AE", "C", "E", "E", "E", "E", "I", "I", "I", "I",  // U+00E0
+    "D", "N", "O", "O", "O", "O", "O", "", "O", "U", "U", "U", "U", "Y", "TH", "Y",  // U+00F0
+    "A", "A", "A", "A", "A", "A", "C", "C", "C", "C", "C", "C", "C", "C", "D", "D",  // U+0100
+    "D", "D", "E", "E", "E", "E", "E", "E", "E", "E", "E", "E", "G", "G", "G", "G",  // U+0110
+    "G", "G", "G", "G", "H", "H", "H", "H", "I", "I", "I", "I", "I", "I", "I", "I",  // U+0120
+    "I", "I", "IJ", "IJ", "J", "J", "K", "K", "K", "L", "L", "L", "L", "L", "L", "L",  // U+0130
+    "L", "L", "L", "N", "N", "N", "N", "N", "N", "N", "N", "N", "O", "O", "O", "O",  // U+0140
+    "O", "O", "OE", "OE", "R", "R", "R", "R", "R", "R", "S", "S", "S", "S", "S", "S",  // U+0150
+    "S", "S", "T", "T", "T", "T", "T", "T", "U", "U", "U", "U", "U", "U", "U", "U",  // U+0160
+    "U", "U", "U", "U", "W", "W", "Y", "Y", "Y", "Z", "Z", "Z", "Z", "Z", "Z", "S"  // U+0170
+  };
+
+
+  static bool IsSeparator(uint32_t codepoint)
+  {
+    // '^' separates the components, '=' separates the alphabetic, ideographic and phonetic groups
+    return (codepoint == '^' || codepoint == '=' || codepoint == ' ' || codepoint == '-' ||
+            codepoint == ',' || codepoint == '.' || codepoint == '\'' || codepoint == '*' ||
+            codepoint == '?' || codepoint == '\t');
+  }
+
+
+  static bool IsVowel(char c)
+  {
+    return c == 'A' || c == 'E' || c == 'I' || c == 'O' || c == 'U' || c == 'Y';
+  }
+
+
+  class PhoneticEncoder
+  {
+  private:
+    const std::string&  word_;
+    std::string&        primary_;
+    std::string&        alternate_;
+
+  public:
+    PhoneticEncoder(std::string& primary,
+                    std::string& alternate,
+                    const std::string& word) :
+      word_(word),
+      primary_(primary),
+      alternate_(alternate)
+    {
+      primary_.clear();
+      alternate_.clear();
+    }
+
+    char GetAt(size_t position) const
+    {
+      return position < word_.size() ? word_[position] : '\0';
+    }
+
+    bool IsAt(size_t position,
+              const char* value) const
+    {
+      return word_.compare(position, strlen(value), value) == 0;
+    }
+
+    void Add(const char* primary,
+             const char* alternate)
+    {
+      primary_ += primary;
+      alternate_ += alternate;
+    }
+
+    void Add(const char* value)
+    {
+      Add(value, value);
+    }
+
+    void Encode()
+    {
+      size_t i = 0;
+
+      // silent initial letters
+      if (IsAt(0, "GN") || IsAt(0, "KN") || IsAt(0, "PN") || IsAt(0, "WR") || IsAt(0, "PS"))
+      {
+        i = 1;
+      }
+      else if (GetAt(0) == 'X')  // "XAVIER"
+      {
+        Add("S");
+        i = 1;
+      }
+
+      while (i < word_.size() &&
+             (primary_.size() < MAX_PHONETIC_KEY_LENGTH || alternate_.size() < MAX_PHONETIC_KEY_LENGTH))
+      {
+        const char c = word_[i];
+        const char next = GetAt(i + 1);
+
+        if (i > 0 && c == word_[i - 1] && c != 'C')  // double letters
+        {
+          i++;
+          continue;
+        }
+
+        switch (c)
+        {
+          case 'A': case 'E': case 'I': case 'O': case 'U': case 'Y':
+            if (i == 0)
+            {
+              Add("A");
+            }
+            i++;
+            break;
+
+          case 'B':
+            Add("P");
+            i++;
+            break;
+
+          case 'C':
+            if (next == 'H')
+            {
+              const char after = GetAt(i + 2);
+              if (after == 'R' || after == 'L' || (i == 0 && !IsVowel(after)))  // "CHRISTOPHE", "CHLOE"
+              {
+                Add("K");
+              }
+              else
+              {
+                Add("X", "K");  // "CHARLES" / "MICHAEL"
+              }
+              i += 2;
+            }
+            else if (next == 'Z')  // "CZERNY"
+            {
+              Add("S", "X");
+              i += 2;
+            }
+            else if (IsAt(i + 1, "IA"))
+            {
+              Add("X");
+              i += 2;
+            }
+            else if (next == 'E' || next == 'I' || next == 'Y')
+            {
+              Add("S");
+              i += 2;
+            }
+            else if (next == 'K' || next == 'Q' || next == 'G' || next == 'C')
+            {
+              Add("K");
+              i += 2;
+            }
+            else
+            {
+              Add("K");
+              i++;
+            }
+            break;
+
+          case 'D':
+            if (next == 'G' && (GetAt(i + 2) == 'E' || GetAt(i + 2) == 'I' || GetAt(i + 2) == 'Y'))  // "EDGE"
+            {
+              Add("J");
+              i += 3;
+            }
+            else
+            {
+              Add("T");
+              i += (next == 'T' ? 2 : 1);
+            }
+            break;
+
+          case 'F':
+          case 'V':
+            Add("F");
+            i++;
+            break;
+
+          case 'G':
+            if (next == 'H')
+            {
+              if (i == 0 || !IsVowel(word_[i - 1]))
+              {
+                Add("K");  // "GHISLAINE"
+              }
+              else if (!IsVowel(GetAt(i + 2)))
+              {
+                Add("", "F");  // silent "WRIGHT", or "LAUGHLIN"
+              }
+              else
+              {
+                Add("K");
+              }
+              i += 2;
+            }
+            else if (next == 'N')
+            {
+              Add("N");  // "GNOCCHI", "CAMPAGNE"
+              i += 2;
+            }
+            else if (next == 'E' || next == 'I' || next == 'Y')
+            {
+              Add("J", "K");  // "GEORGES" / "GUNTHER"
+              i += 2;
+            }
+            else
+            {
+              Add("K");
+              i += (next == 'G' ? 2 : 1);
+            }
+            break;
+
+          case 'H':
+            // only pronounced before a vowel and not after a consonant
+            if ((i == 0 || IsVowel(word_[i - 1])) && IsVowel(next))
+            {
+              Add("H");
+            }
+            i++;
+            break;
+
+          case 'J':
+            Add("J", "H");  // "JOSE"
+            i++;
+            break;
+
+          case 'K':
+          case 'Q':
+            Add("K");
+            i += (next == 'K' || next == 'Q' ? 2 : 1);
+            break;
+
+          case 'L':
+          case 'M':
+          case 'N':
+          case 'R':
+          {
+            const char value[2] = { c, '\0' };
+            Add(value);
+            i++;
+            break;
+          }
+
+          case 'P':
+            if (next == 'H')
+            {
+              Add("F");
+              i += 2;
+            }
+            else
+            {
+              Add("P");
+              i += (next == 'P' || next == 'B' ? 2 : 1);
+            }
+            break;
+
+          case 'S':
+            if (next == 'H')
+            {
+              Add("X");
+              i += 2;
+            }
+            else if (IsAt(i + 1, "CH"))
+            {
+              Add("SK", "X");  // "SCHOOL" / "SCHMIDT"
+              i += 3;
+            }
+            else if (IsAt(i + 1, "IO") || IsAt(i + 1, "IA"))
+            {
+              Add("S", "X");
+              i += 2;
+            }
+            else if (next == 'Z')
+            {
+              Add("S", "X");  // "SZABO"
+              i += 2;
+            }
+            else
+            {
+              Add("S");
+              i++;
+            }
+            break;
+
+          case 'T':
+            if (next == 'H')
+            {
+              Add("0", "T");  // "THOMAS" -> 0 is the "th" sound
+              i += 2;
+            }
+            else if (IsAt(i + 1, "IO") || IsAt(i + 1, "IA"))
+            {
+              Add("X");
+              i += 2;
+            }
+            else if (IsAt(i + 1, "CH"))
+            {
+              i++;  // the "CH" is encoded
+            }
+            else
+            {
+              Add("T");
+              i += (next == 'D' ? 2 : 1);
+            }
+            break;
+
+          case 'W':
+            if (IsVowel(next))
+            {
+              Add(i == 0 ? "A" : "", "F");  // "WAGNER" / "VAGNER"
+            }
+            i++;
+            break;
+
+          case 'X':
+            Add("KS");
+            i++;
+            break;
+
+          case 'Z':
+            Add("S");
+            i++;
+            break;
+
+          default:  // digits
+            i++;
+            break;
+        }
+      }
+
+      primary_.resize(std::min(primary_.size(), MAX_PHONETIC_KEY_LENGTH));
+      alternate_.resize(std::min(alternate_.size(), MAX_PHONETIC_KEY_LENGTH));
+    }
+  };
+
+
+  // the posting lists are kept sorted: a renamed patient is re-indexed with its original slot
+  static void AddPosting(std::vector<uint32_t>& postings,
+                         uint32_t slot)
+  {
+    if (postings.empty() || postings.back() < slot)
+    {
+      postings.push_back(slot);  // the usual case, a new patient
+    }
+    else
+    {
+      std::vector<uint32_t>::iterator position = std::lower_bound(postings.begin(), postings.end(), slot);
+
+      // a patient may have the same key twice (e.g. "SMITH^SMYTH")
+      if (*position != slot)
+      {
+        postings.insert(position, slot);
+      }
+    }
+  }
+
+
+  static void RemovePosting(boost::unordered_map<uint32_t, std::vector<uint32_t> >& lists,
+                            uint32_t key,
+                            uint32_t slot)
+  {
+    boost::unordered_map<uint32_t, std::vector<uint32_t> >::iterator found = lists.find(key);
+    if (found != lists.end())
+    {
+      std::vector<uint32_t>& postings = found->second;
+      std::vector<uint32_t>::iterator position = std::lower_bound(postings.begin(), postings.end(), slot);
+      if (position != postings.end() &&
+          *position == slot)
+      {
+        postings.erase(position);
+      }
+
+      if (postings.empty())
+      {
+        lists.erase(found);
+      }
+    }
+  }
+
+
+  static void GetPhoneticKeyIds(std::vector<uint32_t>& target,
+                                const std::string& component)
+  {
+    std::string primary, alternate;
+    PatientNameIndex::GetPhoneticKeys(primary, alternate, component);
+
+    StringDictionary& dictionary = StringDictionary::GetShared();
+
+    if (!primary.empty())
+    {
+      target.push_back(dictionary.Intern(primary));
+    }
+
+    if (!alternate.empty() && alternate != primary)
+    {
+      target.push_back(dictionary.Intern(alternate));
+    }
+  }
+}
+
+
+void PatientNameIndex::GetFoldedComponents(std::vector<std::string>& target,
+                                           const std::string& patientName)
+{
+  target.clear();
+
+  std::string current;
+
+  for (size_t i = 0; i <= patientName.size(); )
+  {
+    uint32_t codepoint = 0;
+    size_t length = 1;
+
+    if (i == patientName.size())
+    {
+      codepoint = '^';  // flushes the last component
+    }
+    else
+    {
+      const uint8_t c = static_cast<uint8_t>(patientName[i]);
+
+      if (c < 0x80)
+      {
+        codepoint = c;
+      }
+      else if ((c & 0xe0) == 0xc0 && i + 1 < patientName.size())
+      {
+        codepoint = ((c & 0x1f) << 6) | (static_cast<uint8_t>(patientName[i + 1]) & 0x3f);
+        length = 2;
+      }
+      else
+      {
+        // other scripts are kept as they are (they are matched exactly)
+        length = ((c & 0xf0) == 0xe0 ? 3 : (c & 0xf8) == 0xf0 ? 4 : 1);
+        length = std::min(length, patientName.size() - i);
+        current.append(patientName, i, length);
+        i += length;
+        continue;
+      }
+    }
+
+    if (IsSeparator(codepoint))
+    {
+      if (!current.empty())
+      {
+        target.push_back(current);
+        current.clear();
+      }
+    }
+    else if (codepoint < 0x80)
+    {
+      current.push_back(static_cast<char>(toupper(static_cast<int>(codepoint))));
+    }
+    else if (codepoint >= 0xc0 && codepoint < 0x180)
+    {
+      current += LATIN_FOLDING[codepoint - 0xc0];
+    }
+    else if (codepoint >= 0x180)
+    {
+      current.append(patientName, i, length);
+    }
+
+    i += length;
+  }
+}
+
+
+void PatientNameIndex::GetPhoneticKeys(std::string& primary,
+                                       std::string& alternate,
+                                       const std::string& word)
+{
+  for (size_t i = 0; i < word.size(); i++)
+  {
+    if (!isupper(static_cast<unsigned char>(word[i])) &&
+        !isdigit(static_cast<unsigned char>(word[i])))
+    {
+      // not a latin name
+      primary.clear();
+      alternate.clear();
+      return;
+    }
+  }
+
+  PhoneticEncoder encoder(primary, alternate, word);
+  encoder.Encode();
+}
+
+
+PatientNameIndex::PatientNameIndex() :
+  deletedCount_(0),
+  lastSequence_(-1),
+  isRebuilding_(false)
+{
+}
+
+
+void PatientNameIndex::IndexPatient(uint32_t slot)
+{
+  StringDictionary& dictionary = StringDictionary::GetShared();
+
+  std::vector<std::string> components;
+  GetFoldedComponents(components, patients_[slot].patientName_);
+
+  for (size_t i = 0; i < components.size(); i++)
+  {
+    AddPosting(folded_[dictionary.Intern(components[i])], slot);
+
+    std::vector<uint32_t> keys;
+    GetPhoneticKeyIds(keys, components[i]);
+
+    for (size_t j = 0; j < keys.size(); j++)
+    {
+      AddPosting(phonetic_[keys[j]], slot);
+    }
+  }
+}
+
+
+void PatientNameIndex::UnindexPatient(uint32_t slot)
+{
+  StringDictionary& dictionary = StringDictionary::GetShared();
+
+  std::vector<std::string> components;
+  GetFoldedComponents(components, patients_[slot].patientName_);
+
+  for (size_t i = 0; i < components.size(); i++)
+  {
+    RemovePosting(folded_, dictionary.Intern(components[i]), slot);
+
+    std::vector<uint32_t> keys;
+    GetPhoneticKeyIds(keys, components[i]);
+
+    for (size_t j = 0; j < keys.size(); j++)
+    {
+      RemovePosting(phonetic_, keys[j], slot);
+    }
+  }
+}
+
+
+void PatientNameIndex::SetPatient(const std::string& orthancId,
+                                  const std::string& patientName,
+                                  const std::string& patientId)
+{
+  std::map<std::string, uint32_t>::const_iterator found = slots_.find(orthancId);
+
+  if (found != slots_.end())
+  {
+    Patient& patient = patients_[found->second];
+    if (patient.patientName_ == patientName)
+    {
+      patient.patientId_ = patientId;
+      return;
+    }
+
+    UnindexPatient(found->second);
+    patient.patientName_ = patientName;
+    patient.patientId_ = patientId;
+    IndexPatient(found->second);
+  }
+  else
+  {
+    const uint32_t slot = static_cast<uint32_t>(patients_.size());
+
+    Patient patient;
+    patient.orthancId_ = orthancId;
+    patient.patientName_ = patientName;
+    patient.patientId_ = patientId;
+    patient.isDeleted_ = false;
+
+    patients_.push_back(patient);
+    slots_[orthancId] = slot;
+    IndexPatient(slot);
+  }
+}
+
+
+void PatientNameIndex::RemovePatient(const std::string& orthancId)
+{
+  std::map<std::string, uint32_t>::iterator found = slots_.find(orthancId);
+
+  if (found != slots_.end())
+  {
+    UnindexPatient(found->second);
+    patients_[found->second].isDeleted_ = true;
+    patients_[found->second].patientName_.clear();
+    slots_.erase(found);
+    deletedCount_++;
+
+    if (deletedCount_ > 1000 &&
+        deletedCount_ > patients_.size() / 2)
+    {
+      Compact();
+    }
+  }
+}
+
+
+void PatientNameIndex::Compact()
+{
+  std::vector<Patient> patients;
+  patients.reserve(patients_.size() - deletedCount_);
+
+  for (size_t i = 0; i < patients_.size(); i++)
+  {
+    if (!patients_[i].isDeleted_)
+    {
+      patients.push_back(patients_[i]);
+    }
+  }
+
+  Clear();
+
+  for (size_t i = 0; i < patients.size(); i++)
+  {
+    SetPatient(patients[i].orthancId_, patients[i].patientName_, patients[i].patientId_);
+  }
+}
+
+
+void PatientNameIndex::Clear()
+{
+  patients_.clear();
+  slots_.clear();
+  deletedCount_ = 0;
+  folded_.clear();
+  phonetic_.clear();
+}
+
+
+void PatientNameIndex::UpdatePatient(const std::string& orthancId)
+{
+  Json::Value patient;
+  if (OrthancPlugins::RestApiGet(patient, "/patients/" + orthancId, false))
+  {
+    const Json::Value& tags = patient["MainDicomTags"];
+
+    boost::mutex::scoped_lock lock(mutex_);
+    SetPatient(orthancId, tags["PatientName"].asString(), tags["PatientID"].asString());
+  }
+  // else, the patient has already been deleted
+}
+
+
+bool PatientNameIndex::Search(std::vector<Candidate>& target,
+                              const std::string& query,
+                              size_t maxResults)
+{
+  target.clear();
+
+  std::vector<std::string> components;
+  GetFoldedComponents(components, query);
+
+  if (components.empty())
+  {
+    return true;
+  }
+
+  StringDictionary& dictionary = StringDictionary::GetShared();
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (lastSequence_ < 0)
+  {
+    return false;
+  }
+
+  // the score of a patient is the sum of the best match of each component of the query
+  std::map<uint32_t, double> scores;
+
+  for (size_t i = 0; i < components.size(); i++)
+  {
+    std::map<uint32_t, double> componentScores;
+
+    uint32_t key;
+    if (dictionary.Lookup(key, components[i]))
+    {
+      PostingLists::const_iterator found = folded_.find(key);
+      if (found != folded_.end())
+      {
+        for (size_t j = 0; j < found->second.size(); j++)
+        {
+          componentScores[found->second[j]] = SCORE_FOLDED;
+        }
+      }
+    }
+
+    std::string primary, alternate;
+    GetPhoneticKeys(primary, alternate, components[i]);
+
+    for (unsigned int k = 0; k < 2; k++)
+    {
+      const std::string& phoneticKey = (k == 0 ? primary : alternate);
+      const double score = (k == 0 ? SCORE_PHONETIC_PRIMARY : SCORE_PHONETIC_ALTERNATE);
+
+      if (!phoneticKey.empty() && dictionary.Lookup(key, phoneticKey))
+      {
+        PostingLists::const_iterator found = phonetic_.find(key);
+        if (found != phonetic_.end())
+        {
+          for (size_t j = 0; j < found->second.size(); j++)
+          {
+            double& current = componentScores[found->second[j]];
+            current = std::max(current, score);
+          }
+        }
+      }
+    }
+
+    for (std::map<uint32_t, double>::const_iterator it = componentScores.begin(); it != componentScores.end(); ++it)
+    {
+      scores[it->first] += it->second;
+    }
+  }
+
+  std::vector<std::pair<double, uint32_t> > ranked;
+  ranked.reserve(scores.size());
+
+  for (std::map<uint32_t, double>::const_iterator it = scores.begin(); it != scores.end(); ++it)
+  {
+    ranked.push_back(std::make_pair(-it->second, it->first));  // negated to sort by decreasing score
+  }
+
+  const size_t count = std::min(maxResults, ranked.size());
+  std::partial_sort(ranked.begin(), ranked.begin() + count, ranked.end());
+
+  const double maxScore = SCORE_FOLDED * static_cast<double>(components.size());
+
+  for (size_t i = 0; i < count; i++)
+  {
+    const Patient& patient = patients_[ranked[i].second];
+
+    Candidate candidate;
+    candidate.orthancId_ = patient.orthancId_;
+    candidate.patientName_ = patient.patientName_;
+    candidate.patientId_ = patient.patientId_;
+    candidate.score_ = -ranked[i].first / maxScore;
+    target.push_back(candidate);
+  }
+
+  return true;
+}
+
+
+void PatientNameIndex::LoadSnapshot(const IndexSnapshot::Reader& reader)
+{
+  const IndexSnapshot::StringsView orthancIds = reader.GetStrings(SectionId_OrthancIds);
+  const IndexSnapshot::StringsView patientNames = reader.GetStrings(SectionId_PatientNames);
+  const IndexSnapshot::StringsView patientIds = reader.GetStrings(SectionId_PatientIds);
+
+  if (patientNames.GetCount() != orthancIds.GetCount() ||
+      patientIds.GetCount() != orthancIds.GetCount())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Inconsistent patient names snapshot");
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Clear();
+  patients_.reserve(orthancIds.GetCount());
+
+  // the keys are cheap to compute: they are not stored in the snapshot
+  for (uint64_t i = 0; i < orthancIds.GetCount(); i++)
+  {
+    SetPatient(orthancIds.GetString(i), patientNames.GetString(i), patientIds.GetString(i));
+  }
+
+  lastSequence_ = reader.GetChangeSequence();
+}
+
+
+void PatientNameIndex::ListResources(std::vector<std::string>& target)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  target.clear();
+  target.reserve(slots_.size());
+
+  for (std::map<std::string, uint32_t>::const_iterator it = slots_.begin(); it != slots_.end(); ++it)
+  {
+    target.push_back(it->first);
+  }
+}
+
+
+IndexSnapshot::Writer* PatientNameIndex::CreateSnapshot()
+{
+  std::vector<std::string> orthancIds, patientNames, patientIds;
+  int64_t sequence;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    sequence = lastSequence_;
+    orthancIds.reserve(patients_.size() - deletedCount_);
+    patientNames.reserve(patients_.size() - deletedCount_);
+    patientIds.reserve(patients_.size() - deletedCount_);
+
+    for (size_t i = 0; i < patients_.size(); i++)
+    {
+      if (!patients_[i].isDeleted_)
+      {
+        orthancIds.push_back(patients_[i].orthancId_);
+        patientNames.push_back(patients_[i].patientName_);
+        patientIds.push_back(patients_[i].patientId_);
+      }
+    }
+  }
+
+  std::unique_ptr<IndexSnapshot::Writer> writer(new IndexSnapshot::Writer(GetName(), GetFormatVersion(), sequence));
+  writer->AddStrings(SectionId_OrthancIds, orthancIds);
+  writer->AddStrings(SectionId_PatientNames, patientNames);
+  writer->AddStrings(SectionId_PatientIds, patientIds);
+  return writer.release();
+}
+
+
+void PatientNameIndex::Rebuild()
+{
+  // the changes that occur while scanning are applied once the scan is complete
+  const int64_t sequence = ChangesTracker::GetLastChange();
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    isRebuilding_ = true;
+    changesDuringRebuild_.clear();
+  }
+
+  std::vector<Patient> patients;
+
+  for (unsigned int since = 0; ; since += PATIENTS_PAGE_SIZE)
+  {
+    Json::Value page;
+    if (!OrthancPlugins::RestApiGet(page, "/patients?expand&since=" + boost::lexical_cast<std::string>(since) +
+                                    "&limit=" + boost::lexical_cast<std::string>(PATIENTS_PAGE_SIZE), false))
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      isRebuilding_ = false;
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to list the patients");
+    }
+
+    for (Json::Value::ArrayIndex i = 0; i < page.size(); i++)
+    {
+      Patient patient;
+      patient.orthancId_ = page[i]["ID"].asString();
+      patient.patientName_ = page[i]["MainDicomTags"]["PatientName"].asString();
+      patient.patientId_ = page[i]["MainDicomTags"]["PatientID"].asString();
+      patient.isDeleted_ = false;
+      patients.push_back(patient);
+    }
+
+    if (page.size() < PATIENTS_PAGE_SIZE)
+    {
+      break;
+    }
+  }
+
+  std::vector<ChangesPipeline::Change> pendingChanges;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Clear();
+
+    for (size_t i = 0; i < patients.size(); i++)
+    {
+      SetPatient(patients[i].orthancId_, patients[i].patientName_, patients[i].patientId_);
+    }
+
+    lastSequence_ = sequence;
+    MarkModified();
+    isRebuilding_ = false;
+    pendingChanges.swap(changesDuringRebuild_);
+  }
+
+  HandleChanges(pendingChanges);
+}
+
+
+void PatientNameIndex::HandleChanges(const std::vector<ChangesPipeline::Change>& changes)
+{
+  for (size_t i = 0; i < changes.size(); i++)
+  {
+    const ChangesPipeline::Change& change = changes[i];
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (isRebuilding_)
+      {
+        changesDuringRebuild_.push_back(change);
+        continue;
+      }
+
+      if (lastSequence_ < 0)
+      {
+        continue;  // not built yet, the changes will be taken into account by the rebuild
+      }
+
+      if (change.sequence_ >= 0 &&
+          change.sequence_ <= lastSequence_)
+      {
+        continue;  // already processed (replayed after a restart)
+      }
+    }
+
+    if (change.resourceType_ == OrthancPluginResourceType_Patient)
+    {
+      switch (change.changeType_)
+      {
+        case OrthancPluginChangeType_NewPatient:
+        case OrthancPluginChangeType_StablePatient:  // the PatientName may have been modified
+          UpdatePatient(change.resourceId_);
+          break;
+
+        case OrthancPluginChangeType_Deleted:
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          RemovePatient(change.resourceId_);
+          MarkModified();
+          break;
+        }
+
+        default:
+          break;
+      }
+    }
+
+    if (change.sequence_ >= 0)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      lastSequence_ = std::max(lastSequence_, change.sequence_);
+      MarkModified();
+    }
+  }
+}
+
+
+int64_t PatientNameIndex::GetLastProcessedSequence()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return lastSequence_;
+}
@@ -0,0 +1,131 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "PersistentIndexes.h"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+
+// An in-memory index of the patient names for the fuzzy patient search.  Each component of the PatientName
+// ("DOE^JOHN" -> "DOE", "JOHN") is indexed by its accent-folded and case-folded form ("Müller" -> "MULLER") and
+// by its phonetic keys (Double Metaphone-style, "MULLER" / "MILLER" -> "MLR").  The keys are interned in the
+// shared StringDictionary.
+class PatientNameIndex : public IPersistentIndex
+{
+public:
+  struct Candidate
+  {
+    std::string  orthancId_;
+    std::string  patientName_;
+    std::string  patientId_;
+    double       score_;  // between 0 and 1
+  };
+
+private:
+  struct Patient
+  {
+    std::string  orthancId_;
+    std::string  patientName_;
+    std::string  patientId_;
+    bool         isDeleted_;
+  };
+
+  typedef boost::unordered_map<uint32_t, std::vector<uint32_t> >  PostingLists;  // key id -> patient slots
+
+  boost::mutex                     mutex_;
+  std::vector<Patient>             patients_;
+  std::map<std::string, uint32_t>  slots_;  // Orthanc id -> index in 'patients_'
+  size_t                           deletedCount_;
+  PostingLists                     folded_;
+  PostingLists                     phonetic_;
+  int64_t                          lastSequence_;
+  bool                             isRebuilding_;
+  std::vector<ChangesPipeline::Change>  changesDuringRebuild_;
+
+  void IndexPatient(uint32_t slot);
+
+  void UnindexPatient(uint32_t slot);
+
+  // must be called with the mutex locked
+  void SetPatient(const std::string& orthancId,
+                  const std::string& patientName,
+                  const std::string& patientId);
+
+  void RemovePatient(const std::string& orthancId);
+
+  void Compact();
+
+  void Clear();
+
+  void UpdatePatient(const std::string& orthancId);
+
+public:
+  PatientNameIndex();
+
+  // splits a PatientName in its components and returns their accent-folded and case-folded form
+  static void GetFoldedComponents(std::vector<std::string>& target,
+                                  const std::string& patientName);
+
+  // 'word' must be a folded component
+  static void GetPhoneticKeys(std::string& primary,
+                              std::string& alternate,
+                              const std::string& word);
+
+  // the best candidates first.  Returns false if the index has not been built yet.
+  bool Search(std::vector<Candidate>& target,
+              const std::string& query,
+              size_t maxResults);
+
+  virtual const char* GetName() const
+  {
+    return "patient-names";
+  }
+
+  virtual uint32_t GetFormatVersion() const
+  {
+    return 1;
+  }
+
+  virtual OrthancPluginResourceType GetResourceType() const
+  {
+    return OrthancPluginResourceType_Patient;
+  }
+
+  virtual void LoadSnapshot(const IndexSnapshot::Reader& reader);
+
+  virtual void ListResources(std::vector<std::string>& target);
+
+  virtual IndexSnapshot::Writer* CreateSnapshot();
+
+  virtual void Rebuild();
+
+  virtual void HandleChanges(const std::vector<ChangesPipeline::Change>& changes);
+
+  virtual int64_t GetLastProcessedSequence();
+};
@@ -0,0 +1,396 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "PersistentIndexes.h"
+
+#include "ChangesTracker.h"
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <set>
+
+
+namespace
+{
+  class RebuildIndexTask : public TaskExecutor::ITask
+  {
+  private:
+    IPersistentIndex&  index_;
+
+  public:
+    explicit RebuildIndexTask(IPersistentIndex& index) :
+      index_(index)
+    {
+    }
+
+    virtual void Execute()
+    {
+      LOG(WARNING) << "Orthanc Explorer 2: building the '" << index_.GetName() << "' index, this may take a while";
+      index_.Rebuild();
+      LOG(WARNING) << "Orthanc Explorer 2: the '" << index_.GetName() << "' index has been built";
+    }
+  };
+
+
+  // removes the resources of an index that are not in the Orthanc DB anymore
+  class RemoveDeletedResourcesTask : public TaskExecutor::ITask
+  {
+  private:
+    IPersistentIndex&  index_;
+
+  public:
+    explicit RemoveDeletedResourcesTask(IPersistentIndex& index) :
+      index_(index)
+    {
+    }
+
+    virtual void Execute()
+    {
+      // the index is listed first, so that a resource that is added in the meantime is never considered as deleted
+      std::vector<std::string> indexed;
+      index_.ListResources(indexed);
+
+      if (indexed.empty())
+      {
+        return;
+      }
+
+      std::string uri;
+      switch (index_.GetResourceType())
+      {
+        case OrthancPluginResourceType_Patient:
+          uri = "/patients";
+          break;
+
+        case OrthancPluginResourceType_Study:
+          uri = "/studies";
+          break;
+
+        case OrthancPluginResourceType_Series:
+          uri = "/series";
+          break;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+
+      Json::Value resources;
+      if (!OrthancPlugins::RestApiGet(resources, uri, false))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to list the resources");
+      }
+
+      std::set<std::string> existing;
+      for (Json::Value::ArrayIndex i = 0; i < resources.size(); i++)
+      {
+        existing.insert(resources[i].asString());
+      }
+
+      std::vector<ChangesPipeline::Change> deletions;
+
+      for (size_t i = 0; i < indexed.size(); i++)
+      {
+        if (existing.find(indexed[i]) == existing.end())
+        {
+          ChangesPipeline::Change change;
+          change.sequence_ = -1;
+          change.changeType_ = OrthancPluginChangeType_Deleted;
+          change.resourceType_ = index_.GetResourceType();
+          change.resourceId_ = indexed[i];
+          deletions.push_back(change);
+        }
+      }
+
+      if (!deletions.empty())
+      {
+        LOG(WARNING) << "Orthanc Explorer 2: removing " << deletions.size() << " deleted resources from the '" << index_.GetName() << "' index";
+        index_.HandleChanges(deletions);
+      }
+    }
+  };
+
+
+  class SaveSnapshotsTask : public TaskExecutor::ITask
+  {
+  private:
+    PersistentIndexesManager&  manager_;
+
+  public:
+    explicit SaveSnapshotsTask(PersistentIndexesManager& manager) :
+      manager_(manager)
+    {
+    }
+
+    virtual void Execute()
+    {
+      manager_.SaveSnapshots();
+    }
+  };
+}
+
+
+PersistentIndexesManager::PersistentIndexesManager() :
+  snapshotPeriod_(600),
+  executor_(NULL),
+  stopped_(true)
+{
+}
+
+
+PersistentIndexesManager::~PersistentIndexesManager()
+{
+  if (!stopped_)
+  {
+    LOG(ERROR) << "PersistentIndexesManager::Stop() should have been called";
+  }
+}
+
+
+void PersistentIndexesManager::Configure(const Json::Value& configuration)
+{
+  if (configuration.isObject())
+  {
+    directory_ = configuration["Directory"].asString();
+    snapshotPeriod_ = std::max(10u, configuration["Period"].asUInt());
+  }
+
+  if (!directory_.empty())
+  {
+    Orthanc::SystemToolbox::MakeDirectory(directory_);
+  }
+}
+
+
+void PersistentIndexesManager::Register(IPersistentIndex& index)
+{
+  indexes_.push_back(&index);
+}
+
+
+std::string PersistentIndexesManager::GetSnapshotPath(const IPersistentIndex& index) const
+{
+  return (boost::filesystem::path(directory_) / (std::string(index.GetName()) + ".snapshot")).string();
+}
+
+
+void PersistentIndexesManager::LoadSnapshots()
+{
+  for (size_t i = 0; i < indexes_.size(); i++)
+  {
+    IPersistentIndex& index = *indexes_[i];
+    bool loaded = false;
+
+    if (!directory_.empty())
+    {
+      const std::string path = GetSnapshotPath(index);
+
+      if (Orthanc::SystemToolbox::IsExistingFile(path))
+      {
+        try
+        {
+          std::unique_ptr<IndexSnapshot::Reader> reader(new IndexSnapshot::Reader(path));
+
+          if (reader->GetIndexName() == index.GetName() &&
+              reader->GetIndexVersion() == index.GetFormatVersion())
+          {
+            const int64_t sequence = reader->GetChangeSequence();
+            index.LoadSnapshot(*reader);
+            savedSequences_[&index] = sequence;
+            loadedIndexes_.push_back(&index);
+            savedModifications_[&index] = index.GetModificationsCount();
+            loaded = true;
+
+            LOG(WARNING) << "Orthanc Explorer 2: the '" << index.GetName() << "' index has been loaded from its snapshot (change " << sequence << ")";
+          }
+          else
+          {
+            LOG(WARNING) << "Orthanc Explorer 2: the snapshot of the '" << index.GetName() << "' index has an older format and is ignored";
+          }
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          LOG(ERROR) << "Orthanc Explorer 2: unable to load the snapshot of the '" << index.GetName() << "' index: " << e.What();
+        }
+      }
+    }
+
+    if (!loaded)
+    {
+      indexesToRebuild_.push_back(&index);
+    }
+  }
+}
+
+
+void PersistentIndexesManager::HandleChanges(const std::vector<ChangesPipeline::Change>& changes)
+{
+  for (size_t i = 0; i < changes.size(); i++)
+  {
+    if (changes[i].changeType_ == OrthancPluginChangeType_OrthancStarted &&
+        executor_ != NULL)
+    {
+      // a snapshot that is more recent than the Orthanc DB has been created for another DB
+      const int64_t lastChange = ChangesTracker::GetLastChange();
+
+      for (std::map<IPersistentIndex*, int64_t>::const_iterator it = savedSequences_.begin(); it != savedSequences_.end(); ++it)
+      {
+        if (it->second > lastChange)
+        {
+          LOG(WARNING) << "Orthanc Explorer 2: the snapshot of the '" << it->first->GetName() << "' index does not match the Orthanc DB";
+          indexesToRebuild_.push_back(it->first);
+        }
+      }
+
+      for (size_t j = 0; j < indexesToRebuild_.size(); j++)
+      {
+        executor_->Submit(new RebuildIndexTask(*indexesToRebuild_[j]), TaskExecutor::Priority_Maintenance);
+      }
+
+      for (size_t j = 0; j < loadedIndexes_.size(); j++)
+      {
+        if (std::find(indexesToRebuild_.begin(), indexesToRebuild_.end(), loadedIndexes_[j]) == indexesToRebuild_.end())
+        {
+          executor_->Submit(new RemoveDeletedResourcesTask(*loadedIndexes_[j]), TaskExecutor::Priority_Maintenance);
+        }
+      }
+
+      indexesToRebuild_.clear();
+      loadedIndexes_.clear();
+    }
+  }
+}
+
+
+void PersistentIndexesManager::SaveSnapshots()
+{
+  if (directory_.empty())
+  {
+    return;
+  }
+
+  for (size_t i = 0; i < indexes_.size(); i++)
+  {
+    IPersistentIndex& index = *indexes_[i];
+
+    try
+    {
+      // read before creating the snapshot: the modifications that happen meanwhile are saved the next time
+      const uint64_t modifications = index.GetModificationsCount();
+      const int64_t sequence = index.GetLastProcessedSequence();
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        std::map<IPersistentIndex*, uint64_t>::const_iterator saved = savedModifications_.find(&index);
+        if (sequence < 0 ||  // not built yet
+            (saved != savedModifications_.end() && saved->second == modifications))
+        {
+          continue;
+        }
+      }
+
+      std::unique_ptr<IndexSnapshot::Writer> writer(index.CreateSnapshot());
+      writer->WriteAtomically(GetSnapshotPath(index));
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        savedSequences_[&index] = sequence;
+        savedModifications_[&index] = modifications;
+      }
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Orthanc Explorer 2: unable to save the snapshot of the '" << index.GetName() << "' index: " << e.What();
+    }
+    catch (boost::filesystem::filesystem_error& e)
+    {
+      LOG(ERROR) << "Orthanc Explorer 2: unable to save the snapshot of the '" << index.GetName() << "' index: " << e.what();
+    }
+  }
+}
+
+
+void PersistentIndexesManager::Timer()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  while (!stopped_)
+  {
+    stopRequested_.timed_wait(lock, boost::posix_time::seconds(snapshotPeriod_));
+
+    if (!stopped_)
+    {
+      executor_->Submit(new SaveSnapshotsTask(*this), TaskExecutor::Priority_Maintenance);
+    }
+  }
+}
+
+
+void PersistentIndexesManager::Start(TaskExecutor& executor)
+{
+  executor_ = &executor;
+
+  if (!directory_.empty() && !indexes_.empty())
+  {
+    stopped_ = false;
+    timer_ = boost::thread(&PersistentIndexesManager::Timer, this);
+  }
+}
+
+
+void PersistentIndexesManager::StopTimer()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (stopped_)
+    {
+      return;
+    }
+
+    stopped_ = true;
+  }
+
+  stopRequested_.notify_all();
+
+  if (timer_.joinable())
+  {
+    timer_.join();
+  }
+}
+
+
+void PersistentIndexesManager::Stop()
+{
+  StopTimer();
+
+  if (executor_ != NULL)
+  {
+    SaveSnapshots();  // a restart will not have to replay the changes since the last periodic snapshot
+  }
+}
@@ -0,0 +1,141 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "ChangesPipeline.h"
+#include "IndexSnapshot.h"
+#include "TaskExecutor.h"
+
+#include <json/value.h>
+
+#include <boost/thread.hpp>
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+
+// An in-memory index of the plugin that is persisted in a snapshot file, so that it does not have to be
+// rebuilt by scanning the whole Orthanc DB after each restart.  After loading a snapshot, the index is brought
+// up to date by the changes pipeline that replays '/changes' from the sequence of the snapshot.  The deletions
+// are not recorded in '/changes': the resources that have been deleted while the plugin was not running are
+// found by comparing the resources of the index with the ones of the Orthanc DB.
+class IPersistentIndex : public ChangesPipeline::IConsumer
+{
+private:
+  std::atomic<uint64_t>  modificationsCount_;
+
+protected:
+  // to call each time the content or the sequence of the index changes.  The deletions must also call it since
+  // they are not recorded in '/changes' and do not advance the sequence of the index.
+  void MarkModified()
+  {
+    modificationsCount_++;
+  }
+
+public:
+  IPersistentIndex() :
+    modificationsCount_(0)
+  {
+  }
+
+  // a snapshot is saved when this count has changed since the previous snapshot
+  uint64_t GetModificationsCount() const
+  {
+    return modificationsCount_;
+  }
+
+  // used as the name of the snapshot file, must be unique
+  virtual const char* GetName() const = 0;
+
+  // must be incremented each time the content of the snapshot changes: the older snapshots are ignored
+  virtual uint32_t GetFormatVersion() const = 0;
+
+  // the level of the resources returned by ListResources()
+  virtual OrthancPluginResourceType GetResourceType() const = 0;
+
+  // the content of the snapshot is copied in the index, the reader is released once the snapshot is loaded
+  virtual void LoadSnapshot(const IndexSnapshot::Reader& reader) = 0;
+
+  // the Orthanc ids of the resources that are in the index
+  virtual void ListResources(std::vector<std::string>& target) = 0;
+
+  // called from a background thread.  The returned writer must contain a consistent state of the index
+  // together with the sequence of the last change that it reflects.
+  virtual IndexSnapshot::Writer* CreateSnapshot() = 0;
+
+  // called from a background thread if no valid snapshot could be loaded (the Orthanc REST API is available).
+  // Must replace the whole content of the index.
+  virtual void Rebuild() = 0;
+};
+
+
+class PersistentIndexesManager : public ChangesPipeline::IConsumer
+{
+private:
+  std::vector<IPersistentIndex*>  indexes_;
+  std::map<IPersistentIndex*, int64_t>  savedSequences_;
+  std::map<IPersistentIndex*, uint64_t> savedModifications_;
+  std::vector<IPersistentIndex*>  indexesToRebuild_;
+  std::vector<IPersistentIndex*>  loadedIndexes_;   // the indexes that have been loaded from their snapshot
+  std::string                     directory_;
+  unsigned int                    snapshotPeriod_;
+  TaskExecutor*                   executor_;
+  boost::mutex                    mutex_;
+  boost::condition_variable       stopRequested_;
+  bool                            stopped_;
+  boost::thread                   timer_;
+
+  std::string GetSnapshotPath(const IPersistentIndex& index) const;
+
+  void Timer();
+
+public:
+  PersistentIndexesManager();
+
+  ~PersistentIndexesManager();
+
+  void Configure(const Json::Value& configuration);
+
+  // the indexes must outlive the manager
+  void Register(IPersistentIndex& index);
+
+  // to call during the plugin initialization, before the changes pipeline is started
+  void LoadSnapshots();
+
+  void Start(TaskExecutor& executor);
+
+  // to call before stopping the executor: no more periodic snapshot is submitted
+  void StopTimer();
+
+  // writes a last snapshot of the modified indexes, to call once the executor is stopped
+  void Stop();
+
+  // saves the indexes that have been modified since their last snapshot
+  void SaveSnapshots();
+
+  // waits for Orthanc to be started before rebuilding the indexes without snapshot and before removing the
+  // resources that have been deleted since the snapshots of the other indexes
+  virtual void HandleChanges(const std::vector<ChangesPipeline::Change>& changes);
+};
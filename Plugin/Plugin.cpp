@@ -21,6 +21,30 @@
  **/
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+#include "AsyncRestClient.h"
+#include "CborWriter.h"
+#include "ChangesPipeline.h"
+#include "ChangesTracker.h"
+#include "DistDirectory.h"
+#include "JobsIndex.h"
+#include "HttpClientPool.h"
+#include "JsonWriter.h"
+#include "PatientNameIndex.h"
+#include "PersistentIndexes.h"
+#include "PriorsPrefetcher.h"
+#include "RumCollector.h"
+#include "SearchAdmission.h"
+#include "SelectionsRegistry.h"
+#include "SeriesContentIndex.h"
+#include "StorageWarmer.h"
+#include "StudyCapabilitiesIndex.h"
+#include "StudyDateIndex.h"
+#include "StudyFilter.h"
+#include "TaskExecutor.h"
+
+#if ORTHANC_OE2_ENABLE_JWT_VERIFIER == 1
+#  include "JwtVerifier.h"
+#endif
 
 #include <Logging.h>
 #include <SystemToolbox.h>
@@ -29,6 +53,11 @@
 
 #include <EmbeddedResources.h>
 
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+#include <atomic>
+#include <cmath>
+
 // we are using Orthanc 1.11.0 API (RequestedTags in tools/find)
 #define ORTHANC_CORE_MINIMAL_MAJOR     1
 #define ORTHANC_CORE_MINIMAL_MINOR     11
@@ -39,14 +68,42 @@ std::unique_ptr<OrthancPlugins::OrthancConfiguration> orthancFullConfiguration_;
 Json::Value pluginJsonConfiguration_;
 std::string oe2BaseUrl_;
 
+boost::mutex pluginsConfigurationMutex_;  // "pluginsConfiguration_" is written by the changes pipeline once Orthanc has started
 Json::Value pluginsConfiguration_;
-bool hasUserProfile_ = false;
+std::atomic<bool> hasUserProfile_(false);
 bool openInOhifV3IsExplicitelyDisabled = false;
 bool enableShares_ = false;
 std::string customCssPath_;
 std::string theme_ = "light";
 std::string customLogoPath_;
 std::string customLogoUrl_;
+std::unique_ptr<DistDirectory> distDirectory_;  // NULL if the web application is served from the embedded resources
+
+SearchAdmission searchAdmission_;
+AsyncRestClient asyncRestClient_;
+ChangesPipeline changesPipeline_;
+TaskExecutor backgroundTasks_;
+PersistentIndexesManager persistentIndexes_;
+ChangesTracker::DeletedResourcesJournal deletedResources_(10000);
+PatientNameIndex patientNameIndex_;
+bool enablePatientNameIndex_ = false;
+SeriesContentIndex seriesContentIndex_;
+bool enableSeriesContentIndex_ = false;
+StudyCapabilitiesIndex studyCapabilitiesIndex_;
+bool enableStudyCapabilitiesIndex_ = false;
+StudyDateIndex studyDateIndex_;
+bool enableStudyDateIndex_ = false;
+PriorsPrefetcher priorsPrefetcher_;
+StorageWarmer storageWarmer_;
+#if ORTHANC_OE2_ENABLE_JWT_VERIFIER == 1
+JwtVerifier jwtVerifier_;
+#endif
+JobsIndex jobsIndex_(asyncRestClient_);
+bool enableJobsIndex_ = false;
+RumCollector rumCollector_;
+SelectionsRegistry selectionsRegistry_;
+bool enableSelections_ = false;
+size_t selectionsMinSize_ = 0;
 
 
 template <enum Orthanc::EmbeddedResources::DirectoryResourceId folder>
@@ -100,6 +157,79 @@ void ServeEmbeddedFile(OrthancPluginRestOutput* output,
   }
 }
 
+// serves the web application from the external dist directory ("WebApplicationPath")
+void ServeDistDirectory(OrthancPluginRestOutput* output,
+                        const char* url,
+                        const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+    return;
+  }
+
+  std::string path = (request->groupsCount > 0 ? request->groups[0] : "");
+
+  // the version is kept alive until the answer is sent, even if a new version is swapped in the meantime
+  DistDirectory::VersionPtr version = distDirectory_->GetCurrentVersion();
+  const DistDirectory::File* file = version->Lookup(path);
+
+  if (file == NULL)
+  {
+    if (boost::starts_with(path, "assets/"))
+    {
+      OrthancPluginSendHttpStatusCode(context, output, 404);
+      return;
+    }
+
+    // all the other routes are handled by vue-router
+    path = "index.html";
+    file = version->Lookup(path);
+  }
+
+  std::string etag = file->GetETag();
+  if (path == "index.html" && theme_ != "light")
+  {
+    etag = "\"" + theme_ + "-" + etag.substr(1);
+  }
+
+  for (uint32_t i = 0; i < request->headersCount; ++i)
+  {
+    if (std::string(request->headersKeys[i]) == "if-none-match" &&
+        std::string(request->headersValues[i]) == etag)
+    {
+      OrthancPluginSendHttpStatus(context, output, 304, NULL, 0);
+      return;
+    }
+  }
+
+  OrthancPluginSetHttpHeader(context, output, "ETag", etag.c_str());
+
+  if (boost::starts_with(path, "assets/"))
+  {
+    // the names of the assets contain a hash of their content
+    OrthancPluginSetHttpHeader(context, output, "Cache-Control", "public, max-age=31536000, immutable");
+  }
+  else
+  {
+    OrthancPluginSetHttpHeader(context, output, "Cache-Control", "no-cache");
+  }
+
+  if (path == "index.html" && theme_ != "light")
+  {
+    std::string s(reinterpret_cast<const char*>(file->GetData()), file->GetSize());
+    boost::replace_all(s, "data-bs-theme=\"light\"", "data-bs-theme=\"" + theme_ + "\"");
+    OrthancPluginAnswerBuffer(context, output, s.c_str(), s.size(), file->GetMimeType().c_str());
+  }
+  else
+  {
+    // answered from the content kept in memory by DistDirectory, without an intermediate copy
+    OrthancPluginAnswerBuffer(context, output, file->GetData(), file->GetSize(), file->GetMimeType().c_str());
+  }
+}
+
 void ServeCustomLogo(OrthancPluginRestOutput* output,
                      const char* url,
                      const OrthancPluginHttpRequest* request)
@@ -292,6 +422,12 @@ void ReadConfiguration()
       }
     }
 
+    if (jsonConfig.isMember("WebApplicationPath") && jsonConfig["WebApplicationPath"].isString())
+    {
+      distDirectory_.reset(new DistDirectory(jsonConfig["WebApplicationPath"].asString(),
+                                             pluginJsonConfiguration_["WebApplicationPollingInterval"].asUInt()));
+    }
+
     if (jsonConfig.isMember("CustomLogoUrl") && jsonConfig["CustomLogoUrl"].isString())
     {
       customLogoUrl_ = jsonConfig["CustomLogoUrl"].asString();
@@ -304,6 +440,48 @@ void ReadConfiguration()
   }
 
   enableShares_ = pluginJsonConfiguration_["UiOptions"]["EnableShares"].asBool(); // we are sure that the value exists since it is in the default configuration file
+
+  searchAdmission_.Configure(pluginJsonConfiguration_["SearchAdmission"]);
+  backgroundTasks_.Configure(pluginJsonConfiguration_["BackgroundTasks"]);
+  asyncRestClient_.Configure(pluginJsonConfiguration_["InternalRequests"]);
+#if ORTHANC_OE2_ENABLE_HTTP_CLIENT_POOL == 1
+  HttpClientPool::GetInstance().Configure(pluginJsonConfiguration_["OutgoingHttpConnections"]);
+#endif
+  persistentIndexes_.Configure(pluginJsonConfiguration_["IndexSnapshots"]);
+  enablePatientNameIndex_ = pluginJsonConfiguration_["PatientNameIndex"]["Enable"].asBool();
+  enableSeriesContentIndex_ = pluginJsonConfiguration_["SeriesContentIndex"]["Enable"].asBool();
+  enableStudyCapabilitiesIndex_ = pluginJsonConfiguration_["StudyCapabilities"]["Enable"].asBool();
+  enableStudyDateIndex_ = pluginJsonConfiguration_["StudyDateIndex"]["Enable"].asBool();
+  priorsPrefetcher_.Configure(pluginJsonConfiguration_["PriorsPrefetch"]);
+#if ORTHANC_OE2_ENABLE_JWT_VERIFIER == 1
+  jwtVerifier_.Configure(pluginJsonConfiguration_["Keycloak"]);
+#else
+  if (pluginJsonConfiguration_["Keycloak"]["Enable"].asBool() &&
+      pluginJsonConfiguration_["Keycloak"]["VerifyTokens"].asBool())
+  {
+    LOG(WARNING) << "Orthanc Explorer 2: Keycloak.VerifyTokens is ignored, the plugin has been built without the token verification";
+  }
+#endif
+  enableJobsIndex_ = pluginJsonConfiguration_["JobsIndex"]["Enable"].asBool();
+  jobsIndex_.Configure(pluginJsonConfiguration_["JobsIndex"]);
+  rumCollector_.Configure(pluginJsonConfiguration_["RealUserMonitoring"]);
+  enableSelections_ = pluginJsonConfiguration_["Selections"]["Enable"].asBool();
+  selectionsMinSize_ = pluginJsonConfiguration_["Selections"]["MinSize"].asUInt();
+  selectionsRegistry_.Configure(pluginJsonConfiguration_["Selections"]);
+  storageWarmer_.Configure(pluginJsonConfiguration_["StorageWarmer"],
+                           orthancFullConfiguration_->GetUnsignedIntegerValue("MaximumStorageCacheSize", 128));
+
+  if (enableSeriesContentIndex_)
+  {
+    std::vector<std::string> tags;
+    const Json::Value& indexedTags = pluginJsonConfiguration_["SeriesContentIndex"]["Tags"];
+    for (Json::Value::ArrayIndex i = 0; i < indexedTags.size(); i++)
+    {
+      tags.push_back(indexedTags[i].asString());
+    }
+
+    seriesContentIndex_.SetIndexedTags(tags);
+  }
 }
 
 bool GetPluginConfiguration(Json::Value& jsonPluginConfiguration, const std::string& sectionName)
@@ -334,15 +512,6 @@ bool IsPluginEnabledInConfiguration(const std::string& sectionName, const std::s
   return defaultValue;
 }
 
-Json::Value GetPluginInfo(const std::string& pluginName)
-{
-  Json::Value pluginInfo;
-
-  OrthancPlugins::RestApiGet(pluginInfo, "/plugins/" + pluginName, false);
-  
-  return pluginInfo;
-}
-
 Json::Value GetKeycloakConfiguration()
 {
   if (pluginJsonConfiguration_.isMember("Keycloak"))
@@ -350,7 +519,15 @@ Json::Value GetKeycloakConfiguration()
     const Json::Value& keyCloakSection = pluginJsonConfiguration_["Keycloak"];
     if (keyCloakSection.isMember("Enable") && keyCloakSection["Enable"].asBool() == true)
     {
-      return pluginJsonConfiguration_["Keycloak"];
+      // the token verification settings are only relevant for the plugin (see JwtVerifier)
+      Json::Value keycloak = keyCloakSection;
+      keycloak.removeMember("VerifyTokens");
+      keycloak.removeMember("JwksUrl");
+      keycloak.removeMember("JwksPath");
+      keycloak.removeMember("Issuer");
+      keycloak.removeMember("ClaimsCacheSize");
+      keycloak.removeMember("ClockSkew");
+      return keycloak;
     }
   }
 
@@ -372,6 +549,15 @@ Json::Value GetPluginsConfiguration(bool& hasUserProfile)
 
   OrthancPlugins::RestApiGet(pluginList, "/plugins", false);
 
+  // the info of all the plugins are retrieved concurrently
+  std::vector<AsyncRestClient::Future> pluginsInfo;
+  for (Json::Value::ArrayIndex i = 0; i < pluginList.size(); i++)
+  {
+    pluginsInfo.push_back(asyncRestClient_.Get("/plugins/" + pluginList[i].asString(), false));
+  }
+
+  AsyncRestClient::WaitAll(pluginsInfo, asyncRestClient_.GetDefaultDeadline());
+
   for (Json::Value::ArrayIndex i = 0; i < pluginList.size(); i++)
   {
     Json::Value pluginConfiguration;
@@ -382,7 +568,11 @@ Json::Value GetPluginsConfiguration(bool& hasUserProfile)
       continue;
     }
 
-    Json::Value pluginInfo = GetPluginInfo(pluginName);
+    Json::Value pluginInfo;
+    if (pluginsInfo[i].GetStatus() == AsyncRestClient::Status_Success)
+    {
+      pluginInfo = pluginsInfo[i].GetAnswer();
+    }
 
     if (pluginInfo.isMember("RootUri") && pluginInfo["RootUri"].asString().size() > 0)
     {
@@ -531,6 +721,19 @@ Json::Value GetPluginsConfiguration(bool& hasUserProfile)
   return pluginsConfiguration;
 }
 
+// serializes the answer in the buffer of the current thread (compact JSON)
+static void AnswerJson(OrthancPluginRestOutput* output,
+                       const Json::Value& answer)
+{
+  std::string& s = JsonWriter::GetThreadBuffer();
+
+  JsonWriter writer(s);
+  writer.WriteValue(answer);
+
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, s.c_str(), s.size(), "application/json");
+}
+
+
 void UpdateUiOptions(Json::Value& uiOption, const std::list<std::string>& permissions, const std::string& anyOfPermissions)
 {
   std::vector<std::string> permissionsVector;
@@ -560,17 +763,30 @@ void GetOE2Configuration(OrthancPluginRestOutput* output,
   {
     Json::Value oe2Configuration;
 
-    oe2Configuration["Plugins"] = pluginsConfiguration_;
+    {
+      boost::mutex::scoped_lock lock(pluginsConfigurationMutex_);
+      oe2Configuration["Plugins"] = pluginsConfiguration_;
+    }
+
     oe2Configuration["UiOptions"] = pluginJsonConfiguration_["UiOptions"];
     
     // if OHIF has not been explicitely disabled in the config and if the plugin is loaded, enable it
-    if (!openInOhifV3IsExplicitelyDisabled && pluginsConfiguration_.isMember("ohif"))
+    if (!openInOhifV3IsExplicitelyDisabled && oe2Configuration["Plugins"].isMember("ohif"))
     {
       oe2Configuration["UiOptions"]["EnableOpenInOhifViewer3"] = true;
     }
 
+    // the UI warms the storage when a study is expanded
+    oe2Configuration["UiOptions"]["EnableStorageWarming"] = storageWarmer_.IsActive();
+
+    // the UI reports its latencies to api/rum
+    oe2Configuration["UiOptions"]["EnableRealUserMonitoring"] = rumCollector_.IsEnabled();
+
+    // the bulk actions on this number of studies or more go through api/selections (0 = never)
+    oe2Configuration["UiOptions"]["ServerSideSelectionsMinSize"] = static_cast<unsigned int>(enableSelections_ ? selectionsMinSize_ : 0);
+
     Json::Value tokens = pluginJsonConfiguration_["Tokens"];
-    tokens["RequiredForLinks"] = hasUserProfile_;
+    tokens["RequiredForLinks"] = hasUserProfile_.load();
 
     oe2Configuration["Tokens"] = tokens;
 
@@ -616,8 +832,7 @@ void GetOE2Configuration(OrthancPluginRestOutput* output,
     }
 
     oe2Configuration["Keycloak"] = GetKeycloakConfiguration();
-    std::string answer = oe2Configuration.toStyledString();
-    OrthancPluginAnswerBuffer(context, output, answer.c_str(), answer.size(), "application/json");
+    AnswerJson(output, oe2Configuration);
   }
 }
 
@@ -636,182 +851,1915 @@ void GetOE2PreLoginConfiguration(OrthancPluginRestOutput* output,
     Json::Value oe2Configuration;
     oe2Configuration["Keycloak"] = GetKeycloakConfiguration();
 
-    std::string answer = oe2Configuration.toStyledString();
-    OrthancPluginAnswerBuffer(context, output, answer.c_str(), answer.size(), "application/json");
+    AnswerJson(output, oe2Configuration);
   }
 }
 
-
-static bool DisplayPerformanceWarning(OrthancPluginContext* context)
+// Answers the lists built by the plugin in JSON or, if the client accepts it, in a compact CBOR
+// encoding (see CompactJsonEncoder) that is much smaller for the expanded study lists.
+static void AnswerList(OrthancPluginRestOutput* output,
+                       const OrthancPluginHttpRequest* request,
+                       const Json::Value& answer)
 {
-  (void) DisplayPerformanceWarning;   // Disable warning about unused function
-  OrthancPluginLogWarning(context, "Performance warning in Orthanc Explorer 2: "
-                          "Non-release build, runtime debug assertions are turned on");
-  return true;
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  std::map<std::string, std::string> headers;
+  OrthancPlugins::GetHttpHeaders(headers, request);
+
+  if (CompactJsonEncoder::IsAccepted(headers))
+  {
+    std::string& s = JsonWriter::GetThreadBuffer();
+    CompactJsonEncoder encoder(s);
+    encoder.Encode(answer);
+    OrthancPluginAnswerBuffer(context, output, s.c_str(), s.size(), CompactJsonEncoder::GetMimeType());
+  }
+  else
+  {
+    AnswerJson(output, answer);
+  }
 }
 
 
-static void CheckRootUrlIsValid(const std::string& value, const std::string& name, bool allowEmpty)
+static void AnswerSearchRejected(OrthancPluginRestOutput* output,
+                                 SearchAdmission::Status status,
+                                 double cost,
+                                 double retryAfter)
 {
-  if (allowEmpty && value.size() == 0)
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  Json::Value answer;
+  uint16_t httpStatus = 0;
+
+  switch (status)
   {
-    return;
+    case SearchAdmission::Status_TooExpensive:
+      httpStatus = 400;
+      answer["Reason"] = "too-expensive";
+      answer["Message"] = "This search is too broad.  Add more selective criteria (e.g. a shorter date range or a text without a leading wildcard).";
+      break;
+
+    case SearchAdmission::Status_RateLimited:
+      httpStatus = 429;
+      answer["Reason"] = "rate-limited";
+      answer["Message"] = "Too many searches have been performed recently, please retry later.";
+      break;
+
+    case SearchAdmission::Status_Busy:
+      httpStatus = 503;
+      answer["Reason"] = "busy";
+      answer["Message"] = "The server is busy with other searches, please retry later.";
+      break;
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
   }
 
-  if (value.size() < 1 ||
-      value[0] != '/' ||
-      value[value.size() - 1] != '/')
+  answer["EstimatedCost"] = cost;
+
+  LOG(WARNING) << "Orthanc Explorer 2: search rejected (" << answer["Reason"].asString() << ", estimated cost: " << cost << ")";
+
+  if (retryAfter > 0)
   {
-    OrthancPlugins::LogError("Orthanc-Explorer 2: '" + name + "' configuration shall start with a '/' and end with a '/': " + value);
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    std::string retryAfterSeconds = boost::lexical_cast<std::string>(static_cast<unsigned int>(std::ceil(retryAfter)));
+    answer["RetryAfter"] = retryAfterSeconds;
+    OrthancPluginSetHttpHeader(context, output, "Retry-After", retryAfterSeconds.c_str());
   }
+
+  std::string& s = JsonWriter::GetThreadBuffer();
+  JsonWriter writer(s);
+  writer.WriteValue(answer);
+
+  OrthancPluginSendHttpStatus(context, output, httpStatus, s.c_str(), s.size());
 }
 
-OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeType,
-                                        OrthancPluginResourceType resourceType,
-                                        const char* resourceId)
+
+static void AnswerIndexNotReady(OrthancPluginRestOutput* output)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  std::string message = "The index is being built, please retry later.";
+  OrthancPluginSetHttpHeader(context, output, "Retry-After", "30");
+  OrthancPluginSendHttpStatus(context, output, 503, message.c_str(), message.size());
+}
+
+
+// The identity of the user behind a request: the subject of its verified Keycloak token, the name in its profile from
+// the authorization plugin or, by default, a digest of its credentials (that have been checked by Orthanc or by the
+// authorization plugin).  The headers that the clients can set freely (e.g. "X-Forwarded-For") are never used.
+static std::string GetUserIdentity(const std::map<std::string, std::string>& headers)
 {
-  try
+#if ORTHANC_OE2_ENABLE_JWT_VERIFIER == 1
+  if (jwtVerifier_.IsEnabled())
   {
-    if (changeType == OrthancPluginChangeType_OrthancStarted)
+    std::string token;
+    Json::Value claims;
+    if (JwtVerifier::ExtractToken(token, headers) &&
+        jwtVerifier_.Verify(claims, token) == JwtVerifier::Status_Valid &&
+        claims["sub"].isString())
     {
-      // this can not be performed during plugin initialization because it is accessing the DB -> must be done when Orthanc has just started
-      pluginsConfiguration_ = GetPluginsConfiguration(hasUserProfile_);
+      return "sub:" + claims["sub"].asString();
     }
   }
-  catch (Orthanc::OrthancException& e)
+#endif
+
+  if (hasUserProfile_)
   {
-    LOG(ERROR) << "Exception: " << e.What();
-    return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+    Json::Value profile;
+    if (OrthancPlugins::RestApiGet(profile, "/auth/user/profile", headers, true) &&
+        profile.isObject() &&
+        profile["name"].isString() &&
+        !profile["name"].asString().empty())
+    {
+      return "user:" + profile["name"].asString();
+    }
   }
 
-  return OrthancPluginErrorCode_Success;
-}
+  static const char* CREDENTIALS_HEADERS[] = { "authorization", "token", NULL };
 
-
-extern "C"
-{
-  ORTHANC_PLUGINS_API int32_t OrthancPluginInitialize(OrthancPluginContext* context)
+  for (size_t i = 0; CREDENTIALS_HEADERS[i] != NULL; i++)
   {
-    assert(DisplayPerformanceWarning(context));
+    std::map<std::string, std::string>::const_iterator found = headers.find(CREDENTIALS_HEADERS[i]);
+    if (found != headers.end() && !found->second.empty())
+    {
+      std::string digest;
+      Orthanc::Toolbox::ComputeSHA1(digest, found->second);  // the credentials are not kept in memory
+      return std::string(CREDENTIALS_HEADERS[i]) + ":" + digest;
+    }
+  }
 
-    OrthancPlugins::SetGlobalContext(context);
-    
-    Orthanc::Logging::InitializePluginContext(context);
+  return "anonymous";
+}
 
-    Orthanc::Logging::EnableInfoLevel(true);
 
+// The DICOM tags returned for each study by the OE2 list routes.  They are given by 'fields=PatientName,StudyDate'
+// in the URL (or by "Fields" in the body of a POST) and default to the 'StudyListColumns'.  'fields=*' disables the
+// projection.  Returns false if all the tags must be returned.
+static bool GetProjectedFields(std::set<std::string>& fields,
+                               const OrthancPluginHttpRequest* request,
+                               const Json::Value& body)
+{
+  bool isSpecified = false;
+  std::vector<std::string> values;
 
-    /* Check the version of the Orthanc core */
-    if (!OrthancPlugins::CheckMinimalOrthancVersion(ORTHANC_CORE_MINIMAL_MAJOR,
-                                                    ORTHANC_CORE_MINIMAL_MINOR,
-                                                    ORTHANC_CORE_MINIMAL_REVISION))
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    if (std::string(request->getKeys[i]) == "fields")
     {
-      OrthancPlugins::ReportMinimalOrthancVersion(ORTHANC_CORE_MINIMAL_MAJOR,
-                                                  ORTHANC_CORE_MINIMAL_MINOR,
-                                                  ORTHANC_CORE_MINIMAL_REVISION);
-      return -1;
+      Orthanc::Toolbox::TokenizeString(values, request->getValues[i], ',');
+      isSpecified = true;
     }
+  }
 
-    OrthancPluginSetDescription(context, "Advanced User Interface for Orthanc");
+  if (!isSpecified && body.isMember("Fields") && body["Fields"].isArray())
+  {
+    for (Json::Value::ArrayIndex i = 0; i < body["Fields"].size(); i++)
+    {
+      values.push_back(body["Fields"][i].asString());
+    }
+    isSpecified = true;
+  }
 
-    try
+  if (!isSpecified)
+  {
+    const Json::Value& columns = pluginJsonConfiguration_["UiOptions"]["StudyListColumns"];
+    for (Json::Value::ArrayIndex i = 0; i < columns.size(); i++)
     {
-      ReadConfiguration();
+      values.push_back(columns[i].asString());
+    }
+  }
 
-      if (pluginJsonConfiguration_["Enable"].asBool())
-      {
-        oe2BaseUrl_ = pluginJsonConfiguration_["Root"].asString();
+  // the bulk actions (e.g. the viewers of the selected studies) need the DICOM id of the studies, the Orthanc id is
+  // never projected
+  fields.insert("StudyInstanceUID");
 
-        CheckRootUrlIsValid(oe2BaseUrl_, "Root", false);
+  for (size_t i = 0; i < values.size(); i++)
+  {
+    if (values[i] == "*")
+    {
+      return false;
+    }
+    else if (values[i] == "modalities")  // the special columns of the study list
+    {
+      fields.insert("ModalitiesInStudy");
+    }
+    else if (!values[i].empty() && isupper(static_cast<unsigned char>(values[i][0])))  // e.g. "seriesCount" is computed from the "Series" of the study
+    {
+      fields.insert(values[i]);
+    }
+  }
 
-        OrthancPlugins::LogWarning("Root URI to the Orthanc-Explorer 2 application: " + oe2BaseUrl_);
+  return true;
+}
 
 
-        OrthancPlugins::RegisterRestCallback
-          <ServeCustomCss>
-          (oe2BaseUrl_ + "app/customizable/custom.css", true);
+// Orthanc 1.11 can not restrict the main DICOM tags that are returned by an expanded 'tools/find': the projection
+// reduces the size of the answers, not the work of Orthanc (except for the RequestedTags, see RestrictRequestedTags())
+static void ProjectStudy(Json::Value& study,
+                         const std::set<std::string>& fields)
+{
+  // the other members (ID, Series, Labels, ...) are always returned
+  static const char* SECTIONS[] = { "MainDicomTags", "PatientMainDicomTags", "RequestedTags", NULL };
 
-        if (!customLogoPath_.empty())
+  for (size_t i = 0; SECTIONS[i] != NULL; i++)
+  {
+    if (study.isMember(SECTIONS[i]) && study[SECTIONS[i]].isObject())
+    {
+      Json::Value::Members tags = study[SECTIONS[i]].getMemberNames();
+      for (size_t j = 0; j < tags.size(); j++)
+      {
+        if (fields.find(tags[j]) == fields.end())
         {
-          OrthancPlugins::RegisterRestCallback
-            <ServeCustomLogo>
-            (oe2BaseUrl_ + "app/customizable/custom-logo", true);
+          study[SECTIONS[i]].removeMember(tags[j]);
         }
+      }
+    }
+  }
+}
 
-        // we need to mix the "routing" between the server and the frontend (vue-router)
-        // first part are the files that are 'static files' that must be served by the backend
-        OrthancPlugins::RegisterRestCallback
-          <ServeEmbeddedFolder<Orthanc::EmbeddedResources::WEB_APPLICATION_ASSETS> >
-          (oe2BaseUrl_ + "app/assets/(.*)", true);
-        OrthancPlugins::RegisterRestCallback
-          <ServeEmbeddedFile<Orthanc::EmbeddedResources::WEB_APPLICATION_INDEX, Orthanc::MimeType_Html> >
-          (oe2BaseUrl_ + "app/index.html", true);
-        OrthancPlugins::RegisterRestCallback
-          <ServeEmbeddedFile<Orthanc::EmbeddedResources::WEB_APPLICATION_INDEX_LANDING, Orthanc::MimeType_Html> >
-          (oe2BaseUrl_ + "app/token-landing.html", true);
-        OrthancPlugins::RegisterRestCallback
-          <ServeEmbeddedFile<Orthanc::EmbeddedResources::WEB_APPLICATION_INDEX_RETRIEVE_AND_VIEW, Orthanc::MimeType_Html> >
-          (oe2BaseUrl_ + "app/retrieve-and-view.html", true);
-        OrthancPlugins::RegisterRestCallback
-          <ServeEmbeddedFile<Orthanc::EmbeddedResources::WEB_APPLICATION_FAVICON, Orthanc::MimeType_Ico> >
-          (oe2BaseUrl_ + "app/favicon.ico", true);
-        
-        // second part are all the routes that are actually handled by vue-router and that are actually returning the same file (index.html)
-        OrthancPlugins::RegisterRestCallback
-          <ServeEmbeddedFile<Orthanc::EmbeddedResources::WEB_APPLICATION_INDEX, Orthanc::MimeType_Html> >
-          (oe2BaseUrl_ + "app/(.*)", true);
-        OrthancPlugins::RegisterRestCallback
-          <ServeEmbeddedFile<Orthanc::EmbeddedResources::WEB_APPLICATION_INDEX, Orthanc::MimeType_Html> >
-          (oe2BaseUrl_ + "app", true);
 
-        OrthancPlugins::RegisterRestCallback<GetOE2Configuration>(oe2BaseUrl_ + "api/configuration", true);
-        OrthancPlugins::RegisterRestCallback<GetOE2PreLoginConfiguration>(oe2BaseUrl_ + "api/pre-login-configuration", true);
+// The RequestedTags that are not projected are not requested from Orthanc (e.g. ModalitiesInStudy that is computed
+// from the series of each study)
+static void RestrictRequestedTags(Json::Value& findRequest,
+                                  const std::set<std::string>& fields)
+{
+  if (findRequest.isMember("RequestedTags") && findRequest["RequestedTags"].isArray())
+  {
+    Json::Value requestedTags = Json::arrayValue;
 
-        std::string pluginRootUri = oe2BaseUrl_ + "app/";
-        OrthancPluginSetRootUri(context, pluginRootUri.c_str());
+    for (Json::Value::ArrayIndex i = 0; i < findRequest["RequestedTags"].size(); i++)
+    {
+      if (fields.find(findRequest["RequestedTags"][i].asString()) != fields.end())
+      {
+        requestedTags.append(findRequest["RequestedTags"][i]);
+      }
+    }
 
-        if (pluginJsonConfiguration_["IsDefaultOrthancUI"].asBool())
-        {
-          OrthancPlugins::RegisterRestCallback<RedirectRoot>("/", true);
-        }
+    findRequest["RequestedTags"] = requestedTags;
+  }
+}
 
-        OrthancPluginRegisterOnChangeCallback(context, OnChangeCallback);
 
-        {
-          std::string explorer;
-          Orthanc::EmbeddedResources::GetFileResource(explorer, Orthanc::EmbeddedResources::ORTHANC_EXPLORER);
+static const size_t MAX_CANDIDATE_STUDIES = 1000;
+static const size_t CANDIDATES_CHUNK_SIZE = 50;  // the candidate studies that are read concurrently
 
-          std::map<std::string, std::string> dictionary;
-          dictionary["OE2_BASE_URL"] = oe2BaseUrl_.substr(1, oe2BaseUrl_.size() - 2);  // Remove heading and trailing slashes
-          std::string explorerConfigured = Orthanc::Toolbox::SubstituteVariables(explorer, dictionary);
+// Evaluates a study level 'tools/find' request on the studies that have been selected by the plugin indexes
+static void FindStudiesAmongCandidates(Json::Value& studies,
+                                       const Json::Value& findRequest,
+                                       const std::vector<std::string>& candidates,
+                                       const std::map<std::string, std::string>& headers)
+{
+  StudyFilter filter;
 
-          OrthancPluginExtendOrthancExplorer(OrthancPlugins::GetGlobalContext(), explorerConfigured.c_str());
-        }
-      }
-      else
-      {
-        OrthancPlugins::LogWarning("Orthanc Explorer 2 plugin is disabled");
-      }
-    }
-    catch (Orthanc::OrthancException& e)
+  if (findRequest.isMember("Query"))
+  {
+    Json::Value::Members tags = findRequest["Query"].getMemberNames();
+    for (size_t i = 0; i < tags.size(); i++)
     {
-      OrthancPlugins::LogError("Exception while initializing the Orthanc-Explorer 2 plugin: " + 
-                               std::string(e.What()));
-      return -1;
+      filter.AddConstraint(tags[i], findRequest["Query"][tags[i]].asString());
     }
-    catch (...)
+  }
+
+  if (findRequest.isMember("Labels"))
+  {
+    for (Json::Value::ArrayIndex i = 0; i < findRequest["Labels"].size(); i++)
     {
-      OrthancPlugins::LogError("Exception while initializing the Orthanc-Explorer 2 plugin");
-      return -1;
+      filter.AddLabel(findRequest["Labels"][i].asString());
     }
+  }
 
-    return 0;
+  if (findRequest.isMember("LabelsConstraint"))
+  {
+    filter.SetLabelsConstraint(StudyFilter::StringToLabelsConstraint(findRequest["LabelsConstraint"].asString()));
   }
 
+  std::set<std::string> requestedTags;
+  filter.GetRequestedTags(requestedTags);
 
-  ORTHANC_PLUGINS_API void OrthancPluginFinalize()
+  if (findRequest.isMember("RequestedTags"))
+  {
+    for (Json::Value::ArrayIndex i = 0; i < findRequest["RequestedTags"].size(); i++)
+    {
+      requestedTags.insert(findRequest["RequestedTags"][i].asString());
+    }
+  }
+
+  std::string requestedTagsArgument;
+  Orthanc::Toolbox::JoinStrings(requestedTagsArgument, requestedTags, ";");
+
+  const bool expand = findRequest.isMember("Expand") && findRequest["Expand"].asBool();
+  unsigned int since = findRequest.isMember("Since") ? findRequest["Since"].asUInt() : 0;
+  const unsigned int limit = findRequest.isMember("Limit") ? findRequest["Limit"].asUInt() : 0;
+
+  studies = Json::arrayValue;
+
+  // the candidates are read concurrently by chunks, until enough studies match
+  for (size_t offset = 0; offset < candidates.size(); offset += CANDIDATES_CHUNK_SIZE)
   {
+    std::vector<AsyncRestClient::Future> futures;
+
+    for (size_t i = offset; i < candidates.size() && i < offset + CANDIDATES_CHUNK_SIZE; i++)
+    {
+      // forward the headers to let the authorization plugin check the access to each study
+      futures.push_back(asyncRestClient_.Get("/studies/" + candidates[i] + "?requestedTags=" + requestedTagsArgument, headers, true));
+    }
+
+    AsyncRestClient::WaitAll(futures, asyncRestClient_.GetDefaultDeadline());
+
+    for (size_t i = 0; i < futures.size(); i++)
+    {
+      if (limit != 0 && studies.size() >= limit)
+      {
+        return;
+      }
+
+      // a failure is e.g. a study that is forbidden by the authorization plugin
+      if (futures[i].GetStatus() == AsyncRestClient::Status_Success &&
+          futures[i].IsFound() &&
+          filter.Match(futures[i].GetAnswer()))
+      {
+        if (since > 0)
+        {
+          since--;
+        }
+        else if (expand)
+        {
+          studies.append(futures[i].GetAnswer());
+        }
+        else
+        {
+          studies.append(candidates[offset + i]);
+        }
+      }
+    }
+  }
+}
+
+
+// Selects, through the study date index, the candidate studies of a request with a StudyDate constraint, in the
+// order of 'tools/find'.  Returns false if the index can not be used (no StudyDate constraint, open range, several
+// values, index not built).
+static bool LookupStudiesByDate(std::vector<std::string>& candidates,
+                                const Json::Value& findRequest,
+                                const std::set<std::string>* restriction)
+{
+  if (!enableStudyDateIndex_ ||
+      !findRequest.isMember("Query") ||
+      !findRequest["Query"].isMember("StudyDate") ||
+      !findRequest["Query"]["StudyDate"].isString())
+  {
+    return false;
+  }
+
+  uint32_t firstDay, lastDay;
+  return (StudyDateIndex::ParseDateRange(firstDay, lastDay, findRequest["Query"]["StudyDate"].asString()) &&
+          studyDateIndex_.FindStudies(candidates, firstDay, lastDay, restriction, MAX_CANDIDATE_STUDIES));
+}
+
+
+// Adds the StudyCapability flags of a study of the list (used by the UI to select the viewer buttons).
+// The flags are missing if the study has not been analysed yet.
+static void AddStudyCapabilities(Json::Value& study)
+{
+  uint32_t capabilities;
+  if (enableStudyCapabilitiesIndex_ &&
+      study.isMember("ID") &&
+      studyCapabilitiesIndex_.LookupCapabilities(capabilities, study["ID"].asString()))
+  {
+    study["Capabilities"] = capabilities;
+  }
+}
+
+
+// A study level 'tools/find' that goes through the admission control.  The request may contain a "SeriesQuery"
+// (e.g. {"Modality": "PT", "BodyPartExamined": "CHEST"}) to only select the studies that contain a series
+// matching all these constraints (requires the 'SeriesContentIndex').  If the 'StudyDateIndex' is enabled, the
+// studies of a StudyDate range are selected by the index and the other constraints are evaluated on them only.
+void FindStudies(OrthancPluginRestOutput* output,
+                 const char* /*url*/,
+                 const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
+  }
+  else
+  {
+    Json::Value findRequest;
+    if (!OrthancPlugins::ReadJson(findRequest, request->body, request->bodySize) || !findRequest.isObject())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The body must be a JSON object");
+    }
+
+    findRequest["Level"] = "Study";
+
+    std::set<std::string> fields;
+    bool isProjected = GetProjectedFields(fields, request, findRequest);
+    findRequest.removeMember("Fields");
+
+    if (isProjected)
+    {
+      RestrictRequestedTags(findRequest, fields);
+    }
+
+    Json::Value seriesQuery = findRequest["SeriesQuery"];
+    findRequest.removeMember("SeriesQuery");
+
+    if (!seriesQuery.isNull() && !enableSeriesContentIndex_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "The 'SeriesQuery' requires the 'SeriesContentIndex' to be enabled");
+    }
+
+    std::map<std::string, std::string> headers;
+    OrthancPlugins::GetHttpHeaders(headers, request);
+
+    double cost = SearchAdmission::EstimateQueryCost(findRequest);
+    double retryAfter = 0;
+
+    SearchAdmission::Ticket ticket;  // releases the search slot when leaving this scope
+    SearchAdmission::Status status = searchAdmission_.Admit(ticket, retryAfter, searchAdmission_.IsEnabled() ? GetUserIdentity(headers) : "", cost);
+
+    if (status != SearchAdmission::Status_Admitted)
+    {
+      AnswerSearchRejected(output, status, cost, retryAfter);
+      return;
+    }
+
+    Json::Value studies;
+
+    std::set<std::string> seriesCandidates;
+    if (!seriesQuery.isNull() &&
+        !seriesContentIndex_.FindStudies(seriesCandidates, seriesQuery))
+    {
+      AnswerIndexNotReady(output);
+      return;
+    }
+
+    std::vector<std::string> candidates;
+    bool hasCandidates = LookupStudiesByDate(candidates, findRequest, seriesQuery.isNull() ? NULL : &seriesCandidates);
+
+    if (!hasCandidates && !seriesQuery.isNull())
+    {
+      candidates.assign(seriesCandidates.begin(), seriesCandidates.end());
+      hasCandidates = true;
+    }
+
+    // each candidate is read through the REST API: they must be selective enough
+    if (hasCandidates && candidates.size() <= MAX_CANDIDATE_STUDIES)
+    {
+      FindStudiesAmongCandidates(studies, findRequest, candidates, headers);
+    }
+    else if (!seriesQuery.isNull())
+    {
+      AnswerSearchRejected(output, SearchAdmission::Status_TooExpensive, static_cast<double>(candidates.size()), 0);
+      return;
+    }
+    // too many studies in the date range -> let Orthanc run the whole query.
+    // Forward the headers to let the authorization plugin filter the results.
+    else if (!OrthancPlugins::RestApiPost(studies, "/tools/find", findRequest, headers, true))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Unable to find studies");
+    }
+
+    for (Json::Value::ArrayIndex i = 0; i < studies.size(); i++)
+    {
+      if (studies[i].isObject())  // not when "Expand" is false
+      {
+        if (isProjected)
+        {
+          ProjectStudy(studies[i], fields);
+        }
+
+        AddStudyCapabilities(studies[i]);
+      }
+    }
+
+    AnswerList(output, request, studies);
+  }
+}
+
+
+static const unsigned int MAX_DELTA_CHANGES = 10000;  // beyond this, the client had better reload the full list
+static const size_t MAX_DELTA_STUDIES = 200;
+
+// Lists the studies that have been added, updated or removed for a given filter since a given change sequence:
+// GET api/studies/delta?since=1234&PatientName=*JOHN*&labels=a,b&labels-constraint=All&ids=study1,study2&fields=StudyDate
+// The optional 'ids' are studies that must be re-evaluated even if they do not appear in the changes (e.g. label updates).
+void GetStudiesDelta(OrthancPluginRestOutput* output,
+                     const char* /*url*/,
+                     const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+    return;
+  }
+
+  int64_t since = -1;
+  StudyFilter filter;
+  std::set<std::string> touchedStudies;
+
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    const std::string key = request->getKeys[i];
+    const std::string value = request->getValues[i];
+
+    if (key == "since")
+    {
+      since = boost::lexical_cast<int64_t>(value);
+    }
+    else if (key == "labels" || key == "ids")
+    {
+      std::vector<std::string> tokens;
+      Orthanc::Toolbox::TokenizeString(tokens, value, ',');
+
+      for (size_t j = 0; j < tokens.size(); j++)
+      {
+        if (!tokens[j].empty())
+        {
+          if (key == "labels")
+          {
+            filter.AddLabel(tokens[j]);
+          }
+          else
+          {
+            touchedStudies.insert(tokens[j]);
+          }
+        }
+      }
+    }
+    else if (key == "labels-constraint")
+    {
+      filter.SetLabelsConstraint(StudyFilter::StringToLabelsConstraint(value));
+    }
+    else if (!key.empty() && isupper(static_cast<unsigned char>(key[0])))  // DICOM tags start with a capital letter
+    {
+      filter.AddConstraint(key, value);
+    }
+  }
+
+  std::set<std::string> fields;
+  bool isProjected = GetProjectedFields(fields, request, Json::nullValue);
+
+  if (since < 0)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Missing 'since' argument");
+  }
+
+  Json::Value answer;
+  answer["Reset"] = false;
+  answer["Updated"] = Json::arrayValue;
+  answer["Removed"] = Json::arrayValue;
+
+  // collect the studies that have been touched by the changes
+  ChangesTracker::TouchedResources touched;
+  int64_t last = since;
+
+  if (!ChangesTracker::CollectTouchedResources(touched, last, since, MAX_DELTA_CHANGES, false) ||
+      touchedStudies.size() + touched.studies_.size() > MAX_DELTA_STUDIES)
+  {
+    answer["Reset"] = true;
+  }
+
+  touchedStudies.insert(touched.studies_.begin(), touched.studies_.end());
+
+  answer["Last"] = static_cast<Json::Int64>(last);
+
+  if (!answer["Reset"].asBool())
+  {
+    // the study list always displays the modalities
+    std::set<std::string> requestedTags;
+    filter.GetRequestedTags(requestedTags);
+    requestedTags.insert("ModalitiesInStudy");
+
+    std::string requestedTagsArgument;
+    Orthanc::Toolbox::JoinStrings(requestedTagsArgument, requestedTags, ";");
+
+    // forward the headers to let the authorization plugin check the access to each study
+    std::map<std::string, std::string> headers;
+    OrthancPlugins::GetHttpHeaders(headers, request);
+
+    for (std::set<std::string>::const_iterator it = touchedStudies.begin(); it != touchedStudies.end(); ++it)
+    {
+      Json::Value study;
+      bool found = false;
+
+      try
+      {
+        found = OrthancPlugins::RestApiGet(study, "/studies/" + *it + "?requestedTags=" + requestedTagsArgument, headers, true);
+      }
+      catch (Orthanc::OrthancException&)
+      {
+        found = false;  // e.g. forbidden by the authorization plugin
+      }
+
+      if (found && filter.Match(study))
+      {
+        if (isProjected)
+        {
+          ProjectStudy(study, fields);
+        }
+
+        AddStudyCapabilities(study);
+        answer["Updated"].append(study);
+      }
+      else
+      {
+        answer["Removed"].append(*it);
+      }
+    }
+  }
+
+  AnswerList(output, request, answer);
+}
+
+
+static const unsigned int MAX_CACHE_VALIDATION_CHANGES = 10000;
+
+static bool IsAuthorizationPluginEnabled()
+{
+  boost::mutex::scoped_lock lock(pluginsConfigurationMutex_);
+  return pluginsConfiguration_.isMember("authorization") &&
+    pluginsConfiguration_["authorization"]["Enabled"].asBool();
+}
+
+// Keeps the resources that the user is allowed to access, checked through the authorization plugin
+static void FilterAuthorizedResources(Json::Value& target,
+                                      const std::set<std::string>& resources,
+                                      const std::string& level,
+                                      const std::map<std::string, std::string>& headers)
+{
+  std::vector<std::string> ids(resources.begin(), resources.end());
+
+  for (size_t offset = 0; offset < ids.size(); offset += CANDIDATES_CHUNK_SIZE)
+  {
+    std::vector<AsyncRestClient::Future> futures;
+
+    for (size_t i = offset; i < ids.size() && i < offset + CANDIDATES_CHUNK_SIZE; i++)
+    {
+      futures.push_back(asyncRestClient_.Get("/" + level + "/" + ids[i], headers, true));
+    }
+
+    AsyncRestClient::WaitAll(futures, asyncRestClient_.GetDefaultDeadline());
+
+    for (size_t i = 0; i < futures.size(); i++)
+    {
+      if (futures[i].GetStatus() == AsyncRestClient::Status_Success &&
+          futures[i].IsFound())
+      {
+        target.append(ids[offset + i]);
+      }
+    }
+  }
+}
+
+// Lists the resources that have been modified or deleted since the given cursors.  This is used by the frontend
+// to validate its metadata cache.  The modified resources are filtered through the authorized routes.  The deleted
+// resources can not be authorized anymore: when the authorization plugin is enabled, a deletion resets the cache.
+// GET api/changes/resources                                         -> returns the current cursors only
+// GET api/changes/resources?since=1234&deletions-since=12&journal=id
+void GetChangedResources(OrthancPluginRestOutput* output,
+                         const char* /*url*/,
+                         const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+    return;
+  }
+
+  std::map<std::string, std::string> headers;
+  OrthancPlugins::GetHttpHeaders(headers, request);
+
+  int64_t since = -1;
+  uint64_t deletionsSince = 0;
+  std::string journal;
+
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    const std::string key = request->getKeys[i];
+    const std::string value = request->getValues[i];
+
+    if (key == "since")
+    {
+      since = boost::lexical_cast<int64_t>(value);
+    }
+    else if (key == "deletions-since")
+    {
+      deletionsSince = boost::lexical_cast<uint64_t>(value);
+    }
+    else if (key == "journal")
+    {
+      journal = value;
+    }
+  }
+
+  Json::Value answer;
+  answer["Reset"] = false;
+  answer["Journal"] = deletedResources_.GetJournalId();
+  answer["Studies"] = Json::arrayValue;
+  answer["Series"] = Json::arrayValue;
+  answer["Deleted"] = Json::arrayValue;
+
+  if (since < 0)
+  {
+    answer["Last"] = static_cast<Json::Int64>(ChangesTracker::GetLastChange());
+    answer["DeletionsLast"] = static_cast<Json::UInt64>(deletedResources_.GetLast());
+  }
+  else
+  {
+    std::vector<std::string> deleted;
+    uint64_t deletionsLast = 0;
+
+    // read the deletions first: a resource that is deleted while collecting the changes will be reported next time
+    if (journal != deletedResources_.GetJournalId() ||
+        !deletedResources_.GetSince(deleted, deletionsLast, deletionsSince))
+    {
+      answer["Reset"] = true;
+    }
+    else if (!deleted.empty() && IsAuthorizationPluginEnabled())
+    {
+      answer["Reset"] = true;
+    }
+
+    ChangesTracker::TouchedResources touched;
+    int64_t last = since;
+
+    if (!answer["Reset"].asBool() &&
+        !ChangesTracker::CollectTouchedResources(touched, last, since, MAX_CACHE_VALIDATION_CHANGES, true))
+    {
+      answer["Reset"] = true;
+    }
+
+    if (answer["Reset"].asBool())
+    {
+      answer["Last"] = static_cast<Json::Int64>(ChangesTracker::GetLastChange());
+      answer["DeletionsLast"] = static_cast<Json::UInt64>(deletedResources_.GetLast());
+    }
+    else
+    {
+      answer["Last"] = static_cast<Json::Int64>(last);
+      answer["DeletionsLast"] = static_cast<Json::UInt64>(deletionsLast);
+
+      FilterAuthorizedResources(answer["Studies"], touched.studies_, "studies", headers);
+      FilterAuthorizedResources(answer["Series"], touched.series_, "series", headers);
+
+      for (size_t i = 0; i < deleted.size(); i++)
+      {
+        answer["Deleted"].append(deleted[i]);
+      }
+    }
+  }
+
+  AnswerList(output, request, answer);
+}
+
+
+static const size_t DEFAULT_FUZZY_SEARCH_RESULTS = 20;
+static const size_t MAX_FUZZY_SEARCH_RESULTS = 100;
+
+// Finds the patients whose name looks like the given name, ignoring the accents, the case, the order of the
+// components and the spelling variants that sound alike:
+// GET api/patients/fuzzy-search?name=muller^jurgen&limit=20
+void SearchPatientsByName(OrthancPluginRestOutput* output,
+                          const char* /*url*/,
+                          const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+    return;
+  }
+
+  std::string name;
+  size_t limit = DEFAULT_FUZZY_SEARCH_RESULTS;
+
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    const std::string key = request->getKeys[i];
+
+    if (key == "name")
+    {
+      name = request->getValues[i];
+    }
+    else if (key == "limit")
+    {
+      limit = std::min(MAX_FUZZY_SEARCH_RESULTS, boost::lexical_cast<size_t>(request->getValues[i]));
+    }
+  }
+
+  // some candidates may be filtered out by the authorization plugin
+  std::vector<PatientNameIndex::Candidate> candidates;
+  if (!patientNameIndex_.Search(candidates, name, 2 * limit))
+  {
+    AnswerIndexNotReady(output);
+    return;
+  }
+
+  // forward the headers to let the authorization plugin check the access to each patient
+  std::map<std::string, std::string> headers;
+  OrthancPlugins::GetHttpHeaders(headers, request);
+
+  std::vector<AsyncRestClient::Future> patients;
+  for (size_t i = 0; i < candidates.size(); i++)
+  {
+    patients.push_back(asyncRestClient_.Get("/patients/" + candidates[i].orthancId_, headers, true));
+  }
+
+  AsyncRestClient::WaitAll(patients, asyncRestClient_.GetDefaultDeadline());
+
+  Json::Value answer = Json::arrayValue;
+
+  for (size_t i = 0; i < candidates.size() && answer.size() < limit; i++)
+  {
+    // the failed calls are e.g. forbidden by the authorization plugin
+    if (patients[i].GetStatus() == AsyncRestClient::Status_Success &&
+        patients[i].IsFound())
+    {
+      Json::Value patient = patients[i].GetAnswer();
+      patient["Score"] = candidates[i].score_;
+      answer.append(patient);
+    }
+  }
+
+  AnswerList(output, request, answer);
+}
+
+
+void WarmStudy(OrthancPluginRestOutput* output,
+               const char* /*url*/,
+               const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
+    return;
+  }
+
+  const std::string studyId = request->groups[0];
+
+  // forward the headers to let the authorization plugin check the access to the study
+  std::map<std::string, std::string> headers;
+  OrthancPlugins::GetHttpHeaders(headers, request);
+
+  Json::Value study;
+  if (!OrthancPlugins::RestApiGet(study, "/studies/" + studyId, headers, true))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource);
+  }
+
+  Json::Value answer;
+  answer["Status"] = StorageWarmer::EnumerationToString(storageWarmer_.Warm(studyId));
+
+  AnswerJson(output, answer);
+}
+
+
+static const unsigned int DEFAULT_JOBS_PAGE_SIZE = 100;
+static const unsigned int MAX_JOBS_PAGE_SIZE = 1000;
+
+// Lists the summaries of the jobs, from the newest one, with a keyset pagination.
+// GET api/jobs?state=Running,Pending&type=Archive&limit=100
+// GET api/jobs?cursor=...   -> the "Next" cursor of the previous page
+void GetJobs(OrthancPluginRestOutput* output,
+             const char* /*url*/,
+             const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+    return;
+  }
+
+  JobsIndex::Query query;
+  query.limit_ = DEFAULT_JOBS_PAGE_SIZE;
+
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    const std::string key = request->getKeys[i];
+    const std::string value = request->getValues[i];
+
+    if (key == "state" || key == "type")
+    {
+      std::set<std::string>& values = (key == "state" ? query.states_ : query.types_);
+
+      std::vector<std::string> tokens;
+      Orthanc::Toolbox::TokenizeString(tokens, value, ',');
+
+      for (size_t j = 0; j < tokens.size(); j++)
+      {
+        if (!tokens[j].empty())
+        {
+          values.insert(tokens[j]);
+        }
+      }
+    }
+    else if (key == "cursor")
+    {
+      query.cursor_ = value;
+    }
+    else if (key == "limit")
+    {
+      query.limit_ = std::min(MAX_JOBS_PAGE_SIZE, std::max(1u, boost::lexical_cast<unsigned int>(value)));
+    }
+  }
+
+  // forward the headers to let the authorization plugin check the access to the jobs
+  std::map<std::string, std::string> headers;
+  OrthancPlugins::GetHttpHeaders(headers, request);
+
+  Json::Value liveJobIds;
+  if (!OrthancPlugins::RestApiGet(liveJobIds, "/jobs", headers, true))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ForbiddenAccess);
+  }
+
+  jobsIndex_.Refresh(liveJobIds);
+
+  std::vector<JobsIndex::JobSummary> jobs;
+  std::string next;
+  jobsIndex_.Find(jobs, next, query);
+
+  Json::Value answer;
+  answer["Jobs"] = Json::arrayValue;
+
+  for (size_t i = 0; i < jobs.size(); i++)
+  {
+    Json::Value job;
+    JobsIndex::Format(job, jobs[i]);
+    answer["Jobs"].append(job);
+  }
+
+  if (!next.empty())
+  {
+    answer["Next"] = next;
+  }
+  else
+  {
+    answer["Next"] = Json::nullValue;
+  }
+
+  AnswerList(output, request, answer);
+}
+
+
+static const unsigned int MAX_RUM_SAMPLES_PER_REQUEST = 100;
+static const double MAX_RUM_SAMPLE_VALUE = 600000;  // 10 minutes
+
+// Receives the latencies measured by the browsers (sent with navigator.sendBeacon() or a 'keepalive' fetch)
+// POST api/rum   {"Samples": [{"Metric": "search", "Value": 523.4}, ...]}   (the values are in ms)
+void PostRumSamples(OrthancPluginRestOutput* output,
+                    const char* /*url*/,
+                    const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
+    return;
+  }
+
+  Json::Value body;
+  if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+      !body.isObject() ||
+      !body.isMember("Samples") ||
+      !body["Samples"].isArray())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Expecting a 'Samples' array");
+  }
+
+  std::map<std::string, std::string> headers;
+  OrthancPlugins::GetHttpHeaders(headers, request);
+
+  const std::string subnet = RumCollector::GetClientSubnet(headers);
+  const Json::Value& samples = body["Samples"];
+
+  // the malformed samples are ignored: the beacons are sent when the page is closed, nobody reads the errors
+  for (Json::Value::ArrayIndex i = 0; i < samples.size() && i < MAX_RUM_SAMPLES_PER_REQUEST; i++)
+  {
+    RumCollector::Metric metric;
+    const Json::Value& sample = samples[i];
+
+    if (sample.isObject() &&
+        sample["Metric"].isString() &&
+        sample["Value"].isNumeric() &&
+        RumCollector::LookupMetric(metric, sample["Metric"].asString()) &&
+        sample["Value"].asDouble() >= 0 &&
+        sample["Value"].asDouble() <= MAX_RUM_SAMPLE_VALUE)
+    {
+      rumCollector_.Record(metric, subnet, sample["Value"].asDouble());
+    }
+  }
+
+  AnswerJson(output, Json::objectValue);
+}
+
+
+static const size_t SELECTION_CALLS_CHUNK_SIZE = 100;  // the internal calls of a selection action that run concurrently
+
+
+// The selection has expired, Orthanc has been restarted or the selection belongs to another user -> 410 to let the
+// UI create it again.  All the selection routes answer this status for an unknown selection.
+static void AnswerUnknownSelection(OrthancPluginRestOutput* output)
+{
+  OrthancPluginSendHttpStatusCode(OrthancPlugins::GetGlobalContext(), output, 410);
+}
+
+
+static Json::Value ToJsonArray(const std::vector<std::string>& values)
+{
+  Json::Value result = Json::arrayValue;
+
+  for (size_t i = 0; i < values.size(); i++)
+  {
+    result.append(values[i]);
+  }
+
+  return result;
+}
+
+
+// Reads the studies of a selection by chunks of concurrent calls.  The studies that can not be read (e.g. forbidden
+// by the authorization plugin) are reported as null values.
+static void ReadSelectionStudies(std::vector<Json::Value>& target,
+                                 const std::vector<std::string>& studiesIds,
+                                 size_t offset,
+                                 const std::string& subRoute,
+                                 const std::map<std::string, std::string>& headers)
+{
+  target.clear();
+
+  std::vector<AsyncRestClient::Future> futures;
+  for (size_t i = offset; i < studiesIds.size() && i < offset + SELECTION_CALLS_CHUNK_SIZE; i++)
+  {
+    futures.push_back(asyncRestClient_.Get("/studies/" + studiesIds[i] + subRoute, headers, true));
+  }
+
+  AsyncRestClient::WaitAll(futures, asyncRestClient_.GetDefaultDeadline());
+
+  for (size_t i = 0; i < futures.size(); i++)
+  {
+    if (futures[i].GetStatus() == AsyncRestClient::Status_Success &&
+        futures[i].IsFound())
+    {
+      target.push_back(futures[i].GetAnswer());
+    }
+    else
+    {
+      target.push_back(Json::nullValue);
+    }
+  }
+}
+
+
+static std::set<std::string> GetLabelsArgument(const Json::Value& body,
+                                               const std::string& name)
+{
+  std::set<std::string> labels;
+
+  if (body.isMember(name))
+  {
+    if (!body[name].isArray())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "'" + name + "' must be an array of labels");
+    }
+
+    for (Json::Value::ArrayIndex i = 0; i < body[name].size(); i++)
+    {
+      if (!body[name][i].isString() || body[name][i].asString().empty())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "'" + name + "' must be an array of labels");
+      }
+
+      labels.insert(body[name][i].asString());
+    }
+  }
+
+  return labels;
+}
+
+
+// {"Add": ["to-review"], "Remove": ["urgent"], "RemoveAll": false}
+//   -> {"Count": 12340, "FailedCount": 5, "Failed": [...], "RemovedLabels": [...]}
+// "Count" is the number of studies whose labels have all been updated, "Failed" lists the other ones (e.g. forbidden
+// by the authorization plugin).  "RemovedLabels" are the labels that were attached to the studies when "RemoveAll"
+// is true.
+static void ApplyLabelsToSelection(Json::Value& answer,
+                                   const std::vector<std::string>& studiesIds,
+                                   const Json::Value& body,
+                                   const std::map<std::string, std::string>& headers)
+{
+  const std::set<std::string> labelsToAdd = GetLabelsArgument(body, "Add");
+  const std::set<std::string> labelsToRemove = GetLabelsArgument(body, "Remove");
+  const bool removeAll = body.isMember("RemoveAll") && body["RemoveAll"].asBool();
+
+  std::set<std::string> removedLabels;
+  std::vector<std::string> failedStudies;
+
+  for (size_t offset = 0; offset < studiesIds.size(); offset += SELECTION_CALLS_CHUNK_SIZE)
+  {
+    std::vector<AsyncRestClient::Future> updates;
+    std::vector<size_t> updatedStudies;  // the index of the study of each update
+    std::set<size_t> failed;
+
+    std::vector<Json::Value> currentLabels;
+    if (removeAll)
+    {
+      ReadSelectionStudies(currentLabels, studiesIds, offset, "/labels", headers);
+    }
+
+    for (size_t i = offset; i < studiesIds.size() && i < offset + SELECTION_CALLS_CHUNK_SIZE; i++)
+    {
+      std::set<std::string> labels = labelsToRemove;
+
+      if (removeAll)
+      {
+        const Json::Value& studyLabels = currentLabels[i - offset];
+        if (!studyLabels.isArray())
+        {
+          failed.insert(i);  // the labels of the study can not be read
+          continue;
+        }
+
+        for (Json::Value::ArrayIndex j = 0; j < studyLabels.size(); j++)
+        {
+          labels.insert(studyLabels[j].asString());
+          removedLabels.insert(studyLabels[j].asString());
+        }
+      }
+
+      for (std::set<std::string>::const_iterator it = labels.begin(); it != labels.end(); ++it)
+      {
+        updates.push_back(asyncRestClient_.Delete("/studies/" + studiesIds[i] + "/labels/" + *it, headers, true));
+        updatedStudies.push_back(i);
+      }
+
+      for (std::set<std::string>::const_iterator it = labelsToAdd.begin(); it != labelsToAdd.end(); ++it)
+      {
+        updates.push_back(asyncRestClient_.Put("/studies/" + studiesIds[i] + "/labels/" + *it, "", headers, true));
+        updatedStudies.push_back(i);
+      }
+    }
+
+    // the updates of a chunk run concurrently
+    AsyncRestClient::WaitAll(updates, asyncRestClient_.GetDefaultDeadline());
+
+    for (size_t i = 0; i < updates.size(); i++)
+    {
+      if (updates[i].GetStatus() != AsyncRestClient::Status_Success ||
+          !updates[i].IsFound())
+      {
+        failed.insert(updatedStudies[i]);
+      }
+    }
+
+    for (std::set<size_t>::const_iterator it = failed.begin(); it != failed.end(); ++it)
+    {
+      failedStudies.push_back(studiesIds[*it]);
+    }
+  }
+
+  if (!failedStudies.empty())
+  {
+    LOG(WARNING) << "Orthanc Explorer 2: the labels of " << failedStudies.size() << " studies could not be updated in a selection of " << studiesIds.size() << " studies";
+  }
+
+  answer["Count"] = static_cast<unsigned int>(studiesIds.size() - failedStudies.size());
+  answer["FailedCount"] = static_cast<unsigned int>(failedStudies.size());
+  answer["Failed"] = ToJsonArray(failedStudies);
+  answer["RemovedLabels"] = Json::arrayValue;
+
+  for (std::set<std::string>::const_iterator it = removedLabels.begin(); it != removedLabels.end(); ++it)
+  {
+    answer["RemovedLabels"].append(*it);
+  }
+}
+
+
+// {"Type": "viewer-instant-link", "ValidityDuration": 3600, "ExpirationDate": "...", "Id": "..."} -> the token created
+// by the authorization plugin for all the studies of the selection (same body as the one built by the UI)
+static void CreateSelectionToken(Json::Value& answer,
+                                 const std::vector<std::string>& studiesIds,
+                                 const Json::Value& body,
+                                 const std::map<std::string, std::string>& headers)
+{
+  if (!body["Type"].isString() || body["Type"].asString().empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Missing the 'Type' of the token");
+  }
+
+  const std::string tokenType = body["Type"].asString();
+
+  Json::Value tokenRequest = Json::objectValue;
+  tokenRequest["Type"] = tokenType;
+  tokenRequest["Resources"] = Json::arrayValue;
+
+  static const char* const OPTIONAL_FIELDS[] = { "ValidityDuration", "ExpirationDate", "Id" };
+  for (size_t i = 0; i < sizeof(OPTIONAL_FIELDS) / sizeof(OPTIONAL_FIELDS[0]); i++)
+  {
+    if (body.isMember(OPTIONAL_FIELDS[i]) && !body[OPTIONAL_FIELDS[i]].isNull())
+    {
+      tokenRequest[OPTIONAL_FIELDS[i]] = body[OPTIONAL_FIELDS[i]];
+    }
+  }
+
+  for (size_t offset = 0; offset < studiesIds.size(); offset += SELECTION_CALLS_CHUNK_SIZE)
+  {
+    std::vector<Json::Value> studies;
+    ReadSelectionStudies(studies, studiesIds, offset, "", headers);
+
+    for (size_t i = 0; i < studies.size(); i++)
+    {
+      if (!studies[i].isObject())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unable to read the study " + studiesIds[offset + i]);
+      }
+
+      Json::Value resource;
+      resource["OrthancId"] = studiesIds[offset + i];
+      resource["DicomUid"] = studies[i]["MainDicomTags"]["StudyInstanceUID"];
+      resource["Level"] = "study";
+      tokenRequest["Resources"].append(resource);
+    }
+  }
+
+  std::string s;
+  OrthancPlugins::WriteFastJson(s, tokenRequest);
+
+  if (!AsyncRestClient::CallWithHeaders(answer, OrthancPluginHttpMethod_Put, "/auth/tokens/" + tokenType, s, headers, true))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Unable to create the token");
+  }
+}
+
+
+// {"Target": "peer", "Destination": "remote"} with the targets "peer", "transfers", "modality" and "dicom-web" -> the job
+static void SendSelection(Json::Value& answer,
+                          const std::vector<std::string>& studiesIds,
+                          const Json::Value& body,
+                          const std::map<std::string, std::string>& headers)
+{
+  if (!body["Target"].isString() ||
+      !body["Destination"].isString() ||
+      body["Destination"].asString().empty() ||
+      body["Destination"].asString().find('/') != std::string::npos)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Expecting a 'Target' and a 'Destination'");
+  }
+
+  const std::string target = body["Target"].asString();
+  const std::string destination = body["Destination"].asString();
+
+  Json::Value job;
+  job["Synchronous"] = false;
+
+  std::string uri;
+
+  if (target == "peer")
+  {
+    uri = "/peers/" + destination + "/store";
+    job["Resources"] = ToJsonArray(studiesIds);
+  }
+  else if (target == "modality")
+  {
+    uri = "/modalities/" + destination + "/store";
+    job["Resources"] = ToJsonArray(studiesIds);
+  }
+  else if (target == "dicom-web")
+  {
+    uri = "/dicom-web/servers/" + destination + "/stow";
+    job["Resources"] = ToJsonArray(studiesIds);
+  }
+  else if (target == "transfers")
+  {
+    uri = "/transfers/send";
+    job["Peer"] = destination;
+    job["Compression"] = "gzip";
+    job["Resources"] = Json::arrayValue;
+
+    for (size_t i = 0; i < studiesIds.size(); i++)
+    {
+      Json::Value resource;
+      resource["Level"] = "Study";
+      resource["ID"] = studiesIds[i];
+      job["Resources"].append(resource);
+    }
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Unknown target: " + target);
+  }
+
+  if (!OrthancPlugins::RestApiPost(answer, uri, job, headers, true))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unknown destination: " + destination);
+  }
+}
+
+
+// Creates a selection of studies from their Orthanc ids or from all the studies matching a search.  The bulk actions
+// of the UI then refer to the selection by its id instead of sending the ids of all the studies.
+// POST api/selections   {"Resources": ["8a8cf898-ca27c490-d0c7058c-929d0581-2bbf104d", ...]}
+// POST api/selections   {"Query": {"StudyDate": "20240101-"}, "Labels": ["to-review"], "LabelsConstraint": "All"}
+// -> {"ID": "...", "Count": 12345}
+void CreateSelection(OrthancPluginRestOutput* output,
+                     const char* /*url*/,
+                     const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
+    return;
+  }
+
+  Json::Value body;
+  if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) || !body.isObject())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The body must be a JSON object");
+  }
+
+  std::map<std::string, std::string> headers;
+  OrthancPlugins::GetHttpHeaders(headers, request);
+
+  std::vector<std::string> studiesIds;
+
+  if (body.isMember("Resources"))
+  {
+    const Json::Value& resources = body["Resources"];
+    if (!resources.isArray())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "'Resources' must be an array of Orthanc ids");
+    }
+
+    studiesIds.reserve(resources.size());
+    for (Json::Value::ArrayIndex i = 0; i < resources.size(); i++)
+    {
+      if (!resources[i].isString())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "'Resources' must be an array of Orthanc ids");
+      }
+
+      studiesIds.push_back(resources[i].asString());
+    }
+  }
+  else if (body.isMember("Query"))
+  {
+    Json::Value findRequest = Json::objectValue;
+    findRequest["Level"] = "Study";
+    findRequest["Query"] = body["Query"];
+    findRequest["Expand"] = false;
+    findRequest["Limit"] = static_cast<unsigned int>(selectionsRegistry_.GetMaxResources() + 1);
+
+    if (body.isMember("Labels"))
+    {
+      findRequest["Labels"] = body["Labels"];
+    }
+
+    if (body.isMember("LabelsConstraint"))
+    {
+      findRequest["LabelsConstraint"] = body["LabelsConstraint"];
+    }
+
+    double cost = SearchAdmission::EstimateQueryCost(findRequest);
+    double retryAfter = 0;
+
+    SearchAdmission::Ticket ticket;  // releases the search slot when leaving this scope
+    SearchAdmission::Status status = searchAdmission_.Admit(ticket, retryAfter, searchAdmission_.IsEnabled() ? GetUserIdentity(headers) : "", cost);
+
+    if (status != SearchAdmission::Status_Admitted)
+    {
+      AnswerSearchRejected(output, status, cost, retryAfter);
+      return;
+    }
+
+    // forward the headers to let the authorization plugin filter the results
+    Json::Value studies;
+    if (!OrthancPlugins::RestApiPost(studies, "/tools/find", findRequest, headers, true))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Unable to find studies");
+    }
+
+    studiesIds.reserve(studies.size());
+    for (Json::Value::ArrayIndex i = 0; i < studies.size(); i++)
+    {
+      studiesIds.push_back(studies[i].asString());
+    }
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Expecting the 'Resources' or a 'Query'");
+  }
+
+  size_t count = 0;
+
+  Json::Value answer;
+  answer["ID"] = selectionsRegistry_.Create(count, studiesIds, GetUserIdentity(headers));
+  answer["Count"] = static_cast<unsigned int>(count);
+
+  AnswerJson(output, answer);
+}
+
+
+// GET api/selections/{id}      -> {"ID": "...", "Count": 12345, "Resources": [...]}
+// DELETE api/selections/{id}
+// Only the user who has created the selection can access it.
+void ServeSelection(OrthancPluginRestOutput* output,
+                    const char* /*url*/,
+                    const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  const std::string selectionId = request->groups[0];
+
+  std::map<std::string, std::string> headers;
+  OrthancPlugins::GetHttpHeaders(headers, request);
+
+  if (request->method == OrthancPluginHttpMethod_Get)
+  {
+    std::vector<std::string> studiesIds;
+    if (!selectionsRegistry_.Lookup(studiesIds, selectionId, GetUserIdentity(headers)))
+    {
+      AnswerUnknownSelection(output);
+      return;
+    }
+
+    Json::Value answer;
+    answer["ID"] = selectionId;
+    answer["Count"] = static_cast<unsigned int>(studiesIds.size());
+    answer["Resources"] = ToJsonArray(studiesIds);
+
+    AnswerList(output, request, answer);
+  }
+  else if (request->method == OrthancPluginHttpMethod_Delete)
+  {
+    if (!selectionsRegistry_.Remove(selectionId, GetUserIdentity(headers)))
+    {
+      AnswerUnknownSelection(output);
+      return;
+    }
+
+    AnswerJson(output, Json::objectValue);
+  }
+  else
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET,DELETE");
+  }
+}
+
+
+// Applies a bulk action to all the studies of a selection, with the headers of the user:
+// POST api/selections/{id}/archive  (or /media)  -> the asynchronous job that creates the zip (GET /jobs/{job}/archive)
+// POST api/selections/{id}/delete
+// POST api/selections/{id}/send     {"Target": "peer", "Destination": "remote"}  -> the job
+// POST api/selections/{id}/labels   {"Add": [...], "Remove": [...], "RemoveAll": false}
+// POST api/selections/{id}/share    {"Type": "viewer-instant-link", "ValidityDuration": 3600}  -> the token
+// Answers 410 if the selection does not exist anymore or belongs to another user.
+void ApplySelectionAction(OrthancPluginRestOutput* output,
+                          const char* /*url*/,
+                          const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
+    return;
+  }
+
+  const std::string action = request->groups[1];
+
+  Json::Value body = Json::objectValue;
+  if (request->bodySize > 0 &&
+      (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) || !body.isObject()))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The body must be a JSON object");
+  }
+
+  std::map<std::string, std::string> headers;
+  OrthancPlugins::GetHttpHeaders(headers, request);
+
+  std::vector<std::string> studiesIds;
+  if (!selectionsRegistry_.Lookup(studiesIds, request->groups[0], GetUserIdentity(headers)))
+  {
+    AnswerUnknownSelection(output);
+    return;
+  }
+
+  Json::Value answer = Json::objectValue;
+
+  if (action == "archive" ||
+      action == "media")
+  {
+    Json::Value job;
+    job["Resources"] = ToJsonArray(studiesIds);
+    job["Synchronous"] = false;
+
+    if (!OrthancPlugins::RestApiPost(answer, action == "archive" ? "/tools/create-archive" : "/tools/create-media", job, headers, true))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Unable to create the archive");
+    }
+  }
+  else if (action == "delete")
+  {
+    Json::Value resources;
+    resources["Resources"] = ToJsonArray(studiesIds);
+
+    if (!OrthancPlugins::RestApiPost(answer, "/tools/bulk-delete", resources, headers, true))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Unable to delete the studies");
+    }
+  }
+  else if (action == "send")
+  {
+    SendSelection(answer, studiesIds, body, headers);
+  }
+  else if (action == "labels")
+  {
+    ApplyLabelsToSelection(answer, studiesIds, body, headers);
+  }
+  else if (action == "share")
+  {
+    CreateSelectionToken(answer, studiesIds, body, headers);
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unknown action on a selection: " + action);
+  }
+
+  AnswerJson(output, answer);
+}
+
+
+void RefreshMetrics()
+{
+  rumCollector_.PublishMetrics();
+}
+
+
+// when "Keycloak.VerifyTokens" is enabled, the OE2 API routes are only served to the requests with a valid Keycloak token.
+// This only rejects the invalid tokens early: the internal calls of the routes still forward the headers to let the
+// authorization plugin check the permissions of the user.
+template <OrthancPlugins::RestCallback Callback>
+void CheckKeycloakToken(OrthancPluginRestOutput* output,
+                        const char* url,
+                        const OrthancPluginHttpRequest* request)
+{
+#if ORTHANC_OE2_ENABLE_JWT_VERIFIER == 1
+  if (jwtVerifier_.IsEnabled())
+  {
+    std::map<std::string, std::string> headers;
+    OrthancPlugins::GetHttpHeaders(headers, request);
+
+    std::string token;
+    Json::Value claims;
+    JwtVerifier::Status status = (JwtVerifier::ExtractToken(token, headers) ?
+                                  jwtVerifier_.Verify(claims, token) :
+                                  JwtVerifier::Status_MissingToken);
+
+    if (status != JwtVerifier::Status_Valid)
+    {
+      LOG(INFO) << "Orthanc Explorer 2: Rejecting a request to " << url << ", Keycloak token: " << JwtVerifier::EnumerationToString(status);
+
+      // 401 can not be used since Orthanc would answer with a "WWW-Authenticate: Basic" header
+      OrthancPluginSendHttpStatusCode(OrthancPlugins::GetGlobalContext(), output, 403);
+      return;
+    }
+  }
+#endif
+
+  Callback(output, url, request);
+}
+
+
+static bool DisplayPerformanceWarning(OrthancPluginContext* context)
+{
+  (void) DisplayPerformanceWarning;   // Disable warning about unused function
+  OrthancPluginLogWarning(context, "Performance warning in Orthanc Explorer 2: "
+                          "Non-release build, runtime debug assertions are turned on");
+  return true;
+}
+
+
+static void CheckRootUrlIsValid(const std::string& value, const std::string& name, bool allowEmpty)
+{
+  if (allowEmpty && value.size() == 0)
+  {
+    return;
+  }
+
+  if (value.size() < 1 ||
+      value[0] != '/' ||
+      value[value.size() - 1] != '/')
+  {
+    OrthancPlugins::LogError("Orthanc-Explorer 2: '" + name + "' configuration shall start with a '/' and end with a '/': " + value);
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+}
+
+// Must be performed when Orthanc has just started, not during the plugin initialization, because it is accessing the DB
+class PluginsConfigurationLoader : public ChangesPipeline::IConsumer
+{
+public:
+  virtual void HandleChanges(const std::vector<ChangesPipeline::Change>& changes)
+  {
+    for (size_t i = 0; i < changes.size(); i++)
+    {
+      if (changes[i].changeType_ == OrthancPluginChangeType_OrthancStarted)
+      {
+        bool hasUserProfile = false;
+        Json::Value pluginsConfiguration = GetPluginsConfiguration(hasUserProfile);
+
+        {
+          boost::mutex::scoped_lock lock(pluginsConfigurationMutex_);
+          pluginsConfiguration_ = pluginsConfiguration;
+          hasUserProfile_ = hasUserProfile;
+        }
+
+        priorsPrefetcher_.SetWorklistsPluginEnabled(pluginsConfiguration.isMember("worklists") &&
+                                                    pluginsConfiguration["worklists"]["Enabled"].asBool());
+
+        bool isObjectStorage = false;
+        const char* OBJECT_STORAGE_PLUGINS[] = { "AWS S3 Storage", "Azure Blob Storage", "Google Cloud Storage" };
+        for (size_t j = 0; j < sizeof(OBJECT_STORAGE_PLUGINS) / sizeof(const char*); j++)
+        {
+          isObjectStorage |= (pluginsConfiguration.isMember(OBJECT_STORAGE_PLUGINS[j]) &&
+                              pluginsConfiguration[OBJECT_STORAGE_PLUGINS[j]]["Enabled"].asBool());
+        }
+        storageWarmer_.SetObjectStorageEnabled(isObjectStorage);
+      }
+    }
+  }
+};
+
+PluginsConfigurationLoader pluginsConfigurationLoader_;
+
+
+OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeType,
+                                        OrthancPluginResourceType resourceType,
+                                        const char* resourceId)
+{
+  // this is running on the Orthanc change thread -> the processing is performed by the pipeline worker
+  changesPipeline_.Enqueue(changeType, resourceType, resourceId);
+
+  return OrthancPluginErrorCode_Success;
+}
+
+
+extern "C"
+{
+  ORTHANC_PLUGINS_API int32_t OrthancPluginInitialize(OrthancPluginContext* context)
+  {
+    assert(DisplayPerformanceWarning(context));
+
+    OrthancPlugins::SetGlobalContext(context);
+    
+    Orthanc::Logging::InitializePluginContext(context);
+
+    Orthanc::Logging::EnableInfoLevel(true);
+
+
+    /* Check the version of the Orthanc core */
+    if (!OrthancPlugins::CheckMinimalOrthancVersion(ORTHANC_CORE_MINIMAL_MAJOR,
+                                                    ORTHANC_CORE_MINIMAL_MINOR,
+                                                    ORTHANC_CORE_MINIMAL_REVISION))
+    {
+      OrthancPlugins::ReportMinimalOrthancVersion(ORTHANC_CORE_MINIMAL_MAJOR,
+                                                  ORTHANC_CORE_MINIMAL_MINOR,
+                                                  ORTHANC_CORE_MINIMAL_REVISION);
+      return -1;
+    }
+
+    OrthancPluginSetDescription(context, "Advanced User Interface for Orthanc");
+
+    try
+    {
+      ReadConfiguration();
+
+      if (pluginJsonConfiguration_["Enable"].asBool())
+      {
+        oe2BaseUrl_ = pluginJsonConfiguration_["Root"].asString();
+
+        CheckRootUrlIsValid(oe2BaseUrl_, "Root", false);
+
+        OrthancPlugins::LogWarning("Root URI to the Orthanc-Explorer 2 application: " + oe2BaseUrl_);
+
+
+        OrthancPlugins::RegisterRestCallback
+          <ServeCustomCss>
+          (oe2BaseUrl_ + "app/customizable/custom.css", true);
+
+        if (!customLogoPath_.empty())
+        {
+          OrthancPlugins::RegisterRestCallback
+            <ServeCustomLogo>
+            (oe2BaseUrl_ + "app/customizable/custom-logo", true);
+        }
+
+        if (distDirectory_.get() != NULL)
+        {
+          // the static files and the vue-router routes are all handled by the dist directory
+          OrthancPlugins::RegisterRestCallback<ServeDistDirectory>(oe2BaseUrl_ + "app/(.*)", true);
+          OrthancPlugins::RegisterRestCallback<ServeDistDirectory>(oe2BaseUrl_ + "app", true);
+          distDirectory_->Start();
+        }
+        else
+        {
+          // we need to mix the "routing" between the server and the frontend (vue-router)
+          // first part are the files that are 'static files' that must be served by the backend
+          OrthancPlugins::RegisterRestCallback
+            <ServeEmbeddedFolder<Orthanc::EmbeddedResources::WEB_APPLICATION_ASSETS> >
+            (oe2BaseUrl_ + "app/assets/(.*)", true);
+          OrthancPlugins::RegisterRestCallback
+            <ServeEmbeddedFile<Orthanc::EmbeddedResources::WEB_APPLICATION_INDEX, Orthanc::MimeType_Html> >
+            (oe2BaseUrl_ + "app/index.html", true);
+          OrthancPlugins::RegisterRestCallback
+            <ServeEmbeddedFile<Orthanc::EmbeddedResources::WEB_APPLICATION_INDEX_LANDING, Orthanc::MimeType_Html> >
+            (oe2BaseUrl_ + "app/token-landing.html", true);
+          OrthancPlugins::RegisterRestCallback
+            <ServeEmbeddedFile<Orthanc::EmbeddedResources::WEB_APPLICATION_INDEX_RETRIEVE_AND_VIEW, Orthanc::MimeType_Html> >
+            (oe2BaseUrl_ + "app/retrieve-and-view.html", true);
+          OrthancPlugins::RegisterRestCallback
+            <ServeEmbeddedFile<Orthanc::EmbeddedResources::WEB_APPLICATION_FAVICON, Orthanc::MimeType_Ico> >
+            (oe2BaseUrl_ + "app/favicon.ico", true);
+        
+          // second part are all the routes that are actually handled by vue-router and that are actually returning the same file (index.html)
+          OrthancPlugins::RegisterRestCallback
+            <ServeEmbeddedFile<Orthanc::EmbeddedResources::WEB_APPLICATION_INDEX, Orthanc::MimeType_Html> >
+            (oe2BaseUrl_ + "app/(.*)", true);
+          OrthancPlugins::RegisterRestCallback
+            <ServeEmbeddedFile<Orthanc::EmbeddedResources::WEB_APPLICATION_INDEX, Orthanc::MimeType_Html> >
+            (oe2BaseUrl_ + "app", true);
+        }
+
+        OrthancPlugins::RegisterRestCallback<CheckKeycloakToken<GetOE2Configuration> >(oe2BaseUrl_ + "api/configuration", true);
+        OrthancPlugins::RegisterRestCallback<GetOE2PreLoginConfiguration>(oe2BaseUrl_ + "api/pre-login-configuration", true);
+        OrthancPlugins::RegisterRestCallback<CheckKeycloakToken<FindStudies> >(oe2BaseUrl_ + "api/studies/find", true);
+        OrthancPlugins::RegisterRestCallback<CheckKeycloakToken<GetStudiesDelta> >(oe2BaseUrl_ + "api/studies/delta", true);
+        OrthancPlugins::RegisterRestCallback<CheckKeycloakToken<GetChangedResources> >(oe2BaseUrl_ + "api/changes/resources", true);
+        OrthancPlugins::RegisterRestCallback<CheckKeycloakToken<WarmStudy> >(oe2BaseUrl_ + "api/studies/([^/]+)/warm", true);
+
+        if (enableJobsIndex_)
+        {
+          OrthancPlugins::RegisterRestCallback<CheckKeycloakToken<GetJobs> >(oe2BaseUrl_ + "api/jobs", true);
+        }
+
+        if (enableSelections_)
+        {
+          OrthancPlugins::RegisterRestCallback<CheckKeycloakToken<CreateSelection> >(oe2BaseUrl_ + "api/selections", true);
+          OrthancPlugins::RegisterRestCallback<CheckKeycloakToken<ServeSelection> >(oe2BaseUrl_ + "api/selections/([^/]+)", true);
+          OrthancPlugins::RegisterRestCallback<CheckKeycloakToken<ApplySelectionAction> >(oe2BaseUrl_ + "api/selections/([^/]+)/([^/]+)", true);
+        }
+
+        if (rumCollector_.IsEnabled())
+        {
+          OrthancPlugins::RegisterRestCallback<CheckKeycloakToken<PostRumSamples> >(oe2BaseUrl_ + "api/rum", true);
+          OrthancPluginRegisterRefreshMetricsCallback(context, RefreshMetrics);
+        }
+
+        if (enablePatientNameIndex_)
+        {
+          OrthancPlugins::RegisterRestCallback<CheckKeycloakToken<SearchPatientsByName> >(oe2BaseUrl_ + "api/patients/fuzzy-search", true);
+          persistentIndexes_.Register(patientNameIndex_);
+        }
+
+        if (enableSeriesContentIndex_)
+        {
+          persistentIndexes_.Register(seriesContentIndex_);
+        }
+
+        if (enableStudyCapabilitiesIndex_)
+        {
+          persistentIndexes_.Register(studyCapabilitiesIndex_);
+        }
+
+        if (enableStudyDateIndex_)
+        {
+          persistentIndexes_.Register(studyDateIndex_);
+        }
+
+        std::string pluginRootUri = oe2BaseUrl_ + "app/";
+        OrthancPluginSetRootUri(context, pluginRootUri.c_str());
+
+        if (pluginJsonConfiguration_["IsDefaultOrthancUI"].asBool())
+        {
+          OrthancPlugins::RegisterRestCallback<RedirectRoot>("/", true);
+        }
+
+        persistentIndexes_.LoadSnapshots();
+
+        changesPipeline_.Register(pluginsConfigurationLoader_);
+        changesPipeline_.Register(deletedResources_);
+        changesPipeline_.Register(persistentIndexes_);
+
+        if (enablePatientNameIndex_)
+        {
+          changesPipeline_.Register(patientNameIndex_);
+        }
+
+        if (enableSeriesContentIndex_)
+        {
+          changesPipeline_.Register(seriesContentIndex_);
+        }
+
+        if (enableStudyCapabilitiesIndex_)
+        {
+          changesPipeline_.Register(studyCapabilitiesIndex_);
+        }
+
+        if (enableStudyDateIndex_)
+        {
+          changesPipeline_.Register(studyDateIndex_);
+        }
+
+        if (enableJobsIndex_)
+        {
+          changesPipeline_.Register(jobsIndex_);
+        }
+
+#if ORTHANC_OE2_ENABLE_HTTP_CLIENT_POOL == 1
+        // for the calls to the external web services (see HttpClientPool)
+        Orthanc::HttpClient::GlobalInitialize();
+        Orthanc::HttpClient::ConfigureSsl(orthancFullConfiguration_->GetBooleanValue("HttpsVerifyPeers", true),
+                                          orthancFullConfiguration_->GetStringValue("HttpsCACertificates", ""));
+        HttpClientPool::GetInstance().SetOrthancOptions(orthancFullConfiguration_->GetStringValue("HttpProxy", ""),
+                                                        orthancFullConfiguration_->GetUnsignedIntegerValue("HttpTimeout", 60));
+#endif
+
+        asyncRestClient_.Start();
+        changesPipeline_.Start();
+        backgroundTasks_.Start();
+        persistentIndexes_.Start(backgroundTasks_);
+        priorsPrefetcher_.Start(backgroundTasks_);
+        storageWarmer_.Start(backgroundTasks_);
+
+        OrthancPluginRegisterOnChangeCallback(context, OnChangeCallback);
+
+        {
+          std::string explorer;
+          Orthanc::EmbeddedResources::GetFileResource(explorer, Orthanc::EmbeddedResources::ORTHANC_EXPLORER);
+
+          std::map<std::string, std::string> dictionary;
+          dictionary["OE2_BASE_URL"] = oe2BaseUrl_.substr(1, oe2BaseUrl_.size() - 2);  // Remove heading and trailing slashes
+          std::string explorerConfigured = Orthanc::Toolbox::SubstituteVariables(explorer, dictionary);
+
+          OrthancPluginExtendOrthancExplorer(OrthancPlugins::GetGlobalContext(), explorerConfigured.c_str());
+        }
+      }
+      else
+      {
+        OrthancPlugins::LogWarning("Orthanc Explorer 2 plugin is disabled");
+      }
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      OrthancPlugins::LogError("Exception while initializing the Orthanc-Explorer 2 plugin: " + 
+                               std::string(e.What()));
+      return -1;
+    }
+    catch (...)
+    {
+      OrthancPlugins::LogError("Exception while initializing the Orthanc-Explorer 2 plugin");
+      return -1;
+    }
+
+    return 0;
+  }
+
+
+  ORTHANC_PLUGINS_API void OrthancPluginFinalize()
+  {
+    // the consumers of the changes may submit background tasks -> stop them first
+    changesPipeline_.Stop();
+    priorsPrefetcher_.Stop();
+
+    if (distDirectory_.get() != NULL)
+    {
+      distDirectory_->Stop();
+    }
+
+    persistentIndexes_.StopTimer();  // the timer must not submit tasks to the stopped executor
+    storageWarmer_.Stop();
+    backgroundTasks_.Stop();
+    asyncRestClient_.Stop();
+#if ORTHANC_OE2_ENABLE_HTTP_CLIENT_POOL == 1
+    HttpClientPool::GetInstance().Clear();
+    Orthanc::HttpClient::GlobalFinalize();
+#endif
+    persistentIndexes_.Stop();  // once the background tasks are stopped, nothing else is writing the snapshots
   }
 
 
@@ -0,0 +1,507 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "PriorsPrefetcher.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+
+
+class PriorsPrefetcher::PrefetchTask : public TaskExecutor::ITask
+{
+private:
+  PriorsPrefetcher&  prefetcher_;
+  Step               step_;
+  std::string        patientId_;
+  Prior              prior_;
+
+public:
+  PrefetchTask(PriorsPrefetcher& prefetcher,
+               Step step) :
+    prefetcher_(prefetcher),
+    step_(step)
+  {
+  }
+
+  PrefetchTask(PriorsPrefetcher& prefetcher,
+               const std::string& patientId) :
+    prefetcher_(prefetcher),
+    step_(Step_Lookup),
+    patientId_(patientId)
+  {
+  }
+
+  PrefetchTask(PriorsPrefetcher& prefetcher,
+               const Prior& prior) :
+    prefetcher_(prefetcher),
+    step_(Step_Retrieve),
+    prior_(prior)
+  {
+  }
+
+  virtual void Execute()
+  {
+    try
+    {
+      switch (step_)
+      {
+        case Step_Plan:
+          prefetcher_.Plan();
+          break;
+
+        case Step_Lookup:
+          prefetcher_.Lookup(patientId_);
+          break;
+
+        case Step_Retrieve:
+          prefetcher_.Retrieve(prior_);
+          break;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Orthanc Explorer 2: the prefetching of the priors has failed: " << e.What();
+    }
+
+    {
+      boost::mutex::scoped_lock lock(prefetcher_.mutex_);
+      prefetcher_.isTaskRunning_ = false;
+    }
+
+    prefetcher_.stateChanged_.notify_all();  // the timer schedules the next step
+  }
+};
+
+
+static bool IsLaterStudy(const Json::Value& a,
+                         const Json::Value& b)
+{
+  return a["StudyDate"].asString() > b["StudyDate"].asString();
+}
+
+
+PriorsPrefetcher::PriorsPrefetcher() :
+  isEnabled_(false),
+  startHour_(20),
+  endHour_(6),
+  maxStudiesPerHour_(60),
+  maxPriorsPerPatient_(3),
+  lookAheadDays_(1),
+  storageBudget_(0),
+  executor_(NULL),
+  stopped_(true),
+  isWorklistsPluginEnabled_(false),
+  isTaskRunning_(false),
+  isPlanned_(false),
+  initialStorageSize_(0),
+  retrievedCount_(0)
+{
+}
+
+
+PriorsPrefetcher::~PriorsPrefetcher()
+{
+  if (!stopped_)
+  {
+    LOG(ERROR) << "PriorsPrefetcher::Stop() should have been called";
+  }
+}
+
+
+void PriorsPrefetcher::Configure(const Json::Value& configuration)
+{
+  if (!configuration.isObject())
+  {
+    return;
+  }
+
+  isEnabled_ = configuration["Enable"].asBool();
+
+  const Json::Value& sources = configuration["Sources"];
+  for (Json::Value::ArrayIndex i = 0; i < sources.size(); i++)
+  {
+    sources_.push_back(sources[i].asString());
+  }
+
+  startHour_ = configuration["StartHour"].asUInt() % 24;
+  endHour_ = configuration["EndHour"].asUInt() % 24;
+  maxStudiesPerHour_ = std::max(1u, configuration["MaxStudiesPerHour"].asUInt());
+  maxPriorsPerPatient_ = configuration["MaxPriorsPerPatient"].asUInt();
+  lookAheadDays_ = configuration["LookAheadDays"].asUInt();
+  storageBudget_ = static_cast<uint64_t>(configuration["StorageBudget"].asUInt()) * 1024 * 1024;
+
+  if (isEnabled_ && sources_.empty())
+  {
+    LOG(WARNING) << "Orthanc Explorer 2: the prefetching of the priors is enabled but no 'Sources' are configured";
+    isEnabled_ = false;
+  }
+}
+
+
+void PriorsPrefetcher::SetWorklistsPluginEnabled(bool enabled)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  isWorklistsPluginEnabled_ = enabled;
+}
+
+
+bool PriorsPrefetcher::IsInWindow(boost::gregorian::date& night,
+                                  const boost::posix_time::ptime& now) const
+{
+  const unsigned int hour = now.time_of_day().hours();
+
+  if (startHour_ <= endHour_)
+  {
+    night = now.date();
+    return startHour_ <= hour && hour < endHour_;
+  }
+  else if (hour >= startHour_)
+  {
+    night = now.date();
+    return true;
+  }
+  else
+  {
+    // after midnight, the window has started the day before
+    night = now.date() - boost::gregorian::days(1);
+    return hour < endHour_;
+  }
+}
+
+
+void PriorsPrefetcher::GetScheduledPatients(std::set<std::string>& patientIds) const
+{
+  Json::Value worklists;
+  if (!OrthancPlugins::RestApiGet(worklists, "/worklists", false))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to list the worklists");
+  }
+
+  const std::string lastDate = boost::gregorian::to_iso_string(
+    boost::gregorian::day_clock::local_day() + boost::gregorian::days(lookAheadDays_));
+
+  for (Json::Value::ArrayIndex i = 0; i < worklists.size(); i++)
+  {
+    // depending on the version of the plugin, the tags are given in a "Tags" member
+    const Json::Value& tags = worklists[i].isMember("Tags") ? worklists[i]["Tags"] : worklists[i];
+
+    if (!tags.isMember("PatientID") || tags["PatientID"].asString().empty())
+    {
+      continue;
+    }
+
+    std::string scheduledDate;
+    if (tags["ScheduledProcedureStepSequence"].isArray() &&
+        tags["ScheduledProcedureStepSequence"].size() > 0)
+    {
+      scheduledDate = tags["ScheduledProcedureStepSequence"][0]["ScheduledProcedureStepStartDate"].asString();
+    }
+
+    // the entries without a date are prefetched as well
+    if (scheduledDate.empty() || scheduledDate <= lastDate)
+    {
+      patientIds.insert(tags["PatientID"].asString());
+    }
+  }
+}
+
+
+void PriorsPrefetcher::LookupPriors(std::vector<Prior>& priors,
+                                    const std::string& patientId) const
+{
+  std::set<std::string> knownStudies;
+
+  for (size_t i = 0; i < sources_.size(); i++)
+  {
+    Json::Value query;
+    query["Level"] = "Study";
+    query["Query"]["PatientID"] = patientId;
+    query["Query"]["StudyDate"] = "";
+    query["Query"]["StudyInstanceUID"] = "";
+
+    Json::Value queryResult, answers;
+
+    try
+    {
+      if (!OrthancPlugins::RestApiPost(queryResult, "/modalities/" + sources_[i] + "/query", query, false) ||
+          !OrthancPlugins::RestApiGet(answers, "/queries/" + queryResult["ID"].asString() + "/answers?expand&simplify", false))
+      {
+        LOG(WARNING) << "Orthanc Explorer 2: unable to look up the priors of a patient on " << sources_[i];
+        continue;
+      }
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(WARNING) << "Orthanc Explorer 2: unable to look up the priors of a patient on " << sources_[i] << ": " << e.What();
+      continue;
+    }
+
+    std::vector<Json::Value> studies;
+    for (Json::Value::ArrayIndex j = 0; j < answers.size(); j++)
+    {
+      studies.push_back(answers[j]);
+    }
+
+    // the most recent priors first
+    std::sort(studies.begin(), studies.end(), IsLaterStudy);
+
+    unsigned int count = 0;
+    for (size_t j = 0; j < studies.size() && count < maxPriorsPerPatient_; j++)
+    {
+      const std::string uid = studies[j]["StudyInstanceUID"].asString();
+
+      if (!uid.empty() &&
+          knownStudies.insert(uid).second &&  // the same study may be available on several sources
+          !IsStoredLocally(uid))
+      {
+        Prior prior;
+        prior.source_ = sources_[i];
+        prior.studyInstanceUid_ = uid;
+        prior.studyDate_ = studies[j]["StudyDate"].asString();
+        priors.push_back(prior);
+        count++;
+      }
+    }
+  }
+}
+
+
+bool PriorsPrefetcher::IsStoredLocally(const std::string& studyInstanceUid)
+{
+  Json::Value found;
+  return (OrthancPlugins::RestApiPost(found, "/tools/lookup", studyInstanceUid, false) &&
+          found.size() > 0);
+}
+
+
+uint64_t PriorsPrefetcher::GetLocalStorageSize()
+{
+  Json::Value statistics;
+  if (!OrthancPlugins::RestApiGet(statistics, "/statistics", false))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+
+  return boost::lexical_cast<uint64_t>(statistics["TotalDiskSize"].asString());
+}
+
+
+void PriorsPrefetcher::Plan()
+{
+  std::set<std::string> patientIds;
+  GetScheduledPatients(patientIds);
+
+  const uint64_t initialStorageSize = GetLocalStorageSize();
+
+  LOG(WARNING) << "Orthanc Explorer 2: prefetching the priors of " << patientIds.size() << " scheduled patient(s)";
+
+  boost::mutex::scoped_lock lock(mutex_);
+  ClearPlan();
+  pendingPatients_.assign(patientIds.begin(), patientIds.end());
+  initialStorageSize_ = initialStorageSize;
+  isPlanned_ = true;
+}
+
+
+void PriorsPrefetcher::Lookup(const std::string& patientId)
+{
+  std::vector<Prior> priors;
+  LookupPriors(priors, patientId);
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (isPlanned_)  // not interrupted in the meantime
+  {
+    pendingPriors_.insert(pendingPriors_.end(), priors.begin(), priors.end());
+  }
+}
+
+
+void PriorsPrefetcher::Retrieve(const Prior& prior)
+{
+  uint64_t initialStorageSize;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    initialStorageSize = initialStorageSize_;
+  }
+
+  if (storageBudget_ != 0 &&
+      GetLocalStorageSize() >= initialStorageSize + storageBudget_)
+  {
+    LOG(WARNING) << "Orthanc Explorer 2: the storage budget for the prefetching of the priors is exhausted";
+
+    boost::mutex::scoped_lock lock(mutex_);
+    ClearPlan();
+    return;
+  }
+
+  Json::Value move;
+  move["Level"] = "Study";
+  move["Resources"].append(Json::objectValue);
+  move["Resources"][0]["StudyInstanceUID"] = prior.studyInstanceUid_;
+  move["Synchronous"] = true;
+
+  Json::Value moveResult;
+
+  try
+  {
+    if (OrthancPlugins::RestApiPost(moveResult, "/modalities/" + prior.source_ + "/move", move, false))
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      retrievedCount_++;
+    }
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    LOG(WARNING) << "Orthanc Explorer 2: unable to retrieve a prior from " << prior.source_ << ": " << e.What();
+  }
+}
+
+
+void PriorsPrefetcher::ClearPlan()
+{
+  isPlanned_ = false;
+  pendingPatients_.clear();
+  pendingPriors_.clear();
+  retrievedCount_ = 0;
+}
+
+
+void PriorsPrefetcher::SubmitNextStep(boost::posix_time::time_duration& delay,
+                                      const boost::posix_time::ptime& now)
+{
+  // the priors that are already known first, then the lookups while waiting for the rate limit of their sources
+  for (std::list<Prior>::iterator it = pendingPriors_.begin(); it != pendingPriors_.end(); ++it)
+  {
+    std::map<std::string, boost::posix_time::ptime>::const_iterator next = nextRetrieveTime_.find(it->source_);
+
+    if (next == nextRetrieveTime_.end() || next->second <= now)
+    {
+      nextRetrieveTime_[it->source_] = now + boost::posix_time::seconds(3600 / maxStudiesPerHour_);
+      isTaskRunning_ = true;
+      executor_->Submit(new PrefetchTask(*this, *it), TaskExecutor::Priority_Background);
+      pendingPriors_.erase(it);
+      return;
+    }
+    else
+    {
+      delay = std::min(delay, next->second - now);
+    }
+  }
+
+  if (!pendingPatients_.empty())
+  {
+    isTaskRunning_ = true;
+    executor_->Submit(new PrefetchTask(*this, pendingPatients_.front()), TaskExecutor::Priority_Background);
+    pendingPatients_.pop_front();
+  }
+  else if (pendingPriors_.empty())
+  {
+    LOG(WARNING) << "Orthanc Explorer 2: the prefetching of the priors is complete (" << retrievedCount_ << " studies retrieved)";
+    ClearPlan();
+  }
+}
+
+
+void PriorsPrefetcher::Timer()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  while (!stopped_)
+  {
+    const boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+    boost::posix_time::time_duration delay = boost::posix_time::seconds(60);
+
+    boost::gregorian::date night;
+    const bool isInWindow = IsInWindow(night, now);
+
+    if (isPlanned_ &&
+        (!isInWindow || night != lastNight_))
+    {
+      LOG(WARNING) << "Orthanc Explorer 2: the prefetching of the priors has been interrupted (" << retrievedCount_ << " studies retrieved)";
+      ClearPlan();
+    }
+
+    if (isWorklistsPluginEnabled_ &&
+        !isTaskRunning_ &&
+        isInWindow)
+    {
+      if (night != lastNight_)
+      {
+        // once per night
+        lastNight_ = night;
+        isTaskRunning_ = true;
+        executor_->Submit(new PrefetchTask(*this, Step_Plan), TaskExecutor::Priority_Background);
+      }
+      else if (isPlanned_)
+      {
+        SubmitNextStep(delay, now);
+      }
+    }
+
+    stateChanged_.timed_wait(lock, delay);
+  }
+}
+
+
+void PriorsPrefetcher::Start(TaskExecutor& executor)
+{
+  executor_ = &executor;
+
+  if (isEnabled_)
+  {
+    stopped_ = false;
+    timer_ = boost::thread(&PriorsPrefetcher::Timer, this);
+  }
+}
+
+
+void PriorsPrefetcher::Stop()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (stopped_)
+    {
+      return;
+    }
+
+    stopped_ = true;
+  }
+
+  stateChanged_.notify_all();
+
+  if (timer_.joinable())
+  {
+    timer_.join();
+  }
+}
@@ -0,0 +1,139 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "TaskExecutor.h"
+
+#include <json/value.h>
+
+#include <boost/date_time/gregorian/gregorian.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+
+// Retrieves, during the night, the prior studies of the patients that are scheduled in the worklists plugin, so that
+// they are stored locally before the reading session starts.  The priors are looked up (C-FIND) on the configured
+// remote modalities and retrieved (C-MOVE) within an off-hours window, with a rate limit per source and a budget of
+// local storage per night.  The work of a night is split in short tasks (one C-FIND per patient, one C-MOVE per
+// prior) that are scheduled one at a time by the timer, so that the executor is never held while waiting for the
+// rate limit.
+class PriorsPrefetcher : public boost::noncopyable
+{
+private:
+  struct Prior
+  {
+    std::string  source_;
+    std::string  studyInstanceUid_;
+    std::string  studyDate_;
+  };
+
+  bool                      isEnabled_;
+  std::vector<std::string>  sources_;
+  unsigned int              startHour_;
+  unsigned int              endHour_;
+  unsigned int              maxStudiesPerHour_;
+  unsigned int              maxPriorsPerPatient_;
+  unsigned int              lookAheadDays_;
+  uint64_t                  storageBudget_;  // in bytes
+
+  enum Step
+  {
+    Step_Plan,      // lists the scheduled patients
+    Step_Lookup,    // looks up the priors of one patient
+    Step_Retrieve   // retrieves one prior
+  };
+
+  TaskExecutor*             executor_;
+  boost::mutex              mutex_;
+  boost::condition_variable stateChanged_;
+  bool                      stopped_;
+  bool                      isWorklistsPluginEnabled_;
+  bool                      isTaskRunning_;
+  boost::gregorian::date    lastNight_;
+  std::map<std::string, boost::posix_time::ptime>  nextRetrieveTime_;  // per source
+
+  // the plan of the current night
+  bool                      isPlanned_;
+  std::deque<std::string>   pendingPatients_;
+  std::list<Prior>          pendingPriors_;
+  uint64_t                  initialStorageSize_;
+  unsigned int              retrievedCount_;
+
+  boost::thread             timer_;
+
+  class PrefetchTask;
+
+  // the date at which the current window has started
+  bool IsInWindow(boost::gregorian::date& night,
+                  const boost::posix_time::ptime& now) const;
+
+  void GetScheduledPatients(std::set<std::string>& patientIds) const;
+
+  void LookupPriors(std::vector<Prior>& priors,
+                    const std::string& patientId) const;
+
+  static bool IsStoredLocally(const std::string& studyInstanceUid);
+
+  static uint64_t GetLocalStorageSize();
+
+  void Plan();
+
+  void Lookup(const std::string& patientId);
+
+  void Retrieve(const Prior& prior);
+
+  // must be called with the mutex locked
+  void ClearPlan();
+
+  // must be called with the mutex locked.  Submits the next task whose source is available, or updates 'delay'
+  // with the time to wait for the rate limit.
+  void SubmitNextStep(boost::posix_time::time_duration& delay,
+                      const boost::posix_time::ptime& now);
+
+  void Timer();
+
+public:
+  PriorsPrefetcher();
+
+  ~PriorsPrefetcher();
+
+  void Configure(const Json::Value& configuration);
+
+  bool IsEnabled() const
+  {
+    return isEnabled_;
+  }
+
+  // the worklists plugin is detected once Orthanc has started (see GetPluginsConfiguration())
+  void SetWorklistsPluginEnabled(bool enabled);
+
+  void Start(TaskExecutor& executor);
+
+  void Stop();
+};
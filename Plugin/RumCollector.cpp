@@ -0,0 +1,495 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "RumCollector.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+
+// the upper bounds (in ms) of the buckets, the last bucket has no upper bound
+static const double BUCKETS_BOUNDS[] = {
+  25, 50, 100, 150, 200, 300, 400, 500, 750, 1000, 1500, 2000, 3000, 4000, 5000, 7500, 10000, 15000, 30000
+};
+
+static const double LAST_BUCKET_UPPER_BOUND = 60000;  // to interpolate the percentiles in the last bucket
+
+static const char* const METRICS_NAMES[] = {
+  "navigation",
+  "first-row",
+  "search",
+  "viewer-launch"
+};
+
+
+RumCollector::RumCollector() :
+  isEnabled_(false),
+  maxSubnets_(0),
+  capacity_(0),
+  subnetsCount_(0),
+  currentWindow_(0),
+  windowDuration_(boost::posix_time::seconds(300))
+{
+  ClearSubnet(otherSubnets_);
+  strcpy(otherSubnets_.name_, "other");
+  otherSubnets_.isReady_ = true;
+}
+
+
+void RumCollector::ClearSubnet(Subnet& subnet)
+{
+  subnet.key_ = 0;
+  subnet.isReady_ = false;
+  subnet.name_[0] = '\0';
+
+  ClearWindow(subnet, 0);
+  ClearWindow(subnet, 1);
+
+  for (unsigned int metric = 0; metric < Metric_Count; metric++)
+  {
+    subnet.totalCount_[metric] = 0;
+  }
+}
+
+
+void RumCollector::ClearWindow(Subnet& subnet,
+                               unsigned int window)
+{
+  for (unsigned int metric = 0; metric < Metric_Count; metric++)
+  {
+    for (size_t i = 0; i < BUCKETS_COUNT; i++)
+    {
+      subnet.windows_[window][metric].buckets_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+
+void RumCollector::Configure(const Json::Value& configuration)
+{
+  if (sizeof(BUCKETS_BOUNDS) / sizeof(double) + 1 != BUCKETS_COUNT ||
+      sizeof(METRICS_NAMES) / sizeof(const char*) != Metric_Count)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+
+  if (!configuration.isObject())
+  {
+    return;
+  }
+
+  isEnabled_ = configuration["Enable"].asBool();
+  maxSubnets_ = std::max(1u, configuration["MaxSubnets"].asUInt());
+  windowDuration_ = boost::posix_time::seconds(std::max(10u, configuration["Window"].asUInt()));
+
+  capacity_ = 1;
+  while (capacity_ < 2 * maxSubnets_)
+  {
+    capacity_ *= 2;
+  }
+
+  subnets_.reset(new Subnet[capacity_]);
+
+  for (size_t i = 0; i < capacity_; i++)
+  {
+    ClearSubnet(subnets_[i]);
+  }
+}
+
+
+bool RumCollector::LookupMetric(Metric& target,
+                                const std::string& name)
+{
+  for (unsigned int metric = 0; metric < Metric_Count; metric++)
+  {
+    if (name == METRICS_NAMES[metric])
+    {
+      target = static_cast<Metric>(metric);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+const char* RumCollector::GetMetricName(Metric metric)
+{
+  if (metric >= Metric_Count)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+
+  return METRICS_NAMES[metric];
+}
+
+
+static bool ParseIPv4Subnet(std::string& target,
+                            const std::string& address)
+{
+  unsigned int a, b, c, d;
+  char trailing;
+
+  if (sscanf(address.c_str(), "%u.%u.%u.%u%c", &a, &b, &c, &d, &trailing) != 4 ||
+      a > 255 || b > 255 || c > 255 || d > 255)
+  {
+    return false;
+  }
+
+  char subnet[32];
+  sprintf(subnet, "%u.%u.%u.0/24", a, b, c);
+  target = subnet;
+  return true;
+}
+
+
+static bool ParseIPv6Subnet(std::string& target,
+                            const std::string& address)
+{
+  std::vector<std::string> groups;
+  Orthanc::Toolbox::TokenizeString(groups, address, ':');
+
+  target.clear();
+
+  for (size_t i = 0; i < 3 && i < groups.size(); i++)
+  {
+    if (groups[i].empty())
+    {
+      break;  // "::" -> the next groups are zeros
+    }
+
+    if (groups[i].size() > 4)
+    {
+      return false;
+    }
+
+    for (size_t j = 0; j < groups[i].size(); j++)
+    {
+      if (!isxdigit(static_cast<unsigned char>(groups[i][j])))
+      {
+        return false;
+      }
+    }
+
+    target += (target.empty() ? "" : ":") + groups[i];
+  }
+
+  std::transform(target.begin(), target.end(), target.begin(), ::tolower);
+  target += "::/48";
+  return true;
+}
+
+
+std::string RumCollector::GetClientSubnet(const std::map<std::string, std::string>& headers)
+{
+  // the keys are lower case (see OrthancPlugins::GetHttpHeaders())
+  std::map<std::string, std::string>::const_iterator found = headers.find("x-forwarded-for");
+  std::string address;
+
+  if (found != headers.end())
+  {
+    address = found->second.substr(0, found->second.find(','));  // the first address is the client
+  }
+  else
+  {
+    found = headers.find("x-real-ip");
+    if (found != headers.end())
+    {
+      address = found->second;
+    }
+  }
+
+  address = Orthanc::Toolbox::StripSpaces(address);
+
+  if (address.empty())
+  {
+    return "direct";
+  }
+
+  // "[2001:db8::1]:443" -> "2001:db8::1"
+  if (address[0] == '[')
+  {
+    address = address.substr(1, address.find(']') - 1);
+  }
+
+  std::string subnet;
+
+  if (address.find('.') != std::string::npos)
+  {
+    size_t lastColon = address.rfind(':');
+    if (lastColon != std::string::npos &&
+        lastColon > address.rfind('.'))
+    {
+      address = address.substr(0, lastColon);  // "192.168.1.10:5678"
+    }
+
+    lastColon = address.rfind(':');
+    if (lastColon != std::string::npos)
+    {
+      address = address.substr(lastColon + 1);  // IPv4-mapped IPv6 address ("::ffff:192.168.1.10")
+    }
+
+    if (ParseIPv4Subnet(subnet, address))
+    {
+      return subnet;
+    }
+  }
+  else if (address.find(':') != std::string::npos &&
+           ParseIPv6Subnet(subnet, address.substr(0, address.find('%'))))  // without the zone index
+  {
+    return subnet;
+  }
+
+  return "unknown";
+}
+
+
+// FNV-1a, never 0 since 0 marks the free slots
+static uint64_t HashSubnet(const std::string& name)
+{
+  uint64_t hash = 14695981039346656037ULL;
+
+  for (size_t i = 0; i < name.size(); i++)
+  {
+    hash ^= static_cast<uint8_t>(name[i]);
+    hash *= 1099511628211ULL;
+  }
+
+  return (hash == 0 ? 1 : hash);
+}
+
+
+RumCollector::Subnet& RumCollector::LookupSubnet(const std::string& name)
+{
+  if (name.size() >= MAX_SUBNET_NAME)
+  {
+    return otherSubnets_;
+  }
+
+  const uint64_t key = HashSubnet(name);
+  bool hasReservation = false;
+
+  for (size_t probe = 0; probe < capacity_; probe++)
+  {
+    Subnet& subnet = subnets_[(key + probe) & (capacity_ - 1)];
+    uint64_t current = subnet.key_.load(std::memory_order_acquire);
+
+    if (current == 0)
+    {
+      if (!hasReservation)
+      {
+        if (subnetsCount_.fetch_add(1) >= maxSubnets_)
+        {
+          subnetsCount_.fetch_sub(1);
+          return otherSubnets_;
+        }
+
+        hasReservation = true;
+      }
+
+      if (subnet.key_.compare_exchange_strong(current, key, std::memory_order_acq_rel))
+      {
+        strcpy(subnet.name_, name.c_str());
+        subnet.isReady_.store(true, std::memory_order_release);
+        return subnet;
+      }
+
+      // another thread has claimed this slot in the meantime, 'current' is its key
+    }
+
+    if (current == key)
+    {
+      if (hasReservation)
+      {
+        subnetsCount_.fetch_sub(1);
+      }
+
+      return subnet;
+    }
+  }
+
+  if (hasReservation)
+  {
+    subnetsCount_.fetch_sub(1);
+  }
+
+  return otherSubnets_;
+}
+
+
+void RumCollector::Record(Metric metric,
+                          const std::string& subnet,
+                          double value)
+{
+  if (!isEnabled_ ||
+      metric >= Metric_Count)
+  {
+    return;
+  }
+
+  const size_t bucket = std::upper_bound(BUCKETS_BOUNDS, BUCKETS_BOUNDS + BUCKETS_COUNT - 1, value) - BUCKETS_BOUNDS;
+  const unsigned int window = currentWindow_.load(std::memory_order_relaxed);
+
+  Subnet& target = LookupSubnet(subnet);
+  target.windows_[window][metric].buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  target.totalCount_[metric].fetch_add(1, std::memory_order_relaxed);
+}
+
+
+double RumCollector::ComputePercentile(const uint32_t* buckets,
+                                       uint64_t count,
+                                       double percentile)
+{
+  const double rank = percentile * static_cast<double>(count);
+  uint64_t cumulated = 0;
+
+  for (size_t i = 0; i < BUCKETS_COUNT; i++)
+  {
+    if (buckets[i] > 0 &&
+        static_cast<double>(cumulated + buckets[i]) >= rank)
+    {
+      // linear interpolation within the bucket
+      const double lower = (i == 0 ? 0 : BUCKETS_BOUNDS[i - 1]);
+      const double upper = (i == BUCKETS_COUNT - 1 ? LAST_BUCKET_UPPER_BOUND : BUCKETS_BOUNDS[i]);
+      return lower + (upper - lower) * (rank - static_cast<double>(cumulated)) / static_cast<double>(buckets[i]);
+    }
+
+    cumulated += buckets[i];
+  }
+
+  return LAST_BUCKET_UPPER_BOUND;
+}
+
+
+static void SetMetric(const std::string& name,
+                      double value)
+{
+  OrthancPluginSetMetricsValue(OrthancPlugins::GetGlobalContext(), name.c_str(),
+                               static_cast<float>(value), OrthancPluginMetricsType_Default);
+}
+
+
+// e.g. "orthanc_explorer_2_rum_first_row_p95_ms_10_1_2_0_24"
+static std::string GetPrometheusName(const std::string& metric,
+                                     const std::string& statistic,
+                                     const std::string& subnet)
+{
+  std::string name = "orthanc_explorer_2_rum_" + metric + "_" + statistic + "_" + subnet;
+
+  for (size_t i = 0; i < name.size(); i++)
+  {
+    if (!isalnum(static_cast<unsigned char>(name[i])))
+    {
+      name[i] = '_';
+    }
+  }
+
+  return name;
+}
+
+
+void RumCollector::PublishSubnet(const Subnet& subnet,
+                                 unsigned int currentWindow)
+{
+  if (!subnet.isReady_.load(std::memory_order_acquire))
+  {
+    return;
+  }
+
+  const std::string name(subnet.name_);
+
+  for (unsigned int metric = 0; metric < Metric_Count; metric++)
+  {
+    uint32_t buckets[BUCKETS_COUNT];
+    uint64_t count = 0;
+
+    for (size_t i = 0; i < BUCKETS_COUNT; i++)
+    {
+      buckets[i] = (subnet.windows_[currentWindow][metric].buckets_[i].load(std::memory_order_relaxed) +
+                    subnet.windows_[1 - currentWindow][metric].buckets_[i].load(std::memory_order_relaxed));
+      count += buckets[i];
+    }
+
+    const uint64_t totalCount = subnet.totalCount_[metric].load(std::memory_order_relaxed);
+    if (totalCount == 0)
+    {
+      continue;
+    }
+
+    SetMetric(GetPrometheusName(METRICS_NAMES[metric], "count", name), static_cast<double>(totalCount));
+
+    if (count > 0)
+    {
+      SetMetric(GetPrometheusName(METRICS_NAMES[metric], "p50_ms", name), ComputePercentile(buckets, count, 0.5));
+      SetMetric(GetPrometheusName(METRICS_NAMES[metric], "p95_ms", name), ComputePercentile(buckets, count, 0.95));
+    }
+  }
+}
+
+
+void RumCollector::PublishMetrics()
+{
+  if (!isEnabled_)
+  {
+    return;
+  }
+
+  boost::mutex::scoped_lock lock(refreshMutex_);
+
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+  unsigned int window = currentWindow_.load();
+
+  if (lastRotation_.is_not_a_date_time())
+  {
+    lastRotation_ = now;
+  }
+  else if (now - lastRotation_ >= windowDuration_)
+  {
+    // the oldest window is cleared and becomes the current one.  A sample recorded during the rotation may be lost.
+    const unsigned int next = 1 - window;
+
+    for (size_t i = 0; i < capacity_; i++)
+    {
+      ClearWindow(subnets_[i], next);
+    }
+
+    ClearWindow(otherSubnets_, next);
+
+    currentWindow_.store(next);
+    window = next;
+    lastRotation_ = now;
+  }
+
+  for (size_t i = 0; i < capacity_; i++)
+  {
+    PublishSubnet(subnets_[i], window);
+  }
+
+  PublishSubnet(otherSubnets_, window);
+}
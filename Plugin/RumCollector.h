@@ -0,0 +1,127 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <json/value.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <atomic>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+
+// Aggregates the latencies measured in the browsers (real-user monitoring) into histograms per metric and per
+// client subnet, and exposes their percentiles as Orthanc metrics.  The samples are recorded from the HTTP threads
+// without any lock: the subnets are stored in an open-addressing table whose slots are claimed with a CAS, and the
+// histogram buckets are atomic counters.  The histograms of the last two time windows are kept so that the
+// percentiles reflect the recent latencies.
+class RumCollector : public boost::noncopyable
+{
+public:
+  enum Metric
+  {
+    Metric_Navigation,    // page load of the web application
+    Metric_FirstRow,      // from the start of a search to the display of the first row of the study list
+    Metric_Search,        // duration of the 'studies/find' call
+    Metric_ViewerLaunch,  // from the click on a viewer button to the opening of the viewer (token creation)
+
+    Metric_Count          // not a metric
+  };
+
+private:
+  static const size_t BUCKETS_COUNT = 20;
+  static const size_t MAX_SUBNET_NAME = 48;
+
+  struct Histogram
+  {
+    std::atomic<uint32_t>  buckets_[BUCKETS_COUNT];
+  };
+
+  struct Subnet
+  {
+    std::atomic<uint64_t>  key_;      // hash of the subnet name, 0 = free slot
+    std::atomic<bool>      isReady_;  // 'name_' has been written
+    char                   name_[MAX_SUBNET_NAME];
+    Histogram              windows_[2][Metric_Count];
+    std::atomic<uint64_t>  totalCount_[Metric_Count];
+  };
+
+  bool                        isEnabled_;
+  size_t                      maxSubnets_;
+  size_t                      capacity_;  // a power of 2, at least twice 'maxSubnets_' to keep the probes short
+  std::atomic<size_t>         subnetsCount_;
+  boost::scoped_array<Subnet> subnets_;
+  Subnet                      otherSubnets_;  // once the table is full
+  std::atomic<unsigned int>   currentWindow_;
+  boost::posix_time::time_duration  windowDuration_;
+
+  boost::mutex                refreshMutex_;
+  boost::posix_time::ptime    lastRotation_;
+
+  static void ClearWindow(Subnet& subnet,
+                          unsigned int window);
+
+  static void ClearSubnet(Subnet& subnet);
+
+  Subnet& LookupSubnet(const std::string& name);
+
+  static double ComputePercentile(const uint32_t* buckets,
+                                  uint64_t count,
+                                  double percentile);
+
+  static void PublishSubnet(const Subnet& subnet,
+                            unsigned int currentWindow);
+
+public:
+  RumCollector();
+
+  // to call before the first sample
+  void Configure(const Json::Value& configuration);
+
+  bool IsEnabled() const
+  {
+    return isEnabled_;
+  }
+
+  static bool LookupMetric(Metric& target,
+                           const std::string& name);
+
+  static const char* GetMetricName(Metric metric);
+
+  // the client address is read from the "X-Forwarded-For" and "X-Real-IP" headers set by the reverse proxy:
+  // IPv4 addresses are grouped by /24 and IPv6 addresses by /48
+  static std::string GetClientSubnet(const std::map<std::string, std::string>& headers);
+
+  // never blocks, 'value' is in milliseconds
+  void Record(Metric metric,
+              const std::string& subnet,
+              double value);
+
+  // called by the Orthanc metrics refresh callback
+  void PublishMetrics();
+};
@@ -0,0 +1,367 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "SearchAdmission.h"
+
+#include <boost/date_time/gregorian/gregorian.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+
+// Cost model of a study level 'tools/find'.  The unit is roughly "one query that can be answered by an index lookup".
+static const double COST_BASE = 1;
+static const double COST_LEADING_WILDCARD = 10;   // '*smith*' can not use any index -> scan of the column
+static const double COST_SHORT_PREFIX = 5;        // 'sm*' matches a large part of the index
+static const double COST_LONG_PREFIX = 2;         // 'smith*'
+static const double COST_NOT_INDEXED = 25;        // the tag is not a main DICOM tag -> Orthanc must read the JSON of each study
+static const double COST_COMPUTED_TAG = 5;        // e.g. ModalitiesInStudy is computed from the child series
+static const double COST_OPEN_DATE_RANGE = 20;    // '20200101-' or '-20200101'
+static const double COST_MAX_DATE_RANGE = 20;
+static const double COST_FULL_SCAN = 50;          // no selective constraint at all
+static const double COST_UNLIMITED_FACTOR = 2;    // 'Limit' is not set -> the whole result must be built
+
+static const unsigned int MAX_USERS_TRACKED = 10000;
+
+
+static bool IsIndexedTag(const std::string& tag)
+{
+  // the default Orthanc main DICOM tags at patient and study level
+  static const char* INDEXED_TAGS[] = {
+    "PatientName", "PatientID", "PatientBirthDate", "PatientSex", "OtherPatientIDs",
+    "StudyDate", "StudyTime", "StudyID", "StudyDescription", "AccessionNumber", "StudyInstanceUID",
+    "RequestedProcedureDescription", "InstitutionName", "RequestingPhysician", "ReferringPhysicianName",
+    NULL
+  };
+
+  for (size_t i = 0; INDEXED_TAGS[i] != NULL; i++)
+  {
+    if (tag == INDEXED_TAGS[i])
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+static bool IsDateTag(const std::string& tag)
+{
+  return tag == "StudyDate" || tag == "PatientBirthDate";
+}
+
+
+static bool ParseDicomDate(boost::gregorian::date& target,
+                           const std::string& value)
+{
+  if (value.size() != 8)
+  {
+    return false;
+  }
+
+  try
+  {
+    target = boost::gregorian::from_undelimited_string(value);
+    return true;
+  }
+  catch (std::exception&)
+  {
+    return false;
+  }
+}
+
+
+static double GetDateCost(bool& isSelective,
+                          const std::string& value)
+{
+  size_t dash = value.find('-');
+
+  if (dash == std::string::npos)
+  {
+    isSelective = true;  // a single day
+    return 0;
+  }
+
+  boost::gregorian::date from, to;
+
+  if (!ParseDicomDate(from, value.substr(0, dash)) ||
+      !ParseDicomDate(to, value.substr(dash + 1)))
+  {
+    isSelective = false;
+    return COST_OPEN_DATE_RANGE;
+  }
+
+  long days = std::abs((to - from).days()) + 1;
+  isSelective = (days <= 366);
+
+  return std::min(COST_MAX_DATE_RANGE, std::ceil(static_cast<double>(days) / 31.0) - 1);
+}
+
+
+SearchAdmission::Ticket::~Ticket()
+{
+  if (admission_ != NULL)
+  {
+    admission_->ReleaseSlot();
+  }
+}
+
+
+SearchAdmission::SearchAdmission() :
+  runningSearches_(0),
+  enabled_(false),
+  maxConcurrentSearches_(4),
+  maxQueueWaitTime_(10),
+  maxQueryCost_(200),
+  userBudget_(300),
+  userBudgetRefillRate_(5)
+{
+}
+
+
+void SearchAdmission::Configure(const Json::Value& configuration)
+{
+  if (configuration.isObject())
+  {
+    enabled_ = configuration.isMember("Enable") && configuration["Enable"].asBool();
+    maxConcurrentSearches_ = std::max(1u, configuration["MaxConcurrentSearches"].asUInt());
+    maxQueueWaitTime_ = configuration["MaxQueueWaitTime"].asUInt();
+    maxQueryCost_ = configuration["MaxQueryCost"].asDouble();
+    userBudget_ = configuration["UserBudget"].asDouble();
+    userBudgetRefillRate_ = configuration["UserBudgetRefillRate"].asDouble();
+  }
+}
+
+
+double SearchAdmission::EstimateQueryCost(const Json::Value& findRequest)
+{
+  double cost = COST_BASE;
+  bool hasSelectiveConstraint = false;
+
+  if (findRequest.isMember("Query") && findRequest["Query"].isObject())
+  {
+    const Json::Value& query = findRequest["Query"];
+    Json::Value::Members tags = query.getMemberNames();
+
+    for (size_t i = 0; i < tags.size(); i++)
+    {
+      const std::string& tag = tags[i];
+
+      if (!query[tag].isString())
+      {
+        continue;
+      }
+
+      const std::string value = query[tag].asString();
+
+      if (value.empty() || value == "*")
+      {
+        continue;  // no constraint at all
+      }
+
+      if (IsDateTag(tag))
+      {
+        bool isSelective = false;
+        cost += GetDateCost(isSelective, value);
+        hasSelectiveConstraint |= isSelective;
+      }
+      else if (tag == "ModalitiesInStudy")
+      {
+        cost += COST_COMPUTED_TAG;
+      }
+      else if (!IsIndexedTag(tag))
+      {
+        cost += COST_NOT_INDEXED;
+      }
+      else
+      {
+        size_t firstWildcard = value.find_first_of("*?");
+
+        if (firstWildcard == std::string::npos)
+        {
+          hasSelectiveConstraint = true;  // exact match
+        }
+        else if (firstWildcard == 0)
+        {
+          cost += COST_LEADING_WILDCARD;
+        }
+        else if (firstWildcard < 3)
+        {
+          cost += COST_SHORT_PREFIX;
+        }
+        else
+        {
+          cost += COST_LONG_PREFIX;
+          hasSelectiveConstraint = true;
+        }
+      }
+    }
+  }
+
+  if (findRequest.isMember("Labels") && findRequest["Labels"].isArray() && findRequest["Labels"].size() > 0)
+  {
+    hasSelectiveConstraint = true;  // labels are indexed
+  }
+
+  if (!hasSelectiveConstraint)
+  {
+    cost += COST_FULL_SCAN;
+  }
+
+  if (!findRequest.isMember("Limit") || findRequest["Limit"].asUInt() == 0)
+  {
+    cost *= COST_UNLIMITED_FACTOR;
+  }
+
+  return cost;
+}
+
+
+SearchAdmission::Bucket& SearchAdmission::GetUserBucket(const std::string& user)
+{
+  // must be called with mutex_ locked
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  Buckets::iterator bucket = buckets_.find(user);
+
+  if (bucket == buckets_.end())
+  {
+    if (buckets_.size() >= MAX_USERS_TRACKED)
+    {
+      // forget about the users whose budget is full again, they are equivalent to new users
+      for (Buckets::iterator it = buckets_.begin(); it != buckets_.end(); )
+      {
+        double elapsed = static_cast<double>((now - it->second.lastRefill_).total_milliseconds()) / 1000.0;
+        if (it->second.tokens_ + elapsed * userBudgetRefillRate_ >= userBudget_)
+        {
+          buckets_.erase(it++);
+        }
+        else
+        {
+          ++it;
+        }
+      }
+    }
+
+    Bucket b;
+    b.tokens_ = userBudget_;
+    b.lastRefill_ = now;
+    bucket = buckets_.insert(std::make_pair(user, b)).first;
+  }
+  else
+  {
+    double elapsed = static_cast<double>((now - bucket->second.lastRefill_).total_milliseconds()) / 1000.0;
+    bucket->second.tokens_ = std::min(userBudget_, bucket->second.tokens_ + elapsed * userBudgetRefillRate_);
+    bucket->second.lastRefill_ = now;
+  }
+
+  return bucket->second;
+}
+
+
+bool SearchAdmission::HasUserBudget(double& retryAfter,
+                                    const Bucket& bucket,
+                                    double cost) const
+{
+  // a query that costs more than the whole budget is accepted when the bucket is full (otherwise, it could never run)
+  double required = std::min(cost, userBudget_);
+
+  if (bucket.tokens_ >= required)
+  {
+    return true;
+  }
+  else
+  {
+    retryAfter = (userBudgetRefillRate_ > 0 ? (required - bucket.tokens_) / userBudgetRefillRate_ : 60);
+    return false;
+  }
+}
+
+
+SearchAdmission::Status SearchAdmission::Admit(Ticket& ticket,
+                                               double& retryAfter,
+                                               const std::string& user,
+                                               double cost)
+{
+  assert(ticket.admission_ == NULL);
+  retryAfter = 0;
+
+  if (!enabled_)
+  {
+    return Status_Admitted;
+  }
+
+  if (maxQueryCost_ > 0 && cost > maxQueryCost_)
+  {
+    return Status_TooExpensive;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  // don't queue a query that could not be admitted anyway
+  if (!HasUserBudget(retryAfter, GetUserBucket(user), cost))
+  {
+    return Status_RateLimited;
+  }
+
+  const boost::system_time timeout = boost::get_system_time() + boost::posix_time::seconds(maxQueueWaitTime_);
+
+  while (runningSearches_ >= maxConcurrentSearches_)
+  {
+    if (!slotReleased_.timed_wait(lock, timeout))
+    {
+      if (runningSearches_ >= maxConcurrentSearches_)
+      {
+        retryAfter = 1;
+        return Status_Busy;
+      }
+    }
+  }
+
+  // the budget is only charged on admission, a query rejected as "busy" costs nothing.  Other queries of
+  // the same user might have been admitted while waiting -> check the budget again.
+  Bucket& bucket = GetUserBucket(user);
+  if (!HasUserBudget(retryAfter, bucket, cost))
+  {
+    return Status_RateLimited;
+  }
+
+  bucket.tokens_ -= cost;  // may become negative -> the user has to wait longer
+  runningSearches_++;
+  ticket.admission_ = this;
+
+  return Status_Admitted;
+}
+
+
+void SearchAdmission::ReleaseSlot()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    assert(runningSearches_ > 0);
+    runningSearches_--;
+  }
+
+  slotReleased_.notify_one();
+}
@@ -0,0 +1,116 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <json/value.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <map>
+#include <string>
+
+
+// Protects the Orthanc index DB against expensive searches issued through the OE2 API:
+// - each query gets a cost estimated from its wildcards, date ranges and the tags it uses,
+// - each user has a token bucket that is consumed by the cost of its admitted queries,
+// - a global cap limits the number of searches running simultaneously (extra ones wait in a queue).
+class SearchAdmission : public boost::noncopyable
+{
+public:
+  enum Status
+  {
+    Status_Admitted,
+    Status_TooExpensive,   // the query alone exceeds 'MaxQueryCost'
+    Status_RateLimited,    // the user has exhausted its budget
+    Status_Busy            // no slot has been released within 'MaxQueueWaitTime'
+  };
+
+  // Holds one of the global search slots, releases it when destroyed
+  class Ticket : public boost::noncopyable
+  {
+  private:
+    SearchAdmission*  admission_;
+
+  public:
+    Ticket() :
+      admission_(NULL)
+    {
+    }
+
+    ~Ticket();
+
+    friend class SearchAdmission;
+  };
+
+private:
+  struct Bucket
+  {
+    double                    tokens_;
+    boost::posix_time::ptime  lastRefill_;
+  };
+
+  typedef std::map<std::string, Bucket>  Buckets;
+
+  boost::mutex                mutex_;
+  boost::condition_variable   slotReleased_;
+  Buckets                     buckets_;
+  unsigned int                runningSearches_;
+
+  bool          enabled_;
+  unsigned int  maxConcurrentSearches_;
+  unsigned int  maxQueueWaitTime_;  // in seconds
+  double        maxQueryCost_;
+  double        userBudget_;
+  double        userBudgetRefillRate_;  // tokens per second
+
+  // the bucket is refilled according to the time elapsed since its last use
+  Bucket& GetUserBucket(const std::string& user);
+
+  bool HasUserBudget(double& retryAfter,
+                     const Bucket& bucket,
+                     double cost) const;
+
+  void ReleaseSlot();
+
+public:
+  SearchAdmission();
+
+  void Configure(const Json::Value& configuration);
+
+  bool IsEnabled() const
+  {
+    return enabled_;
+  }
+
+  // 'findRequest' is the payload of a 'tools/find' request
+  static double EstimateQueryCost(const Json::Value& findRequest);
+
+  // 'user' must be an authenticated identity, not a value that the clients can choose
+  Status Admit(Ticket& ticket,
+               double& retryAfter,
+               const std::string& user,
+               double cost);
+};
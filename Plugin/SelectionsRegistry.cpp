@@ -0,0 +1,324 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "SelectionsRegistry.h"
+
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cassert>
+
+
+static const size_t ORTHANC_ID_LENGTH = 44;  // 5 groups of 8 hexadecimal digits separated by dashes
+
+
+static int GetHexValue(char c)
+{
+  if (c >= '0' && c <= '9')
+  {
+    return c - '0';
+  }
+  else if (c >= 'a' && c <= 'f')
+  {
+    return c - 'a' + 10;
+  }
+  else
+  {
+    return -1;
+  }
+}
+
+
+SelectionsRegistry::SelectionsRegistry() :
+  maxSelections_(100),
+  maxSelectionsPerUser_(10),
+  maxResources_(100000),
+  timeout_(boost::posix_time::seconds(3600))
+{
+}
+
+
+void SelectionsRegistry::Configure(const Json::Value& configuration)
+{
+  if (configuration.isObject())
+  {
+    maxSelections_ = std::max(1u, configuration["MaxSelections"].asUInt());
+    maxSelectionsPerUser_ = std::max(1u, configuration["MaxSelectionsPerUser"].asUInt());
+    maxResources_ = std::max(1u, configuration["MaxResources"].asUInt());
+    timeout_ = boost::posix_time::seconds(configuration["Timeout"].asUInt());
+  }
+}
+
+
+bool SelectionsRegistry::EncodeOrthancId(std::string& target,
+                                         const std::string& orthancId)
+{
+  if (orthancId.size() != ORTHANC_ID_LENGTH)
+  {
+    return false;
+  }
+
+  target.resize(DIGEST_SIZE);
+  size_t position = 0;
+
+  for (size_t i = 0; i < ORTHANC_ID_LENGTH; )
+  {
+    if (i % 9 == 8)
+    {
+      if (orthancId[i] != '-')
+      {
+        return false;
+      }
+      i++;
+    }
+    else
+    {
+      const int high = GetHexValue(orthancId[i]);
+      const int low = GetHexValue(orthancId[i + 1]);
+
+      if (high < 0 || low < 0)
+      {
+        return false;
+      }
+
+      target[position++] = static_cast<char>(high * 16 + low);
+      i += 2;
+    }
+  }
+
+  assert(position == DIGEST_SIZE);
+  return true;
+}
+
+
+std::string SelectionsRegistry::DecodeOrthancId(const char* digest)
+{
+  static const char HEX[] = "0123456789abcdef";
+
+  std::string result;
+  result.reserve(ORTHANC_ID_LENGTH);
+
+  for (size_t i = 0; i < DIGEST_SIZE; i++)
+  {
+    if (i > 0 && i % 4 == 0)
+    {
+      result.push_back('-');
+    }
+
+    const uint8_t value = static_cast<uint8_t>(digest[i]);
+    result.push_back(HEX[value >> 4]);
+    result.push_back(HEX[value & 0x0f]);
+  }
+
+  return result;
+}
+
+
+void SelectionsRegistry::RemoveExpired(const boost::posix_time::ptime& now)
+{
+  Selections::iterator it = selections_.begin();
+
+  while (it != selections_.end())
+  {
+    if (now - it->second.lastUse_ > timeout_)
+    {
+      selections_.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+
+size_t SelectionsRegistry::CountSelections(const std::string& owner) const
+{
+  size_t count = 0;
+
+  for (Selections::const_iterator it = selections_.begin(); it != selections_.end(); ++it)
+  {
+    if (it->second.owner_ == owner)
+    {
+      count++;
+    }
+  }
+
+  return count;
+}
+
+
+void SelectionsRegistry::RemoveLeastRecentlyUsed(const std::string& owner)
+{
+  std::string victim = owner;
+
+  if (victim.empty())
+  {
+    // the registry is full: the user that has the most selections loses one
+    std::map<std::string, size_t> counts;
+    size_t maxCount = 0;
+
+    for (Selections::const_iterator it = selections_.begin(); it != selections_.end(); ++it)
+    {
+      const size_t count = ++counts[it->second.owner_];
+      if (count > maxCount)
+      {
+        maxCount = count;
+        victim = it->second.owner_;
+      }
+    }
+  }
+
+  Selections::iterator oldest = selections_.end();
+
+  for (Selections::iterator it = selections_.begin(); it != selections_.end(); ++it)
+  {
+    if (it->second.owner_ == victim &&
+        (oldest == selections_.end() || it->second.lastUse_ < oldest->second.lastUse_))
+    {
+      oldest = it;
+    }
+  }
+
+  if (oldest != selections_.end())
+  {
+    selections_.erase(oldest);
+  }
+}
+
+
+std::string SelectionsRegistry::Create(size_t& count,
+                                       const std::vector<std::string>& orthancIds,
+                                       const std::string& owner)
+{
+  if (orthancIds.size() > maxResources_)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "A selection can not contain more than " + boost::lexical_cast<std::string>(maxResources_) + " resources");
+  }
+
+  std::vector<std::string> digests;
+  digests.reserve(orthancIds.size());
+
+  for (size_t i = 0; i < orthancIds.size(); i++)
+  {
+    std::string digest;
+    if (!EncodeOrthancId(digest, orthancIds[i]))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest, "Not an Orthanc id: " + orthancIds[i]);
+    }
+
+    digests.push_back(digest);
+  }
+
+  std::sort(digests.begin(), digests.end());
+  digests.erase(std::unique(digests.begin(), digests.end()), digests.end());
+
+  count = digests.size();
+
+  std::string packed;
+  packed.reserve(digests.size() * DIGEST_SIZE);
+
+  for (size_t i = 0; i < digests.size(); i++)
+  {
+    packed += digests[i];
+  }
+
+  const std::string selectionId = Orthanc::Toolbox::GenerateUuid();
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  RemoveExpired(now);
+
+  for (size_t i = CountSelections(owner); i >= maxSelectionsPerUser_; i--)
+  {
+    RemoveLeastRecentlyUsed(owner);
+  }
+
+  while (!selections_.empty() &&
+         selections_.size() >= maxSelections_)
+  {
+    RemoveLeastRecentlyUsed("");
+  }
+
+  Selection& selection = selections_[selectionId];
+  selection.digests_.swap(packed);
+  selection.owner_ = owner;
+  selection.lastUse_ = now;
+
+  return selectionId;
+}
+
+
+bool SelectionsRegistry::Lookup(std::vector<std::string>& orthancIds,
+                                const std::string& selectionId,
+                                const std::string& owner)
+{
+  orthancIds.clear();
+
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  RemoveExpired(now);
+
+  Selections::iterator found = selections_.find(selectionId);
+  if (found == selections_.end() ||
+      found->second.owner_ != owner)
+  {
+    return false;  // the selections of the other users are not disclosed
+  }
+
+  found->second.lastUse_ = now;
+
+  const std::string& digests = found->second.digests_;
+  orthancIds.reserve(digests.size() / DIGEST_SIZE);
+
+  for (size_t i = 0; i < digests.size(); i += DIGEST_SIZE)
+  {
+    orthancIds.push_back(DecodeOrthancId(digests.c_str() + i));
+  }
+
+  return true;
+}
+
+
+bool SelectionsRegistry::Remove(const std::string& selectionId,
+                                const std::string& owner)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Selections::iterator found = selections_.find(selectionId);
+  if (found == selections_.end() ||
+      found->second.owner_ != owner)
+  {
+    return false;
+  }
+
+  selections_.erase(found);
+  return true;
+}
@@ -0,0 +1,103 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <json/value.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+
+// The server-side selections of studies used by the bulk actions of the UI ({Root}api/selections): the browser
+// sends the id of a selection instead of the Orthanc ids of all the selected studies.  Each selection is stored as
+// a sorted array of the 20-byte SHA-1 digests behind the Orthanc ids and is forgotten once it has not been used
+// for a while.  A selection is only visible to the user who has created it, and each user has a quota of selections
+// so that the activity of a user does not evict the selections of the others.
+class SelectionsRegistry : public boost::noncopyable
+{
+private:
+  struct Selection
+  {
+    std::string               digests_;  // sorted, DIGEST_SIZE bytes per resource
+    std::string               owner_;
+    boost::posix_time::ptime  lastUse_;
+  };
+
+  typedef std::map<std::string, Selection>  Selections;
+
+  boost::mutex                      mutex_;
+  Selections                        selections_;
+  size_t                            maxSelections_;
+  size_t                            maxSelectionsPerUser_;
+  size_t                            maxResources_;
+  boost::posix_time::time_duration  timeout_;
+
+  // must be called with the mutex locked
+  void RemoveExpired(const boost::posix_time::ptime& now);
+
+  // must be called with the mutex locked.  Forgets the least recently used selection of 'owner', or of the user
+  // that has the most selections if 'owner' is empty.
+  void RemoveLeastRecentlyUsed(const std::string& owner);
+
+  // must be called with the mutex locked
+  size_t CountSelections(const std::string& owner) const;
+
+public:
+  static const size_t DIGEST_SIZE = 20;
+
+  SelectionsRegistry();
+
+  void Configure(const Json::Value& configuration);
+
+  size_t GetMaxResources() const
+  {
+    return maxResources_;
+  }
+
+  // "8a8cf898-ca27c490-d0c7058c-929d0581-2bbf104d" -> the 20 bytes of the digest.  Returns false if this
+  // is not an Orthanc id.
+  static bool EncodeOrthancId(std::string& target,
+                              const std::string& orthancId);
+
+  static std::string DecodeOrthancId(const char* digest);
+
+  // throws if one of the ids is not an Orthanc id or if there are too many of them.  Returns the id of the
+  // selection, 'count' is the number of distinct resources.  'owner' identifies the user who creates the selection.
+  std::string Create(size_t& count,
+                     const std::vector<std::string>& orthancIds,
+                     const std::string& owner);
+
+  // returns false if the selection does not exist, has expired or belongs to another user
+  bool Lookup(std::vector<std::string>& orthancIds,
+              const std::string& selectionId,
+              const std::string& owner);
+
+  bool Remove(const std::string& selectionId,
+              const std::string& owner);
+};
@@ -0,0 +1,663 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "SeriesContentIndex.h"
+
+#include "ChangesTracker.h"
+#include "StringDictionary.h"
+#include "StudyFilter.h"
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <memory>
+
+
+namespace
+{
+  enum SectionId
+  {
+    SectionId_Tags = 1,
+    SectionId_StudiesIds = 2,
+    SectionId_SeriesIds = 3,
+    SectionId_SeriesStudies = 4,
+    SectionId_FirstTagValues = 100  // followed by the values of the other tags
+  };
+
+  static const unsigned int SERIES_PAGE_SIZE = 1000;
+
+
+  static void AddPosting(std::vector<uint32_t>& postings,
+                         uint32_t slot)
+  {
+    // the lists are sorted to be intersected
+    std::vector<uint32_t>::iterator position = std::lower_bound(postings.begin(), postings.end(), slot);
+    if (position == postings.end() || *position != slot)
+    {
+      postings.insert(position, slot);
+    }
+  }
+
+
+  static void RemovePosting(boost::unordered_map<uint32_t, std::vector<uint32_t> >& lists,
+                            uint32_t value,
+                            uint32_t slot)
+  {
+    boost::unordered_map<uint32_t, std::vector<uint32_t> >::iterator found = lists.find(value);
+    if (found != lists.end())
+    {
+      std::vector<uint32_t>& postings = found->second;
+      std::vector<uint32_t>::iterator position = std::lower_bound(postings.begin(), postings.end(), slot);
+      if (position != postings.end() && *position == slot)
+      {
+        postings.erase(position);
+      }
+
+      if (postings.empty())
+      {
+        lists.erase(found);
+      }
+    }
+  }
+}
+
+
+SeriesContentIndex::SeriesContentIndex() :
+  deletedCount_(0),
+  lastSequence_(-1),
+  isRebuilding_(false)
+{
+}
+
+
+void SeriesContentIndex::SetIndexedTags(const std::vector<std::string>& tags)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  tags_ = tags;
+  Clear();
+}
+
+
+bool SeriesContentIndex::IsIndexedTag(const std::string& tag) const
+{
+  return std::find(tags_.begin(), tags_.end(), tag) != tags_.end();
+}
+
+
+void SeriesContentIndex::SetSeries(const std::string& seriesId,
+                                   const std::string& studyId,
+                                   const std::vector<std::string>& values)
+{
+  assert(values.size() == tags_.size());
+
+  StringDictionary& dictionary = StringDictionary::GetShared();
+
+  uint32_t studySlot;
+  std::map<std::string, uint32_t>::const_iterator foundStudy = studiesSlots_.find(studyId);
+
+  if (foundStudy != studiesSlots_.end())
+  {
+    studySlot = foundStudy->second;
+  }
+  else
+  {
+    studySlot = static_cast<uint32_t>(studies_.size());
+    studies_.push_back(Study());
+    studies_.back().orthancId_ = studyId;
+    studiesSlots_[studyId] = studySlot;
+  }
+
+  uint32_t slot;
+  std::map<std::string, uint32_t>::const_iterator foundSeries = seriesSlots_.find(seriesId);
+
+  if (foundSeries != seriesSlots_.end())
+  {
+    // the tags may have been modified: the slot is updated in place
+    slot = foundSeries->second;
+    Series& series = series_[slot];
+
+    for (size_t i = 0; i < series.values_.size(); i++)
+    {
+      RemovePosting(postingLists_[i], series.values_[i], slot);
+    }
+
+    series.values_.clear();
+
+    if (series.study_ != studySlot)
+    {
+      std::vector<uint32_t>& previousSeries = studies_[series.study_].series_;
+      previousSeries.erase(std::remove(previousSeries.begin(), previousSeries.end(), slot), previousSeries.end());
+      series.study_ = studySlot;
+      studies_[studySlot].series_.push_back(slot);
+    }
+  }
+  else
+  {
+    slot = static_cast<uint32_t>(series_.size());
+
+    series_.push_back(Series());
+    series_.back().orthancId_ = seriesId;
+    series_.back().study_ = studySlot;
+    series_.back().isDeleted_ = false;
+
+    seriesSlots_[seriesId] = slot;
+    studies_[studySlot].series_.push_back(slot);
+  }
+
+  Series& series = series_[slot];
+
+  for (size_t i = 0; i < values.size(); i++)
+  {
+    series.values_.push_back(dictionary.Intern(values[i]));
+    AddPosting(postingLists_[i][series.values_.back()], slot);
+  }
+}
+
+
+void SeriesContentIndex::RemoveSeries(const std::string& seriesId)
+{
+  std::map<std::string, uint32_t>::iterator found = seriesSlots_.find(seriesId);
+
+  if (found != seriesSlots_.end())
+  {
+    const uint32_t slot = found->second;
+    Series& series = series_[slot];
+
+    for (size_t i = 0; i < series.values_.size(); i++)
+    {
+      RemovePosting(postingLists_[i], series.values_[i], slot);
+    }
+
+    std::vector<uint32_t>& studySeries = studies_[series.study_].series_;
+    studySeries.erase(std::remove(studySeries.begin(), studySeries.end(), slot), studySeries.end());
+
+    series.isDeleted_ = true;
+    series.values_.clear();
+    seriesSlots_.erase(found);
+    deletedCount_++;
+  }
+}
+
+
+void SeriesContentIndex::RemoveStudy(const std::string& studyId)
+{
+  std::map<std::string, uint32_t>::iterator found = studiesSlots_.find(studyId);
+
+  if (found != studiesSlots_.end())
+  {
+    // the deletion of the series of the study may not be notified
+    const std::vector<uint32_t> studySeries = studies_[found->second].series_;
+
+    for (size_t i = 0; i < studySeries.size(); i++)
+    {
+      RemoveSeries(series_[studySeries[i]].orthancId_);
+    }
+  }
+}
+
+
+void SeriesContentIndex::CompactIfNeeded()
+{
+  if (deletedCount_ < 1000 ||
+      deletedCount_ < series_.size() / 2)
+  {
+    return;
+  }
+
+  StringDictionary& dictionary = StringDictionary::GetShared();
+
+  std::vector<Series> series;
+  series.swap(series_);
+
+  std::vector<Study> studies;
+  studies.swap(studies_);
+
+  Clear();
+
+  std::vector<std::string> values(tags_.size());
+
+  for (size_t i = 0; i < series.size(); i++)
+  {
+    if (!series[i].isDeleted_)
+    {
+      for (size_t j = 0; j < tags_.size(); j++)
+      {
+        values[j] = dictionary.GetString(series[i].values_[j]);
+      }
+
+      SetSeries(series[i].orthancId_, studies[series[i].study_].orthancId_, values);
+    }
+  }
+}
+
+
+void SeriesContentIndex::Clear()
+{
+  series_.clear();
+  seriesSlots_.clear();
+  studies_.clear();
+  studiesSlots_.clear();
+  deletedCount_ = 0;
+  postingLists_.clear();
+  postingLists_.resize(tags_.size());
+}
+
+
+void SeriesContentIndex::GetValues(std::vector<std::string>& values,
+                                   const Json::Value& mainDicomTags) const
+{
+  values.resize(tags_.size());
+
+  for (size_t i = 0; i < tags_.size(); i++)
+  {
+    values[i] = (mainDicomTags.isMember(tags_[i]) ? mainDicomTags[tags_[i]].asString() : "");
+  }
+}
+
+
+void SeriesContentIndex::UpdateSeries(const std::string& seriesId)
+{
+  Json::Value series;
+  if (OrthancPlugins::RestApiGet(series, "/series/" + seriesId, false))
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    std::vector<std::string> values;
+    GetValues(values, series["MainDicomTags"]);
+    SetSeries(seriesId, series["ParentStudy"].asString(), values);
+  }
+  // else, the series has already been deleted
+}
+
+
+void SeriesContentIndex::GetMatchingSeries(std::vector<uint32_t>& target,
+                                           size_t tagIndex,
+                                           const std::string& constraint) const
+{
+  StringDictionary& dictionary = StringDictionary::GetShared();
+
+  std::vector<std::string> alternatives;
+  Orthanc::Toolbox::TokenizeString(alternatives, constraint, '\\');
+
+  // the number of distinct values of a tag is small: they are all compared with the constraint
+  std::vector<uint32_t> matching;
+  const PostingLists& lists = postingLists_[tagIndex];
+  const bool isCaseSensitive = StudyFilter::IsCaseSensitiveTag(tags_[tagIndex]);
+
+  for (PostingLists::const_iterator it = lists.begin(); it != lists.end(); ++it)
+  {
+    const std::string value = dictionary.GetString(it->first);
+
+    for (size_t i = 0; i < alternatives.size(); i++)
+    {
+      if (StudyFilter::WildcardMatch(value, alternatives[i], isCaseSensitive))
+      {
+        matching.insert(matching.end(), it->second.begin(), it->second.end());
+        break;
+      }
+    }
+  }
+
+  std::sort(matching.begin(), matching.end());
+  target.swap(matching);
+}
+
+
+bool SeriesContentIndex::FindStudies(std::set<std::string>& target,
+                                     const Json::Value& seriesQuery)
+{
+  target.clear();
+
+  if (!seriesQuery.isObject())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "The series query must be a JSON object");
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (lastSequence_ < 0)
+  {
+    return false;
+  }
+
+  std::vector<uint32_t> series;
+  bool isFirst = true;
+
+  Json::Value::Members tags = seriesQuery.getMemberNames();
+
+  for (size_t i = 0; i < tags.size(); i++)
+  {
+    std::vector<std::string>::const_iterator tag = std::find(tags_.begin(), tags_.end(), tags[i]);
+    if (tag == tags_.end())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "This series tag is not indexed: " + tags[i]);
+    }
+
+    const std::string constraint = seriesQuery[tags[i]].asString();
+    if (constraint.empty() || constraint == "*")
+    {
+      continue;  // matches all the series
+    }
+
+    std::vector<uint32_t> matching;
+    GetMatchingSeries(matching, tag - tags_.begin(), constraint);
+
+    if (isFirst)
+    {
+      series.swap(matching);
+      isFirst = false;
+    }
+    else
+    {
+      std::vector<uint32_t> intersection;
+      std::set_intersection(series.begin(), series.end(), matching.begin(), matching.end(),
+                            std::back_inserter(intersection));
+      series.swap(intersection);
+    }
+  }
+
+  if (isFirst)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "The series query must contain at least one constraint");
+  }
+
+  for (size_t i = 0; i < series.size(); i++)
+  {
+    target.insert(studies_[series_[series[i]].study_].orthancId_);
+  }
+
+  return true;
+}
+
+
+void SeriesContentIndex::LoadSnapshot(const IndexSnapshot::Reader& reader)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  const IndexSnapshot::StringsView tags = reader.GetStrings(SectionId_Tags);
+
+  bool isSameTags = (tags.GetCount() == tags_.size());
+  for (size_t i = 0; isSameTags && i < tags_.size(); i++)
+  {
+    isSameTags = (tags.GetString(i) == tags_[i]);
+  }
+
+  if (!isSameTags)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "The indexed series tags have been modified since the snapshot");
+  }
+
+  const IndexSnapshot::StringsView studiesIds = reader.GetStrings(SectionId_StudiesIds);
+  const IndexSnapshot::StringsView seriesIds = reader.GetStrings(SectionId_SeriesIds);
+  const IndexSnapshot::UInt32ArrayView seriesStudies = reader.GetUInt32Array(SectionId_SeriesStudies);
+
+  std::vector<IndexSnapshot::StringsView> values;
+  for (size_t i = 0; i < tags_.size(); i++)
+  {
+    values.push_back(reader.GetStrings(SectionId_FirstTagValues + static_cast<uint32_t>(i)));
+
+    if (values.back().GetCount() != seriesIds.GetCount())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Inconsistent series content snapshot");
+    }
+  }
+
+  if (seriesStudies.GetCount() != seriesIds.GetCount())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Inconsistent series content snapshot");
+  }
+
+  Clear();
+  series_.reserve(seriesIds.GetCount());
+
+  std::vector<std::string> seriesValues(tags_.size());
+
+  for (uint64_t i = 0; i < seriesIds.GetCount(); i++)
+  {
+    if (seriesStudies[i] >= studiesIds.GetCount())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Inconsistent series content snapshot");
+    }
+
+    for (size_t j = 0; j < tags_.size(); j++)
+    {
+      seriesValues[j] = values[j].GetString(i);
+    }
+
+    SetSeries(seriesIds.GetString(i), studiesIds.GetString(seriesStudies[i]), seriesValues);
+  }
+
+  lastSequence_ = reader.GetChangeSequence();
+}
+
+
+void SeriesContentIndex::ListResources(std::vector<std::string>& target)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  target.clear();
+  target.reserve(seriesSlots_.size());
+
+  for (std::map<std::string, uint32_t>::const_iterator it = seriesSlots_.begin(); it != seriesSlots_.end(); ++it)
+  {
+    target.push_back(it->first);
+  }
+}
+
+
+IndexSnapshot::Writer* SeriesContentIndex::CreateSnapshot()
+{
+  StringDictionary& dictionary = StringDictionary::GetShared();
+
+  std::unique_ptr<IndexSnapshot::Writer> writer;
+
+  std::vector<std::string> studiesIds, seriesIds;
+  std::vector<uint32_t> seriesStudies;
+  std::vector<std::vector<std::string> > values;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    writer.reset(new IndexSnapshot::Writer(GetName(), GetFormatVersion(), lastSequence_));
+    writer->AddStrings(SectionId_Tags, tags_);
+
+    // the deleted series and the studies without series are not saved
+    std::map<uint32_t, uint32_t> studiesIndexes;
+    values.resize(tags_.size());
+
+    for (size_t i = 0; i < series_.size(); i++)
+    {
+      const Series& series = series_[i];
+
+      if (!series.isDeleted_)
+      {
+        std::map<uint32_t, uint32_t>::const_iterator study = studiesIndexes.find(series.study_);
+        if (study == studiesIndexes.end())
+        {
+          study = studiesIndexes.insert(std::make_pair(series.study_, static_cast<uint32_t>(studiesIds.size()))).first;
+          studiesIds.push_back(studies_[series.study_].orthancId_);
+        }
+
+        seriesIds.push_back(series.orthancId_);
+        seriesStudies.push_back(study->second);
+
+        for (size_t j = 0; j < tags_.size(); j++)
+        {
+          values[j].push_back(dictionary.GetString(series.values_[j]));
+        }
+      }
+    }
+  }
+
+  writer->AddStrings(SectionId_StudiesIds, studiesIds);
+  writer->AddStrings(SectionId_SeriesIds, seriesIds);
+  writer->AddUInt32Array(SectionId_SeriesStudies, seriesStudies);
+
+  for (size_t i = 0; i < values.size(); i++)
+  {
+    writer->AddStrings(SectionId_FirstTagValues + static_cast<uint32_t>(i), values[i]);
+  }
+
+  return writer.release();
+}
+
+
+void SeriesContentIndex::Rebuild()
+{
+  // the changes that occur while scanning are applied once the scan is complete
+  const int64_t sequence = ChangesTracker::GetLastChange();
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    isRebuilding_ = true;
+    changesDuringRebuild_.clear();
+  }
+
+  Json::Value series = Json::arrayValue;
+
+  for (unsigned int since = 0; ; since += SERIES_PAGE_SIZE)
+  {
+    Json::Value page;
+    if (!OrthancPlugins::RestApiGet(page, "/series?expand&since=" + boost::lexical_cast<std::string>(since) +
+                                    "&limit=" + boost::lexical_cast<std::string>(SERIES_PAGE_SIZE), false))
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      isRebuilding_ = false;
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to list the series");
+    }
+
+    for (Json::Value::ArrayIndex i = 0; i < page.size(); i++)
+    {
+      // only keep the required fields to limit the memory usage of large DBs
+      Json::Value item;
+      item["ID"] = page[i]["ID"];
+      item["ParentStudy"] = page[i]["ParentStudy"];
+      item["MainDicomTags"] = page[i]["MainDicomTags"];
+      series.append(item);
+    }
+
+    if (page.size() < SERIES_PAGE_SIZE)
+    {
+      break;
+    }
+  }
+
+  std::vector<ChangesPipeline::Change> pendingChanges;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Clear();
+
+    std::vector<std::string> values;
+
+    for (Json::Value::ArrayIndex i = 0; i < series.size(); i++)
+    {
+      GetValues(values, series[i]["MainDicomTags"]);
+      SetSeries(series[i]["ID"].asString(), series[i]["ParentStudy"].asString(), values);
+    }
+
+    lastSequence_ = sequence;
+    MarkModified();
+    isRebuilding_ = false;
+    pendingChanges.swap(changesDuringRebuild_);
+  }
+
+  HandleChanges(pendingChanges);
+}
+
+
+void SeriesContentIndex::HandleChanges(const std::vector<ChangesPipeline::Change>& changes)
+{
+  for (size_t i = 0; i < changes.size(); i++)
+  {
+    const ChangesPipeline::Change& change = changes[i];
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (isRebuilding_)
+      {
+        changesDuringRebuild_.push_back(change);
+        continue;
+      }
+
+      if (lastSequence_ < 0)
+      {
+        continue;  // not built yet, the changes will be taken into account by the rebuild
+      }
+
+      if (change.sequence_ >= 0 &&
+          change.sequence_ <= lastSequence_)
+      {
+        continue;  // already processed (replayed after a restart)
+      }
+    }
+
+    if (change.changeType_ == OrthancPluginChangeType_Deleted)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (change.resourceType_ == OrthancPluginResourceType_Series)
+      {
+        RemoveSeries(change.resourceId_);
+      }
+      else if (change.resourceType_ == OrthancPluginResourceType_Study)
+      {
+        RemoveStudy(change.resourceId_);
+      }
+
+      CompactIfNeeded();
+      MarkModified();
+    }
+    else if (change.resourceType_ == OrthancPluginResourceType_Series &&
+             (change.changeType_ == OrthancPluginChangeType_NewSeries ||
+              change.changeType_ == OrthancPluginChangeType_StableSeries))  // the tags may have been modified
+    {
+      UpdateSeries(change.resourceId_);
+    }
+
+    if (change.sequence_ >= 0)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      lastSequence_ = std::max(lastSequence_, change.sequence_);
+      MarkModified();
+    }
+  }
+}
+
+
+int64_t SeriesContentIndex::GetLastProcessedSequence()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return lastSequence_;
+}
@@ -0,0 +1,133 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "PersistentIndexes.h"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+
+// An in-memory index of the main DICOM tags of the series that gives, for each value of an indexed tag, the
+// (sorted) list of the series that have this value.  It is used to find the studies that contain a series
+// matching several series level constraints (e.g. Modality=PT and BodyPartExamined=CHEST) without loading
+// the series of each study.  The values are interned in the shared StringDictionary.
+class SeriesContentIndex : public IPersistentIndex
+{
+private:
+  struct Series
+  {
+    std::string            orthancId_;
+    uint32_t               study_;
+    std::vector<uint32_t>  values_;  // the id of the value of each indexed tag
+    bool                   isDeleted_;
+  };
+
+  struct Study
+  {
+    std::string            orthancId_;
+    std::vector<uint32_t>  series_;
+  };
+
+  typedef boost::unordered_map<uint32_t, std::vector<uint32_t> >  PostingLists;  // value id -> series slots
+
+  boost::mutex                     mutex_;
+  std::vector<std::string>         tags_;
+  std::vector<Series>              series_;
+  std::map<std::string, uint32_t>  seriesSlots_;  // Orthanc id -> index in 'series_'
+  std::vector<Study>               studies_;
+  std::map<std::string, uint32_t>  studiesSlots_;
+  size_t                           deletedCount_;
+  std::vector<PostingLists>        postingLists_;  // one per indexed tag
+  int64_t                          lastSequence_;
+  bool                             isRebuilding_;
+  std::vector<ChangesPipeline::Change>  changesDuringRebuild_;
+
+  // must be called with the mutex locked
+  void SetSeries(const std::string& seriesId,
+                 const std::string& studyId,
+                 const std::vector<std::string>& values);
+
+  void RemoveSeries(const std::string& seriesId);
+
+  void RemoveStudy(const std::string& studyId);
+
+  void CompactIfNeeded();
+
+  void Clear();
+
+  void GetValues(std::vector<std::string>& values,
+                 const Json::Value& mainDicomTags) const;
+
+  void UpdateSeries(const std::string& seriesId);
+
+  void GetMatchingSeries(std::vector<uint32_t>& target,
+                         size_t tagIndex,
+                         const std::string& constraint) const;
+
+public:
+  SeriesContentIndex();
+
+  // the names of the series main DICOM tags to index (e.g. "BodyPartExamined")
+  void SetIndexedTags(const std::vector<std::string>& tags);
+
+  bool IsIndexedTag(const std::string& tag) const;
+
+  // 'seriesQuery' is a JSON object with the same syntax as the "Query" of a series level 'tools/find' (wildcards
+  // and '\' separated values).  A study is returned if one of its series matches all the constraints.
+  // Returns false if the index has not been built yet.
+  bool FindStudies(std::set<std::string>& target,
+                   const Json::Value& seriesQuery);
+
+  virtual const char* GetName() const
+  {
+    return "series-content";
+  }
+
+  virtual uint32_t GetFormatVersion() const
+  {
+    return 1;
+  }
+
+  virtual OrthancPluginResourceType GetResourceType() const
+  {
+    return OrthancPluginResourceType_Series;
+  }
+
+  virtual void LoadSnapshot(const IndexSnapshot::Reader& reader);
+
+  virtual void ListResources(std::vector<std::string>& target);
+
+  virtual IndexSnapshot::Writer* CreateSnapshot();
+
+  virtual void Rebuild();
+
+  virtual void HandleChanges(const std::vector<ChangesPipeline::Change>& changes);
+
+  virtual int64_t GetLastProcessedSequence();
+};
@@ -0,0 +1,305 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "StorageWarmer.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <algorithm>
+
+
+class StorageWarmer::WarmStudyTask : public TaskExecutor::ITask
+{
+private:
+  StorageWarmer&  warmer_;
+  std::string     studyId_;
+
+public:
+  WarmStudyTask(StorageWarmer& warmer,
+                const std::string& studyId) :
+    warmer_(warmer),
+    studyId_(studyId)
+  {
+  }
+
+  virtual void Execute()
+  {
+    try
+    {
+      warmer_.SubmitReads(studyId_);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(WARNING) << "Orthanc Explorer 2: unable to warm the storage for study " << studyId_ << ": " << e.What();
+    }
+  }
+};
+
+
+StorageWarmer::StorageWarmer() :
+  isEnabled_(false),
+  isObjectStorage_(false),
+  maxParallelReads_(8),
+  storageCacheSize_(0),
+  warmDuration_(boost::posix_time::minutes(10)),
+  executor_(NULL),
+  stopped_(true)
+{
+}
+
+
+StorageWarmer::~StorageWarmer()
+{
+  Stop();
+}
+
+
+void StorageWarmer::Configure(const Json::Value& configuration,
+                              unsigned int storageCacheSize)
+{
+  if (!configuration.isObject())
+  {
+    return;
+  }
+
+  isEnabled_ = configuration["Enable"].asBool();
+  maxParallelReads_ = std::max(1u, configuration["MaxParallelReads"].asUInt());
+  warmDuration_ = boost::posix_time::seconds(configuration["WarmDuration"].asUInt());
+  storageCacheSize_ = static_cast<uint64_t>(storageCacheSize) * 1024 * 1024;
+
+  if (isEnabled_ && storageCacheSize_ == 0)
+  {
+    LOG(WARNING) << "Orthanc Explorer 2: the storage warmer is disabled since the Orthanc storage cache is disabled (MaximumStorageCacheSize)";
+    isEnabled_ = false;
+  }
+}
+
+
+void StorageWarmer::SetObjectStorageEnabled(bool enabled)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  isObjectStorage_ = enabled;
+}
+
+
+bool StorageWarmer::IsActive()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return isEnabled_ && isObjectStorage_ && executor_ != NULL;
+}
+
+
+void StorageWarmer::Start(TaskExecutor& executor)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    executor_ = &executor;
+  }
+
+  if (isEnabled_ && readers_.empty())
+  {
+    {
+      boost::mutex::scoped_lock lock(readsMutex_);
+      stopped_ = false;
+    }
+
+    for (unsigned int i = 0; i < maxParallelReads_; i++)
+    {
+      readers_.push_back(new boost::thread(&StorageWarmer::Reader, this));
+    }
+  }
+}
+
+
+void StorageWarmer::Stop()
+{
+  {
+    boost::mutex::scoped_lock lock(readsMutex_);
+    stopped_ = true;
+    pendingReads_.clear();
+  }
+
+  readAvailable_.notify_all();
+
+  for (size_t i = 0; i < readers_.size(); i++)
+  {
+    if (readers_[i]->joinable())
+    {
+      readers_[i]->join();
+    }
+
+    delete readers_[i];
+  }
+
+  readers_.clear();
+}
+
+
+void StorageWarmer::ReadInstanceFile(const std::string& instanceId)
+{
+  OrthancPlugins::MemoryBuffer file;
+  file.RestApiGet("/instances/" + instanceId + "/file", false);
+}
+
+
+void StorageWarmer::Reader()
+{
+  for (;;)
+  {
+    std::string instanceId;
+
+    {
+      boost::mutex::scoped_lock lock(readsMutex_);
+
+      while (!stopped_ && pendingReads_.empty())
+      {
+        readAvailable_.wait(lock);
+      }
+
+      if (stopped_)
+      {
+        return;
+      }
+
+      instanceId = pendingReads_.front();
+      pendingReads_.pop_front();
+    }
+
+    try
+    {
+      ReadInstanceFile(instanceId);
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      // e.g. the instance has been deleted in the meantime
+    }
+    catch (std::exception& e)
+    {
+      LOG(WARNING) << "Orthanc Explorer 2: unable to warm the storage for instance " << instanceId << ": " << e.what();
+    }
+  }
+}
+
+
+void StorageWarmer::QueueReads(const std::vector<std::string>& instancesIds)
+{
+  {
+    boost::mutex::scoped_lock lock(readsMutex_);
+
+    if (stopped_)
+    {
+      return;
+    }
+
+    pendingReads_.insert(pendingReads_.end(), instancesIds.begin(), instancesIds.end());
+  }
+
+  readAvailable_.notify_all();
+}
+
+
+void StorageWarmer::SubmitReads(const std::string& studyId)
+{
+  Json::Value instances;
+  if (!OrthancPlugins::RestApiGet(instances, "/studies/" + studyId + "/instances", false))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource);
+  }
+
+  std::vector<std::string> instancesIds;
+  uint64_t totalSize = 0;
+
+  for (Json::Value::ArrayIndex i = 0; i < instances.size(); i++)
+  {
+    // the following files would evict the first ones from the storage cache
+    totalSize += instances[i]["FileSize"].asUInt64();
+    if (totalSize > storageCacheSize_)
+    {
+      break;
+    }
+
+    instancesIds.push_back(instances[i]["ID"].asString());
+  }
+
+  QueueReads(instancesIds);
+}
+
+
+StorageWarmer::Status StorageWarmer::Warm(const std::string& studyId)
+{
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!isEnabled_ || !isObjectStorage_ || executor_ == NULL)
+    {
+      return Status_Disabled;
+    }
+
+    // forget the studies that may have been evicted from the storage cache since they were warmed
+    for (std::map<std::string, boost::posix_time::ptime>::iterator it = warmedStudies_.begin(); it != warmedStudies_.end(); )
+    {
+      if (it->second + warmDuration_ < now)
+      {
+        warmedStudies_.erase(it++);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+
+    if (warmedStudies_.find(studyId) != warmedStudies_.end())
+    {
+      return Status_AlreadyWarm;
+    }
+
+    warmedStudies_[studyId] = now;
+  }
+
+  // the user has just expanded the study and is about to open it in a viewer
+  executor_->Submit(new WarmStudyTask(*this, studyId), TaskExecutor::Priority_Interactive);
+  return Status_Started;
+}
+
+
+const char* StorageWarmer::EnumerationToString(Status status)
+{
+  switch (status)
+  {
+    case Status_Disabled:
+      return "Disabled";
+
+    case Status_Started:
+      return "Started";
+
+    case Status_AlreadyWarm:
+      return "AlreadyWarm";
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
@@ -0,0 +1,105 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "TaskExecutor.h"
+
+#include <json/value.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+// On the object storage backends (S3, Azure, GCS), opening a study in a viewer waits for the first bytes of hundreds
+// of objects.  When a study is expanded in the UI, its files are read in parallel in the background so that they
+// are in the Orthanc storage cache when the viewer requests them.  The files are read by dedicated threads
+// ("MaxParallelReads") since these reads are waiting for the network and must not occupy the TaskExecutor.
+class StorageWarmer : public boost::noncopyable
+{
+public:
+  enum Status
+  {
+    Status_Disabled,    // the Orthanc storage is not an object storage
+    Status_Started,
+    Status_AlreadyWarm  // the study has been warmed recently
+  };
+
+private:
+  class WarmStudyTask;
+
+  bool                      isEnabled_;
+  bool                      isObjectStorage_;
+  unsigned int              maxParallelReads_;
+  uint64_t                  storageCacheSize_;  // in bytes, the files beyond this size would evict the first ones
+  boost::posix_time::time_duration  warmDuration_;
+
+  TaskExecutor*             executor_;
+  boost::mutex              mutex_;
+  std::map<std::string, boost::posix_time::ptime>  warmedStudies_;  // the time at which each study has been warmed
+
+  boost::mutex                  readsMutex_;
+  boost::condition_variable     readAvailable_;
+  std::deque<std::string>       pendingReads_;  // the instances whose file must be read
+  std::vector<boost::thread*>   readers_;
+  bool                          stopped_;
+
+  void SubmitReads(const std::string& studyId);
+
+  void Reader();
+
+protected:
+  // the content is not used, reading the file is enough to populate the Orthanc storage cache
+  virtual void ReadInstanceFile(const std::string& instanceId);
+
+public:
+  StorageWarmer();
+
+  virtual ~StorageWarmer();
+
+  // 'storageCacheSize' is the "MaximumStorageCacheSize" of the Orthanc configuration (in MB)
+  void Configure(const Json::Value& configuration,
+                 unsigned int storageCacheSize);
+
+  // the storage plugins are detected once Orthanc has started (see GetPluginsConfiguration())
+  void SetObjectStorageEnabled(bool enabled);
+
+  bool IsActive();
+
+  void Start(TaskExecutor& executor);
+
+  // the pending reads are discarded and the running reads are awaited
+  void Stop();
+
+  // the files are read by the reader threads, in the given order
+  void QueueReads(const std::vector<std::string>& instancesIds);
+
+  Status Warm(const std::string& studyId);
+
+  static const char* EnumerationToString(Status status);
+};
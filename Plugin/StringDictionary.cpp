@@ -0,0 +1,314 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "StringDictionary.h"
+
+#include <OrthancException.h>
+
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <string.h>
+
+
+namespace
+{
+  // a key that points to the string stored in the blocks of the dictionary (no copy)
+  struct StringKey
+  {
+    const char*  data_;
+    size_t       size_;
+
+    bool operator== (const StringKey& other) const
+    {
+      return size_ == other.size_ && memcmp(data_, other.data_, size_) == 0;
+    }
+  };
+
+  struct StringKeyHash
+  {
+    size_t operator() (const StringKey& key) const
+    {
+      return boost::hash_range(key.data_, key.data_ + key.size_);
+    }
+  };
+}
+
+
+struct StringDictionary::Shard
+{
+  mutable boost::mutex                                      mutex_;
+  boost::unordered_map<StringKey, uint32_t, StringKeyHash>  ids_;
+  std::vector<char*>                                        blocks_;   // all the allocated blocks
+  char*                                                     current_;  // the block being filled
+  size_t                                                    currentUsed_;
+
+  Shard() :
+    current_(NULL),
+    currentUsed_(0)
+  {
+  }
+
+  ~Shard()
+  {
+    for (size_t i = 0; i < blocks_.size(); i++)
+    {
+      delete[] blocks_[i];
+    }
+  }
+
+  char* Allocate(size_t size)
+  {
+    blocks_.push_back(new char[size > 0 ? size : 1]);
+    return blocks_.back();
+  }
+
+  // must be called with the mutex locked
+  const char* Store(const std::string& value)
+  {
+    if (value.size() > BLOCK_SIZE / 4)
+    {
+      // a large string gets its own block to avoid wasting the end of the current block
+      char* block = Allocate(value.size());
+      memcpy(block, value.c_str(), value.size());
+      return block;
+    }
+
+    if (current_ == NULL ||
+        currentUsed_ + value.size() > BLOCK_SIZE)
+    {
+      current_ = Allocate(BLOCK_SIZE);
+      currentUsed_ = 0;
+    }
+
+    char* target = current_ + currentUsed_;
+    memcpy(target, value.c_str(), value.size());
+    currentUsed_ += value.size();
+    return target;
+  }
+};
+
+
+StringDictionary::StringDictionary() :
+  segments_(new std::atomic<Segment*>[MAX_SEGMENTS]),
+  nextId_(0),
+  shards_(new Shard[SHARDS_COUNT])
+{
+  for (size_t i = 0; i < MAX_SEGMENTS; i++)
+  {
+    segments_[i].store(NULL, std::memory_order_relaxed);
+  }
+
+  if (Intern("") != EMPTY_STRING_ID)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+}
+
+
+StringDictionary::~StringDictionary()
+{
+  for (size_t i = 0; i < MAX_SEGMENTS; i++)
+  {
+    delete segments_[i].load();
+  }
+
+  delete[] segments_;
+  delete[] shards_;
+}
+
+
+bool StringDictionary::LookupEntry(const char*& data,
+                                   uint32_t& size,
+                                   uint32_t id) const
+{
+  if (id >= nextId_.load(std::memory_order_acquire))
+  {
+    return false;
+  }
+
+  Segment* segment = segments_[id >> SEGMENT_BITS].load(std::memory_order_acquire);
+  if (segment == NULL)
+  {
+    return false;
+  }
+
+  const Entry& entry = segment->entries_[id & (SEGMENT_SIZE - 1)];
+  data = entry.data_.load(std::memory_order_acquire);
+  size = entry.size_;
+  return data != NULL;
+}
+
+
+void StringDictionary::SetEntry(uint32_t id,
+                                const char* data,
+                                uint32_t size)
+{
+  std::atomic<Segment*>& slot = segments_[id >> SEGMENT_BITS];
+  Segment* segment = slot.load(std::memory_order_acquire);
+
+  if (segment == NULL)
+  {
+    // several shards may need the same new segment at the same time
+    Segment* created = new Segment();  // value-initialization sets all the entries to NULL
+    if (slot.compare_exchange_strong(segment, created, std::memory_order_acq_rel))
+    {
+      segment = created;
+    }
+    else
+    {
+      delete created;  // 'segment' has been set to the one created by another thread
+    }
+  }
+
+  Entry& entry = segment->entries_[id & (SEGMENT_SIZE - 1)];
+  entry.size_ = size;
+  entry.data_.store(data, std::memory_order_release);  // publishes the entry
+}
+
+
+uint32_t StringDictionary::Intern(const std::string& value)
+{
+  StringKey key;
+  key.data_ = value.c_str();
+  key.size_ = value.size();
+
+  const size_t hash = StringKeyHash()(key);
+  Shard& shard = shards_[hash % SHARDS_COUNT];
+
+  boost::mutex::scoped_lock lock(shard.mutex_);
+
+  boost::unordered_map<StringKey, uint32_t, StringKeyHash>::const_iterator found = shard.ids_.find(key);
+  if (found != shard.ids_.end())
+  {
+    return found->second;
+  }
+
+  // the other shards may reserve ids concurrently, the entry is only visible once it is filled
+  const uint32_t reserved = nextId_.fetch_add(1, std::memory_order_acq_rel);
+  if (reserved == 0xffffffffu)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory, "Too many strings in the dictionary");
+  }
+
+  key.data_ = shard.Store(value);
+  SetEntry(reserved, key.data_, static_cast<uint32_t>(value.size()));
+  shard.ids_[key] = reserved;
+
+  return reserved;
+}
+
+
+bool StringDictionary::Lookup(uint32_t& id,
+                              const std::string& value) const
+{
+  StringKey key;
+  key.data_ = value.c_str();
+  key.size_ = value.size();
+
+  const Shard& shard = shards_[StringKeyHash()(key) % SHARDS_COUNT];
+
+  boost::mutex::scoped_lock lock(shard.mutex_);
+
+  boost::unordered_map<StringKey, uint32_t, StringKeyHash>::const_iterator found = shard.ids_.find(key);
+  if (found != shard.ids_.end())
+  {
+    id = found->second;
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+
+std::string StringDictionary::GetString(uint32_t id) const
+{
+  size_t size;
+  const char* data = GetData(id, size);
+  return std::string(data, size);
+}
+
+
+const char* StringDictionary::GetData(uint32_t id,
+                                      size_t& size) const
+{
+  const char* data = NULL;
+  uint32_t entrySize = 0;
+
+  if (!LookupEntry(data, entrySize, id))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Unknown string id");
+  }
+
+  size = entrySize;
+  return data;
+}
+
+
+void StringDictionary::SaveSnapshot(IndexSnapshot::Writer& writer,
+                                    uint32_t sectionId) const
+{
+  const uint32_t size = GetSize();
+
+  std::vector<std::string> values;
+  values.reserve(size);
+
+  for (uint32_t i = 0; i < size; i++)
+  {
+    const char* data = NULL;
+    uint32_t entrySize = 0;
+
+    // An id that is still being filled by another thread is saved as an empty string: it can not be
+    // referenced by the content of an index that has been captured before the dictionary.
+    if (LookupEntry(data, entrySize, i))
+    {
+      values.push_back(std::string(data, entrySize));
+    }
+    else
+    {
+      values.push_back(std::string());
+    }
+  }
+
+  writer.AddStrings(sectionId, values);
+}
+
+
+void StringDictionary::LoadSnapshot(std::vector<uint32_t>& savedIdToId,
+                                    const IndexSnapshot::StringsView& strings)
+{
+  savedIdToId.resize(strings.GetCount());
+
+  for (uint64_t i = 0; i < strings.GetCount(); i++)
+  {
+    savedIdToId[i] = Intern(strings.GetString(i));
+  }
+}
+
+
+StringDictionary& StringDictionary::GetShared()
+{
+  static StringDictionary dictionary;
+  return dictionary;
+}
@@ -0,0 +1,114 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "IndexSnapshot.h"
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+// A concurrent append-only dictionary that maps the repeated strings of the plugin indexes and caches
+// (modalities, institution names, descriptions, labels, ...) to 32-bit ids.  The strings are stored once
+// in large blocks, so an index only has to store 4 bytes per value.
+//
+// - Intern() is sharded by hash to limit the contention between the writers.
+// - GetString() does not take any lock: the ids are never reused and the entries are never moved.
+// - The strings are never released: the unique ids of the resources (studies, selections, ...) must not be
+//   interned, otherwise the dictionary would keep growing with the deleted resources.
+class StringDictionary : public boost::noncopyable
+{
+public:
+  static const uint32_t EMPTY_STRING_ID = 0;  // always present
+
+private:
+  static const size_t SHARDS_COUNT = 16;
+  static const size_t SEGMENT_BITS = 16;
+  static const size_t SEGMENT_SIZE = static_cast<size_t>(1) << SEGMENT_BITS;
+  static const size_t MAX_SEGMENTS = static_cast<size_t>(1) << (32 - SEGMENT_BITS);
+  static const size_t BLOCK_SIZE = 1024 * 1024;
+
+  struct Entry
+  {
+    std::atomic<const char*>  data_;  // NULL as long as the id is reserved but not yet filled
+    uint32_t                  size_;
+  };
+
+  struct Segment
+  {
+    Entry  entries_[SEGMENT_SIZE];
+  };
+
+  struct Shard;
+
+  std::atomic<Segment*>*  segments_;   // MAX_SEGMENTS pointers, allocated on demand
+  std::atomic<uint32_t>   nextId_;
+  Shard*                  shards_;
+
+  bool LookupEntry(const char*& data,
+                   uint32_t& size,
+                   uint32_t id) const;
+
+  void SetEntry(uint32_t id,
+                const char* data,
+                uint32_t size);
+
+public:
+  StringDictionary();
+
+  ~StringDictionary();
+
+  uint32_t Intern(const std::string& value);
+
+  // does not insert the value, returns false if the value has never been interned
+  bool Lookup(uint32_t& id,
+              const std::string& value) const;
+
+  std::string GetString(uint32_t id) const;
+
+  // the strings are never moved: the pointer remains valid as long as the dictionary exists
+  const char* GetData(uint32_t id,
+                      size_t& size) const;
+
+  uint32_t GetSize() const
+  {
+    return nextId_.load();
+  }
+
+  // The ids are specific to each run.  The indexes save the strings of the dictionary in their snapshot and
+  // get the correspondence between the saved ids and the new ids when loading the snapshot.  The dictionary
+  // must be saved after the content of the index has been captured.
+  void SaveSnapshot(IndexSnapshot::Writer& writer,
+                    uint32_t sectionId) const;
+
+  void LoadSnapshot(std::vector<uint32_t>& savedIdToId,
+                    const IndexSnapshot::StringsView& strings);
+
+  // the dictionary shared by all the plugin indexes and caches
+  static StringDictionary& GetShared();
+};
@@ -0,0 +1,351 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "StudyCapabilitiesIndex.h"
+
+#include "ChangesTracker.h"
+#include "JsonScanner.h"
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+
+
+namespace
+{
+  enum SectionId
+  {
+    SectionId_StudiesIds = 1,
+    SectionId_Capabilities = 2
+  };
+
+  static const unsigned int SERIES_PAGE_SIZE = 1000;
+
+  // below this number of slices, a volume rendering is not meaningful (localizers, key images, ...)
+  static const size_t MIN_VOLUME_SLICES = 20;
+}
+
+
+StudyCapabilitiesIndex::StudyCapabilitiesIndex() :
+  lastSequence_(-1),
+  isRebuilding_(false)
+{
+}
+
+
+uint32_t StudyCapabilitiesIndex::ComputeCapabilities(const std::vector<SeriesSummary>& series)
+{
+  // the modalities sets are the ones of the isValidMode() of the OHIF modes
+  static const std::set<std::string> NON_IMAGES = { "SM", "ECG", "SR", "SEG" };
+  static const std::set<std::string> NOT_SEGMENTABLE = { "SM", "US", "MG", "OT", "DOC", "CR" };
+
+  std::set<std::string> modalities;
+  uint32_t capabilities = 0;
+
+  for (size_t i = 0; i < series.size(); i++)
+  {
+    const std::string& modality = series[i].modality_;
+    modalities.insert(modality);
+
+    if (NON_IMAGES.find(modality) == NON_IMAGES.end())
+    {
+      capabilities |= StudyCapability_Images;
+    }
+
+    if (NOT_SEGMENTABLE.find(modality) == NOT_SEGMENTABLE.end())
+    {
+      capabilities |= StudyCapability_SegmentationCompatible;
+    }
+
+    if ((modality == "CT" || modality == "MR" || modality == "PT") &&
+        series[i].instancesCount_ >= MIN_VOLUME_SLICES)
+    {
+      capabilities |= StudyCapability_Volumetric;
+    }
+
+    if (modality == "SEG" || modality == "RTSTRUCT")
+    {
+      capabilities |= StudyCapability_Segmentation;
+    }
+  }
+
+  if (modalities.find("SM") != modalities.end())
+  {
+    capabilities |= StudyCapability_Wsi;
+  }
+  else if (modalities.find("PT") != modalities.end() &&
+           modalities.find("CT") != modalities.end())
+  {
+    capabilities |= StudyCapability_PetCt;
+  }
+
+  return capabilities;
+}
+
+
+static StudyCapabilitiesIndex::SeriesSummary GetSeriesSummary(const JsonScanner::Value& series)
+{
+  StudyCapabilitiesIndex::SeriesSummary summary;
+
+  JsonScanner::Value member;
+  if (series.LookupMember(member, "MainDicomTags"))
+  {
+    summary.modality_ = member.GetStringMember("Modality");
+  }
+
+  summary.instancesCount_ = (series.LookupMember(member, "Instances") ? member.GetArraySize() : 0);
+  return summary;
+}
+
+
+void StudyCapabilitiesIndex::AnalyseStudy(const std::string& studyId)
+{
+  JsonScanner::Document series;
+  if (series.RestApiGet("/studies/" + studyId + "/series", false))
+  {
+    std::vector<SeriesSummary> summaries;
+
+    JsonScanner::ArrayReader reader(series.GetRoot());
+    JsonScanner::Value item;
+    while (reader.Next(item))
+    {
+      summaries.push_back(GetSeriesSummary(item));
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    capabilities_[studyId] = ComputeCapabilities(summaries);
+  }
+  // else, the study has already been deleted
+}
+
+
+bool StudyCapabilitiesIndex::LookupCapabilities(uint32_t& capabilities,
+                                                const std::string& studyId)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  boost::unordered_map<std::string, uint32_t>::const_iterator found = capabilities_.find(studyId);
+  if (found != capabilities_.end())
+  {
+    capabilities = found->second;
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+
+void StudyCapabilitiesIndex::LoadSnapshot(const IndexSnapshot::Reader& reader)
+{
+  const IndexSnapshot::StringsView studiesIds = reader.GetStrings(SectionId_StudiesIds);
+  const IndexSnapshot::UInt32ArrayView capabilities = reader.GetUInt32Array(SectionId_Capabilities);
+
+  if (capabilities.GetCount() != studiesIds.GetCount())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Inconsistent study capabilities snapshot");
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  capabilities_.clear();
+  capabilities_.reserve(studiesIds.GetCount());
+
+  for (uint64_t i = 0; i < studiesIds.GetCount(); i++)
+  {
+    capabilities_[studiesIds.GetString(i)] = capabilities[i];
+  }
+
+  lastSequence_ = reader.GetChangeSequence();
+}
+
+
+void StudyCapabilitiesIndex::ListResources(std::vector<std::string>& target)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  target.clear();
+  target.reserve(capabilities_.size());
+
+  for (boost::unordered_map<std::string, uint32_t>::const_iterator it = capabilities_.begin(); it != capabilities_.end(); ++it)
+  {
+    target.push_back(it->first);
+  }
+}
+
+
+IndexSnapshot::Writer* StudyCapabilitiesIndex::CreateSnapshot()
+{
+  std::vector<std::string> studiesIds;
+  std::vector<uint32_t> capabilities;
+  int64_t sequence;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    sequence = lastSequence_;
+    studiesIds.reserve(capabilities_.size());
+    capabilities.reserve(capabilities_.size());
+
+    for (boost::unordered_map<std::string, uint32_t>::const_iterator it = capabilities_.begin(); it != capabilities_.end(); ++it)
+    {
+      studiesIds.push_back(it->first);
+      capabilities.push_back(it->second);
+    }
+  }
+
+  std::unique_ptr<IndexSnapshot::Writer> writer(new IndexSnapshot::Writer(GetName(), GetFormatVersion(), sequence));
+  writer->AddStrings(SectionId_StudiesIds, studiesIds);
+  writer->AddUInt32Array(SectionId_Capabilities, capabilities);
+  return writer.release();
+}
+
+
+void StudyCapabilitiesIndex::Rebuild()
+{
+  // the changes that occur while scanning are applied once the scan is complete
+  const int64_t sequence = ChangesTracker::GetLastChange();
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    isRebuilding_ = true;
+    changesDuringRebuild_.clear();
+  }
+
+  // a single scan of all the series instead of one request per study
+  std::map<std::string, std::vector<SeriesSummary> > studies;
+
+  for (unsigned int since = 0; ; since += SERIES_PAGE_SIZE)
+  {
+    // only a few fields of each series are needed -> the page is scanned without building the JSON tree
+    JsonScanner::Document page;
+    if (!page.RestApiGet("/series?expand&since=" + boost::lexical_cast<std::string>(since) +
+                         "&limit=" + boost::lexical_cast<std::string>(SERIES_PAGE_SIZE), false))
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      isRebuilding_ = false;
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to list the series");
+    }
+
+    unsigned int count = 0;
+
+    JsonScanner::ArrayReader reader(page.GetRoot());
+    JsonScanner::Value item;
+    while (reader.Next(item))
+    {
+      studies[item.GetStringMember("ParentStudy")].push_back(GetSeriesSummary(item));
+      count++;
+    }
+
+    if (count < SERIES_PAGE_SIZE)
+    {
+      break;
+    }
+  }
+
+  std::vector<ChangesPipeline::Change> pendingChanges;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    capabilities_.clear();
+    capabilities_.reserve(studies.size());
+
+    for (std::map<std::string, std::vector<SeriesSummary> >::const_iterator it = studies.begin(); it != studies.end(); ++it)
+    {
+      capabilities_[it->first] = ComputeCapabilities(it->second);
+    }
+
+    lastSequence_ = sequence;
+    MarkModified();
+    isRebuilding_ = false;
+    pendingChanges.swap(changesDuringRebuild_);
+  }
+
+  HandleChanges(pendingChanges);
+}
+
+
+void StudyCapabilitiesIndex::HandleChanges(const std::vector<ChangesPipeline::Change>& changes)
+{
+  for (size_t i = 0; i < changes.size(); i++)
+  {
+    const ChangesPipeline::Change& change = changes[i];
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (isRebuilding_)
+      {
+        changesDuringRebuild_.push_back(change);
+        continue;
+      }
+
+      if (lastSequence_ < 0)
+      {
+        continue;  // not built yet, the changes will be taken into account by the rebuild
+      }
+
+      if (change.sequence_ >= 0 &&
+          change.sequence_ <= lastSequence_)
+      {
+        continue;  // already processed (replayed after a restart)
+      }
+    }
+
+    // NB: the deletion of a series does not refresh the capabilities of its study (they are only hints for the UI)
+    if (change.resourceType_ == OrthancPluginResourceType_Study)
+    {
+      if (change.changeType_ == OrthancPluginChangeType_StableStudy)
+      {
+        AnalyseStudy(change.resourceId_);
+      }
+      else if (change.changeType_ == OrthancPluginChangeType_Deleted)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        capabilities_.erase(change.resourceId_);
+        MarkModified();
+      }
+    }
+
+    if (change.sequence_ >= 0)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      lastSequence_ = std::max(lastSequence_, change.sequence_);
+      MarkModified();
+    }
+  }
+}
+
+
+int64_t StudyCapabilitiesIndex::GetLastProcessedSequence()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return lastSequence_;
+}
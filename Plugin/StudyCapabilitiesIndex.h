@@ -0,0 +1,101 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include "PersistentIndexes.h"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <string>
+#include <vector>
+
+
+// Precomputes, for each study, the flags that tell which viewers are relevant for its content.  The studies are
+// analysed when they become stable, so that the study list can show the right viewer buttons without loading the
+// series of each study.  The values must be kept in sync with 'helpers/study-capabilities.js'.
+enum StudyCapability
+{
+  StudyCapability_Images = (1 << 0),                  // at least one series that is not SM, ECG, SR or SEG
+  StudyCapability_PetCt = (1 << 1),                   // PT and CT series (and no SM), for the OHIF TMTV mode
+  StudyCapability_Volumetric = (1 << 2),              // a CT, MR or PT series with enough slices for the OHIF VR mode
+  StudyCapability_Segmentation = (1 << 3),            // SEG or RTSTRUCT series
+  StudyCapability_Wsi = (1 << 4),                     // whole slide images (SM)
+  StudyCapability_SegmentationCompatible = (1 << 5)   // a series that can be segmented in the OHIF segmentation mode
+};
+
+
+class StudyCapabilitiesIndex : public IPersistentIndex
+{
+public:
+  struct SeriesSummary
+  {
+    std::string  modality_;
+    size_t       instancesCount_;
+  };
+
+private:
+  boost::mutex                                    mutex_;
+  boost::unordered_map<std::string, uint32_t>     capabilities_;  // Orthanc study id -> StudyCapability flags
+  int64_t                                         lastSequence_;
+  bool                                            isRebuilding_;
+  std::vector<ChangesPipeline::Change>            changesDuringRebuild_;
+
+  void AnalyseStudy(const std::string& studyId);
+
+public:
+  StudyCapabilitiesIndex();
+
+  static uint32_t ComputeCapabilities(const std::vector<SeriesSummary>& series);
+
+  // returns false if the study has not been analysed yet
+  bool LookupCapabilities(uint32_t& capabilities,
+                          const std::string& studyId);
+
+  virtual const char* GetName() const
+  {
+    return "study-capabilities";
+  }
+
+  virtual uint32_t GetFormatVersion() const
+  {
+    return 1;
+  }
+
+  virtual OrthancPluginResourceType GetResourceType() const
+  {
+    return OrthancPluginResourceType_Study;
+  }
+
+  virtual void LoadSnapshot(const IndexSnapshot::Reader& reader);
+
+  virtual void ListResources(std::vector<std::string>& target);
+
+  virtual IndexSnapshot::Writer* CreateSnapshot();
+
+  virtual void Rebuild();
+
+  virtual void HandleChanges(const std::vector<ChangesPipeline::Change>& changes);
+
+  virtual int64_t GetLastProcessedSequence();
+};
@@ -0,0 +1,575 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "StudyDateIndex.h"
+
+#include "ChangesTracker.h"
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <OrthancException.h>
+
+#include <boost/date_time/gregorian/gregorian.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+
+
+namespace
+{
+  enum SectionId
+  {
+    SectionId_StudiesIds = 1,
+    SectionId_StudiesDays = 2
+  };
+
+  static const unsigned int STUDIES_PAGE_SIZE = 1000;
+
+  static const unsigned short FIRST_YEAR = 1800;
+  static const unsigned short LAST_YEAR = 2199;
+  static const uint32_t MAX_DAY = 146096;  // 2199-12-31 (400 years are exactly 146097 days)
+
+
+  static void AddSlot(std::vector<uint32_t>& bucket,
+                      uint32_t slot)
+  {
+    std::vector<uint32_t>::iterator position = std::lower_bound(bucket.begin(), bucket.end(), slot);
+    if (position == bucket.end() || *position != slot)
+    {
+      bucket.insert(position, slot);
+    }
+  }
+
+
+  static void RemoveSlot(std::vector<uint32_t>& bucket,
+                         uint32_t slot)
+  {
+    std::vector<uint32_t>::iterator position = std::lower_bound(bucket.begin(), bucket.end(), slot);
+    if (position != bucket.end() && *position == slot)
+    {
+      bucket.erase(position);
+    }
+  }
+}
+
+
+StudyDateIndex::StudyDateIndex() :
+  deletedCount_(0),
+  firstDay_(0),
+  lastSequence_(-1),
+  isRebuilding_(false)
+{
+}
+
+
+bool StudyDateIndex::ParseDate(uint32_t& day,
+                               const std::string& date)
+{
+  if (date.size() != 8)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < date.size(); i++)
+  {
+    if (!isdigit(static_cast<unsigned char>(date[i])))
+    {
+      return false;
+    }
+  }
+
+  const unsigned short year = boost::lexical_cast<unsigned short>(date.substr(0, 4));
+  if (year < FIRST_YEAR || year > LAST_YEAR)
+  {
+    return false;
+  }
+
+  try
+  {
+    boost::gregorian::date value = boost::gregorian::from_undelimited_string(date);
+    day = static_cast<uint32_t>(value.day_number() - boost::gregorian::date(FIRST_YEAR, 1, 1).day_number());
+    return true;
+  }
+  catch (std::exception&)
+  {
+    return false;  // e.g. "20240231"
+  }
+}
+
+
+bool StudyDateIndex::ParseDateRange(uint32_t& firstDay,
+                                    uint32_t& lastDay,
+                                    const std::string& constraint)
+{
+  const size_t dash = constraint.find('-');
+
+  if (dash == std::string::npos)
+  {
+    if (ParseDate(firstDay, constraint))
+    {
+      lastDay = firstDay;
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  const std::string from = constraint.substr(0, dash);
+  const std::string to = constraint.substr(dash + 1);
+
+  // the open ranges also match the studies that are not indexed (e.g. an empty StudyDate matches "-20240131")
+  return (ParseDate(firstDay, from) &&
+          ParseDate(lastDay, to));
+}
+
+
+std::vector<uint32_t>& StudyDateIndex::GetBucket(uint32_t day)
+{
+  if (buckets_.empty())
+  {
+    firstDay_ = day;
+    buckets_.resize(1);
+  }
+  else if (day < firstDay_)
+  {
+    buckets_.insert(buckets_.begin(), firstDay_ - day, std::vector<uint32_t>());
+    firstDay_ = day;
+  }
+  else if (day - firstDay_ >= buckets_.size())
+  {
+    buckets_.resize(day - firstDay_ + 1);
+  }
+
+  return buckets_[day - firstDay_];
+}
+
+
+void StudyDateIndex::SetStudy(const std::string& orthancId,
+                              uint32_t day)
+{
+  std::map<std::string, uint32_t>::const_iterator found = slots_.find(orthancId);
+
+  if (found != slots_.end())
+  {
+    Study& study = studies_[found->second];
+
+    if (study.day_ != day)  // the StudyDate has been modified
+    {
+      RemoveSlot(GetBucket(study.day_), found->second);
+      study.day_ = day;
+      AddSlot(GetBucket(day), found->second);
+    }
+  }
+  else
+  {
+    const uint32_t slot = static_cast<uint32_t>(studies_.size());
+
+    Study study;
+    study.orthancId_ = orthancId;
+    study.day_ = day;
+    study.isDeleted_ = false;
+
+    studies_.push_back(study);
+    slots_[orthancId] = slot;
+    AddSlot(GetBucket(day), slot);
+  }
+}
+
+
+void StudyDateIndex::RemoveStudy(const std::string& orthancId)
+{
+  std::map<std::string, uint32_t>::iterator found = slots_.find(orthancId);
+
+  if (found != slots_.end())
+  {
+    Study& study = studies_[found->second];
+    RemoveSlot(GetBucket(study.day_), found->second);
+    study.isDeleted_ = true;
+    study.orthancId_.clear();
+    slots_.erase(found);
+    deletedCount_++;
+  }
+}
+
+
+void StudyDateIndex::CompactIfNeeded()
+{
+  if (deletedCount_ < 1000 ||
+      deletedCount_ < studies_.size() / 2)
+  {
+    return;
+  }
+
+  std::vector<Study> studies;
+  studies.swap(studies_);
+
+  Clear();
+
+  for (size_t i = 0; i < studies.size(); i++)
+  {
+    if (!studies[i].isDeleted_)
+    {
+      SetStudy(studies[i].orthancId_, studies[i].day_);
+    }
+  }
+}
+
+
+void StudyDateIndex::Clear()
+{
+  studies_.clear();
+  slots_.clear();
+  deletedCount_ = 0;
+  firstDay_ = 0;
+  buckets_.clear();
+}
+
+
+void StudyDateIndex::UpdateStudy(const std::string& orthancId)
+{
+  Json::Value study;
+  if (OrthancPlugins::RestApiGet(study, "/studies/" + orthancId, false))
+  {
+    uint32_t day;
+    const bool isDated = ParseDate(day, study["MainDicomTags"]["StudyDate"].asString());
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (isDated)
+    {
+      SetStudy(orthancId, day);
+    }
+    else
+    {
+      RemoveStudy(orthancId);  // the StudyDate may have been cleared by a modification
+    }
+  }
+  // else, the study has already been deleted
+}
+
+
+bool StudyDateIndex::FindStudies(std::vector<std::string>& target,
+                                 uint32_t firstDay,
+                                 uint32_t lastDay,
+                                 const std::set<std::string>* restriction,
+                                 size_t maxStudies)
+{
+  target.clear();
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (lastSequence_ < 0)
+  {
+    return false;
+  }
+
+  if (buckets_.empty())
+  {
+    return true;
+  }
+
+  const uint32_t lastBucketDay = firstDay_ + static_cast<uint32_t>(buckets_.size()) - 1;
+
+  firstDay = std::max(firstDay, firstDay_);
+  lastDay = std::min(lastDay, lastBucketDay);
+
+  if (firstDay > lastDay)
+  {
+    return true;
+  }
+
+  size_t rangeCount = 0;
+  for (uint32_t day = firstDay; day <= lastDay; day++)
+  {
+    rangeCount += buckets_[day - firstDay_].size();
+  }
+
+  if (restriction != NULL &&
+      restriction->size() < rangeCount)
+  {
+    // the other index is more selective: look up the day of each of its studies
+    std::vector<uint32_t> selected;
+
+    for (std::set<std::string>::const_iterator it = restriction->begin(); it != restriction->end(); ++it)
+    {
+      std::map<std::string, uint32_t>::const_iterator found = slots_.find(*it);
+      if (found != slots_.end())
+      {
+        const uint32_t day = studies_[found->second].day_;
+        if (day >= firstDay && day <= lastDay)
+        {
+          selected.push_back(found->second);
+        }
+      }
+    }
+
+    std::sort(selected.begin(), selected.end());
+
+    for (size_t i = 0; i < selected.size() && target.size() <= maxStudies; i++)
+    {
+      target.push_back(studies_[selected[i]].orthancId_);
+    }
+  }
+  else
+  {
+    std::vector<uint32_t> selected;
+
+    for (uint32_t day = firstDay; day <= lastDay; day++)
+    {
+      const std::vector<uint32_t>& bucket = buckets_[day - firstDay_];
+
+      for (size_t i = 0; i < bucket.size(); i++)
+      {
+        if (restriction == NULL ||
+            restriction->find(studies_[bucket[i]].orthancId_) != restriction->end())
+        {
+          selected.push_back(bucket[i]);
+
+          if (selected.size() > maxStudies)
+          {
+            break;  // too broad, the order does not matter anymore
+          }
+        }
+      }
+
+      if (selected.size() > maxStudies)
+      {
+        break;
+      }
+    }
+
+    std::sort(selected.begin(), selected.end());
+
+    for (size_t i = 0; i < selected.size(); i++)
+    {
+      target.push_back(studies_[selected[i]].orthancId_);
+    }
+  }
+
+  return true;
+}
+
+
+void StudyDateIndex::LoadSnapshot(const IndexSnapshot::Reader& reader)
+{
+  const IndexSnapshot::StringsView studiesIds = reader.GetStrings(SectionId_StudiesIds);
+  const IndexSnapshot::UInt32ArrayView studiesDays = reader.GetUInt32Array(SectionId_StudiesDays);
+
+  if (studiesDays.GetCount() != studiesIds.GetCount())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Inconsistent study dates snapshot");
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Clear();
+  studies_.reserve(studiesIds.GetCount());
+
+  for (uint64_t i = 0; i < studiesIds.GetCount(); i++)
+  {
+    if (studiesDays[i] > MAX_DAY)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Inconsistent study dates snapshot");
+    }
+
+    SetStudy(studiesIds.GetString(i), studiesDays[i]);
+  }
+
+  lastSequence_ = reader.GetChangeSequence();
+}
+
+
+void StudyDateIndex::ListResources(std::vector<std::string>& target)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  target.clear();
+  target.reserve(slots_.size());
+
+  for (std::map<std::string, uint32_t>::const_iterator it = slots_.begin(); it != slots_.end(); ++it)
+  {
+    target.push_back(it->first);
+  }
+}
+
+
+IndexSnapshot::Writer* StudyDateIndex::CreateSnapshot()
+{
+  std::vector<std::string> studiesIds;
+  std::vector<uint32_t> studiesDays;
+  int64_t sequence;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    sequence = lastSequence_;
+    studiesIds.reserve(studies_.size() - deletedCount_);
+    studiesDays.reserve(studies_.size() - deletedCount_);
+
+    for (size_t i = 0; i < studies_.size(); i++)
+    {
+      if (!studies_[i].isDeleted_)
+      {
+        studiesIds.push_back(studies_[i].orthancId_);
+        studiesDays.push_back(studies_[i].day_);
+      }
+    }
+  }
+
+  std::unique_ptr<IndexSnapshot::Writer> writer(new IndexSnapshot::Writer(GetName(), GetFormatVersion(), sequence));
+  writer->AddStrings(SectionId_StudiesIds, studiesIds);
+  writer->AddUInt32Array(SectionId_StudiesDays, studiesDays);
+  return writer.release();
+}
+
+
+void StudyDateIndex::Rebuild()
+{
+  // the changes that occur while scanning are applied once the scan is complete
+  const int64_t sequence = ChangesTracker::GetLastChange();
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    isRebuilding_ = true;
+    changesDuringRebuild_.clear();
+  }
+
+  std::vector<std::pair<std::string, uint32_t> > studies;
+
+  for (unsigned int since = 0; ; since += STUDIES_PAGE_SIZE)
+  {
+    Json::Value page;
+    if (!OrthancPlugins::RestApiGet(page, "/studies?expand&since=" + boost::lexical_cast<std::string>(since) +
+                                    "&limit=" + boost::lexical_cast<std::string>(STUDIES_PAGE_SIZE), false))
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      isRebuilding_ = false;
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to list the studies");
+    }
+
+    for (Json::Value::ArrayIndex i = 0; i < page.size(); i++)
+    {
+      uint32_t day;
+      if (ParseDate(day, page[i]["MainDicomTags"]["StudyDate"].asString()))
+      {
+        studies.push_back(std::make_pair(page[i]["ID"].asString(), day));
+      }
+    }
+
+    if (page.size() < STUDIES_PAGE_SIZE)
+    {
+      break;
+    }
+  }
+
+  std::vector<ChangesPipeline::Change> pendingChanges;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Clear();
+    studies_.reserve(studies.size());
+
+    for (size_t i = 0; i < studies.size(); i++)
+    {
+      SetStudy(studies[i].first, studies[i].second);
+    }
+
+    lastSequence_ = sequence;
+    MarkModified();
+    isRebuilding_ = false;
+    pendingChanges.swap(changesDuringRebuild_);
+  }
+
+  HandleChanges(pendingChanges);
+}
+
+
+void StudyDateIndex::HandleChanges(const std::vector<ChangesPipeline::Change>& changes)
+{
+  for (size_t i = 0; i < changes.size(); i++)
+  {
+    const ChangesPipeline::Change& change = changes[i];
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (isRebuilding_)
+      {
+        changesDuringRebuild_.push_back(change);
+        continue;
+      }
+
+      if (lastSequence_ < 0)
+      {
+        continue;  // not built yet, the changes will be taken into account by the rebuild
+      }
+
+      if (change.sequence_ >= 0 &&
+          change.sequence_ <= lastSequence_)
+      {
+        continue;  // already processed (replayed after a restart)
+      }
+    }
+
+    if (change.resourceType_ == OrthancPluginResourceType_Study)
+    {
+      switch (change.changeType_)
+      {
+        case OrthancPluginChangeType_NewStudy:
+        case OrthancPluginChangeType_StableStudy:  // the StudyDate may have been modified
+          UpdateStudy(change.resourceId_);
+          break;
+
+        case OrthancPluginChangeType_Deleted:
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          RemoveStudy(change.resourceId_);
+          CompactIfNeeded();
+          MarkModified();
+          break;
+        }
+
+        default:
+          break;
+      }
+    }
+
+    if (change.sequence_ >= 0)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      lastSequence_ = std::max(lastSequence_, change.sequence_);
+      MarkModified();
+    }
+  }
+}
+
+
+int64_t StudyDateIndex::GetLastProcessedSequence()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return lastSequence_;
+}
@@ -0,0 +1,125 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "PersistentIndexes.h"
+
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+
+// An in-memory index of the studies partitioned by StudyDate: one bucket per day with the sorted slots of the
+// studies of this day.  The buckets are stored contiguously from the oldest to the most recent day, so that a
+// StudyDate range is a contiguous walk over the buckets and a single day (e.g. "today") is a direct access,
+// whatever the age of the archive.  The studies without a valid StudyDate (between 1800 and 2199) are not indexed.
+class StudyDateIndex : public IPersistentIndex
+{
+private:
+  struct Study
+  {
+    std::string  orthancId_;
+    uint32_t     day_;
+    bool         isDeleted_;
+  };
+
+  boost::mutex                         mutex_;
+  std::vector<Study>                   studies_;
+  std::map<std::string, uint32_t>      slots_;  // Orthanc id -> index in 'studies_'
+  size_t                               deletedCount_;
+  uint32_t                             firstDay_;
+  std::vector<std::vector<uint32_t> >  buckets_;  // buckets_[i] contains the slots of the day 'firstDay_ + i'
+  int64_t                              lastSequence_;
+  bool                                 isRebuilding_;
+  std::vector<ChangesPipeline::Change>  changesDuringRebuild_;
+
+  std::vector<uint32_t>& GetBucket(uint32_t day);
+
+  // must be called with the mutex locked
+  void SetStudy(const std::string& orthancId,
+                uint32_t day);
+
+  void RemoveStudy(const std::string& orthancId);
+
+  void CompactIfNeeded();
+
+  void Clear();
+
+  void UpdateStudy(const std::string& orthancId);
+
+public:
+  StudyDateIndex();
+
+  // "YYYYMMDD" -> the number of days since 1800-01-01.  Returns false if this is not a date between 1800 and 2199.
+  static bool ParseDate(uint32_t& day,
+                        const std::string& date);
+
+  // A StudyDate constraint of 'tools/find' with a single day or a closed range ("20240101-20240131").  Returns
+  // false for the syntaxes that are not handled by the index: '\' separated values, and the open ranges
+  // ("-20240131", "20240101-") since Orthanc also matches them against the studies that are not indexed.
+  static bool ParseDateRange(uint32_t& firstDay,
+                             uint32_t& lastDay,
+                             const std::string& constraint);
+
+  // The studies between 'firstDay' and 'lastDay' (included), in the order in which they have been indexed, which
+  // is the order of the Orthanc database (i.e. the order of the answers of 'tools/find').  If 'restriction' is
+  // not NULL, only the studies that it contains are selected (e.g. the result of the series content index).
+  // At most 'maxStudies + 1' studies are returned to let the caller detect the too broad ranges.
+  // Returns false if the index has not been built yet.
+  bool FindStudies(std::vector<std::string>& target,
+                   uint32_t firstDay,
+                   uint32_t lastDay,
+                   const std::set<std::string>* restriction,
+                   size_t maxStudies);
+
+  virtual const char* GetName() const
+  {
+    return "study-dates";
+  }
+
+  virtual uint32_t GetFormatVersion() const
+  {
+    return 1;
+  }
+
+  virtual OrthancPluginResourceType GetResourceType() const
+  {
+    return OrthancPluginResourceType_Study;
+  }
+
+  virtual void LoadSnapshot(const IndexSnapshot::Reader& reader);
+
+  virtual void ListResources(std::vector<std::string>& target);
+
+  virtual IndexSnapshot::Writer* CreateSnapshot();
+
+  virtual void Rebuild();
+
+  virtual void HandleChanges(const std::vector<ChangesPipeline::Change>& changes);
+
+  virtual int64_t GetLastProcessedSequence();
+};
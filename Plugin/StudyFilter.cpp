@@ -0,0 +1,263 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "StudyFilter.h"
+
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <cctype>
+
+
+
+
+static bool IsDateTag(const std::string& tag)
+{
+  return (tag == "StudyDate" ||
+          tag == "PatientBirthDate" ||
+          tag == "SeriesDate");
+}
+
+
+static bool CharEquals(char a, char b, bool isCaseSensitive)
+{
+  if (isCaseSensitive)
+  {
+    return a == b;
+  }
+  else
+  {
+    return toupper(static_cast<unsigned char>(a)) == toupper(static_cast<unsigned char>(b));
+  }
+}
+
+
+bool StudyFilter::IsCaseSensitiveTag(const std::string& tag)
+{
+  // like in Orthanc, only the values of the PN tags are compared case-insensitively (as long as "CaseSensitivePN"
+  // is false).  These are the PN tags among the patient, study and series main DICOM tags.
+  return !(tag == "PatientName" ||
+           tag == "ReferringPhysicianName" ||
+           tag == "RequestingPhysician" ||
+           tag == "PerformingPhysicianName" ||
+           tag == "NameOfPhysiciansReadingStudy" ||
+           tag == "OperatorsName");
+}
+
+
+bool StudyFilter::WildcardMatch(const std::string& value,
+                                const std::string& pattern,
+                                bool isCaseSensitive)
+{
+  // iterative matching with a single backtracking point (the last '*')
+  size_t v = 0, p = 0;
+  size_t starPosition = std::string::npos;
+  size_t starMatch = 0;
+
+  while (v < value.size())
+  {
+    if (p < pattern.size() && (pattern[p] == '?' || CharEquals(pattern[p], value[v], isCaseSensitive)))
+    {
+      v++;
+      p++;
+    }
+    else if (p < pattern.size() && pattern[p] == '*')
+    {
+      starPosition = p++;
+      starMatch = v;
+    }
+    else if (starPosition != std::string::npos)
+    {
+      p = starPosition + 1;
+      v = ++starMatch;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  while (p < pattern.size() && pattern[p] == '*')
+  {
+    p++;
+  }
+
+  return p == pattern.size();
+}
+
+
+StudyFilter::LabelsConstraint StudyFilter::StringToLabelsConstraint(const std::string& value)
+{
+  if (value == "All")
+  {
+    return LabelsConstraint_All;
+  }
+  else if (value == "Any")
+  {
+    return LabelsConstraint_Any;
+  }
+  else if (value == "None")
+  {
+    return LabelsConstraint_None;
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Invalid labels constraint: " + value);
+  }
+}
+
+
+void StudyFilter::AddConstraint(const std::string& tag,
+                                const std::string& value)
+{
+  if (value.empty() || value == "*")
+  {
+    return;  // universal matching
+  }
+
+  Constraint constraint;
+  constraint.tag_ = tag;
+  constraint.isRange_ = IsDateTag(tag) && value.find('-') != std::string::npos;
+  constraint.isCaseSensitive_ = IsCaseSensitiveTag(tag);
+  Orthanc::Toolbox::TokenizeString(constraint.values_, value, '\\');
+
+  constraints_.push_back(constraint);
+}
+
+
+void StudyFilter::GetRequestedTags(std::set<std::string>& target) const
+{
+  for (size_t i = 0; i < constraints_.size(); i++)
+  {
+    if (constraints_[i].tag_ == "ModalitiesInStudy")
+    {
+      target.insert(constraints_[i].tag_);
+    }
+  }
+}
+
+
+bool StudyFilter::LookupStudyValue(std::string& target,
+                                   const Json::Value& study,
+                                   const std::string& tag)
+{
+  static const char* SECTIONS[] = { "MainDicomTags", "PatientMainDicomTags", "RequestedTags", NULL };
+
+  for (size_t i = 0; SECTIONS[i] != NULL; i++)
+  {
+    if (study.isMember(SECTIONS[i]) &&
+        study[SECTIONS[i]].isMember(tag) &&
+        study[SECTIONS[i]][tag].isString())
+    {
+      target = study[SECTIONS[i]][tag].asString();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+bool StudyFilter::MatchConstraint(const Constraint& constraint,
+                                  const std::string& value)
+{
+  std::vector<std::string> studyValues;  // e.g. ModalitiesInStudy = "CT\PT"
+  Orthanc::Toolbox::TokenizeString(studyValues, value, '\\');
+
+  for (size_t i = 0; i < constraint.values_.size(); i++)
+  {
+    const std::string& expected = constraint.values_[i];
+
+    for (size_t j = 0; j < studyValues.size(); j++)
+    {
+      const std::string& actual = studyValues[j];
+
+      if (constraint.isRange_)
+      {
+        size_t dash = expected.find('-');
+        std::string from = expected.substr(0, dash);
+        std::string to = expected.substr(dash + 1);
+
+        // DICOM dates (YYYYMMDD) can be compared as strings
+        if (!actual.empty() &&
+            (from.empty() || actual >= from) &&
+            (to.empty() || actual <= to))
+        {
+          return true;
+        }
+      }
+      else if (WildcardMatch(actual, expected, constraint.isCaseSensitive_))
+      {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+
+bool StudyFilter::Match(const Json::Value& study) const
+{
+  for (size_t i = 0; i < constraints_.size(); i++)
+  {
+    std::string value;
+    if (!LookupStudyValue(value, study, constraints_[i].tag_) ||
+        !MatchConstraint(constraints_[i], value))
+    {
+      return false;
+    }
+  }
+
+  if (!labels_.empty())
+  {
+    size_t count = 0;
+
+    if (study.isMember("Labels") && study["Labels"].isArray())
+    {
+      for (Json::Value::ArrayIndex i = 0; i < study["Labels"].size(); i++)
+      {
+        if (labels_.find(study["Labels"][i].asString()) != labels_.end())
+        {
+          count++;
+        }
+      }
+    }
+
+    switch (labelsConstraint_)
+    {
+      case LabelsConstraint_All:
+        return count == labels_.size();
+
+      case LabelsConstraint_Any:
+        return count > 0;
+
+      case LabelsConstraint_None:
+        return count == 0;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,102 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <json/value.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+
+// Evaluates, in the plugin, the same constraints as a study level 'tools/find' on a
+// single study (as returned by '/studies/{id}?requestedTags=...' or by an expanded 'tools/find').
+class StudyFilter
+{
+public:
+  enum LabelsConstraint
+  {
+    LabelsConstraint_All,
+    LabelsConstraint_Any,
+    LabelsConstraint_None
+  };
+
+private:
+  struct Constraint
+  {
+    std::string               tag_;
+    std::vector<std::string>  values_;  // the study matches if it matches any of these values
+    bool                      isRange_;
+    bool                      isCaseSensitive_;
+  };
+
+  std::vector<Constraint>  constraints_;
+  std::set<std::string>    labels_;
+  LabelsConstraint         labelsConstraint_;
+
+  static bool LookupStudyValue(std::string& target,
+                               const Json::Value& study,
+                               const std::string& tag);
+
+  static bool MatchConstraint(const Constraint& constraint,
+                              const std::string& value);
+
+public:
+  StudyFilter() :
+    labelsConstraint_(LabelsConstraint_All)
+  {
+  }
+
+  // 'value' uses the same syntax as in 'tools/find' (wildcards, date ranges, '\' separated values)
+  void AddConstraint(const std::string& tag,
+                     const std::string& value);
+
+  void AddLabel(const std::string& label)
+  {
+    labels_.insert(label);
+  }
+
+  void SetLabelsConstraint(LabelsConstraint constraint)
+  {
+    labelsConstraint_ = constraint;
+  }
+
+  bool IsEmpty() const
+  {
+    return constraints_.empty() && labels_.empty();
+  }
+
+  // the tags that must be requested from Orthanc to evaluate the filter (e.g. ModalitiesInStudy)
+  void GetRequestedTags(std::set<std::string>& target) const;
+
+  bool Match(const Json::Value& study) const;
+
+  // the values of the PN tags are compared case-insensitively, like in Orthanc
+  static bool IsCaseSensitiveTag(const std::string& tag);
+
+  static bool WildcardMatch(const std::string& value,
+                            const std::string& pattern,
+                            bool isCaseSensitive);
+
+  static LabelsConstraint StringToLabelsConstraint(const std::string& value);
+};
@@ -0,0 +1,383 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#include "TaskExecutor.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <memory>
+
+
+static const unsigned int IDLE_WAKE_UP_PERIOD_MS = 500;
+static const unsigned int MIN_THREADS_COUNT = 2;
+
+
+TaskExecutor::TaskExecutor() :
+  runningNonInteractiveTasks_(0),
+  maxNonInteractiveTasks_(MIN_THREADS_COUNT - 1),
+  nextWorker_(0),
+  pendingTasks_(0),
+  stopped_(true),
+  wakeUps_(0),
+  threadsCount_(MIN_THREADS_COUNT)
+{
+  for (size_t i = 0; i < PRIORITIES_COUNT; i++)
+  {
+    runningTasks_[i] = 0;
+  }
+
+  maxRunningTasks_[Priority_Interactive] = 1;
+  maxRunningTasks_[Priority_Background] = 1;
+  maxRunningTasks_[Priority_Maintenance] = 1;
+}
+
+
+TaskExecutor::~TaskExecutor()
+{
+  Stop();
+}
+
+
+void TaskExecutor::Configure(const Json::Value& configuration)
+{
+  if (!threads_.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+  }
+
+  unsigned int cores = std::max(1u, boost::thread::hardware_concurrency());
+  unsigned int cpuPercentage = 25;
+  unsigned int maxBackgroundThreads = 0;
+  unsigned int maxMaintenanceThreads = 1;
+
+  if (configuration.isObject())
+  {
+    if (configuration.isMember("MaxCpuPercentage"))
+    {
+      cpuPercentage = std::min(100u, configuration["MaxCpuPercentage"].asUInt());
+    }
+
+    if (configuration.isMember("MaxBackgroundThreads"))
+    {
+      maxBackgroundThreads = configuration["MaxBackgroundThreads"].asUInt();
+    }
+
+    if (configuration.isMember("MaxMaintenanceThreads"))
+    {
+      maxMaintenanceThreads = configuration["MaxMaintenanceThreads"].asUInt();
+    }
+  }
+
+  threadsCount_ = std::max(MIN_THREADS_COUNT, cores * cpuPercentage / 100);
+
+  // always keep one thread available for the interactive tasks
+  maxNonInteractiveTasks_ = threadsCount_ - 1;
+
+  maxRunningTasks_[Priority_Interactive] = threadsCount_;
+  maxRunningTasks_[Priority_Background] = (maxBackgroundThreads == 0 ? maxNonInteractiveTasks_ : std::min(maxBackgroundThreads, maxNonInteractiveTasks_));
+  maxRunningTasks_[Priority_Maintenance] = (maxMaintenanceThreads == 0 ? maxNonInteractiveTasks_ : std::min(maxMaintenanceThreads, maxNonInteractiveTasks_));
+
+  LOG(WARNING) << "Orthanc Explorer 2: using " << threadsCount_ << " threads for the background tasks";
+}
+
+
+void TaskExecutor::Start()
+{
+  if (threads_.empty())
+  {
+    {
+      boost::mutex::scoped_lock lock(workersMutex_);
+
+      for (size_t i = 0; i < threadsCount_; i++)
+      {
+        workers_.push_back(new Worker);
+      }
+
+      stopped_ = false;
+    }
+
+    for (size_t i = 0; i < threadsCount_; i++)
+    {
+      threads_.push_back(new boost::thread(&TaskExecutor::WorkerThread, this, i));
+    }
+  }
+}
+
+
+void TaskExecutor::Stop()
+{
+  if (!threads_.empty())
+  {
+    {
+      // no task can be pushed once this lock is released
+      boost::mutex::scoped_lock lock(workersMutex_);
+      stopped_ = true;
+    }
+
+    {
+      boost::mutex::scoped_lock lock(idleMutex_);
+      wakeUps_++;
+      taskAvailable_.notify_all();
+    }
+
+    for (size_t i = 0; i < threads_.size(); i++)
+    {
+      if (threads_[i]->joinable())
+      {
+        threads_[i]->join();
+      }
+
+      delete threads_[i];
+    }
+
+    threads_.clear();
+
+    boost::mutex::scoped_lock lock(workersMutex_);
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      for (size_t j = 0; j < PRIORITIES_COUNT; j++)
+      {
+        for (size_t k = 0; k < workers_[i]->lanes_[j].size(); k++)
+        {
+          delete workers_[i]->lanes_[j][k];
+        }
+      }
+
+      delete workers_[i];
+    }
+
+    workers_.clear();
+    pendingTasks_ = 0;
+  }
+}
+
+
+void TaskExecutor::Submit(ITask* task,
+                          Priority priority)
+{
+  std::unique_ptr<ITask> protection(task);
+
+  if (task == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+  }
+
+  boost::mutex::scoped_lock lock(workersMutex_);
+
+  if (stopped_ || workers_.empty())
+  {
+    return;  // the plugin is being stopped, the task is discarded
+  }
+
+  // a task submitted from a worker goes to the deque of this worker (better cache locality), the other
+  // tasks are spread over all the workers and balanced by work stealing
+  size_t index;
+  if (currentWorkerIndex_.get() != NULL)
+  {
+    index = *currentWorkerIndex_;
+  }
+  else
+  {
+    index = nextWorker_++ % workers_.size();
+  }
+
+  {
+    boost::mutex::scoped_lock workerLock(workers_[index]->mutex_);
+    workers_[index]->lanes_[priority].push_back(protection.release());
+  }
+
+  pendingTasks_++;
+  lock.unlock();
+
+  WakeUp();
+}
+
+
+void TaskExecutor::WakeUp()
+{
+  // the counter is modified under the mutex so that a worker that is about to sleep can not miss the notification
+  boost::mutex::scoped_lock lock(idleMutex_);
+  wakeUps_++;
+  taskAvailable_.notify_one();
+}
+
+
+static bool TryIncrement(std::atomic<unsigned int>& counter,
+                         unsigned int maximum)
+{
+  unsigned int value = counter.load();
+
+  while (value < maximum)
+  {
+    if (counter.compare_exchange_weak(value, value + 1))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+bool TaskExecutor::TryAcquireQuota(Priority priority)
+{
+  if (!TryIncrement(runningTasks_[priority], maxRunningTasks_[priority]))
+  {
+    return false;
+  }
+
+  if (priority != Priority_Interactive &&
+      !TryIncrement(runningNonInteractiveTasks_, maxNonInteractiveTasks_))
+  {
+    runningTasks_[priority]--;
+    return false;
+  }
+
+  return true;
+}
+
+
+void TaskExecutor::ReleaseQuota(Priority priority)
+{
+  if (priority != Priority_Interactive)
+  {
+    runningNonInteractiveTasks_--;
+  }
+
+  runningTasks_[priority]--;
+}
+
+
+TaskExecutor::ITask* TaskExecutor::PopOwnTask(size_t workerIndex,
+                                              Priority& priority)
+{
+  Worker& worker = *workers_[workerIndex];
+  boost::mutex::scoped_lock lock(worker.mutex_);
+
+  for (size_t i = 0; i < PRIORITIES_COUNT; i++)
+  {
+    if (!worker.lanes_[i].empty() &&
+        TryAcquireQuota(static_cast<Priority>(i)))
+    {
+      // LIFO: the most recent task is the most likely to have its data in the CPU caches
+      ITask* task = worker.lanes_[i].back();
+      worker.lanes_[i].pop_back();
+      priority = static_cast<Priority>(i);
+      return task;
+    }
+  }
+
+  return NULL;
+}
+
+
+TaskExecutor::ITask* TaskExecutor::StealTask(size_t workerIndex,
+                                             Priority& priority)
+{
+  // the lanes are scanned by priority first, so that an interactive task is never left
+  // in a busy worker while an idle worker executes a maintenance task
+  for (size_t i = 0; i < PRIORITIES_COUNT; i++)
+  {
+    for (size_t j = 1; j < workers_.size(); j++)
+    {
+      Worker& victim = *workers_[(workerIndex + j) % workers_.size()];
+      boost::mutex::scoped_lock lock(victim.mutex_);
+
+      if (!victim.lanes_[i].empty() &&
+          TryAcquireQuota(static_cast<Priority>(i)))
+      {
+        // FIFO: steal the oldest task, the owner keeps working on the most recent ones
+        ITask* task = victim.lanes_[i].front();
+        victim.lanes_[i].pop_front();
+        priority = static_cast<Priority>(i);
+        return task;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+
+void TaskExecutor::WorkerThread(size_t workerIndex)
+{
+  currentWorkerIndex_.reset(new size_t(workerIndex));
+
+  while (!stopped_)
+  {
+    uint64_t wakeUps;
+
+    {
+      boost::mutex::scoped_lock lock(idleMutex_);
+      wakeUps = wakeUps_;
+    }
+
+    Priority priority = Priority_Interactive;
+    ITask* task = PopOwnTask(workerIndex, priority);
+
+    if (task == NULL)
+    {
+      task = StealTask(workerIndex, priority);
+    }
+
+    if (task == NULL)
+    {
+      // no task or quota reached for all the pending tasks: sleep unless a task has been submitted or
+      // a quota has been released since the deques have been scanned
+      boost::mutex::scoped_lock lock(idleMutex_);
+      if (wakeUps_ == wakeUps && !stopped_)
+      {
+        taskAvailable_.timed_wait(lock, boost::posix_time::milliseconds(IDLE_WAKE_UP_PERIOD_MS));
+      }
+      continue;
+    }
+
+    pendingTasks_--;
+
+    std::unique_ptr<ITask> protection(task);
+
+    try
+    {
+      task->Execute();
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Orthanc Explorer 2: error in a background task: " << e.What();
+    }
+    catch (std::exception& e)
+    {
+      LOG(ERROR) << "Orthanc Explorer 2: error in a background task: " << e.what();
+    }
+
+    ReleaseQuota(priority);
+
+    if (pendingTasks_ > 0)
+    {
+      WakeUp();  // a task might have been waiting for the quota that has just been released
+    }
+  }
+
+  currentWorkerIndex_.reset();
+}
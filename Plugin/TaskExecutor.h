@@ -0,0 +1,125 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+#pragma once
+
+#include <json/value.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+#include <atomic>
+#include <deque>
+#include <stdint.h>
+#include <vector>
+
+
+// The plugin-wide pool of threads for the OE2 background tasks.  Each worker owns a deque per priority lane:
+// a worker executes its own tasks in LIFO order and, when it has nothing left, steals the oldest tasks of the
+// other workers.  The number of threads is a share of the CPU cores and the lower priority lanes are limited to
+// a part of these threads so that they never delay the interactive tasks nor starve the Orthanc threads.
+// There are at least 2 threads and the background and maintenance tasks together never occupy all of them, so
+// that one thread remains available for the interactive tasks.
+class TaskExecutor : public boost::noncopyable
+{
+public:
+  enum Priority
+  {
+    Priority_Interactive = 0,   // a user is waiting for the result, e.g. warming the storage before opening a viewer
+    Priority_Background = 1,    // e.g. prefetching the priors
+    Priority_Maintenance = 2    // e.g. rebuilding or saving an index
+  };
+
+  class ITask : public boost::noncopyable
+  {
+  public:
+    virtual ~ITask()
+    {
+    }
+
+    virtual void Execute() = 0;
+  };
+
+private:
+  static const size_t PRIORITIES_COUNT = 3;
+
+  struct Worker : public boost::noncopyable
+  {
+    boost::mutex         mutex_;
+    std::deque<ITask*>   lanes_[PRIORITIES_COUNT];
+  };
+
+  boost::mutex                  workersMutex_;  // protects "workers_" and "stopped_" against Submit()
+  std::vector<Worker*>          workers_;
+  std::vector<boost::thread*>   threads_;
+  std::atomic<unsigned int>     runningTasks_[PRIORITIES_COUNT];
+  unsigned int                  maxRunningTasks_[PRIORITIES_COUNT];
+  std::atomic<unsigned int>     runningNonInteractiveTasks_;
+  unsigned int                  maxNonInteractiveTasks_;  // the background and maintenance tasks together
+  std::atomic<unsigned int>     nextWorker_;
+  std::atomic<unsigned int>     pendingTasks_;
+  std::atomic<bool>             stopped_;
+  boost::mutex                  idleMutex_;     // protects "wakeUps_"
+  boost::condition_variable     taskAvailable_;
+  uint64_t                      wakeUps_;       // incremented each time a task might have become executable
+
+  // the index of the current thread among the workers of this executor, used to push the subtasks in its deque
+  boost::thread_specific_ptr<size_t>  currentWorkerIndex_;
+
+  unsigned int                  threadsCount_;
+
+  bool TryAcquireQuota(Priority priority);
+
+  void ReleaseQuota(Priority priority);
+
+  void WakeUp();
+
+  ITask* PopOwnTask(size_t workerIndex,
+                    Priority& priority);
+
+  ITask* StealTask(size_t workerIndex,
+                   Priority& priority);
+
+  void WorkerThread(size_t workerIndex);
+
+public:
+  TaskExecutor();
+
+  ~TaskExecutor();
+
+  // to call before Start()
+  void Configure(const Json::Value& configuration);
+
+  void Start();
+
+  // the pending tasks are discarded and the running tasks are awaited
+  void Stop();
+
+  // takes the ownership of the task
+  void Submit(ITask* task,
+              Priority priority);
+
+  unsigned int GetThreadsCount() const
+  {
+    return threadsCount_;
+  }
+};
@@ -0,0 +1,130 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+// Compares the serialization of a large answer (such as the one of "/tools/find" with "Expand") by JsonWriter with
+// the ones of jsoncpp.  Usage: ./JsonWriterBench [studies count] [iterations count]
+
+#include "../Plugin/JsonWriter.h"
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <stdlib.h>
+
+
+static void CreateAnswer(Json::Value& target,
+                         unsigned int studiesCount)
+{
+  target = Json::arrayValue;
+
+  for (unsigned int i = 0; i < studiesCount; i++)
+  {
+    const std::string index = boost::lexical_cast<std::string>(i);
+
+    Json::Value study;
+    study["ID"] = "8a8cf898-ca27c490-d0c7058c-929d0581-" + index;
+    study["Type"] = "Study";
+    study["IsStable"] = true;
+    study["LastUpdate"] = "20240102T030405";
+    study["ParentPatient"] = "6816cb19-844d5aee-85245eba-28e841e6-" + index;
+    study["Labels"].append("label-" + index);
+    study["MainDicomTags"]["StudyDate"] = "20240102";
+    study["MainDicomTags"]["StudyDescription"] = "CT Chest \"with\" contrast \xc3\xa9";
+    study["MainDicomTags"]["StudyInstanceUID"] = "1.2.840.113619.2.55.3.604688119.969.1268071029.320." + index;
+    study["MainDicomTags"]["AccessionNumber"] = "A" + index;
+    study["PatientMainDicomTags"]["PatientName"] = "Doe^John";
+    study["PatientMainDicomTags"]["PatientID"] = "P" + index;
+    study["RequestedTags"]["NumberOfStudyRelatedInstances"] = i * 3;
+    study["RequestedTags"]["ModalitiesInStudy"] = "CT\\SR";
+
+    for (unsigned int j = 0; j < 4; j++)
+    {
+      study["Series"].append("5f8a1b0e-4c1d2e3f-" + index + "-" + boost::lexical_cast<std::string>(j));
+    }
+
+    target.append(study);
+  }
+}
+
+
+static size_t SerializeStyled(const Json::Value& answer)
+{
+  return answer.toStyledString().size();
+}
+
+
+static size_t SerializeFast(const Json::Value& answer)
+{
+  std::string s;
+  OrthancPlugins::WriteFastJson(s, answer);
+  return s.size();
+}
+
+
+static size_t SerializeJsonWriter(const Json::Value& answer)
+{
+  std::string s;
+  JsonWriter writer(s);
+  writer.WriteValue(answer);
+  return s.size();
+}
+
+
+static void Measure(const char* name,
+                    const Json::Value& answer,
+                    unsigned int iterationsCount,
+                    size_t (*serialize) (const Json::Value&))
+{
+  size_t size = 0;
+
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  for (unsigned int i = 0; i < iterationsCount; i++)
+  {
+    size = serialize(answer);
+  }
+
+  const boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+
+  std::cout << name << ": " << (static_cast<double>(elapsed.total_microseconds()) / 1000.0 / iterationsCount)
+            << " ms per answer (" << size << " bytes)" << std::endl;
+}
+
+
+int main(int argc, char **argv)
+{
+  const unsigned int studiesCount = (argc > 1 ? atoi(argv[1]) : 10000);
+  const unsigned int iterationsCount = (argc > 2 ? std::max(1, atoi(argv[2])) : 20);
+
+  Json::Value answer;
+  CreateAnswer(answer, studiesCount);
+
+  Measure("toStyledString", answer, iterationsCount, SerializeStyled);
+  Measure("WriteFastJson ", answer, iterationsCount, SerializeFast);
+  Measure("JsonWriter    ", answer, iterationsCount, SerializeJsonWriter);
+
+  return 0;
+}
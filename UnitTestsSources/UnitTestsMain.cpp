@@ -0,0 +1,1087 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2024 Osimis S.A., Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../Plugin/IndexSnapshot.h"
+#include "../Plugin/JsonScanner.h"
+#include "../Plugin/JsonWriter.h"
+#include "../Plugin/PatientNameIndex.h"
+#include "../Plugin/SearchAdmission.h"
+#include "../Plugin/SelectionsRegistry.h"
+#include "../Plugin/SeriesContentIndex.h"
+#include "../Plugin/StorageWarmer.h"
+#include "../Plugin/StudyDateIndex.h"
+#include "../Plugin/StudyFilter.h"
+#include "../Plugin/TaskExecutor.h"
+
+#if ORTHANC_OE2_ENABLE_JWT_VERIFIER == 1
+#  include "../Plugin/JwtVerifier.h"
+#endif
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <gtest/gtest.h>
+
+#include <limits>
+#include <memory>
+#include <string.h>
+
+
+namespace
+{
+  // a file that is removed at the end of the test
+  class TemporaryFile : public boost::noncopyable
+  {
+  private:
+    std::string  path_;
+
+  public:
+    TemporaryFile()
+    {
+      path_ = (boost::filesystem::temp_directory_path() /
+               boost::filesystem::unique_path("oe2-tests-%%%%-%%%%-%%%%")).string();
+    }
+
+    ~TemporaryFile()
+    {
+      boost::system::error_code error;
+      boost::filesystem::remove(path_, error);
+    }
+
+    const std::string& GetPath() const
+    {
+      return path_;
+    }
+  };
+}
+
+
+TEST(IndexSnapshot, RoundTrip)
+{
+  TemporaryFile file;
+
+  {
+    std::vector<std::string> strings;
+    strings.push_back("CT");
+    strings.push_back("");
+    strings.push_back("hello");
+
+    std::vector<uint32_t> values;
+    values.push_back(5);
+    values.push_back(0xffffffffu);
+
+    std::vector<std::vector<uint32_t> > lists(3);
+    lists[0].push_back(1);
+    lists[0].push_back(2);
+    lists[2].push_back(9);
+
+    std::vector<bool> bits(130, false);
+    bits[0] = true;
+    bits[64] = true;
+    bits[129] = true;
+
+    IndexSnapshot::Writer writer("test", 3, 42);
+    writer.AddStrings(1, strings);
+    writer.AddUInt32Array(2, values);
+    writer.AddPostingLists(3, lists);
+    writer.AddBitmap(4, bits);
+    ASSERT_THROW(writer.AddBitmap(4, bits), Orthanc::OrthancException);  // duplicate section
+    writer.WriteAtomically(file.GetPath());
+  }
+
+  IndexSnapshot::Reader reader(file.GetPath());
+  ASSERT_EQ("test", reader.GetIndexName());
+  ASSERT_EQ(3u, reader.GetIndexVersion());
+  ASSERT_EQ(42, reader.GetChangeSequence());
+
+  IndexSnapshot::StringsView strings = reader.GetStrings(1);
+  ASSERT_EQ(3u, strings.GetCount());
+  ASSERT_EQ("CT", strings.GetString(0));
+  ASSERT_EQ("", strings.GetString(1));
+  ASSERT_EQ("hello", strings.GetString(2));
+
+  IndexSnapshot::UInt32ArrayView values = reader.GetUInt32Array(2);
+  ASSERT_EQ(2u, values.GetCount());
+  ASSERT_EQ(5u, values[0]);
+  ASSERT_EQ(0xffffffffu, values[1]);
+
+  IndexSnapshot::PostingListsView lists = reader.GetPostingLists(3);
+  ASSERT_EQ(3u, lists.GetCount());
+  ASSERT_EQ(2u, lists.GetList(0).GetCount());
+  ASSERT_EQ(2u, lists.GetList(0)[1]);
+  ASSERT_EQ(0u, lists.GetList(1).GetCount());
+  ASSERT_EQ(9u, lists.GetList(2)[0]);
+
+  IndexSnapshot::BitmapView bits = reader.GetBitmap(4);
+  ASSERT_EQ(130u, bits.GetCount());
+  ASSERT_TRUE(bits.IsSet(0));
+  ASSERT_FALSE(bits.IsSet(1));
+  ASSERT_TRUE(bits.IsSet(64));
+  ASSERT_TRUE(bits.IsSet(129));
+
+  ASSERT_TRUE(reader.HasSection(4));
+  ASSERT_FALSE(reader.HasSection(5));
+  ASSERT_THROW(reader.GetBitmap(1), Orthanc::OrthancException);  // not a bitmap
+  ASSERT_THROW(reader.GetStrings(5), Orthanc::OrthancException);
+}
+
+
+TEST(IndexSnapshot, Corrupted)
+{
+  TemporaryFile file;
+
+  {
+    std::vector<std::string> strings;
+    strings.push_back("ab");
+    strings.push_back("cd");
+
+    IndexSnapshot::Writer writer("test", 1, 0);
+    writer.AddStrings(1, strings);
+    writer.WriteAtomically(file.GetPath());
+  }
+
+  std::string content;
+  Orthanc::SystemToolbox::ReadFile(content, file.GetPath());
+
+  {
+    std::string truncated = content.substr(0, content.size() - 8);
+    Orthanc::SystemToolbox::WriteFile(truncated, file.GetPath());
+    ASSERT_THROW(IndexSnapshot::Reader reader(file.GetPath()), Orthanc::OrthancException);
+  }
+
+  {
+    std::string badMagic = content;
+    badMagic[0] = 'X';
+    Orthanc::SystemToolbox::WriteFile(badMagic, file.GetPath());
+    ASSERT_THROW(IndexSnapshot::Reader reader(file.GetPath()), Orthanc::OrthancException);
+  }
+
+  {
+    // the single section is at the end of the file: 3 offsets, then "abcd" padded to 8 bytes
+    const size_t offsetsPosition = content.size() - 3 * sizeof(uint64_t) - 8;
+    uint64_t offsets[3];
+    memcpy(offsets, &content[offsetsPosition], sizeof(offsets));
+    ASSERT_EQ(0u, offsets[0]);
+    ASSERT_EQ(2u, offsets[1]);
+    ASSERT_EQ(4u, offsets[2]);
+
+    std::string badOffsets = content;
+    offsets[1] = 10;  // not monotonic anymore
+    memcpy(&badOffsets[offsetsPosition], offsets, sizeof(offsets));
+    Orthanc::SystemToolbox::WriteFile(badOffsets, file.GetPath());
+
+    IndexSnapshot::Reader reader(file.GetPath());
+    ASSERT_THROW(reader.GetStrings(1), Orthanc::OrthancException);
+  }
+}
+
+
+TEST(StudyDateIndex, ParseDate)
+{
+  uint32_t day;
+  ASSERT_TRUE(StudyDateIndex::ParseDate(day, "18000101"));
+  ASSERT_EQ(0u, day);
+  ASSERT_TRUE(StudyDateIndex::ParseDate(day, "18000201"));
+  ASSERT_EQ(31u, day);
+  ASSERT_TRUE(StudyDateIndex::ParseDate(day, "21991231"));
+  ASSERT_EQ(146096u, day);
+
+  ASSERT_FALSE(StudyDateIndex::ParseDate(day, ""));
+  ASSERT_FALSE(StudyDateIndex::ParseDate(day, "2024010"));
+  ASSERT_FALSE(StudyDateIndex::ParseDate(day, "2024-01-01"));
+  ASSERT_FALSE(StudyDateIndex::ParseDate(day, "17991231"));
+  ASSERT_FALSE(StudyDateIndex::ParseDate(day, "22000101"));
+  ASSERT_FALSE(StudyDateIndex::ParseDate(day, "20230229"));
+  ASSERT_TRUE(StudyDateIndex::ParseDate(day, "20240229"));
+}
+
+
+TEST(StudyDateIndex, ParseDateRange)
+{
+  uint32_t firstDay, lastDay, day;
+
+  ASSERT_TRUE(StudyDateIndex::ParseDateRange(firstDay, lastDay, "20240115"));
+  ASSERT_TRUE(StudyDateIndex::ParseDate(day, "20240115"));
+  ASSERT_EQ(day, firstDay);
+  ASSERT_EQ(day, lastDay);
+
+  ASSERT_TRUE(StudyDateIndex::ParseDateRange(firstDay, lastDay, "20240101-20240131"));
+  ASSERT_EQ(30u, lastDay - firstDay);
+
+  ASSERT_TRUE(StudyDateIndex::ParseDateRange(firstDay, lastDay, "20240131-20240101"));  // empty range
+  ASSERT_GT(firstDay, lastDay);
+
+  // the open ranges also match the studies that are not indexed
+  ASSERT_FALSE(StudyDateIndex::ParseDateRange(firstDay, lastDay, "-20240131"));
+  ASSERT_FALSE(StudyDateIndex::ParseDateRange(firstDay, lastDay, "20240101-"));
+
+  ASSERT_FALSE(StudyDateIndex::ParseDateRange(firstDay, lastDay, ""));
+  ASSERT_FALSE(StudyDateIndex::ParseDateRange(firstDay, lastDay, "-"));
+  ASSERT_FALSE(StudyDateIndex::ParseDateRange(firstDay, lastDay, "20240101\\20240102"));
+  ASSERT_FALSE(StudyDateIndex::ParseDateRange(firstDay, lastDay, "2024*"));
+  ASSERT_FALSE(StudyDateIndex::ParseDateRange(firstDay, lastDay, "20240101-20240132"));
+}
+
+
+#if ORTHANC_OE2_ENABLE_JWT_VERIFIER == 1
+namespace
+{
+  // ES256 tokens of the issuer "http://keycloak:8080/realms/orthanc" signed by the key "k1" of JWKS, valid until 2100
+  static const char* JWKS = "{\"keys\":[{\"kid\":\"k1\",\"kty\":\"EC\",\"crv\":\"P-256\",\"x\":\"wIpmV2NsyGNB_Lt_V0F-slRfiQzDtbCAEKFKYAdaTPc\",\"y\":\"2gpOlXvmZ88XUwx_Pk-iQlqGqdjQdkAZ1Lt1LDYGQL4\"}]}";
+
+  static const char* VALID_TOKEN =
+    "eyJhbGciOiJFUzI1NiIsImtpZCI6ImsxIiwidHlwIjoiSldUIn0."
+    "eyJpc3MiOiJodHRwOi8va2V5Y2xvYWs6ODA4MC9yZWFsbXMvb3J0aGFuYyIsImV4cCI6NDEwMjQ0NDgwMCwiYXpwIjoib3J0aGFuYyIsInByZWZlcnJlZF91c2VybmFtZSI6ImFsaWNlIn0."
+    "egly315_dCsmpCOFhKqAZX_r-O5mWYUs0Pdg7l6BYSFoikS3W71MRiLda-44UPNHG01kMWQt1qofVVqCH7SDxg";
+
+  static const char* EXPIRED_TOKEN =
+    "eyJhbGciOiJFUzI1NiIsImtpZCI6ImsxIiwidHlwIjoiSldUIn0."
+    "eyJpc3MiOiJodHRwOi8va2V5Y2xvYWs6ODA4MC9yZWFsbXMvb3J0aGFuYyIsImV4cCI6MTAwMDAwMDAwMCwiYXpwIjoib3J0aGFuYyIsInByZWZlcnJlZF91c2VybmFtZSI6ImFsaWNlIn0."
+    "O_lOf9LsGDfqqA1yepXnYTUvIccN_kXzI3OZIwBA5Jn8SgSA2m-UWq1B30VQZul-57mh4se2kifnYviMjFwRDQ";
+
+  static const char* OTHER_ISSUER_TOKEN =
+    "eyJhbGciOiJFUzI1NiIsImtpZCI6ImsxIiwidHlwIjoiSldUIn0."
+    "eyJpc3MiOiJodHRwOi8vb3RoZXIvcmVhbG1zL29ydGhhbmMiLCJleHAiOjQxMDI0NDQ4MDAsImF6cCI6Im9ydGhhbmMiLCJwcmVmZXJyZWRfdXNlcm5hbWUiOiJhbGljZSJ9."
+    "aiBNnqEmQQNpQUk_zL55hrL_DcjNgKr4UUUsvkY0Q5cTNlwFFuNooyT84xe1MciIq7wg5TLOq-hBfO7vcyoytg";
+
+  static const char* OTHER_CLIENT_TOKEN =  // "azp" is another client of the realm
+    "eyJhbGciOiJFUzI1NiIsImtpZCI6ImsxIiwidHlwIjoiSldUIn0."
+    "eyJpc3MiOiJodHRwOi8va2V5Y2xvYWs6ODA4MC9yZWFsbXMvb3J0aGFuYyIsImV4cCI6NDEwMjQ0NDgwMCwiYXpwIjoib3RoZXIiLCJwcmVmZXJyZWRfdXNlcm5hbWUiOiJhbGljZSJ9."
+    "ha0AWzbMSS9Re0gFK4syy-oE5sHfYHPnY-VFauSqM9IMElwFbjcO4GYkD4emuyYKI9oIV1B6dlansu254RtNZA";
+
+  static const char* AUDIENCE_TOKEN =  // "azp" is another client, but "aud" contains "orthanc"
+    "eyJhbGciOiJFUzI1NiIsImtpZCI6ImsxIiwidHlwIjoiSldUIn0."
+    "eyJpc3MiOiJodHRwOi8va2V5Y2xvYWs6ODA4MC9yZWFsbXMvb3J0aGFuYyIsImV4cCI6NDEwMjQ0NDgwMCwiYXpwIjoib3RoZXIiLCJwcmVmZXJyZWRfdXNlcm5hbWUiOiJhbGljZSIsImF1ZCI6WyJhY2NvdW50Iiwib3J0aGFuYyJdfQ."
+    "rEDEd2aj779I5WYHr6_lslmtu7m_rhrVI-EcAVAsIWZsXcWvj190IoOr-xS49753x2DplaNEc4OXYrAumLhcvw";
+
+  static const char* UNSIGNED_TOKEN =  // "alg": "none"
+    "eyJhbGciOiJub25lIiwia2lkIjoiazEiLCJ0eXAiOiJKV1QifQ."
+    "eyJpc3MiOiJodHRwOi8va2V5Y2xvYWs6ODA4MC9yZWFsbXMvb3J0aGFuYyIsImV4cCI6NDEwMjQ0NDgwMCwiYXpwIjoib3J0aGFuYyIsInByZWZlcnJlZF91c2VybmFtZSI6ImFsaWNlIn0."
+    "";
+
+  static const char* UNKNOWN_KEY_TOKEN =  // "kid": "k2"
+    "eyJhbGciOiJFUzI1NiIsImtpZCI6ImsyIiwidHlwIjoiSldUIn0."
+    "eyJpc3MiOiJodHRwOi8va2V5Y2xvYWs6ODA4MC9yZWFsbXMvb3J0aGFuYyIsImV4cCI6NDEwMjQ0NDgwMCwiYXpwIjoib3J0aGFuYyIsInByZWZlcnJlZF91c2VybmFtZSI6ImFsaWNlIn0."
+    "26ZXGu7H1E96sr5gRUaoH8dnGYuCubyys_gGFA8Eh7OZj9P88TzjMlTZdt2KPXU-6TZLZanvd6f5B_9On1PLug";
+
+  static const char* TAMPERED_TOKEN =  // the "preferred_username" of VALID_TOKEN has been replaced
+    "eyJhbGciOiJFUzI1NiIsImtpZCI6ImsxIiwidHlwIjoiSldUIn0."
+    "eyJpc3MiOiJodHRwOi8va2V5Y2xvYWs6ODA4MC9yZWFsbXMvb3J0aGFuYyIsImV4cCI6NDEwMjQ0NDgwMCwiYXpwIjoib3J0aGFuYyIsInByZWZlcnJlZF91c2VybmFtZSI6ImFkbWluIn0."
+    "egly315_dCsmpCOFhKqAZX_r-O5mWYUs0Pdg7l6BYSFoikS3W71MRiLda-44UPNHG01kMWQt1qofVVqCH7SDxg";
+
+
+  class JwtVerifierTest : public ::testing::Test
+  {
+  protected:
+    TemporaryFile  jwks_;
+    JwtVerifier    verifier_;
+
+    virtual void SetUp()
+    {
+      Orthanc::SystemToolbox::WriteFile(std::string(JWKS), jwks_.GetPath());
+
+      Json::Value configuration;
+      configuration["Enable"] = true;
+      configuration["VerifyTokens"] = true;
+      configuration["Url"] = "http://keycloak:8080";
+      configuration["Realm"] = "orthanc";
+      configuration["ClientId"] = "orthanc";
+      configuration["JwksPath"] = jwks_.GetPath();
+      configuration["ClaimsCacheSize"] = 2;
+      configuration["ClockSkew"] = 30;
+      verifier_.Configure(configuration);
+    }
+  };
+}
+
+
+TEST_F(JwtVerifierTest, Verify)
+{
+  ASSERT_TRUE(verifier_.IsEnabled());
+
+  for (unsigned int i = 0; i < 2; i++)  // the second time, the valid tokens are in the cache
+  {
+    Json::Value claims;
+    ASSERT_EQ(JwtVerifier::Status_Valid, verifier_.Verify(claims, VALID_TOKEN));
+    ASSERT_EQ("alice", claims["preferred_username"].asString());
+
+    ASSERT_EQ(JwtVerifier::Status_Valid, verifier_.Verify(claims, AUDIENCE_TOKEN));
+
+    ASSERT_EQ(JwtVerifier::Status_Expired, verifier_.Verify(claims, EXPIRED_TOKEN));
+    ASSERT_EQ(JwtVerifier::Status_InvalidIssuer, verifier_.Verify(claims, OTHER_ISSUER_TOKEN));
+    ASSERT_EQ(JwtVerifier::Status_InvalidAudience, verifier_.Verify(claims, OTHER_CLIENT_TOKEN));
+    ASSERT_EQ(JwtVerifier::Status_UnsupportedAlgorithm, verifier_.Verify(claims, UNSIGNED_TOKEN));
+    ASSERT_EQ(JwtVerifier::Status_UnknownKey, verifier_.Verify(claims, UNKNOWN_KEY_TOKEN));
+    ASSERT_EQ(JwtVerifier::Status_InvalidSignature, verifier_.Verify(claims, TAMPERED_TOKEN));
+    ASSERT_EQ(JwtVerifier::Status_Malformed, verifier_.Verify(claims, "abc.def"));
+    ASSERT_EQ(JwtVerifier::Status_Malformed, verifier_.Verify(claims, ""));
+  }
+}
+
+
+TEST(JwtVerifier, ExtractToken)
+{
+  std::map<std::string, std::string> headers;
+  std::string token;
+
+  ASSERT_FALSE(JwtVerifier::ExtractToken(token, headers));
+
+  headers["authorization"] = "Bearer  abc";
+  ASSERT_TRUE(JwtVerifier::ExtractToken(token, headers));
+  ASSERT_EQ("abc", token);
+
+  headers["authorization"] = "Basic xyz";
+  headers["token"] = "bearer def";
+  ASSERT_TRUE(JwtVerifier::ExtractToken(token, headers));
+  ASSERT_EQ("def", token);
+}
+#endif
+
+
+TEST(StudyFilter, Match)
+{
+  Json::Value study;
+  study["MainDicomTags"]["StudyDate"] = "20240115";
+  study["MainDicomTags"]["StudyDescription"] = "CT Chest";
+  study["PatientMainDicomTags"]["PatientName"] = "DOE^JOHN";
+  study["RequestedTags"]["ModalitiesInStudy"] = "CT\\SR";
+  study["Labels"].append("urgent");
+
+  {
+    StudyFilter filter;
+    ASSERT_TRUE(filter.IsEmpty());
+    ASSERT_TRUE(filter.Match(study));
+  }
+
+  {
+    StudyFilter filter;
+    filter.AddConstraint("StudyDate", "20240101-20240131");
+    filter.AddConstraint("PatientName", "*john*");
+    ASSERT_TRUE(filter.Match(study));
+  }
+
+  {
+    StudyFilter filter;
+    filter.AddConstraint("StudyDate", "20240116-");
+    ASSERT_FALSE(filter.Match(study));
+  }
+
+  {
+    StudyFilter filter;
+    filter.AddConstraint("ModalitiesInStudy", "MR\\CT");
+    ASSERT_TRUE(filter.Match(study));
+
+    std::set<std::string> tags;
+    filter.GetRequestedTags(tags);
+    ASSERT_TRUE(tags.find("ModalitiesInStudy") != tags.end());
+  }
+
+  {
+    StudyFilter filter;
+    filter.AddLabel("urgent");
+    filter.AddLabel("reviewed");
+    filter.SetLabelsConstraint(StudyFilter::LabelsConstraint_All);
+    ASSERT_FALSE(filter.Match(study));
+    filter.SetLabelsConstraint(StudyFilter::LabelsConstraint_Any);
+    ASSERT_TRUE(filter.Match(study));
+    filter.SetLabelsConstraint(StudyFilter::LabelsConstraint_None);
+    ASSERT_FALSE(filter.Match(study));
+  }
+
+  ASSERT_TRUE(StudyFilter::WildcardMatch("CT Chest", "CT*", true));
+  ASSERT_TRUE(StudyFilter::WildcardMatch("CT Chest", "ct?chest", false));
+  ASSERT_FALSE(StudyFilter::WildcardMatch("CT Chest", "ct*", true));
+}
+
+
+TEST(PatientNameIndex, GetFoldedComponents)
+{
+  std::vector<std::string> components;
+  PatientNameIndex::GetFoldedComponents(components, "M\xc3\xbcller^Jean-Pierre");
+  ASSERT_EQ(3u, components.size());
+  ASSERT_EQ("MULLER", components[0]);
+  ASSERT_EQ("JEAN", components[1]);
+  ASSERT_EQ("PIERRE", components[2]);
+
+  PatientNameIndex::GetFoldedComponents(components, "\xc3\x85sa^\xc3\x87\xc3\x89LINE^^Dr.");
+  ASSERT_EQ(3u, components.size());
+  ASSERT_EQ("ASA", components[0]);
+  ASSERT_EQ("CELINE", components[1]);
+  ASSERT_EQ("DR", components[2]);
+
+  PatientNameIndex::GetFoldedComponents(components, "  o'brien ^ ANNE");
+  ASSERT_EQ(3u, components.size());
+  ASSERT_EQ("O", components[0]);
+  ASSERT_EQ("BRIEN", components[1]);
+  ASSERT_EQ("ANNE", components[2]);
+
+  PatientNameIndex::GetFoldedComponents(components, "^^");
+  ASSERT_TRUE(components.empty());
+  PatientNameIndex::GetFoldedComponents(components, "");
+  ASSERT_TRUE(components.empty());
+}
+
+
+TEST(PatientNameIndex, GetPhoneticKeys)
+{
+  std::string primary, alternate, primary2, alternate2;
+
+  // the spelling variants share a key
+  const char* VARIANTS[][2] = {
+    { "MULLER", "MILLER" },
+    { "SMITH", "SMYTH" },
+    { "PHILIPPE", "FILIP" },
+    { "KNIGHT", "NIGHT" },
+    { "CATHERINE", "KATHRYN" },
+    { "JOHN", "JEAN" }
+  };
+
+  for (size_t i = 0; i < sizeof(VARIANTS) / sizeof(VARIANTS[0]); i++)
+  {
+    PatientNameIndex::GetPhoneticKeys(primary, alternate, VARIANTS[i][0]);
+    PatientNameIndex::GetPhoneticKeys(primary2, alternate2, VARIANTS[i][1]);
+    ASSERT_FALSE(primary.empty());
+    ASSERT_EQ(primary, primary2);
+    ASSERT_EQ(alternate, alternate2);
+  }
+
+  PatientNameIndex::GetPhoneticKeys(primary, alternate, "MULLER");
+  ASSERT_EQ("MLR", primary);
+  ASSERT_EQ("MLR", alternate);
+
+  PatientNameIndex::GetPhoneticKeys(primary, alternate, "SCHMIDT");
+  ASSERT_EQ("SKMT", primary);
+  ASSERT_EQ("XMT", alternate);
+
+  PatientNameIndex::GetPhoneticKeys(primary, alternate, "SMITH");
+  PatientNameIndex::GetPhoneticKeys(primary2, alternate2, "DOE");
+  ASSERT_NE(primary, primary2);
+
+  PatientNameIndex::GetPhoneticKeys(primary, alternate, "");
+  ASSERT_TRUE(primary.empty());
+}
+
+
+TEST(SeriesContentIndex, CaseSensitivity)
+{
+  TemporaryFile file;
+
+  std::vector<std::string> tags;
+  tags.push_back("Modality");
+  tags.push_back("OperatorsName");
+
+  {
+    std::vector<std::string> studies;
+    studies.push_back("study1");
+    studies.push_back("study2");
+
+    std::vector<std::string> series;
+    series.push_back("series1");
+    series.push_back("series2");
+
+    std::vector<uint32_t> seriesStudies;
+    seriesStudies.push_back(0);
+    seriesStudies.push_back(1);
+
+    std::vector<std::string> modalities;
+    modalities.push_back("CT");
+    modalities.push_back("ct");
+
+    std::vector<std::string> operators;
+    operators.push_back("SMITH^JOHN");
+    operators.push_back("Doe^Jane");
+
+    // the sections of the "series-content" snapshot
+    IndexSnapshot::Writer writer("series-content", 1, 10);
+    writer.AddStrings(1, tags);
+    writer.AddStrings(2, studies);
+    writer.AddStrings(3, series);
+    writer.AddUInt32Array(4, seriesStudies);
+    writer.AddStrings(100, modalities);
+    writer.AddStrings(101, operators);
+    writer.WriteAtomically(file.GetPath());
+  }
+
+  SeriesContentIndex index;
+  index.SetIndexedTags(tags);
+  index.LoadSnapshot(IndexSnapshot::Reader(file.GetPath()));
+
+  std::set<std::string> studies;
+  Json::Value query;
+
+  // the CS tags are case-sensitive
+  query["Modality"] = "CT";
+  ASSERT_TRUE(index.FindStudies(studies, query));
+  ASSERT_EQ(1u, studies.size());
+  ASSERT_EQ(1u, studies.count("study1"));
+
+  query["Modality"] = "c?";
+  ASSERT_TRUE(index.FindStudies(studies, query));
+  ASSERT_EQ(1u, studies.size());
+  ASSERT_EQ(1u, studies.count("study2"));
+
+  // the PN tags are case-insensitive
+  query = Json::objectValue;
+  query["OperatorsName"] = "smith*";
+  ASSERT_TRUE(index.FindStudies(studies, query));
+  ASSERT_EQ(1u, studies.size());
+  ASSERT_EQ(1u, studies.count("study1"));
+
+  query["OperatorsName"] = "*JANE";
+  ASSERT_TRUE(index.FindStudies(studies, query));
+  ASSERT_EQ(1u, studies.size());
+  ASSERT_EQ(1u, studies.count("study2"));
+
+  ASSERT_TRUE(StudyFilter::IsCaseSensitiveTag("Modality"));
+  ASSERT_FALSE(StudyFilter::IsCaseSensitiveTag("PatientName"));
+}
+
+
+TEST(SelectionsRegistry, OrthancIds)
+{
+  const std::string id = "8a8cf898-ca27c490-d0c7058c-929d0581-2bbf104d";
+
+  std::string digest;
+  ASSERT_TRUE(SelectionsRegistry::EncodeOrthancId(digest, id));
+  ASSERT_EQ(static_cast<size_t>(SelectionsRegistry::DIGEST_SIZE), digest.size());
+  ASSERT_EQ(id, SelectionsRegistry::DecodeOrthancId(digest.c_str()));
+
+  ASSERT_FALSE(SelectionsRegistry::EncodeOrthancId(digest, ""));
+  ASSERT_FALSE(SelectionsRegistry::EncodeOrthancId(digest, "8a8cf898ca27c490d0c7058c929d05812bbf104d"));
+  ASSERT_FALSE(SelectionsRegistry::EncodeOrthancId(digest, "8a8cf898-ca27c490-d0c7058c-929d0581-2bbf104g"));
+}
+
+
+TEST(SelectionsRegistry, Owners)
+{
+  Json::Value configuration;
+  configuration["MaxSelections"] = 3;
+  configuration["MaxSelectionsPerUser"] = 2;
+  configuration["MaxResources"] = 10;
+  configuration["Timeout"] = 3600;
+
+  SelectionsRegistry registry;
+  registry.Configure(configuration);
+
+  std::vector<std::string> ids;
+  ids.push_back("8a8cf898-ca27c490-d0c7058c-929d0581-2bbf104d");
+  ids.push_back("8a8cf898-ca27c490-d0c7058c-929d0581-2bbf104d");
+
+  size_t count = 0;
+  const std::string a1 = registry.Create(count, ids, "alice");
+  ASSERT_EQ(1u, count);
+
+  std::vector<std::string> found;
+  ASSERT_TRUE(registry.Lookup(found, a1, "alice"));
+  ASSERT_EQ(1u, found.size());
+  ASSERT_FALSE(registry.Lookup(found, a1, "bob"));
+  ASSERT_TRUE(found.empty());
+  ASSERT_FALSE(registry.Remove(a1, "bob"));
+
+  // the quota of a user only evicts its own selections (the sleeps order the uses)
+  const boost::posix_time::milliseconds tick(2);
+  boost::this_thread::sleep(tick);
+  const std::string b1 = registry.Create(count, ids, "bob");
+  const std::string a2 = registry.Create(count, ids, "alice");
+  boost::this_thread::sleep(tick);
+  const std::string a3 = registry.Create(count, ids, "alice");
+  ASSERT_FALSE(registry.Lookup(found, a1, "alice"));
+  ASSERT_TRUE(registry.Lookup(found, a2, "alice"));
+  boost::this_thread::sleep(tick);
+  ASSERT_TRUE(registry.Lookup(found, a3, "alice"));
+  ASSERT_TRUE(registry.Lookup(found, b1, "bob"));
+
+  // the registry is full: the user that has the most selections loses its least recently used one
+  const std::string c1 = registry.Create(count, ids, "carol");
+  ASSERT_TRUE(registry.Lookup(found, b1, "bob"));
+  ASSERT_TRUE(registry.Lookup(found, c1, "carol"));
+  ASSERT_FALSE(registry.Lookup(found, a2, "alice"));
+  ASSERT_TRUE(registry.Lookup(found, a3, "alice"));
+
+  ASSERT_TRUE(registry.Remove(a3, "alice"));
+  ASSERT_FALSE(registry.Lookup(found, a3, "alice"));
+
+  ids.resize(11, ids[0]);
+  ASSERT_THROW(registry.Create(count, ids, "alice"), Orthanc::OrthancException);
+}
+
+
+namespace
+{
+  // the scanned values point into 'json', that must outlive them
+  JsonScanner::Value ScanJson(const std::string& json)
+  {
+    return JsonScanner::GetRoot(json.c_str(), json.size());
+  }
+}
+
+
+TEST(JsonScanner, Strings)
+{
+  const std::string json = "{ \"a\" : \"x\\\"y\", \"b\": \"\\u00e9\\ud83d\\ude00\\n\\/\", \"c\": \"\\\\\", \"d\": 12 }";
+  JsonScanner::Value root = ScanJson(json);
+  ASSERT_EQ(JsonScanner::Type_Object, root.GetType());
+
+  JsonScanner::Value v;
+  ASSERT_TRUE(root.LookupMember(v, "a"));
+  ASSERT_EQ("x\"y", v.GetString());
+  ASSERT_TRUE(v.IsString("x\"y"));
+  ASSERT_FALSE(v.IsString("x"));
+
+  ASSERT_EQ("\xc3\xa9\xf0\x9f\x98\x80\n/", root.GetStringMember("b"));
+  ASSERT_EQ("\\", root.GetStringMember("c"));
+  ASSERT_EQ("", root.GetStringMember("missing"));
+
+  ASSERT_TRUE(root.LookupMember(v, "d"));
+  ASSERT_THROW(v.GetString(), Orthanc::OrthancException);
+}
+
+
+TEST(JsonScanner, Nested)
+{
+  // the strings contain brackets and quotes that must be skipped
+  const std::string json = "[ { \"ID\": \"1\", \"Tags\": { \"x\": [ \"]\", { \"y\": \"}\\\"\" } ], \"e\": {}, \"ea\": [] }, "
+    "\"Last\": true }, null, [ [ 1 ], 2 ] ]";
+  JsonScanner::Value root = ScanJson(json);
+  ASSERT_EQ(JsonScanner::Type_Array, root.GetType());
+  ASSERT_EQ(3u, root.GetArraySize());
+
+  JsonScanner::ArrayReader reader(root);
+  JsonScanner::Value item, v;
+
+  ASSERT_TRUE(reader.Next(item));
+  ASSERT_TRUE(item.LookupMember(v, "Last"));
+  ASSERT_TRUE(v.GetBoolean());
+  ASSERT_TRUE(item.LookupMember(v, "Tags"));
+  ASSERT_TRUE(v.LookupMember(v, "x"));
+  ASSERT_EQ(2u, v.GetArraySize());
+
+  Json::Value converted;
+  item.ToJson(converted);
+  ASSERT_EQ("}\"", converted["Tags"]["x"][1]["y"].asString());
+  ASSERT_TRUE(converted["Tags"]["e"].isObject());
+  ASSERT_TRUE(converted["Tags"]["ea"].isArray());
+
+  ASSERT_TRUE(reader.Next(item));
+  ASSERT_TRUE(item.IsNull());
+  ASSERT_FALSE(item.LookupMember(v, "ID"));  // not an object
+
+  ASSERT_TRUE(reader.Next(item));
+  ASSERT_EQ(2u, item.GetArraySize());
+  ASSERT_FALSE(reader.Next(item));
+
+  // the keys of an object
+  const std::string object = "{ \"a\": 1, \"b\": [ 2 ] }";
+  JsonScanner::ObjectReader members(ScanJson(object));
+  JsonScanner::Value key;
+  ASSERT_TRUE(members.Next(key, v));
+  ASSERT_TRUE(key.IsString("a"));
+  ASSERT_TRUE(members.Next(key, v));
+  ASSERT_TRUE(key.IsString("b"));
+  ASSERT_EQ(JsonScanner::Type_Array, v.GetType());
+  ASSERT_FALSE(members.Next(key, v));
+}
+
+
+TEST(JsonScanner, Numbers)
+{
+  const std::string json = "[ -12, 18446744073709551615, 2.5e3, 1.0, 1e3, \"1\" ]";
+  JsonScanner::Value root = ScanJson(json);
+  JsonScanner::ArrayReader reader(root);
+  JsonScanner::Value v;
+
+  ASSERT_TRUE(reader.Next(v));
+  ASSERT_EQ(-12, v.GetInteger());
+  ASSERT_THROW(v.GetUnsigned(), Orthanc::OrthancException);
+  ASSERT_DOUBLE_EQ(-12.0, v.GetDouble());
+
+  ASSERT_TRUE(reader.Next(v));
+  ASSERT_EQ(std::numeric_limits<uint64_t>::max(), v.GetUnsigned());
+  ASSERT_THROW(v.GetInteger(), Orthanc::OrthancException);  // overflow
+
+  ASSERT_TRUE(reader.Next(v));
+  ASSERT_DOUBLE_EQ(2500.0, v.GetDouble());
+  ASSERT_THROW(v.GetInteger(), Orthanc::OrthancException);
+
+  ASSERT_TRUE(reader.Next(v));
+  ASSERT_THROW(v.GetInteger(), Orthanc::OrthancException);
+  ASSERT_THROW(v.GetUnsigned(), Orthanc::OrthancException);
+
+  ASSERT_TRUE(reader.Next(v));
+  ASSERT_THROW(v.GetUnsigned(), Orthanc::OrthancException);
+  ASSERT_DOUBLE_EQ(1000.0, v.GetDouble());
+
+  ASSERT_TRUE(reader.Next(v));
+  ASSERT_THROW(v.GetInteger(), Orthanc::OrthancException);  // a string
+}
+
+
+TEST(JsonScanner, Malformed)
+{
+  ASSERT_THROW(ScanJson("[1, 2").GetArraySize(), Orthanc::OrthancException);
+  ASSERT_THROW(ScanJson("[\"abc").GetArraySize(), Orthanc::OrthancException);
+  ASSERT_THROW(ScanJson("{\"a\": {\"b\": 1}").Skip(), Orthanc::OrthancException);
+
+  JsonScanner::Value v;
+  ASSERT_THROW(ScanJson("{\"a\" 1}").LookupMember(v, "b"), Orthanc::OrthancException);
+  ASSERT_THROW(ScanJson("{\"a\": \"\\u12\"}").GetStringMember("a"), Orthanc::OrthancException);
+  ASSERT_THROW(ScanJson("").GetType(), Orthanc::OrthancException);
+}
+
+
+TEST(JsonWriter, WriteValue)
+{
+  Json::Value source = Json::objectValue;
+  source["Escapes"] = "quote \" backslash \\ slash / \b\f\n\r\t \x01 \x1f";
+  source["Utf8"] = "J\xc3\xa9r\xc3\xb4me \xe6\x97\xa5\xe6\x9c\xac \xf0\x9f\x98\x80";
+  source["Key \"with\" escapes"] = Json::nullValue;
+  source[std::string("Embedded\0zero", 13)] = std::string("a\0b", 3);
+  source["Int64"].append(Json::Value(std::numeric_limits<Json::Int64>::min()));
+  source["Int64"].append(Json::Value(std::numeric_limits<Json::Int64>::max()));
+  source["Int64"].append(Json::Value(std::numeric_limits<Json::UInt64>::max()));
+  source["Int64"].append(-1);
+  source["Doubles"].append(0.1);
+  source["Doubles"].append(-2.5e-300);
+  source["Doubles"].append(1.7976931348623157e308);
+  source["Doubles"].append(3.0);
+  source["Doubles"].append(-0.0);
+  source["Booleans"].append(true);
+  source["Booleans"].append(false);
+  source["Empty"]["Array"] = Json::arrayValue;
+  source["Empty"]["Object"] = Json::objectValue;
+  source["Empty"]["String"] = "";
+
+  std::string s;
+  JsonWriter writer(s);
+  writer.WriteValue(source);
+
+  // the UTF-8 sequences are kept as is, the output is not necessarily byte-identical to the one of jsoncpp
+  ASSERT_NE(std::string::npos, s.find("\"Utf8\":\"J\xc3\xa9r\xc3\xb4me \xe6\x97\xa5\xe6\x9c\xac \xf0\x9f\x98\x80\""));
+  ASSERT_NE(std::string::npos, s.find("[-9223372036854775808,9223372036854775807,18446744073709551615,-1]"));
+  ASSERT_NE(std::string::npos, s.find("\\u0001"));
+  ASSERT_EQ(std::string::npos, s.find('\n'));
+
+  std::string reference;
+  OrthancPlugins::WriteFastJson(reference, source);
+
+  Json::Value parsed, parsedReference;
+  ASSERT_TRUE(OrthancPlugins::ReadJson(parsed, s));
+  ASSERT_TRUE(OrthancPlugins::ReadJson(parsedReference, reference));
+  ASSERT_TRUE(parsed == parsedReference);
+
+  // NB: jsoncpp parses the positive integers beyond 2^31 as unsigned, hence no comparison with "source"
+  ASSERT_EQ(source["Escapes"].asString(), parsed["Escapes"].asString());
+  ASSERT_EQ(source["Utf8"].asString(), parsed["Utf8"].asString());
+  ASSERT_EQ(3u, parsed[std::string("Embedded\0zero", 13)].asString().size());
+  ASSERT_TRUE(parsed.isMember("Key \"with\" escapes"));
+  ASSERT_EQ(std::numeric_limits<Json::Int64>::min(), parsed["Int64"][0].asInt64());
+  ASSERT_EQ(std::numeric_limits<Json::Int64>::max(), parsed["Int64"][1].asInt64());
+  ASSERT_EQ(std::numeric_limits<Json::UInt64>::max(), parsed["Int64"][2].asUInt64());
+  ASSERT_EQ(0.1, parsed["Doubles"][0].asDouble());
+  ASSERT_EQ(-2.5e-300, parsed["Doubles"][1].asDouble());
+  ASSERT_EQ(1.7976931348623157e308, parsed["Doubles"][2].asDouble());
+  ASSERT_EQ(Json::realValue, parsed["Doubles"][3].type());
+  ASSERT_TRUE(parsed["Empty"]["Object"].isObject());
+}
+
+
+TEST(JsonWriter, NonFinite)
+{
+  std::string s;
+  JsonWriter writer(s);
+  writer.StartArray();
+  writer.WriteDouble(std::numeric_limits<double>::quiet_NaN());
+  writer.WriteDouble(std::numeric_limits<double>::infinity());
+  writer.WriteDouble(1.0);
+  writer.EndArray();
+  ASSERT_EQ("[null,null,1.0]", s);
+
+  ASSERT_THROW(writer.EndArray(), Orthanc::OrthancException);
+}
+
+
+namespace
+{
+  // submits "depth" levels of subtasks from the worker threads
+  class CountingTask : public TaskExecutor::ITask
+  {
+  private:
+    TaskExecutor&              executor_;
+    std::atomic<unsigned int>& count_;
+    unsigned int               depth_;
+
+  public:
+    CountingTask(TaskExecutor& executor,
+                 std::atomic<unsigned int>& count,
+                 unsigned int depth) :
+      executor_(executor),
+      count_(count),
+      depth_(depth)
+    {
+    }
+
+    virtual void Execute()
+    {
+      if (depth_ > 0)
+      {
+        executor_.Submit(new CountingTask(executor_, count_, depth_ - 1), TaskExecutor::Priority_Background);
+        executor_.Submit(new CountingTask(executor_, count_, depth_ - 1), TaskExecutor::Priority_Interactive);
+      }
+
+      count_++;
+    }
+  };
+
+
+  void WaitCount(const std::atomic<unsigned int>& count,
+                 unsigned int expected)
+  {
+    for (unsigned int i = 0; i < 1000 && count.load() < expected; i++)
+    {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+  }
+
+
+  // occupies a thread until released
+  class BlockingTask : public TaskExecutor::ITask
+  {
+  private:
+    std::atomic<unsigned int>&  started_;
+    const std::atomic<bool>&    released_;
+
+  public:
+    BlockingTask(std::atomic<unsigned int>& started,
+                 const std::atomic<bool>& released) :
+      started_(started),
+      released_(released)
+    {
+    }
+
+    virtual void Execute()
+    {
+      started_++;
+
+      for (unsigned int i = 0; i < 1000 && !released_.load(); i++)
+      {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+      }
+    }
+  };
+}
+
+
+TEST(TaskExecutor, Submit)
+{
+  Json::Value configuration;
+  configuration["MaxCpuPercentage"] = 0;
+
+  TaskExecutor executor1, executor2;
+  executor1.Configure(configuration);
+  executor2.Configure(configuration);
+  ASSERT_EQ(2u, executor1.GetThreadsCount());
+
+  executor1.Start();
+  executor2.Start();
+
+  // the subtasks are pushed in the deque of the current worker of their own executor
+  std::atomic<unsigned int> count1(0), count2(0);
+  executor1.Submit(new CountingTask(executor1, count1, 8), TaskExecutor::Priority_Maintenance);
+  executor2.Submit(new CountingTask(executor2, count2, 8), TaskExecutor::Priority_Interactive);
+
+  WaitCount(count1, 511);
+  WaitCount(count2, 511);
+  ASSERT_EQ(511u, count1.load());
+  ASSERT_EQ(511u, count2.load());
+
+  executor1.Stop();
+  executor2.Stop();
+
+  // discarded once stopped
+  executor1.Submit(new CountingTask(executor1, count1, 0), TaskExecutor::Priority_Interactive);
+  ASSERT_EQ(511u, count1.load());
+}
+
+
+TEST(TaskExecutor, InteractiveThread)
+{
+  Json::Value configuration;
+  configuration["MaxCpuPercentage"] = 0;
+  configuration["MaxBackgroundThreads"] = 0;
+  configuration["MaxMaintenanceThreads"] = 0;
+
+  TaskExecutor executor;
+  executor.Configure(configuration);
+  ASSERT_EQ(2u, executor.GetThreadsCount());
+  executor.Start();
+
+  // the background and maintenance tasks together can not occupy the last thread
+  std::atomic<unsigned int> started(0), count(0);
+  std::atomic<bool> released(false);
+  executor.Submit(new BlockingTask(started, released), TaskExecutor::Priority_Background);
+  executor.Submit(new BlockingTask(started, released), TaskExecutor::Priority_Maintenance);
+  WaitCount(started, 1);
+  boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+  ASSERT_EQ(1u, started.load());
+
+  executor.Submit(new CountingTask(executor, count, 0), TaskExecutor::Priority_Interactive);
+  WaitCount(count, 1);
+  ASSERT_EQ(1u, count.load());
+
+  released = true;
+  WaitCount(started, 2);
+  ASSERT_EQ(2u, started.load());
+
+  executor.Stop();
+}
+
+
+TEST(SearchAdmission, Budget)
+{
+  Json::Value configuration;
+  configuration["Enable"] = true;
+  configuration["MaxConcurrentSearches"] = 1;
+  configuration["MaxQueueWaitTime"] = 0;
+  configuration["MaxQueryCost"] = 0;
+  configuration["UserBudget"] = 10;
+  configuration["UserBudgetRefillRate"] = 0;
+
+  SearchAdmission admission;
+  admission.Configure(configuration);
+
+  double retryAfter;
+  std::unique_ptr<SearchAdmission::Ticket> ticket1(new SearchAdmission::Ticket);
+  ASSERT_EQ(SearchAdmission::Status_Admitted, admission.Admit(*ticket1, retryAfter, "user:a", 1));
+
+  // no slot available: the budget is not charged
+  {
+    SearchAdmission::Ticket ticket2;
+    ASSERT_EQ(SearchAdmission::Status_Busy, admission.Admit(ticket2, retryAfter, "user:a", 5));
+  }
+
+  ticket1.reset();
+
+  {
+    SearchAdmission::Ticket ticket3;
+    ASSERT_EQ(SearchAdmission::Status_Admitted, admission.Admit(ticket3, retryAfter, "user:a", 9));
+  }
+
+  {
+    SearchAdmission::Ticket ticket4, ticket5;
+    ASSERT_EQ(SearchAdmission::Status_RateLimited, admission.Admit(ticket4, retryAfter, "user:a", 1));
+    ASSERT_EQ(SearchAdmission::Status_Admitted, admission.Admit(ticket5, retryAfter, "user:b", 1));
+  }
+}
+
+
+namespace
+{
+  // records the maximum number of files that are read simultaneously
+  class SlowStorageWarmer : public StorageWarmer
+  {
+  private:
+    boost::mutex  mutex_;
+    unsigned int  reading_;
+    unsigned int  maxReading_;
+    unsigned int  readCount_;
+
+  protected:
+    virtual void ReadInstanceFile(const std::string& instanceId)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        reading_++;
+        maxReading_ = std::max(maxReading_, reading_);
+      }
+
+      boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+
+      boost::mutex::scoped_lock lock(mutex_);
+      reading_--;
+      readCount_++;
+    }
+
+  public:
+    SlowStorageWarmer() :
+      reading_(0),
+      maxReading_(0),
+      readCount_(0)
+    {
+    }
+
+    unsigned int GetMaxReading()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return maxReading_;
+    }
+
+    unsigned int GetReadCount()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return readCount_;
+    }
+  };
+}
+
+
+TEST(StorageWarmer, ParallelReads)
+{
+  Json::Value configuration;
+  configuration["Enable"] = true;
+  configuration["MaxParallelReads"] = 4;
+  configuration["WarmDuration"] = 600;
+
+  // the reads do not depend on the size of the TaskExecutor
+  TaskExecutor executor;
+  SlowStorageWarmer warmer;
+  warmer.Configure(configuration, 128);
+  warmer.Start(executor);
+
+  std::vector<std::string> instances;
+  for (unsigned int i = 0; i < 12; i++)
+  {
+    instances.push_back("instance" + boost::lexical_cast<std::string>(i));
+  }
+
+  warmer.QueueReads(instances);
+
+  for (unsigned int i = 0; i < 100 && warmer.GetReadCount() < 12; i++)
+  {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+
+  ASSERT_EQ(12u, warmer.GetReadCount());
+  ASSERT_EQ(4u, warmer.GetMaxReading());
+
+  warmer.Stop();
+}
+
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,41 @@
+import { createStore } from 'vuex'
+import studies from '../src/store/modules/studies'
+import { STUDY_LIST_COLUMNS, MODALITIES_FILTER } from './synthetic-studies'
+
+// A store with the real 'studies' module and the few bits of the other modules that are read by
+// the study list.  Unlike src/store/index.js, it is neither strict nor logging (both would dominate the measures).
+export function createBenchStore(studiesList) {
+    const store = createStore({
+        modules: {
+            studies,
+            configuration: {
+                namespaced: true,
+                state: () => ({
+                    loaded: true,
+                    uiOptions: {
+                        StudyListColumns: STUDY_LIST_COLUMNS,
+                        ModalitiesFilter: MODALITIES_FILTER,
+                        MaxStudiesDisplayed: 100,
+                        StudyListSearchMode: "search-as-you-type",
+                        StudyListSearchAsYouTypeMinChars: 3,
+                        StudyListSearchAsYouTypeDelay: 400,
+                        EnableStorageWarming: false
+                    }
+                })
+            },
+            labels: {
+                namespaced: true,
+                state: () => ({
+                    allLabels: ["urgent", "teaching", "research"]
+                })
+            }
+        }
+    });
+
+    if (studiesList) {
+        store.commit('studies/setStudies', { studies: studiesList });
+        store.commit('studies/setStudiesIds', { studiesIds: studiesList.map(s => s.ID) });
+    }
+
+    return store;
+}
@@ -0,0 +1,70 @@
+import { bench, describe } from 'vitest'
+import { createBenchStore } from './bench-store'
+import { DATASET_SIZES, makeStudies, makeStudy } from './synthetic-studies'
+
+// Cost of the mutations of store/modules/studies.js on lists of growing size.
+// The benches that grow or shrink the list restore it at the end of each iteration so that all
+// iterations run on a list of the same size.
+
+for (const size of DATASET_SIZES) {
+    describe(`studies store - ${size} studies`, () => {
+        const studies = makeStudies(size);
+        const store = createBenchStore(studies);
+        const state = store.state.studies;
+        const middleStudy = studies[Math.floor(size / 2)];
+        const newStudy = makeStudy(size);
+
+        bench('addStudy (new study)', () => {
+            store.commit('studies/addStudy', { studyId: newStudy.ID, study: newStudy });
+            state.studiesIds.pop();
+            state.studies.pop();
+        });
+
+        bench('addStudy (existing study)', () => {
+            store.commit('studies/addStudy', { studyId: middleStudy.ID, study: middleStudy });
+        });
+
+        bench('deleteStudy', () => {
+            store.commit('studies/deleteStudy', { studyId: middleStudy.ID });
+            state.studiesIds.push(middleStudy.ID);
+            state.studies.push(middleStudy);
+        });
+
+        bench('selectStudy + unselect', () => {
+            store.commit('studies/selectStudy', { studyId: middleStudy.ID, isSelected: true });
+            store.commit('studies/selectStudy', { studyId: middleStudy.ID, isSelected: false });
+        });
+
+        bench('selectAllStudies + unselect', () => {
+            store.commit('studies/selectAllStudies', { isSelected: true });
+            store.commit('studies/selectAllStudies', { isSelected: false });
+        });
+
+        bench('refreshStudyLabels', () => {
+            store.commit('studies/refreshStudyLabels', { studyId: middleStudy.ID, labels: ["urgent"] });
+        });
+
+        bench('setStudies + setStudiesIds (full reload)', () => {
+            store.commit('studies/setStudies', { studies: [...studies] });
+            store.commit('studies/setStudiesIds', { studiesIds: studies.map(s => s.ID) });
+        });
+    });
+}
+
+describe('studies store - filter getters', () => {
+    const store = createBenchStore();
+    let i = 0;
+
+    // the getters are cached by vuex -> change a filter before each read to measure their evaluation
+    bench('filterQuery (text + date filters)', () => {
+        store.commit('studies/setFilter', { dicomTagName: 'PatientName', value: (i++ % 2) ? '"DOE' : 'DOE^J' });
+        store.commit('studies/setFilter', { dicomTagName: 'StudyDate', value: '20240101-20240131' });
+        store.commit('studies/setFilter', { dicomTagName: 'ModalitiesInStudy', value: 'CT\\MR' });
+        store.getters['studies/filterQuery'];
+    });
+
+    bench('isFilterEmpty', () => {
+        store.commit('studies/setFilter', { dicomTagName: 'AccessionNumber', value: (i++ % 2) ? 'ACC' : '' });
+        store.getters['studies/isFilterEmpty'];
+    });
+});
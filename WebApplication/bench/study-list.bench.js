@@ -0,0 +1,110 @@
+import { bench, describe } from 'vitest'
+import { h } from 'vue'
+import { mount } from '@vue/test-utils'
+import mitt from 'mitt'
+import i18n from '../src/locales/i18n'
+import StudyList from '../src/components/StudyList.vue'
+import StudyItem from '../src/components/StudyItem.vue'
+import { createBenchStore } from './bench-store'
+import { DATASET_SIZES, MODALITIES_FILTER, STUDY_LIST_COLUMNS, makeStudies } from './synthetic-studies'
+
+// Filtering and column logic of StudyList.vue and rendering of the StudyItem rows.
+
+
+// StudyList itself pulls the date picker, the router and the API calls -> its methods are called
+// on a context that only provides what they read.
+function createStudyListContext(store) {
+    let context = {
+        ...StudyList.data(),
+        $store: store,
+        $router: { replace() {} },
+        $i18n: { t: (...args) => i18n.global.t(...args), te: (...args) => i18n.global.te(...args) },
+        get uiOptions() { return store.state.configuration.uiOptions; },
+        get isConfigurationLoaded() { return store.state.configuration.loaded; },
+        get isSearchAsYouTypeEnabled() { return StudyList.computed.isSearchAsYouTypeEnabled.call(this); }
+    };
+    for (const [name, method] of Object.entries(StudyList.methods)) {
+        context[name] = method.bind(context);
+    }
+    context.filterModalities = {};
+    context.emptyFilterForm();
+    return context;
+}
+
+describe('study list - filters', () => {
+    const store = createBenchStore();
+    const context = createStudyListContext(store);
+    const filters = {
+        "StudyDate": "20240101-20240131",
+        "PatientName": "DOE^J",
+        "AccessionNumber": "ACC0001",
+        "StudyDescription": "CHEST",
+        "ModalitiesInStudy": "CT\\MR",
+        "labels": ["urgent"]
+    };
+
+    bench('updateFilterForm + updateUrl (route -> form -> url)', () => {
+        context.updateFilterForm(filters);
+        context.updateUrl();
+    });
+
+    bench('getModalityFilter', () => {
+        context.getModalityFilter();
+    });
+
+    // same sequence as StudyList.search() without the final reloadStudyList()
+    bench('search filter query construction', async () => {
+        await store.dispatch('studies/clearFilterNoReload');
+        for (const tag of context.uiOptions.StudyListColumns) {
+            if (['modalities', 'seriesCount'].indexOf(tag) == -1) {
+                await store.dispatch('studies/updateFilterNoReload', { dicomTagName: tag, value: context.getFilterValue(tag) });
+            }
+        }
+        await store.dispatch('studies/updateFilterNoReload', { dicomTagName: 'ModalitiesInStudy', value: context.getModalityFilter() });
+        store.getters['studies/filterQuery'];
+    });
+
+    bench('column headers (title, width, placeholder, filter class)', () => {
+        for (const tag of STUDY_LIST_COLUMNS) {
+            context.columnTitle(tag);
+            context.columnWidth(tag);
+            if (context.hasFilter(tag)) {
+                context.getFilterPlaceholder(tag);
+                if (['StudyDate', 'PatientBirthDate', 'modalities'].indexOf(tag) == -1) {
+                    context.getFilterClass(tag);
+                }
+            }
+        }
+    });
+});
+
+
+// one page of rows (MaxStudiesDisplayed) is rendered out of a store containing the whole dataset
+// since each StudyItem looks its study up in the store.
+for (const size of DATASET_SIZES) {
+    describe(`study list - rendering ${size} studies`, () => {
+        const studies = makeStudies(size);
+        const store = createBenchStore(studies);
+        const displayedIds = studies.slice(-store.state.configuration.uiOptions.MaxStudiesDisplayed).map(s => s.ID);
+
+        const StudyTable = {
+            props: ["studiesIds"],
+            render() {
+                return h('table', this.studiesIds.map(id => h(StudyItem, { key: id, studyId: id })));
+            }
+        };
+
+        bench(`mount + unmount ${displayedIds.length} rows`, () => {
+            const messageBus = mitt();  // the rows never unregister their handlers
+            const wrapper = mount(StudyTable, {
+                props: { studiesIds: displayedIds },
+                global: {
+                    plugins: [store, i18n],
+                    mocks: { $route: { query: {} }, messageBus: messageBus },
+                    stubs: { SeriesList: true, StudyDetails: true }
+                }
+            });
+            wrapper.unmount();
+        });
+    });
+}
@@ -0,0 +1,81 @@
+// Synthetic study lists shaped like the answers of tools/find (Expand + RequestedTags) used by the benchmarks.
+// The generator is deterministic so that the results of two runs can be compared.
+
+export const DATASET_SIZES = [1000, 10000, 50000];
+
+export const STUDY_LIST_COLUMNS = ["StudyDate", "AccessionNumber", "PatientID", "PatientName", "PatientBirthDate", "StudyDescription", "modalities", "seriesCount"];
+
+export const MODALITIES_FILTER = ["CR", "CT", "DR", "DX", "KO", "MG", "MR", "NM", "OT", "PR", "PT", "PX", "RTDOSE", "RTSTRUCT", "RTPLAN", "SEG", "SR", "US", "XA", "XC"];
+
+const LAST_NAMES = ["DOE", "SMITH", "MARTIN", "GARCIA", "MULLER", "ROSSI", "DUBOIS", "IVANOV", "KOWALSKI", "NOVAK"];
+const FIRST_NAMES = ["JOHN", "JANE", "PAUL", "MARIA", "LUCAS", "EMMA", "NOAH", "LEA", "ADAM", "SARA"];
+const DESCRIPTIONS = ["CHEST PA", "CT ABDOMEN", "MR BRAIN", "MAMMO SCREENING", "US THYROID", "PET CT WHOLE BODY"];
+const MODALITIES = ["CT", "MR", "CR", "US", "MG", "PT\\CT", "DX", "SR\\CT"];
+const LABELS = ["urgent", "teaching", "research"];
+
+// a tiny LCG: Math.random() can not be seeded
+function makeRandom(seed) {
+    let value = seed;
+    return () => {
+        value = (value * 1103515245 + 12345) & 0x7fffffff;
+        return value;
+    };
+}
+
+function pad(value, length) {
+    return value.toString().padStart(length, '0');
+}
+
+function makeDate(random, firstYear, yearsCount) {
+    return pad(firstYear + random() % yearsCount, 4) + pad(1 + random() % 12, 2) + pad(1 + random() % 28, 2);
+}
+
+function makeId(prefix, i) {
+    // Orthanc IDs are SHA-1 digests formatted as 5 groups of 8 hexadecimal digits
+    const hex = pad((i * 2654435761 >>> 0).toString(16), 8);
+    return [prefix, hex, pad(i.toString(16), 8), hex, pad((i + 1).toString(16), 8)].join('-');
+}
+
+export function makeStudy(i, random = makeRandom(i + 1)) {
+    const seriesCount = 1 + random() % 6;
+    let series = [];
+    for (let s = 0; s < seriesCount; s++) {
+        series.push(makeId(pad(s, 8), i));
+    }
+
+    return {
+        "ID": makeId("5757a1e0", i),
+        "Type": "Study",
+        "IsStable": true,
+        "LastUpdate": "20240101T120000",
+        "ParentPatient": makeId("0a5eb7c1", i % 7919),
+        "Series": series,
+        "Labels": (random() % 10 == 0) ? [LABELS[random() % LABELS.length]] : [],
+        "MainDicomTags": {
+            "StudyDate": makeDate(random, 2000, 25),
+            "StudyTime": pad(random() % 240000, 6),
+            "AccessionNumber": "ACC" + pad(i, 8),
+            "StudyDescription": DESCRIPTIONS[random() % DESCRIPTIONS.length],
+            "StudyInstanceUID": "1.2.826.0.1.3680043.8.498." + i,
+            "StudyID": pad(i % 10000, 4)
+        },
+        "PatientMainDicomTags": {
+            "PatientID": "PAT" + pad(i % 7919, 6),
+            "PatientName": LAST_NAMES[random() % LAST_NAMES.length] + "^" + FIRST_NAMES[random() % FIRST_NAMES.length],
+            "PatientBirthDate": makeDate(random, 1930, 90),
+            "PatientSex": (random() % 2 == 0) ? "F" : "M"
+        },
+        "RequestedTags": {
+            "ModalitiesInStudy": MODALITIES[random() % MODALITIES.length]
+        }
+    };
+}
+
+export function makeStudies(count) {
+    const random = makeRandom(count);
+    let studies = [];
+    for (let i = 0; i < count; i++) {
+        studies.push(makeStudy(i, random));
+    }
+    return studies;
+}
@@ -0,0 +1,168 @@
+// Decoder for the compact CBOR encoding of the plugin lists (see CompactJsonEncoder in Plugin/CborWriter.h):
+//   { "d": <data>, "k": [ <key dictionary> ] }
+// where the object keys are indices in the key dictionary and the arrays of objects are stored in columns.
+
+export const COMPACT_JSON_MIME_TYPE = "application/cbor";
+const COLUMNAR_TAG = 65000;
+const UNDEFINED = Symbol("undefined");
+
+const textDecoder = new TextDecoder("utf-8");
+
+
+class CborReader {
+    constructor(buffer) {
+        this.view = new DataView(buffer);
+        this.bytes = new Uint8Array(buffer);
+        this.offset = 0;
+    }
+
+    readLength(additional) {
+        if (additional < 24) {
+            return additional;
+        }
+        let value;
+        switch (additional) {
+            case 24:
+                value = this.view.getUint8(this.offset);
+                this.offset += 1;
+                return value;
+            case 25:
+                value = this.view.getUint16(this.offset);
+                this.offset += 2;
+                return value;
+            case 26:
+                value = this.view.getUint32(this.offset);
+                this.offset += 4;
+                return value;
+            case 27:
+                // above 2^53, the precision is lost (not used by Orthanc)
+                value = this.view.getUint32(this.offset) * 4294967296 + this.view.getUint32(this.offset + 4);
+                this.offset += 8;
+                return value;
+            default:
+                throw new Error("CBOR: indefinite lengths are not supported");
+        }
+    }
+
+    // returns the raw CBOR structure: maps are returned as arrays of [key, value] pairs
+    readItem() {
+        const initial = this.bytes[this.offset++];
+        const majorType = initial >> 5;
+        const additional = initial & 0x1f;
+
+        switch (majorType) {
+            case 0:
+                return this.readLength(additional);
+            case 1:
+                return -1 - this.readLength(additional);
+            case 2: {
+                const length = this.readLength(additional);
+                const value = this.bytes.slice(this.offset, this.offset + length);
+                this.offset += length;
+                return value;
+            }
+            case 3: {
+                const length = this.readLength(additional);
+                const value = textDecoder.decode(this.bytes.subarray(this.offset, this.offset + length));
+                this.offset += length;
+                return value;
+            }
+            case 4: {
+                const length = this.readLength(additional);
+                const value = new Array(length);
+                for (let i = 0; i < length; i++) {
+                    value[i] = this.readItem();
+                }
+                return value;
+            }
+            case 5: {
+                const length = this.readLength(additional);
+                const value = new Map();
+                for (let i = 0; i < length; i++) {
+                    const key = this.readItem();
+                    value.set(key, this.readItem());
+                }
+                return value;
+            }
+            case 6: {
+                const tag = this.readLength(additional);
+                return { tag: tag, value: this.readItem() };
+            }
+            case 7:
+                return this.readSimple(additional);
+        }
+    }
+
+    readSimple(additional) {
+        let value;
+        switch (additional) {
+            case 20: return false;
+            case 21: return true;
+            case 22: return null;
+            case 23: return UNDEFINED;
+            case 25: {
+                // half precision float
+                const half = this.view.getUint16(this.offset);
+                this.offset += 2;
+                const exponent = (half >> 10) & 0x1f;
+                const fraction = half & 0x3ff;
+                const sign = (half & 0x8000) ? -1 : 1;
+                if (exponent == 0) {
+                    return sign * Math.pow(2, -14) * (fraction / 1024);
+                } else if (exponent == 0x1f) {
+                    return fraction ? NaN : sign * Infinity;
+                }
+                return sign * Math.pow(2, exponent - 15) * (1 + fraction / 1024);
+            }
+            case 26:
+                value = this.view.getFloat32(this.offset);
+                this.offset += 4;
+                return value;
+            case 27:
+                value = this.view.getFloat64(this.offset);
+                this.offset += 8;
+                return value;
+            default:
+                throw new Error("CBOR: unsupported simple value " + additional);
+        }
+    }
+}
+
+
+function rebuild(item, keys) {
+    if (item instanceof Map) {
+        const object = {};
+        for (const [key, value] of item) {
+            object[keys[key]] = rebuild(value, keys);
+        }
+        return object;
+    } else if (Array.isArray(item)) {
+        return item.map(value => rebuild(value, keys));
+    } else if (item !== null && typeof item === "object" && "tag" in item) {
+        if (item.tag != COLUMNAR_TAG) {
+            return rebuild(item.value, keys);  // unknown tags are ignored
+        }
+        const columns = item.value[0].map(key => keys[key]);
+        const rows = new Array(item.value.length - 1);
+        for (let i = 1; i < item.value.length; i++) {
+            const row = {};
+            const cells = item.value[i];
+            for (let j = 0; j < columns.length; j++) {
+                if (cells[j] !== UNDEFINED) {
+                    row[columns[j]] = rebuild(cells[j], keys);
+                }
+            }
+            rows[i - 1] = row;
+        }
+        return rows;
+    } else if (item === UNDEFINED) {
+        return undefined;
+    }
+    return item;
+}
+
+
+export function decodeCompactJson(buffer) {
+    const root = new CborReader(buffer).readItem();
+    return rebuild(root.get("d"), root.get("k"));
+}
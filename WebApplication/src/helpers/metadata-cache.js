@@ -0,0 +1,202 @@
+import axios from "axios"
+
+import { oe2ApiUrl } from "../globalConfigurations";
+
+// A browser side cache for the resources metadata (series lists, instance lists, tags, ...).
+// Each entry is stored with the list of Orthanc ids it depends on.  Before an entry is served,
+// the cache is validated against the changes that have occurred in Orthanc since the last validation
+// (api/changes/resources) and the entries that depend on a modified or deleted resource are evicted.
+
+const DB_NAME = "oe2-metadata-cache";
+const DB_VERSION = 1;
+const ENTRIES_STORE = "entries";
+const META_STORE = "meta";
+const CURSOR_KEY = "cursor";
+const VALIDATION_INTERVAL_MS = 2000;  // don't validate more than once every 2 seconds
+const MAX_ENTRIES = 5000;
+
+let dbPromise = null;
+let validationPromise = null;
+let lastValidationTime = 0;
+let enabled = false;
+let owner = null;
+
+
+function requestToPromise(request) {
+    return new Promise((resolve, reject) => {
+        request.onsuccess = () => resolve(request.result);
+        request.onerror = () => reject(request.error);
+    });
+}
+
+function transactionToPromise(transaction) {
+    return new Promise((resolve, reject) => {
+        transaction.oncomplete = () => resolve();
+        transaction.onerror = () => reject(transaction.error);
+        transaction.onabort = () => reject(transaction.error);
+    });
+}
+
+function openDb() {
+    if (!dbPromise) {
+        dbPromise = new Promise((resolve, reject) => {
+            const request = window.indexedDB.open(DB_NAME, DB_VERSION);
+            request.onupgradeneeded = () => {
+                const db = request.result;
+                const entries = db.createObjectStore(ENTRIES_STORE, { keyPath: "key" });
+                entries.createIndex("ids", "ids", { multiEntry: true });
+                entries.createIndex("lastAccess", "lastAccess");
+                db.createObjectStore(META_STORE);
+            };
+            request.onsuccess = () => resolve(request.result);
+            request.onerror = () => reject(request.error);
+        });
+    }
+    return dbPromise;
+}
+
+// a cheap non-cryptographic hash to detect that another user has logged in without storing its identity
+function hashString(value) {
+    let hash = 0;
+    for (let i = 0; i < value.length; i++) {
+        hash = ((hash << 5) - hash + value.charCodeAt(i)) | 0;
+    }
+    return hash.toString(16);
+}
+
+async function clearAll(db, cursor) {
+    const transaction = db.transaction([ENTRIES_STORE, META_STORE], "readwrite");
+    transaction.objectStore(ENTRIES_STORE).clear();
+    transaction.objectStore(META_STORE).put(cursor, CURSOR_KEY);
+    await transactionToPromise(transaction);
+}
+
+async function evict(db, ids, cursor) {
+    const transaction = db.transaction([ENTRIES_STORE, META_STORE], "readwrite");
+    const index = transaction.objectStore(ENTRIES_STORE).index("ids");
+
+    for (const id of ids) {
+        const keys = await requestToPromise(index.getAllKeys(id));
+        for (const key of keys) {
+            transaction.objectStore(ENTRIES_STORE).delete(key);
+        }
+    }
+    transaction.objectStore(META_STORE).put(cursor, CURSOR_KEY);
+    await transactionToPromise(transaction);
+}
+
+async function doValidate() {
+    const db = await openDb();
+    const cursor = await requestToPromise(db.transaction(META_STORE).objectStore(META_STORE).get(CURSOR_KEY));
+
+    if (!cursor || cursor.owner != owner) {
+        const current = (await axios.get(oe2ApiUrl + "changes/resources")).data;
+        await clearAll(db, { owner: owner, last: current["Last"], deletionsLast: current["DeletionsLast"], journal: current["Journal"] });
+        return;
+    }
+
+    const changes = (await axios.get(oe2ApiUrl + "changes/resources", {
+        params: { "since": cursor.last, "deletions-since": cursor.deletionsLast, "journal": cursor.journal }
+    })).data;
+
+    const newCursor = { owner: owner, last: changes["Last"], deletionsLast: changes["DeletionsLast"], journal: changes["Journal"] };
+
+    if (changes["Reset"]) {
+        await clearAll(db, newCursor);
+    } else {
+        await evict(db, [...changes["Studies"], ...changes["Series"], ...changes["Deleted"]], newCursor);
+    }
+}
+
+async function validate() {
+    if (validationPromise) {
+        return validationPromise;
+    }
+    if (Date.now() - lastValidationTime < VALIDATION_INTERVAL_MS) {
+        return;
+    }
+
+    validationPromise = doValidate().finally(() => {
+        lastValidationTime = Date.now();
+        validationPromise = null;
+    });
+    return validationPromise;
+}
+
+async function trimIfNeeded(db) {
+    const transaction = db.transaction(ENTRIES_STORE, "readwrite");
+    const store = transaction.objectStore(ENTRIES_STORE);
+    const count = await requestToPromise(store.count());
+
+    if (count > MAX_ENTRIES) {
+        // evict the least recently used entries
+        const keys = await requestToPromise(store.index("lastAccess").getAllKeys(null, count - MAX_ENTRIES));
+        for (const key of keys) {
+            store.delete(key);
+        }
+    }
+    await transactionToPromise(transaction);
+}
+
+
+export default {
+    // the cache is disabled by default since it stores patient data in the browser
+    // 'userIdentity' must be stable across token refreshes (e.g. the user profile).  Without a user identity,
+    // the cache is disabled since it could be shared between the users of the same browser.
+    configure(isEnabled, userIdentity) {
+        enabled = isEnabled && !!window.indexedDB && !!userIdentity;
+        owner = userIdentity ? hashString(userIdentity) : null;
+    },
+
+    // 'getIds(value)' returns the Orthanc ids the value depends on, the entry is evicted when any of them is modified or deleted
+    async get(key, fetch, getIds) {
+        if (!enabled) {
+            return fetch();
+        }
+
+        let db = null;
+        try {
+            await validate();
+            db = await openDb();
+
+            const store = db.transaction(ENTRIES_STORE, "readwrite").objectStore(ENTRIES_STORE);
+            const entry = await requestToPromise(store.get(key));
+            if (entry) {
+                entry.lastAccess = Date.now();
+                store.put(entry);
+                return entry.value;
+            }
+        } catch (err) {
+            console.warn("metadata cache is not available: ", err);
+            return fetch();
+        }
+
+        const value = await fetch();
+
+        try {
+            const transaction = db.transaction(ENTRIES_STORE, "readwrite");
+            transaction.objectStore(ENTRIES_STORE).put({ key: key, value: value, ids: getIds(value), lastAccess: Date.now() });
+            await transactionToPromise(transaction);
+            await trimIfNeeded(db);
+        } catch (err) {
+            console.warn("unable to store in the metadata cache: ", err);
+        }
+        return value;
+    },
+
+    // to call after a modification performed by this UI to avoid waiting for the next validation
+    async invalidate(ids) {
+        if (!enabled) {
+            return;
+        }
+        try {
+            const db = await openDb();
+            const cursor = await requestToPromise(db.transaction(META_STORE).objectStore(META_STORE).get(CURSOR_KEY));
+            if (cursor) {
+                await evict(db, ids, cursor);
+            }
+        } catch (err) {
+            console.warn("unable to invalidate the metadata cache: ", err);
+        }
+    }
+}
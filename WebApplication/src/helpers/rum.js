@@ -0,0 +1,93 @@
+import axios from "axios"
+
+import { oe2ApiUrl } from "../globalConfigurations";
+
+// Real-user monitoring: the latencies perceived by the user are batched and sent to the plugin (api/rum)
+// that aggregates them per metric and per client subnet.  The metrics must be known by Plugin/RumCollector.cpp:
+//   "navigation", "first-row", "search", "viewer-launch"   (all values in ms)
+
+const FLUSH_INTERVAL_MS = 30000;
+const MAX_PENDING_SAMPLES = 50;
+
+let enabled = false;
+let pending = [];
+let flushTimer = null;
+
+
+function flush() {
+    if (flushTimer) {
+        clearTimeout(flushTimer);
+        flushTimer = null;
+    }
+    if (pending.length == 0) {
+        return;
+    }
+
+    const url = oe2ApiUrl + "rum";
+    const body = JSON.stringify({ "Samples": pending });
+    pending = [];
+
+    // sendBeacon() survives the closing of the page but can not carry the auth header (e.g. Keycloak)
+    // -> in this case, use a 'keepalive' fetch that also survives the closing of the page
+    const token = axios.defaults.headers.common['token'];
+    if (!token && navigator.sendBeacon && navigator.sendBeacon(url, new Blob([body], { type: "application/json" }))) {
+        return;
+    }
+
+    let headers = { "Content-Type": "application/json" };
+    if (token) {
+        headers["token"] = token;
+    }
+    fetch(url, { method: "POST", body: body, headers: headers, keepalive: true }).catch(() => {});
+}
+
+function recordNavigation() {
+    const entries = performance.getEntriesByType ? performance.getEntriesByType("navigation") : [];
+    if (entries.length > 0 && entries[0].loadEventEnd > 0) {
+        record("navigation", entries[0].loadEventEnd);
+    }
+}
+
+function record(metric, durationMs) {
+    if (!enabled || !(durationMs >= 0)) {
+        return;
+    }
+
+    pending.push({ "Metric": metric, "Value": Math.round(durationMs * 10) / 10 });
+
+    if (pending.length >= MAX_PENDING_SAMPLES) {
+        flush();
+    } else if (!flushTimer) {
+        flushTimer = setTimeout(flush, FLUSH_INTERVAL_MS);
+    }
+}
+
+
+export default {
+    configure(isEnabled) {
+        if (enabled || !isEnabled) {
+            return;
+        }
+        enabled = true;
+
+        document.addEventListener("visibilitychange", () => {
+            if (document.visibilityState === "hidden") {
+                flush();
+            }
+        });
+
+        if (document.readyState === "complete") {
+            recordNavigation();
+        } else {
+            window.addEventListener("load", () => setTimeout(recordNavigation, 0));
+        }
+    },
+
+    record,
+
+    // returns a function that records the time elapsed since the call to start()
+    start(metric) {
+        const startTime = performance.now();
+        return () => record(metric, performance.now() - startTime);
+    }
+}
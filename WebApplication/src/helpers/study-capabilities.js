@@ -0,0 +1,15 @@
+// The content flags computed by the plugin for each study (see StudyCapability in Plugin/StudyCapabilitiesIndex.h).
+// They are returned in the "Capabilities" field of the studies lists once the study has been analysed.
+
+export const StudyCapability = {
+    Images: 1 << 0,                  // at least one series that is not SM, ECG, SR or SEG
+    PetCt: 1 << 1,                   // PT and CT series (and no SM)
+    Volumetric: 1 << 2,              // a CT, MR or PT series with enough slices for a volume rendering
+    Segmentation: 1 << 3,            // SEG or RTSTRUCT series
+    Wsi: 1 << 4,                     // whole slide images (SM)
+    SegmentationCompatible: 1 << 5   // a series that can be segmented
+};
+
+export function hasCapability(capabilities, capability) {
+    return (capabilities & capability) != 0;
+}
@@ -2,6 +2,30 @@ import axios from "axios"
 import store from "./store"
 
 import { orthancApiUrl, oe2ApiUrl } from "./globalConfigurations";
+import metadataCache from "./helpers/metadata-cache";
+import { decodeCompactJson, COMPACT_JSON_MIME_TYPE } from "./helpers/compact-json";
+
+// request options for the lists built by the plugin: if enabled, they are transferred in a compact binary encoding
+function listRequestOptions(options = {}) {
+    if (!store.state.configuration.uiOptions.EnableCompactListEncoding) {
+        return options;
+    }
+    return {
+        ...options,
+        responseType: "arraybuffer",
+        headers: { "Accept": COMPACT_JSON_MIME_TYPE + ", application/json" },
+        transformResponse: (data, headers) => {
+            if (headers["content-type"] && headers["content-type"].startsWith(COMPACT_JSON_MIME_TYPE)) {
+                return decodeCompactJson(data);
+            }
+            try {
+                return JSON.parse(new TextDecoder("utf-8").decode(data));  // e.g. the errors
+            } catch (err) {
+                return data;
+            }
+        }
+    };
+}
 
 export default {
     updateAuthHeader() {
@@ -23,6 +47,9 @@ export default {
         return (await axios.get(orthancApiUrl + "system")).data;
     },
     async sendToDicomWebServer(resourcesIds, destination) {
+        if (this.isLargeSelection(resourcesIds)) {
+            return (await this.applySelectionAction(resourcesIds, "send", { "Target": "dicom-web", "Destination": destination }))['ID'];
+        }
         const response = (await axios.post(orthancApiUrl + "dicom-web/servers/" + destination + "/stow", {
             "Resources" : resourcesIds,
             "Synchronous": false
@@ -31,6 +58,9 @@ export default {
         return response.data['ID'];
     },
     async sendToOrthancPeer(resourcesIds, destination) {
+        if (this.isLargeSelection(resourcesIds)) {
+            return (await this.applySelectionAction(resourcesIds, "send", { "Target": "peer", "Destination": destination }))['ID'];
+        }
         const response = (await axios.post(orthancApiUrl + "peers/" + destination + "/store", {
             "Resources" : resourcesIds,
             "Synchronous": false
@@ -39,6 +69,9 @@ export default {
         return response.data['ID'];
     },
     async sendToOrthancPeerWithTransfers(resources, destination) {
+        if (this.isLargeSelection(resources) && resources.every(r => r["Level"] == "Study")) {
+            return (await this.applySelectionAction(resources.map(r => r["ID"]), "send", { "Target": "transfers", "Destination": destination }))['ID'];
+        }
         const response = (await axios.post(orthancApiUrl + "transfers/send", {
             "Resources" : resources,
             "Compression": "gzip",
@@ -49,6 +82,9 @@ export default {
         return response.data['ID'];
     },
     async sendToDicomModality(resourcesIds, destination) {
+        if (this.isLargeSelection(resourcesIds)) {
+            return (await this.applySelectionAction(resourcesIds, "send", { "Target": "modality", "Destination": destination }))['ID'];
+        }
         const response = (await axios.post(orthancApiUrl + "modalities/" + destination + "/store", {
             "Resources" : resourcesIds,
             "Synchronous": false
@@ -61,12 +97,21 @@ export default {
         return response.data;
     },
     async deleteResource(level, orthancId) {
-        return axios.delete(orthancApiUrl + this.pluralizeResourceLevel(level) + "/" + orthancId);
+        const response = await axios.delete(orthancApiUrl + this.pluralizeResourceLevel(level) + "/" + orthancId);
+        await metadataCache.invalidate([orthancId]);
+        return response;
     },
     async deleteResources(resourcesIds) {
-        return axios.post(orthancApiUrl + "tools/bulk-delete", {
-            "Resources": resourcesIds
-        });
+        let response = null;
+        if (this.isLargeSelection(resourcesIds)) {
+            response = await this.applySelectionAction(resourcesIds, "delete");
+        } else {
+            response = await axios.post(orthancApiUrl + "tools/bulk-delete", {
+                "Resources": resourcesIds
+            });
+        }
+        await metadataCache.invalidate(resourcesIds);
+        return response;
     },
     async cancelFindStudies() {
         if (window.axiosFindStudiesAbortController) {
@@ -92,10 +137,23 @@ export default {
             payload["LabelsConstraint"] = LabelsConstraint;
         }
 
-        return (await axios.post(orthancApiUrl + "tools/find", payload, 
+        // this route applies the admission control of the plugin before calling tools/find
+        return (await axios.post(oe2ApiUrl + "studies/find", payload, listRequestOptions(
             {
                 signal: window.axiosFindStudiesAbortController.signal
-            })).data;
+            }))).data;
+    },
+    async getStudiesDelta(since, filterQuery, labels, LabelsConstraint, touchedStudiesIds) {
+        let params = new URLSearchParams(filterQuery);
+        params.set("since", since);
+        if (labels && labels.length > 0) {
+            params.set("labels", labels.join(","));
+            params.set("labels-constraint", LabelsConstraint);
+        }
+        if (touchedStudiesIds && touchedStudiesIds.length > 0) {
+            params.set("ids", touchedStudiesIds.join(","));
+        }
+        return (await axios.get(oe2ApiUrl + "studies/delta?" + params.toString(), listRequestOptions())).data;
     },
     async getLastChangeId() {
         const response = (await axios.get(orthancApiUrl + "changes?last"));
@@ -117,12 +175,12 @@ export default {
                 query[tag] = patientTags[tag];
             }
         }
-        const response = (await axios.post(orthancApiUrl + "tools/find", {
+        const response = (await axios.post(oe2ApiUrl + "studies/find", {
             "Level": "Study",
             "Limit": store.state.configuration.uiOptions.MaxStudiesDisplayed,
             "Query": query,
             "Expand": false
-        }));
+        }, listRequestOptions()));
         return response.data;
     },
     async findPatient(patientId) {
@@ -205,14 +263,24 @@ export default {
         // returns the same result as a findStudies (including RequestedTags !)
         return (await axios.get(orthancApiUrl + "studies/" + orthancId + "?requestedTags=ModalitiesInStudy")).data;
     },
+    async warmStudy(orthancId) {
+        // reads the files of the study in the background on the object storage backends
+        return (await axios.post(oe2ApiUrl + "studies/" + orthancId + "/warm")).data;
+    },
     async getStudySeries(orthancId) {
-        return (await axios.get(orthancApiUrl + "studies/" + orthancId + "/series")).data;
+        return metadataCache.get("study-series/" + orthancId,
+            async () => (await axios.get(orthancApiUrl + "studies/" + orthancId + "/series")).data,
+            (series) => [orthancId, ...series.map(s => s["ID"])]);
     },
     async getSeriesInstances(orthancId) {
-        return (await axios.get(orthancApiUrl + "series/" + orthancId + "/instances")).data;
+        return metadataCache.get("series-instances/" + orthancId,
+            async () => (await axios.get(orthancApiUrl + "series/" + orthancId + "/instances")).data,
+            (instances) => [orthancId, ...instances.map(i => i["ID"])]);
     },
     async getStudyInstances(orthancId) {
-        return (await axios.get(orthancApiUrl + "studies/" + orthancId + "/instances")).data;
+        return metadataCache.get("study-instances/" + orthancId,
+            async () => (await axios.get(orthancApiUrl + "studies/" + orthancId + "/instances")).data,
+            (instances) => [orthancId, ...instances.map(i => i["ID"])]);
     },
     async getSeriesParentStudy(orthancId) {
         return (await axios.get(orthancApiUrl + "series/" + orthancId + "/study")).data;
@@ -232,13 +300,19 @@ export default {
         }
     },
     async getInstanceTags(orthancId) {
-        return (await axios.get(orthancApiUrl + "instances/" + orthancId + "/tags")).data;
+        return metadataCache.get("instance-tags/" + orthancId,
+            async () => (await axios.get(orthancApiUrl + "instances/" + orthancId + "/tags")).data,
+            () => [orthancId]);
     },
     async getSimplifiedInstanceTags(orthancId) {
-        return (await axios.get(orthancApiUrl + "instances/" + orthancId + "/tags?simplify")).data;
+        return metadataCache.get("instance-simplified-tags/" + orthancId,
+            async () => (await axios.get(orthancApiUrl + "instances/" + orthancId + "/tags?simplify")).data,
+            () => [orthancId]);
     },
     async getInstanceHeader(orthancId) {
-        return (await axios.get(orthancApiUrl + "instances/" + orthancId + "/header")).data;
+        return metadataCache.get("instance-header/" + orthancId,
+            async () => (await axios.get(orthancApiUrl + "instances/" + orthancId + "/header")).data,
+            () => [orthancId]);
     },
     async getStatistics() {
         return (await axios.get(orthancApiUrl + "statistics")).data;
@@ -277,6 +351,8 @@ export default {
             "Synchronous": false
         }))
 
+        // the modification runs in a job: the next validation of the cache also evicts the modified resources
+        await metadataCache.invalidate([orthancId]);
         return response.data['ID'];
     },
 
@@ -287,14 +363,31 @@ export default {
 
     async addLabel({studyId, label}) {
         await axios.put(orthancApiUrl + "studies/" + studyId + "/labels/" + label, "");
+        await metadataCache.invalidate([studyId]);
         return label;
     },
 
     async removeLabel({studyId, label}) {
         await axios.delete(orthancApiUrl + "studies/" + studyId + "/labels/" + label);
+        await metadataCache.invalidate([studyId]);
         return label;
     },
 
+    // adds/removes labels to/from all the studies of a large selection in a single request.
+    // Returns the labels that have been removed by 'removeAll'.
+    async updateSelectionLabels(studiesIds, {labelsToAdd = [], labelsToRemove = [], removeAll = false}) {
+        const answer = await this.applySelectionAction(studiesIds, "labels", {
+            "Add": labelsToAdd,
+            "Remove": labelsToRemove,
+            "RemoveAll": removeAll
+        });
+        await metadataCache.invalidate(studiesIds);
+        if (answer["FailedCount"] > 0) {
+            console.warn("The labels of " + answer["FailedCount"] + " studies could not be updated", answer["Failed"]);
+        }
+        return answer["RemovedLabels"];
+    },
+
     async removeAllLabels(studyId) {
         const labels = await this.getLabels(studyId);
         let promises = [];
@@ -340,6 +433,16 @@ export default {
 
 
     async createToken({tokenType, resourcesIds, level, validityDuration=null, id=null, expirationDate=null}) {
+        if (level == 'study' && this.isLargeSelection(resourcesIds)) {
+            // the plugin collects the StudyInstanceUIDs and creates the token
+            return this.applySelectionAction(resourcesIds, "share", {
+                "Type": tokenType,
+                "ValidityDuration": validityDuration,
+                "ExpirationDate": expirationDate != null ? expirationDate.toJSON() : null,
+                "Id": id
+            });
+        }
+
         let body = {
             "Resources" : [],
             "Type": tokenType
@@ -381,6 +484,42 @@ export default {
         return response.data;
     },
 
+    ////////////////////////////////////////// SELECTIONS
+    // the bulk actions on large selections of studies send the ids once to the plugin (api/selections)
+    // and refer to the selection by its id
+    isLargeSelection(resourcesIds) {
+        const minSize = store.state.configuration.uiOptions.ServerSideSelectionsMinSize;
+        return minSize > 0 && resourcesIds.length >= minSize;
+    },
+    async createSelection(body) {
+        return (await axios.post(oe2ApiUrl + "selections", body)).data;
+    },
+    // the selection is created once by the studies store and reused by all the bulk actions on the same studies
+    async applySelectionAction(studiesIds, action, body = {}) {
+        const apply = async () => {
+            const selectionId = await store.dispatch('studies/getServerSelectionId', { studiesIds: studiesIds });
+            return (await axios.post(oe2ApiUrl + "selections/" + selectionId + "/" + action, body)).data;
+        };
+
+        try {
+            return await apply();
+        } catch (err) {
+            if (err.response && err.response.status == 410) {
+                await store.dispatch('studies/forgetServerSelection');  // expired on the server -> created again
+                return await apply();
+            }
+            throw err;
+        }
+    },
+    // the zip (or DICOMDIR) of a large selection is created by an asynchronous job, to download from
+    // jobs/{id}/archive once the job has succeeded.  Returns the id of the job.
+    async createBulkArchiveJob(studiesIds, isDicomDir) {
+        return (await this.applySelectionAction(studiesIds, isDicomDir ? "media" : "archive"))['ID'];
+    },
+    getJobArchiveUrl(jobId) {
+        return orthancApiUrl + "jobs/" + jobId + "/archive";
+    },
+
     ////////////////////////////////////////// HELPERS
     getOsimisViewerUrl(level, resourceOrthancId) {
         return orthancApiUrl + 'osimis-viewer/app/index.html?' + level + '=' + resourceOrthancId;
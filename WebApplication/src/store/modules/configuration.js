@@ -1,4 +1,6 @@
 import api from "../../orthancApi"
+import metadataCache from "../../helpers/metadata-cache"
+import rum from "../../helpers/rum"
 
 ///////////////////////////// STATE
 const state = () => ({
@@ -103,6 +105,8 @@ const actions = {
         if ('Profile' in oe2Config) {
             commit('setUserProfile', { profile: oe2Config['Profile']});
         }
+        metadataCache.configure(oe2Config['UiOptions']['EnableMetadataCache'], 'Profile' in oe2Config ? JSON.stringify(oe2Config['Profile']) : null);
+        rum.configure(oe2Config['UiOptions']['EnableRealUserMonitoring']);
         document._mustTranslateDicomTags = oe2Config['UiOptions']['TranslateDicomTags'];
 
         if ('HasCustomLogo' in oe2Config) {
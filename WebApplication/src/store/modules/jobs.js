@@ -5,6 +5,8 @@ import api from "../../orthancApi"
 //     'name': "Send to DICOM PACS"
 //     'isRunning': false,
 //     'status': //response from orthanc /jobs/...
+//     'downloadUrl': null  // e.g. the zip created by the job, to download once the job has succeeded
+//     'downloadResourcesIds': []  // the studies in the download (for the instant-link token)
 // }
 
 ///////////////////////////// STATE
@@ -21,12 +23,14 @@ const getters = {
 ///////////////////////////// MUTATIONS
 
 const mutations = {
-    addJob(state, { jobId, name }) {
+    addJob(state, { jobId, name, downloadUrl, downloadResourcesIds }) {
         const job = {
             'id': jobId,
             'name': name,
             'isRunning': true,
-            'status': null
+            'status': null,
+            'downloadUrl': downloadUrl || null,
+            'downloadResourcesIds': downloadResourcesIds || []
         }
         state.jobsIds.push(jobId);
         state.jobs[jobId] = job;
@@ -46,7 +50,7 @@ const actions = {
     addJob({ commit, state }, payload) {
         const jobId = payload['jobId'];
         const name = payload['name'];
-        commit('addJob', { jobId: jobId, name: name });
+        commit('addJob', { jobId: jobId, name: name, downloadUrl: payload['downloadUrl'], downloadResourcesIds: payload['downloadResourcesIds'] });
 
         if (this.state.configuration.uiOptions.MaxMyJobsHistorySize > 0) {
             while (state.jobsIds.length >  this.state.configuration.uiOptions.MaxMyJobsHistorySize) {
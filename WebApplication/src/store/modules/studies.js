@@ -1,4 +1,5 @@
 import api from "../../orthancApi"
+import rum from "../../helpers/rum"
 
 const _clearedFilter = {
     StudyDate : "",
@@ -15,14 +16,33 @@ const _clearedFilter = {
 const state = () => ({
     studies: [],  // studies as returned by tools/find
     studiesIds: [],
+    lastChangeSeq: null, // the change sequence at the time the studies have been loaded (used to get the delta)
+    reloadRequestsCount: 0, // incremented when the list can not be patched and must be reloaded by the StudyList
     dicomTagsFilters: {..._clearedFilter},
     labelsFilter: [],
     statistics: {},
     isSearching: false,
+    searchRejectionReason: null, // set when the plugin refuses to run the search ('too-expensive', 'rate-limited', 'busy')
     selectedStudiesIds: [],
-    selectedStudies: []
+    selectedStudies: [],
+    selectionVersion: 0,      // incremented each time the selection or the list changes
+    serverSelectionId: null   // the server-side selection (api/selections) of the selected studies, when it is large
 })
 
+// the creation of the server-side selection of a version of the selection, shared by the bulk actions
+let pendingServerSelection = null;  // { version, promise }
+
+// the server-side selection must be recreated when the selection or the list changes (e.g. patched by a delta)
+function invalidateServerSelection(state) {
+    state.selectionVersion++;
+    state.serverSelectionId = null;
+}
+
+function isSameSelection(studiesIds, otherStudiesIds) {
+    return studiesIds === otherStudiesIds ||
+        (studiesIds.length == otherStudiesIds.length && studiesIds.every((id, i) => id == otherStudiesIds[i]));
+}
+
 function insert_wildcards(initialValue) {
     // 'filter'   -> *filter* (by default, adds the wildcard before and after)
     // '"filter'  -> filter*  (a double quote means "no wildcard")
@@ -64,11 +84,19 @@ const getters = {
 const mutations = {
     setStudiesIds(state, { studiesIds }) {
         state.studiesIds = studiesIds;
+        invalidateServerSelection(state);
     },
     setStudies(state, { studies }) {
         state.studies = studies;
     },
+    setLastChangeSeq(state, { lastChangeSeq }) {
+        state.lastChangeSeq = lastChangeSeq;
+    },
+    requestReload(state) {
+        state.reloadRequestsCount++;
+    },
     addStudy(state, { studyId, study }) {
+        invalidateServerSelection(state);
         if (!state.studiesIds.includes(studyId)) {
             state.studiesIds.push(studyId);
             state.studies.push(study);
@@ -94,6 +122,7 @@ const mutations = {
         }
     },
     deleteStudy(state, {studyId}) {
+        invalidateServerSelection(state);
         const pos = state.studiesIds.indexOf(studyId);
         if (pos >= 0) {
             state.studiesIds.splice(pos, 1);
@@ -103,7 +132,8 @@ const mutations = {
         // also delete from selection
         const pos2 = state.selectedStudiesIds.indexOf(studyId);
         if (pos2 >= 0) {
-            state.selectedStudiesIds.splice(pos, 1);
+            state.selectedStudiesIds.splice(pos2, 1);
+            state.selectedStudies = state.selectedStudies.filter(s => s["ID"] != studyId);
         }
     },
     refreshStudyLabels(state, {studyId, labels}) {
@@ -119,7 +149,11 @@ const mutations = {
     setIsSearching(state, {isSearching}) {
         state.isSearching = isSearching;
     },
+    setSearchRejectionReason(state, {reason}) {
+        state.searchRejectionReason = reason;
+    },
     selectStudy(state, {studyId, isSelected}) {
+        invalidateServerSelection(state);
         if (isSelected && !state.selectedStudiesIds.includes(studyId)) {
             state.selectedStudiesIds.push(studyId);
             state.selectedStudies = state.selectedStudies.concat(state.studies.filter(s => state.selectedStudiesIds.includes(s["ID"])))
@@ -132,6 +166,7 @@ const mutations = {
         }
     },
     selectAllStudies(state, {isSelected}) {
+        invalidateServerSelection(state);
         if (isSelected) {
             state.selectedStudiesIds = [...state.studiesIds];
             state.selectedStudies = [...state.studies];
@@ -140,6 +175,11 @@ const mutations = {
             state.selectedStudies = [];
         }
        
+    },
+    setServerSelectionId(state, {version, selectionId}) {
+        if (version == state.selectionVersion) {
+            state.serverSelectionId = selectionId;
+        }
     }
 }
 
@@ -173,28 +213,77 @@ const actions = {
     async clearFilterNoReload({ commit }) {
         commit('clearFilter');
     },
-    async clearStudies({ commit }) {
+    async clearStudies({ commit }, payload) {
         commit('setStudiesIds', { studiesIds: [] });
         commit('setStudies', { studies: [] });
+        commit('setLastChangeSeq', { lastChangeSeq: (payload && payload['lastChangeSeq']) || null });
     },
     async reloadFilteredStudies({ commit, getters, state }) {
         commit('setStudiesIds', { studiesIds: [] });
         commit('setStudies', { studies: [] });
+        commit('setSearchRejectionReason', { reason: null });
 
         if (!getters.isFilterEmpty) {
             try {
                 commit('setIsSearching', { isSearching: true});
+                commit('setLastChangeSeq', { lastChangeSeq: null });
+                // get the last change before the search to make sure no change is missed by the next delta
+                const lastChangeSeq = await api.getLastChangeId();
+                const searchDone = rum.start("search");
                 const studies = (await api.findStudies(getters.filterQuery, state.labelsFilter, "All"));
+                searchDone();
                 let studiesIds = studies.map(s => s['ID']);
                 commit('setStudiesIds', { studiesIds: studiesIds });
                 commit('setStudies', { studies: studies });
+                commit('setLastChangeSeq', { lastChangeSeq: lastChangeSeq });
             } catch (err) {
-                console.log("Find studies cancelled");
+                if (err.response && err.response.data && err.response.data["Reason"]) {
+                    console.warn("Find studies rejected: ", err.response.data["Message"]);
+                    commit('setSearchRejectionReason', { reason: err.response.data["Reason"] });
+                } else {
+                    console.log("Find studies cancelled");
+                }
             } finally {
                 commit('setIsSearching', { isSearching: false});
             }
         }
     },
+    async syncFilteredStudies({ commit, getters, state }, payload) {
+        // patches the current list with the studies that have changed since it has been loaded
+        // instead of reloading the full list (e.g. after a bulk delete or a labels update)
+        const touchedStudiesIds = (payload && payload['touchedStudiesIds']) || [];
+        const isFilteredList = !getters.isFilterEmpty;
+
+        // the StudyList knows whether it displays a search result or the most recent studies
+        if (state.lastChangeSeq == null) {
+            commit('requestReload');
+            return;
+        }
+
+        let delta = null;
+        try {
+            delta = await api.getStudiesDelta(state.lastChangeSeq, getters.filterQuery, state.labelsFilter, "All", touchedStudiesIds);
+        } catch (err) {
+            console.warn("Unable to get the studies delta", err);
+        }
+
+        if (delta == null || delta["Reset"]) {
+            commit('requestReload');
+            return;
+        }
+
+        for (const studyId of delta["Removed"]) {
+            commit('deleteStudy', { studyId: studyId });
+        }
+        for (const study of delta["Updated"]) {
+            // when displaying the most recent studies (no filter), only update the studies that are displayed
+            if (isFilteredList || state.studiesIds.includes(study["ID"])) {
+                commit('addStudy', { studyId: study["ID"], study: study });
+            }
+        }
+        commit('setLastChangeSeq', { lastChangeSeq: delta["Last"] });
+        this.dispatch('studies/loadStatistics');
+    },
     async cancelSearch() {
         await api.cancelFindStudies();
     },
@@ -218,9 +307,56 @@ const actions = {
         const isSelected = payload['isSelected'];
         commit('selectStudy', { studyId: studyId, isSelected: isSelected});
     },
-    async selectAllStudies({ commit }, payload) {
+    async selectAllStudies({ commit, state }, payload) {
         const isSelected = payload['isSelected'];
         commit('selectAllStudies', { isSelected: isSelected});
+
+        // prepare the selection of the bulk actions while the user chooses one
+        if (isSelected && api.isLargeSelection(state.selectedStudiesIds)) {
+            this.dispatch('studies/getServerSelectionId', { studiesIds: state.selectedStudiesIds }).catch(() => {});
+        }
+    },
+    // Returns the id of the server-side selection of the selected studies.  It is created once per version of
+    // the selection and reused by all the bulk actions.  It is always created from the ids of the selected studies
+    // so that a bulk action never reaches a study that has not been displayed.
+    async getServerSelectionId({ commit, state }, payload) {
+        const studiesIds = payload['studiesIds'];
+
+        if (!isSameSelection(studiesIds, state.selectedStudiesIds)) {
+            // not the selection of the study list
+            return (await api.createSelection({ "Resources": studiesIds }))["ID"];
+        }
+
+        if (state.serverSelectionId != null) {
+            return state.serverSelectionId;
+        }
+
+        const version = state.selectionVersion;
+        if (pendingServerSelection == null || pendingServerSelection.version != version) {
+            const selectedIds = [...state.selectedStudiesIds];
+
+            const create = async () => {
+                return (await api.createSelection({ "Resources": selectedIds }))["ID"];
+            };
+
+            pendingServerSelection = { version: version, promise: create() };
+        }
+
+        try {
+            const selectionId = await pendingServerSelection.promise;
+            commit('setServerSelectionId', { version: version, selectionId: selectionId });
+            return selectionId;
+        } catch (err) {
+            if (pendingServerSelection != null && pendingServerSelection.version == version) {
+                pendingServerSelection = null;  // retry on the next action
+            }
+            throw err;
+        }
+    },
+    // e.g. the selection has expired on the server
+    async forgetServerSelection({ commit, state }) {
+        pendingServerSelection = null;
+        commit('setServerSelectionId', { version: state.selectionVersion, selectionId: null });
     },
     async reloadStudy({ commit }, payload) {
         const studyId = payload['studyId'];
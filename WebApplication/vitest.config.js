@@ -0,0 +1,12 @@
+import { defineConfig, mergeConfig } from 'vite'
+import viteConfig from './vite.config'
+
+// benchmarks of the study list: 'npm run bench' (runs offline, see bench/)
+export default mergeConfig(viteConfig, defineConfig({
+  test: {
+    environment: 'jsdom',
+    benchmark: {
+      include: ['bench/**/*.bench.js']
+    }
+  }
+}))